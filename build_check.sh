@@ -16,7 +16,7 @@ fi
 # Check source files
 echo
 echo "2. Source Files:"
-src_files=("main.cpp" "webhandler.cpp" "lorahandler.cpp" "mp3handler.cpp" "schedule.cpp")
+src_files=("main.cpp" "tasks.cpp" "eventbus.cpp" "logger.cpp" "profiler.cpp" "webhandler.cpp" "lorahandler.cpp" "mp3handler.cpp" "trackcatalog.cpp" "gongprogram.cpp" "gongsynth.cpp" "schedule.cpp" "schedulesync.cpp" "nodestatus.cpp" "linkadapt.cpp" "lowpower.cpp" "powermanager.cpp" "boot.cpp" "configstore.cpp" "frameauth.cpp" "loraota.cpp" "loracapture.cpp")
 for file in "${src_files[@]}"; do
     if [ -f "src/$file" ]; then
         echo "   ✓ $file"
@@ -28,7 +28,7 @@ done
 # Check header files
 echo
 echo "3. Header Files:"
-header_files=("webhandler.h" "lorahandler.h" "mp3handler.h" "schedule.h")
+header_files=("tasks.h" "eventbus.h" "logger.h" "profiler.h" "webhandler.h" "lorahandler.h" "mp3handler.h" "trackcatalog.h" "gongprogram.h" "gongsynth.h" "schedule.h" "schedulesync.h" "nodestatus.h" "linkadapt.h" "lowpower.h" "powermanager.h" "boot.h" "configstore.h" "frameauth.h" "loraota.h" "loracapture.h")
 for file in "${header_files[@]}"; do
     if [ -f "include/$file" ]; then
         echo "   ✓ $file"
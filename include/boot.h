@@ -0,0 +1,88 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Boot orchestrator: setup() runs the modules' setups as a fixed list of
+// stages. SPIFFS is mounted first and the configuration store opened next;
+// the modules then load their sections from it (configstore.h). Once every
+// stage is done, the parsed sources are freed and the configuration image
+// written.
+//
+//   storage    SPIFFS, formatted if it cannot be mounted
+//   config     configuration image, or gong.conf
+//   core       log, profiler, event bus, task queues
+//   radio      LoRa, schedule sync, heartbeats, link adaptation, low power, OTA
+//   scheduler  schedule, NTP client, power manager
+//   audio      MP3 driver, track catalog, synthesizer, gong programs
+//   web        WiFi, web server
+//
+// The first five run in turn on the setup task: the radio stage decides
+// whether the node runs tasks at all, and the scheduler stage subscribes
+// to events before anything publishes them. Audio and web then run at the
+// same time, each on the task that owns its modules, while setup() waits
+// up to BOOT_STAGE_TIMEOUT_MS for both. A stage that has not finished by
+// then is flagged; the other tasks start their loops without it. Battery
+// slaves run every stage in turn.
+//
+// A missing peripheral does not stop the boot. The node runs without it,
+// and the fault is logged, shown in GET /boot and answered by GET /health
+// with 503. After boot, the scheduler task watches for the milestones that
+// make a scheduled gong possible: network, time, audio and the first
+// planned gong. Faults that depend on them count from BOOT_READY_TIMEOUT_MS.
+#define BOOT_STAGE_TIMEOUT_MS 8000      // Under TASK_WATCHDOG_TIMEOUT
+#define BOOT_READY_TIMEOUT_MS 60000     // As WIFI_TIMEOUT: network, time and audio expected by then
+
+// Stages, in order
+#define BOOT_STAGE_STORAGE 0
+#define BOOT_STAGE_CONFIG 1
+#define BOOT_STAGE_CORE 2
+#define BOOT_STAGE_RADIO 3
+#define BOOT_STAGE_SCHEDULER 4
+#define BOOT_STAGE_AUDIO 5
+#define BOOT_STAGE_WEB 6
+#define BOOT_STAGES 7
+#define BOOT_ON_SETUP 0xFF              // Stage task: the setup task, not one of SYSTEM_TASKS
+
+// Stage results
+#define BOOT_RESULT_PENDING 0
+#define BOOT_RESULT_OK 1
+#define BOOT_RESULT_FAILED 2            // Finished without its peripheral or file
+#define BOOT_RESULT_TIMEOUT 3           // Still running when setup() went on
+#define BOOT_RESULT_SKIPPED 4           // Not used on this node
+#define BOOT_RESULTS 5
+
+// Milestones after setup, on the way to the first scheduled gong
+#define BOOT_MILESTONE_NETWORK 0        // WiFi connected, or the access point up
+#define BOOT_MILESTONE_TIME 1           // NTP time
+#define BOOT_MILESTONE_AUDIO 2          // MP3 module online, or the synthesizer on
+#define BOOT_MILESTONE_READY 3          // All of them, and the next scheduled gong planned
+#define BOOT_MILESTONES 4
+
+// Faults, as a mask
+#define BOOT_FAULT_STORAGE 0x01         // SPIFFS not mounted: defaults only, nothing saved
+#define BOOT_FAULT_CONFIG 0x02          // gong.conf missing or unreadable, or a section invalid: defaults
+#define BOOT_FAULT_STAGE 0x04           // A stage overran BOOT_STAGE_TIMEOUT_MS
+#define BOOT_FAULT_LORA 0x08            // No LoRa radio: no gongs to or from other nodes
+#define BOOT_FAULT_WIFI 0x10            // Configured network not joined: access point only
+#define BOOT_FAULT_TIME 0x20            // No NTP time: scheduled gongs wait
+#define BOOT_FAULT_AUDIO 0x40           // No MP3 module and no synthesizer: nothing sounds
+#define BOOT_FAULTS 7
+
+struct BootStageRecord {
+    uint8_t result;
+    uint32_t startUs;           // From the start of setup()
+    uint32_t durationUs;
+};
+
+// Function declarations
+void bootSystem();
+void runBootStage(uint8_t stage);
+uint8_t getBootStageTask(uint8_t stage);
+void loopBoot();
+uint8_t getBootFaults();
+bool isBootDegraded();
+const BootStageRecord& getBootStage(uint8_t stage);
+uint32_t getBootMilestoneMs(uint8_t milestone);
+String getBootJSON();
+String getHealthJSON();
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Configuration store: gong.conf parsed once and kept as a compact binary
+// image on SPIFFS, so later boots read no JSON at all.
+//
+// Every module owns a section: a plain struct of its settings, and a parser
+// that fills it from the section's JSON and checks it against the section's
+// schema. The parser sets every field, from the JSON or from the module's
+// default; given no JSON, it returns the defaults. The module loads its
+// section at setup with loadConfigSection(). The image holds each section
+// as its parser left it. A section missing from the image has the sources
+// parsed, once, into one document, and is added to the image, which is
+// written when boot is done. The image names the firmware that wrote it and
+// a hash of the sources, so a new firmware or a new gong.conf has them
+// parsed again.
+//
+// A section that fails its schema leaves the module on its defaults and is
+// reported by GET /config and the boot health check. It is kept out of the
+// image, so it is parsed, and reported, at every boot until it is fixed.
+//
+// Changes go through setConfig() (POST /config): each section is checked by
+// its parser as at boot, written to gong.conf and the image, and announced
+// as an EVENT_CONFIG_CHANGED event. The module takes the event on its own
+// task and loads its section again, so no restart is needed.
+//
+// wifi.conf, written by the web interface of earlier firmware, replaces the
+// "wifi" section of gong.conf while it exists; the first change to that
+// section moves it into gong.conf and removes wifi.conf.
+#define CONFIG_FILE "/gong.conf"
+#define CONFIG_WIFI_FILE "/wifi.conf"
+#define CONFIG_IMAGE_FILE "/config.img"
+#define CONFIG_IMAGE_MAGIC 0x47464347UL     // "GCFG"
+#define CONFIG_IMAGE_VERSION 1
+#define CONFIG_IMAGE_SIZE 6144              // Every section's settings, with a 4-byte header each
+#define CONFIG_DOC_SIZE 8192                // gong.conf parsed
+#define CONFIG_WIFI_DOC_SIZE 512
+
+// Sections, as event params
+#define CONFIG_SECTION_WIFI 0
+#define CONFIG_SECTION_LORA 1
+#define CONFIG_SECTION_LOG 2
+#define CONFIG_SECTION_POWER 3
+#define CONFIG_SECTION_MP3 4
+#define CONFIG_SECTION_SYNTH 5
+#define CONFIG_SECTION_PROGRAMS 6
+#define CONFIG_SECTION_VOLUME_PROFILE 7
+#define CONFIG_SECTION_DEFAULT_SCHEDULES 8
+#define CONFIG_SECTIONS 9
+
+// Sources as read
+#define CONFIG_SOURCE_OK 0
+#define CONFIG_SOURCE_MISSING 1             // No gong.conf: every module on its defaults
+#define CONFIG_SOURCE_INVALID 2             // Not readable as JSON
+#define CONFIG_SOURCE_STATES 3
+
+// Fills settings from a section's JSON, or with the defaults when it is
+// null. Returns nullptr, or what fails the schema.
+typedef const char* (*ConfigParser)(JsonVariantConst json, void* settings);
+
+// Store counters
+struct ConfigStats {
+    uint8_t sourceStatus;       // CONFIG_SOURCE_*, of gong.conf
+    bool parsed;                // Sources parsed this boot: no image, or a section missing from it
+    uint32_t imageLoadUs;       // Reading and checking the image at boot
+    uint32_t parseUs;           // Parsing the sources, 0 when the image had everything
+    uint16_t imageBytes;        // Sections in the image
+    uint8_t unknownSections;    // In gong.conf, not one of the sections below
+    uint8_t invalidSections;    // Loaded, and failing their schema
+    uint32_t version;           // Changes applied since the image was first written
+    uint32_t changes;           // This boot
+    uint32_t refused;           // Changes that failed a schema
+    uint32_t rejected;          // Images refused: wrong magic, version, firmware, sources or checksum
+};
+
+// Function declarations
+bool setupConfig();
+void finishConfig();
+bool loadConfigSection(uint8_t section, void* settings, size_t size, ConfigParser parser);
+bool setConfig(JsonObjectConst changes, String& error);
+const char* getConfigSectionName(uint8_t section);
+const char* getConfigSectionError(uint8_t section);
+const ConfigStats& getConfigStats();
+String getConfigJSON();
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+// Event bus: modules publish typed events instead of calling each other
+// through hook pointers. Every subscriber has its own preallocated ring
+// and takes its events on its own task with dispatchEvents(), so a
+// publisher never runs another module's code.
+//
+// Publishing copies a 12-byte event into each subscribed ring. No heap,
+// no lock, and no waiting: a slot is claimed with one compare-and-swap
+// and released once written (a bounded MPSC queue with a sequence number
+// per slot), so interrupt handlers publish with publishEventFromISR(). A
+// handler that interrupts a publisher halfway finishes its own event
+// regardless. A ring with only one publisher, flagged EVENT_RING_SPSC,
+// skips the compare-and-swap. A full ring drops the event and counts it.
+//
+// Subscribers are set up before the tasks start; the subscriber table is
+// not changed afterwards.
+#define EVENT_RING_SIZE 16              // Events per subscriber; a power of 2
+#define MAX_EVENT_SUBSCRIBERS 8
+#define EVENT_SUBSCRIBER_NAME_LENGTH 12
+
+// Event types
+#define EVENT_GONG_REQUESTED 1          // source, param: gong program index + 1, 0 = a single gong
+#define EVENT_GONG_FIRED 2              // source, param: as requested, value: us from request to strike
+#define EVENT_SCHEDULE_CHANGED 3        // param: entries, value: schedule version hash
+#define EVENT_TIME_SYNCED 4             // value: epoch seconds
+#define EVENT_LORA_FRAME_RECEIVED 5     // param: bytes, from the radio task once the frame's length is read
+#define EVENT_WIFI_STATE 6              // param: EVENT_WIFI_*
+#define EVENT_CONFIG_CHANGED 7          // param: CONFIG_SECTION_*, value: configuration version
+#define EVENT_TYPES 8
+#define EVENT_MASK(type) (1UL << (type))
+
+// Event sources
+#define EVENT_SOURCE_NONE 0
+#define EVENT_SOURCE_SCHEDULE 1
+#define EVENT_SOURCE_LORA 2
+#define EVENT_SOURCE_WEB 3
+
+// EVENT_WIFI_STATE values
+#define EVENT_WIFI_CONNECTING 0
+#define EVENT_WIFI_CONNECTED 1
+#define EVENT_WIFI_AP 2
+
+// Ring flags
+#define EVENT_RING_SPSC 0x01            // One publisher only: a single task or a single interrupt handler
+
+struct Event {
+    uint8_t type;
+    uint8_t source;
+    uint16_t param;
+    uint32_t value;
+    uint32_t timeUs;            // micros() when published
+};
+
+typedef void (*EventHandler)(const Event& event);
+
+// Wakes the subscriber's task; fromIsr when published by an interrupt handler
+typedef void (*EventWake)(bool fromIsr);
+
+// Per-subscriber counters; latency runs from publishing to the handler
+// having returned
+struct EventSubscriberStats {
+    uint32_t delivered;
+    std::atomic<uint32_t> dropped;      // Ring full
+    uint32_t maxDepth;
+    uint64_t latencyUs;
+    uint32_t maxLatencyUs;
+};
+
+// Bus counters
+struct EventBusStats {
+    std::atomic<uint32_t> published[EVENT_TYPES];
+    std::atomic<uint32_t> fromIsr;
+    std::atomic<uint32_t> dropped;      // Events that missed at least one subscriber
+};
+
+// Function declarations
+void setupEventBus();
+int8_t subscribeEvents(const char* name, uint32_t mask, EventHandler handler, uint8_t flags = 0,
+                       EventWake wake = nullptr);
+bool publishEvent(uint8_t type, uint8_t source = EVENT_SOURCE_NONE, uint16_t param = 0, uint32_t value = 0);
+bool publishEventFromISR(uint8_t type, uint8_t source = EVENT_SOURCE_NONE, uint16_t param = 0,
+                         uint32_t value = 0);
+uint8_t dispatchEvents(int8_t subscriber);
+const char* getEventName(uint8_t type);
+const EventSubscriberStats& getEventSubscriberStats(int8_t subscriber);
+const EventBusStats& getEventBusStats();
+String getEventBusJSON();
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// LoRa frame authentication with a network key shared by all nodes
+// ("key" in the "lora" section of gong.conf, 32 hex digits). Without a key,
+// frames go out and are accepted unsigned, as before.
+//
+// Every signed frame carries a binary trailer after the text frame:
+//
+//   <type hex>:<payload><sender:2><counter:4><mac:4>
+//
+// The MAC is AES-128-CMAC over everything before it, truncated to 4 bytes,
+// computed on the ESP32 AES hardware. Each sender's counter is monotonic
+// across reboots: blocks of FRAME_AUTH_COUNTER_RESERVE values are reserved
+// in SPIFFS before use. Receivers keep the highest counter per sender and a
+// bitmap of the FRAME_AUTH_REPLAY_WINDOW counters below it: each counter is
+// accepted once, and nothing older than the window is accepted at all.
+//
+// The highest counters are kept in SPIFFS too, so a receiver that reboots
+// or loses power accepts nothing at or below them. A gong frame is only
+// acted on once its counter is stored; other frames' counters are stored
+// at most every FRAME_AUTH_SENDERS_SAVE_MS, which keeps flash writes, and
+// the cache stalls they cause, off the path of every heartbeat. The table
+// is never evicted from: a sender beyond FRAME_AUTH_MAX_SENDERS is refused,
+// as its frames could not be checked for replays once forgotten.
+#define FRAME_AUTH_KEY_BYTES 16
+#define FRAME_AUTH_MAC_BYTES 4
+#define FRAME_AUTH_TRAILER_BYTES (2 + 4 + FRAME_AUTH_MAC_BYTES)
+#define FRAME_AUTH_REPLAY_WINDOW 32      // Counters below the highest still accepted once
+#define FRAME_AUTH_MAX_SENDERS 128       // Replay state per sender, twice MAX_NODES for replaced nodes
+#define FRAME_AUTH_COUNTER_RESERVE 1024  // Counters reserved per SPIFFS write
+#define FRAME_AUTH_COUNTER_FILE "/lora_counter"
+#define FRAME_AUTH_SENDERS_FILE "/lora_senders"
+#define FRAME_AUTH_SENDERS_MAGIC 0x534E4452UL  // "SNDR"
+#define FRAME_AUTH_SENDERS_SAVE_MS 60000 // Highest counters of frames other than gongs stored within this
+
+// Authentication counters
+struct FrameAuthStats {
+    uint32_t signedFrames;
+    uint32_t verified;
+    uint32_t rejectedMac;       // Forged, damaged, or sent with another key
+    uint32_t rejectedReplay;    // Counter seen before or below the window
+    uint32_t rejectedUnsigned;  // Shorter than a trailer
+    uint32_t rejectedFull;      // From a new sender with the sender table full
+    uint32_t senderSaves;       // Writes of the highest counters to SPIFFS
+    uint64_t signUs;
+    uint64_t verifyUs;
+    uint32_t maxSignUs;
+    uint32_t maxVerifyUs;
+};
+
+// Function declarations
+void setupFrameAuth(const char* hexKey);
+bool isFrameAuthKeyValid(const char* hexKey);
+bool setFrameAuthKey(const String& hexKey);
+bool isFrameAuthEnabled();
+size_t getFrameAuthOverhead();
+size_t signLoRaFrame(uint8_t* frame, size_t length);
+int verifyLoRaFrame(const uint8_t* frame, size_t length);
+void persistFrameAuthCounter();
+void persistFrameAuthSenders(bool now);
+void computeFrameAuthCmac(const uint8_t* data, size_t length, uint8_t mac[16]);
+const FrameAuthStats& getFrameAuthStats();
+void addFrameAuthJSON(JsonObject obj);
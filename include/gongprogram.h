@@ -0,0 +1,71 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Gong programs: named strike patterns in the "programs" section of
+// gong.conf, run by schedule entries ("program": "<name>") or by
+// POST /play?program=<name>:
+//
+//   "programs": {
+//     "ceremony": [
+//       {"track": 1, "volume": 26, "repeat": 3, "interval": 6000},
+//       {"pause": 4000},
+//       {"track": 2, "volume": 20, "repeat": 12, "interval": 700}
+//     ]
+//   }
+//
+// "interval" is the time from one strike to the next, start to start; 0
+// strikes again as soon as the previous strike has ended. An interval
+// shorter than the track cuts the previous strike off, which is how a roll
+// sounds on a single-voice module. A pause adds to the last interval of the
+// step before it. A step without "volume" keeps the current one; the
+// volume from before the program is restored after it. A program with a
+// track the track catalog does not have on the card is refused. A change
+// applies without a restart; a program running then is stopped.
+#define MAX_GONG_PROGRAMS 8
+#define MAX_GONG_PROGRAM_STEPS 8
+#define GONG_PROGRAM_NAME_LENGTH 24
+#define GONG_PROGRAM_MAX_REPEAT 100
+#define GONG_PROGRAM_MAX_LATE 500   // ms behind plan before the timing restarts from now
+#define GONG_VOLUME_KEEP 0xFF
+
+struct GongProgramStep {
+    uint16_t track;         // 0 = pause
+    uint8_t volume;         // GONG_VOLUME_KEEP = unchanged
+    uint8_t repeat;
+    uint32_t interval;      // ms, strike start to strike start; 0 = once the previous strike ends
+};
+
+struct GongProgram {
+    char name[GONG_PROGRAM_NAME_LENGTH];
+    uint8_t stepCount;
+    GongProgramStep steps[MAX_GONG_PROGRAM_STEPS];
+};
+
+// Sequencer counters
+struct GongProgramStats {
+    uint32_t runs;
+    uint32_t completed;
+    uint32_t aborted;           // Stopped, or replaced by another program
+    uint32_t strikes;
+    uint32_t maxLateMs;         // Strike issued after its planned time
+};
+
+// Function declarations
+void setupGongPrograms();
+void loopGongProgram();
+void loadGongPrograms();
+bool setGongProgram(const char* name, const GongProgramStep* steps, uint8_t stepCount);
+const GongProgram* findGongProgram(const String& name);
+int8_t findGongProgramIndex(const String& name);
+const GongProgram* getGongProgram(uint8_t index);
+bool hasGongProgramTracks(const String& name);
+uint16_t getGongProgramFirstTrack(const String& name);
+void prepareGongProgram(const String& name);
+bool startGongProgram(const String& name);
+void stopGongProgram();
+void fadeOutGongProgram(uint32_t durationMs);
+bool isGongProgramRunning();
+const GongProgramStats& getGongProgramStats();
+String getGongProgramsJSON();
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Built-in gong synthesizer: an alternative to the MP3 module that renders
+// the gong from a handful of decaying partials into I2S DMA buffers, so a
+// strike starts within one DMA buffer instead of the module's start latency.
+// It needs an I2S DAC/amplifier (e.g. MAX98357A) on the pins below, and is
+// enabled and voiced in the "synth" section of gong.conf:
+//
+//   "synth": {
+//     "enabled": true, "fundamental": 110, "volume": 0.8,
+//     "noise": 0.15, "noise_decay": 60,
+//     "modes": [{"ratio": 1.0, "level": 1.0, "decay": 8.0}, ...]
+//   }
+//
+// "ratio" is the partial's frequency over the fundamental, "level" its
+// share of the strike and "decay" its time to -60 dB in seconds. "noise" is
+// the level of the strike transient and "noise_decay" its time to -60 dB
+// in ms. Levels are normalized, so "volume" (0-1) is the peak of one strike.
+// A change applies at the next strike, without a restart.
+#define GONG_SYNTH_BCK_PIN 26
+#define GONG_SYNTH_WS_PIN 25
+#define GONG_SYNTH_DATA_PIN 22
+
+// Rendering, all in fixed point: a Q15 sine table read by a 32-bit phase
+// accumulator per partial, and Q30 envelopes that decay by a per-block
+// factor with linear steps in between
+#define GONG_SYNTH_RATE 22050
+#define GONG_SYNTH_BLOCK 32             // Samples per envelope step
+#define GONG_SYNTH_TABLE_BITS 10
+#define GONG_SYNTH_MAX_MODES 8
+#define GONG_SYNTH_VOICES 4             // Overlapping strikes; the quietest is taken for a fifth
+#define GONG_SYNTH_FULL_VELOCITY 255
+
+// I2S DMA ring: a strike after silence is heard at the next buffer
+// boundary; while a gong rings the ring is kept full, GONG_SYNTH_DMA_BUFFERS
+// buffers ahead
+#define GONG_SYNTH_DMA_BUFFERS 8
+#define GONG_SYNTH_DMA_FRAMES 128       // 5.8 ms
+#define GONG_SYNTH_PRE_ROLL 3           // ms a scheduled strike goes out early: half a DMA buffer
+
+struct GongSynthMode {
+    float ratio;            // Frequency over the fundamental
+    float level;
+    float decay;            // Seconds to -60 dB
+};
+
+struct GongSynthPatch {
+    float fundamental;      // Hz
+    float volume;           // 0-1
+    float noise;            // Strike transient level
+    float noiseDecay;       // ms to -60 dB
+    uint8_t modeCount;
+    GongSynthMode modes[GONG_SYNTH_MAX_MODES];
+};
+
+// Synthesizer counters
+struct GongSynthStats {
+    uint32_t strikes;
+    uint32_t stolen;            // Strikes that took a voice still ringing
+    uint64_t samples;           // Rendered for I2S
+    uint64_t renderUs;
+    uint32_t maxRenderUs;       // One DMA buffer
+};
+
+// Function declarations
+void setupGongSynth();
+void loadGongSynthConfig();
+bool startGongSynthOutput();
+void loopGongSynth();
+bool isGongSynthEnabled();
+bool isGongSynthPatchValid(const GongSynthPatch& patch);
+bool setGongSynthPatch(const GongSynthPatch& patch);
+const GongSynthPatch& getGongSynthPatch();
+void strikeGongSynth(uint8_t velocity);
+void playGongSynth();
+void stopGongSynth();
+bool isGongSynthPlaying();
+uint8_t getGongSynthVoices();
+void renderGongSynth(int16_t* out, size_t frames);
+const GongSynthStats& getGongSynthStats();
+String getGongSynthJSON();
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Adaptive data rate over the heartbeat link statistics.
+//
+// The master picks the lowest-airtime spreading factor that keeps every live
+// link ADR_TARGET_MARGIN dB above the demodulation floor, and tells each
+// slave how many dB of TX power it can trim (or must add):
+//
+//   A<seq>,<sf>;<node>:<power delta>,...     (MSG_TYPE_STATUS, master only)
+//
+// Slaves confirm a change through the SF/power fields of their next
+// heartbeat. If a slave does not confirm, or a node drops out, the master
+// falls back to the robust profile. Slaves that stop hearing the master fall
+// back on their own. A periodic rendezvous beacon on the robust and boot
+// profiles tells lost nodes the current network SF.
+#define ADR_TARGET_MARGIN 10          // dB above the demodulation floor
+#define ADR_POWER_HYSTERESIS 3        // dB of excess before power is lowered
+#define ADR_MIN_TX_POWER 2
+#define ADR_MIN_SF 7
+#define ADR_MAX_SF 12
+#define ADR_ROBUST_SF 10              // Rendezvous profile, always at LORA_TX_POWER
+#define ADR_MIN_HEARTBEATS 3          // Samples needed before a link is trusted
+#define ADR_EVAL_INTERVAL 60000
+#define ADR_STEP_DOWN_HOLD 600000     // Stable time before trying a faster SF
+#define ADR_SWITCH_DELAY 3000         // Command-to-switch delay, lets the frame finish
+#define ADR_CONFIRM_JITTER 30000      // Slaves confirm a new SF within this window
+#define ADR_CONFIRM_TIMEOUT 120000
+#define ADR_FALLBACK_TIMEOUT 300000   // Slave: master silent this long -> robust profile
+#define ADR_BEACON_INTERVAL 300000
+#define ADR_MAX_ADJUSTMENTS 16        // Power trims per command frame
+#define ADR_SUPPLY_VOLTAGE 3.3f
+
+// Function declarations
+void setupLinkAdapt();
+void loopLinkAdapt();
+void handleLinkAdaptMessage(const char* body);
+void recordLinkTransmission(size_t frameLength, int spreadingFactor, int txPower);
+float getLinkEnergySavedMj();
+float getLinkAirtimeSavedMs();
+void addLinkAdaptJSON(JsonObject obj);
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include <type_traits>
+
+// Deferred binary logger. A call site stores its format string, module,
+// level and raw arguments in a lock-free RAM ring and returns; the text is
+// formatted later, by the web task printing the ring to Serial while the
+// UART has room, or by GET /log. Recording takes a few microseconds. A
+// Serial.printf at 115200 baud blocks for 87 us per character once the
+// UART buffer is full.
+//
+// The format string is kept as a pointer, so it must be a literal; it is
+// checked against the arguments like printf at compile time. Arguments
+// may be integers, floats and C strings; strings are copied into the
+// record, cut to the room its payload has left. A writer claims its record
+// with one atomic add and publishes it with the record's sequence number,
+// so tasks never wait for each other. A writer that finds its slot still
+// held by one a whole lap behind drops its record, counts it and marks the
+// slot skipped, so a record is never torn; the printer passes over the
+// skipped record and the next lap's writer takes the slot as usual.
+//
+// The ring sits in RAM that a reset does not clear. After a panic, a
+// watchdog reset or a restart, setupLog() keeps the last records of the
+// previous run, as long as the firmware has not changed.
+#define LOG_RING_RECORDS 128            // A power of 2
+#define LOG_PAYLOAD_WORDS 12            // Per record: arguments, then string bytes
+#define LOG_MAX_ARGS 8
+#define LOG_KEPT_RECORDS 32             // Kept from before the last reset
+#define LOG_DRAIN_RECORDS 8             // Printed per loopLog() call at most
+#define LOG_LINE_LENGTH 192
+#define LOG_SERIAL_TX_BUFFER 2048       // Serial TX buffer the log is printed into without waiting
+#define LOG_REGION_MAGIC 0x4C4F4731     // "LOG1"
+#define LOG_RECORD_BUSY (LOG_RING_RECORDS / 2)  // Added to the sequence of a record being written
+
+// Levels; a module records its level and the ones above it
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4               // Every command, frame and message
+#define LOG_LEVELS 5
+#define LOG_DEFAULT_LEVEL LOG_LEVEL_INFO
+
+// Modules, as named in the "log" section of gong.conf: {"<module>": "<level>", ...}
+#define LOG_MODULE_MAIN 0
+#define LOG_MODULE_TASKS 1
+#define LOG_MODULE_EVENTS 2
+#define LOG_MODULE_WEB 3
+#define LOG_MODULE_LORA 4
+#define LOG_MODULE_AUTH 5
+#define LOG_MODULE_OTA 6
+#define LOG_MODULE_CAPTURE 7
+#define LOG_MODULE_ADR 8
+#define LOG_MODULE_SYNC 9
+#define LOG_MODULE_NODES 10
+#define LOG_MODULE_POWER 11
+#define LOG_MODULE_MP3 12
+#define LOG_MODULE_CATALOG 13
+#define LOG_MODULE_PROGRAM 14
+#define LOG_MODULE_SYNTH 15
+#define LOG_MODULE_SCHEDULE 16
+#define LOG_MODULE_PROFILE 17
+#define LOG_MODULES 18
+
+// One record as written; string arguments hold the offset of their
+// text, which follows the argument words in the payload
+struct LogEntry {
+    uint32_t timeMs;
+    const char* format;
+    uint8_t module;
+    uint8_t level;
+    uint8_t argCount;
+    uint8_t textBytes;
+    uint32_t payload[LOG_PAYLOAD_WORDS];
+};
+
+struct LogRecord {
+    std::atomic<uint32_t> sequence;     // Position + 1 once written, + LOG_RECORD_BUSY while being written
+    std::atomic<uint32_t> skipped;      // Position + 1 of a writer that found the slot busy and dropped its record
+    LogEntry entry;
+};
+
+// Arguments gathered at the call site
+struct LogArgs {
+    uint32_t words[LOG_MAX_ARGS];
+    char text[LOG_PAYLOAD_WORDS * 4];
+    uint8_t argCount;
+    uint8_t textBytes;
+    bool truncated;
+};
+
+// Logger counters
+struct LogStats {
+    uint32_t written;
+    uint32_t printed;
+    uint32_t lost;              // Overwritten before they were printed
+    std::atomic<uint32_t> truncated;    // Records whose strings were cut to fit
+    std::atomic<uint32_t> dropped;      // Slot still being written, or taken, by another lap
+    uint32_t waits;             // loopLog() calls that left a line for the UART to drain first
+    uint32_t kept;              // Records kept from before the last reset
+    uint8_t resetReason;        // esp_reset_reason() at boot
+};
+
+// Function declarations
+void setupLog();
+void loadLogLevels();
+void loopLog();
+void flushLog();
+bool isLogEnabled(uint8_t module, uint8_t level);
+void writeLog(uint8_t module, uint8_t level, const char* format, const LogArgs& args);
+bool setLogLevel(const String& module, const String& level);
+const char* getLogModuleName(uint8_t module);
+const char* getLogLevelName(uint8_t level);
+void exportLog(Print& out, bool kept);
+const LogStats& getLogStats();
+String getLogConfigJSON();
+
+// Argument capture, by type
+inline void addLogArg(LogArgs& args, const char* text) {
+    size_t room = sizeof(args.text) - args.textBytes;
+    size_t length = text ? strlen(text) : 0;
+    if (room == 0) {
+        args.words[args.argCount++] = sizeof(args.text);
+        args.truncated = true;
+        return;
+    }
+    if (length > room - 1) {
+        length = room - 1;
+        args.truncated = true;
+    }
+    args.words[args.argCount++] = args.textBytes;
+    memcpy(args.text + args.textBytes, text, length);
+    args.text[args.textBytes + length] = 0;
+    args.textBytes += length + 1;
+}
+
+inline void addLogArg(LogArgs& args, double value) {
+    float single = value;
+    memcpy(&args.words[args.argCount++], &single, sizeof(single));
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+addLogArg(LogArgs& args, T value) {
+    args.words[args.argCount++] = (uint32_t)value;
+}
+
+inline void addLogArgs(LogArgs& args) {
+}
+
+template <typename T, typename... Rest>
+inline void addLogArgs(LogArgs& args, T first, Rest... rest) {
+    addLogArg(args, first);
+    addLogArgs(args, rest...);
+}
+
+template <typename... Values>
+inline void logAt(uint8_t module, uint8_t level, const char* format, Values... values) {
+    static_assert(sizeof...(Values) <= LOG_MAX_ARGS, "too many log arguments");
+    if (!isLogEnabled(module, level)) {
+        return;
+    }
+    LogArgs args;
+    args.argCount = 0;
+    args.textBytes = 0;
+    args.truncated = false;
+    addLogArgs(args, values...);
+    writeLog(module, level, format, args);
+}
+
+// Never called; lets the compiler check the format against the arguments
+inline void checkLogFormat(const char* format, ...) __attribute__((format(printf, 1, 2)));
+inline void checkLogFormat(const char* format, ...) {
+}
+
+#define LOG_AT(module, level, ...) \
+    do { \
+        if (false) { \
+            checkLogFormat(__VA_ARGS__); \
+        } \
+        logAt(module, level, __VA_ARGS__); \
+    } while (0)
+
+#define LOG_ERROR(module, ...) LOG_AT(module, LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(module, ...) LOG_AT(module, LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(module, ...) LOG_AT(module, LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(module, ...) LOG_AT(module, LOG_LEVEL_DEBUG, __VA_ARGS__)
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// LoRa packet capture: every frame the radio sends or receives, with its
+// radio metadata, goes into a RAM ring that overwrites the oldest frames
+// first. Turned on with "capture": true in the "lora" section of gong.conf
+// or at runtime over HTTP, and cheap enough to stay on in the field: a
+// capture is a bounded memcpy into the ring.
+//
+// GET /lora-capture exports the ring as a pcapng file that Wireshark opens
+// directly: one interface of link type LINKTYPE_LORATAP, and per frame a
+// LoRaTap v0 header (frequency, bandwidth, SF, RSSI, SNR, sync word) ahead of
+// the frame bytes as they went over the air, auth trailer included. The
+// direction is in the epb_flags option, the frequency error and receive
+// verdict in the packet comment.
+#define LORA_CAPTURE_BUFFER 16384       // Bytes of ring, about 180 heartbeat-sized frames
+#define LORA_CAPTURE_SNAPLEN 255        // As LORA_MAX_PACKET
+
+// Record flags
+#define LORA_CAPTURE_FLAG_TX 0x01
+#define LORA_CAPTURE_FLAG_FILTERED 0x02     // Other zones: only the header was read
+#define LORA_CAPTURE_FLAG_AUTH_OK 0x04
+#define LORA_CAPTURE_FLAG_AUTH_FAILED 0x08  // Forged, replayed, damaged or unsigned
+
+// pcapng constants
+#define PCAPNG_LINKTYPE_LORATAP 270
+#define LORATAP_HEADER_BYTES 15
+#define LORATAP_RSSI_OFFSET 139         // LoRaTap RSSI byte = dBm + 139
+
+// Ring entry header; the captured bytes follow it in the ring
+struct LoRaCaptureRecord {
+    uint32_t timeMs;            // millis() at capture
+    int32_t frequencyError;     // Hz, RX only
+    int16_t rssi;               // dBm; TX power for TX records
+    int8_t snr;                 // Quarter dB, RX only
+    uint8_t spreadingFactor;
+    uint8_t flags;
+    uint8_t length;             // Bytes captured
+    uint8_t frameLength;        // Bytes on air; more than length for filtered frames
+};
+
+// The ring's records as they were at one instant, oldest first and back to
+// back, so an export sees neither half-written records nor a moving end
+struct LoRaCaptureSnapshot {
+    uint8_t* data;
+    size_t length;
+};
+
+// Capture counters
+struct LoRaCaptureStats {
+    uint32_t captured;
+    uint32_t overwritten;       // Oldest records dropped to make room
+    uint16_t records;           // In the ring now
+    uint16_t bytesUsed;
+    uint64_t captureUs;
+    uint32_t maxCaptureUs;
+};
+
+// Function declarations
+void setLoRaCaptureEnabled(bool enabled);
+bool isLoRaCaptureEnabled();
+void captureLoRaFrame(const uint8_t* data, size_t length, size_t frameLength, uint8_t flags,
+                      int spreadingFactor, int rssi, float snr, long frequencyError);
+void clearLoRaCapture();
+bool takeLoRaCaptureSnapshot(LoRaCaptureSnapshot& snapshot);
+void releaseLoRaCaptureSnapshot(LoRaCaptureSnapshot& snapshot);
+size_t getLoRaCaptureSize(const LoRaCaptureSnapshot& snapshot);
+void exportLoRaCapture(const LoRaCaptureSnapshot& snapshot, Print& out, uint32_t epochNow);
+const LoRaCaptureStats& getLoRaCaptureStats();
+void addLoRaCaptureJSON(JsonObject obj);
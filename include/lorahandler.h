@@ -8,26 +8,137 @@
 #define LORA_RST_PIN 14  // ESP32 GPIO14 -> LoRa RST
 #define LORA_DIO0_PIN 2  // ESP32 GPIO2 -> LoRa DIO0
 
+// DIO0 only wakes the radio task. The task reads and clears the SX1278
+// interrupt flags and reads the FIFO itself, so all SPI traffic to the
+// radio stays on one task.
+#define LORA_SPI_FREQUENCY 8000000      // As the LoRa library
+#define LORA_REG_FIFO 0x00
+#define LORA_REG_FIFO_ADDR_PTR 0x0D
+#define LORA_REG_FIFO_RX_CURRENT_ADDR 0x10
+#define LORA_REG_IRQ_FLAGS 0x12
+#define LORA_REG_RX_NB_BYTES 0x13
+#define LORA_REG_DIO_MAPPING_1 0x40
+#define LORA_IRQ_CAD_DETECTED 0x01
+#define LORA_IRQ_CAD_DONE 0x04
+#define LORA_IRQ_TX_DONE 0x08
+#define LORA_IRQ_PAYLOAD_CRC_ERROR 0x20
+#define LORA_IRQ_RX_DONE 0x40
+#define LORA_DIO0_TX_DONE 0x40          // RegDioMapping1; receive() and channelActivityDetection() map the others
+
 // LoRa configuration
 #define LORA_FREQUENCY 433E6  // 433 MHz
 #define LORA_SYNC_WORD 0x12
 #define LORA_SPREADING_FACTOR 7
 #define LORA_BANDWIDTH 125E3
 #define LORA_CODING_RATE 5
+#define LORA_PREAMBLE_LENGTH 8
+#define LORA_TX_POWER 20      // dBm on PA_BOOST (2-20)
+
+// "lora" section of gong.conf: {"role": "master" | "slave", "low_power", "wake_period", "zones",
+// "capture", "key"}. A change to role, low_power or wake_period takes effect at the next restart.
+
+// Low-power listening: battery slaves sample the channel every wake period,
+// so the master stretches its preambles to cover one period
+#define LORA_WAKE_PREAMBLE_MARGIN 8     // Symbols beyond the wake period, covers the CAD itself
+
+// Zone addressing: a node subscribes to zones 1-32 ("zones": [1, 3] in the
+// "lora" section; none = every zone). Frames for some zones carry the zone
+// mask in the header, "<type hex>@<zone mask hex>:<payload>", and receivers
+// outside those zones drop them after reading the header bytes alone.
+#define LORA_MAX_ZONES 32
+#define LORA_ZONE_ALL 0xFFFFFFFFUL
+#define LORA_HEADER_MAX 12              // "ff@ffffffff:"
 
 // Message types
 #define MSG_TYPE_GONG 0x01
 #define MSG_TYPE_SCHEDULE 0x02
 #define MSG_TYPE_STATUS 0x03
+#define MSG_TYPE_OTA 0x04           // Binary payload, see loraota.h
+
+// Transmit queue
+#define LORA_MAX_PACKET 255
+#define LORA_TX_QUEUE_SIZE 8
+#define LORA_TX_TIMEOUT_MARGIN 200  // ms past the computed airtime before a TX is abandoned
+
+// Duty-cycle budget over a sliding window (433.05-434.79 MHz: 10%)
+#define LORA_DUTY_CYCLE_WINDOW 3600000  // ms
+#define LORA_DUTY_CYCLE_BUCKETS 60
+#define LORA_DUTY_CYCLE_PERMILLE 100
+#define LORA_DUTY_CYCLE_GONG_RESERVE 10 // Percent of the budget only gong frames may use
+#define LORA_DUTY_CYCLE_BULK_SHARE 50   // Percent of the budget firmware blocks may use
+
+// Listen before talk: CAD before every frame, random exponential backoff while busy
+#define LORA_CAD_TIMEOUT 50             // ms; a CAD-done flag that never comes counts as a clear channel
+#define LORA_LBT_BACKOFF_SLOT 50        // ms, doubled per busy CAD
+#define LORA_LBT_MAX_ATTEMPTS 4         // Busy CADs before the frame is sent anyway
+
+// Transmit priority classes, highest first
+#define LORA_TX_CLASS_GONG 0
+#define LORA_TX_CLASS_SCHEDULE 1
+#define LORA_TX_CLASS_STATUS 2
+#define LORA_TX_CLASS_BULK 3
+#define LORA_TX_CLASSES 4
+
+// Per-class transmit counters
+struct LoRaTxClassStats {
+    uint32_t queued;
+    uint32_t sent;
+    uint32_t dropped;       // Queue full, or evicted by a higher class
+    uint32_t timeouts;      // TX-done flag never raised
+    uint8_t maxDepth;       // Frames of this class queued at once
+    uint64_t waitMs;        // Queued until TX start, summed
+    uint32_t maxWaitMs;
+    uint64_t airtimeUs;     // Measured from TX start to DIO0 rising on TX done
+};
+
+// Channel access counters
+struct LoRaChannelStats {
+    uint32_t cadChecks;
+    uint32_t cadBusy;               // Collisions avoided by listen before talk
+    uint32_t lbtForced;             // Sent with the channel still busy after max attempts
+    uint64_t backoffMs;
+    uint32_t dutyCycleDeferrals;    // Times the queue head was held for budget
+    uint32_t rxCorrupt;             // Malformed frames, mostly collision damage (CRC is off)
+    uint32_t rxFiltered;            // Addressed to zones this node is not in, dropped at the header
+};
 
 // Function declarations
 void setupLoRa();
+void loadLoRaConfig();
 void loopLoRa();
-void sendGongLoRa();
-void sendLoRaMessage(const String& message, uint8_t type = MSG_TYPE_GONG);
+void sendGongLoRa(uint32_t zones = LORA_ZONE_ALL);
+bool sendLoRaMessage(const String& message, uint8_t type = MSG_TYPE_GONG);
+bool sendLoRaMessageAt(const String& message, uint8_t type, int spreadingFactor, int txPower,
+                       bool wakeSleepers = true, uint32_t zones = LORA_ZONE_ALL);
+bool sendLoRaBinary(const uint8_t* payload, size_t length, uint8_t type, bool wakeSleepers = false);
+uint8_t getLoRaTxQueueDepth();
+bool isLoRaTransmitting();
+String getLoRaStatsJSON();
 bool isLoRaMessageAvailable();
 String receiveLoRaMessage();
 void onLoRaMessageReceived(const String& message);
-
-// External callback for gong trigger
-extern void (*onGongTrigger)();
+bool isLoRaMaster();
+uint32_t getLoRaZones();
+uint32_t parseLoRaZones(JsonVariantConst zones);
+void addLoRaZonesJSON(JsonObject obj, uint32_t zones);
+bool isLoRaReady();
+bool isLoRaLowPower();
+uint32_t getLoRaWakePeriod();
+uint16_t getLoRaWakePreamble(int spreadingFactor, uint32_t wakePeriod);
+bool isLoRaIdle();
+void sleepLoRa();
+void startLoRaChannelSample();
+bool finishLoRaChannelSample();
+unsigned long getLastPacketMillis();
+uint16_t getLoRaNodeId();
+uint32_t getLoRaAirtimeUs(size_t payloadLength);
+uint32_t calculateLoRaAirtimeUs(size_t payloadLength, int spreadingFactor, long bandwidth = LORA_BANDWIDTH,
+                               int codingRate = LORA_CODING_RATE, int preambleLength = LORA_PREAMBLE_LENGTH);
+uint32_t getLoRaDutyCycleUsedUs();
+uint32_t getLoRaDutyCycleBudgetUs();
+void setLoRaProfile(int spreadingFactor, int txPower);
+int getLoRaSpreadingFactor();
+int getLoRaTxPower();
+float getLoRaSnrFloor(int spreadingFactor);
+int getLastPacketRssi();
+float getLastPacketSnr();
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Firmware distribution over LoRa (binary payload of MSG_TYPE_OTA frames)
+//
+// The master multicasts a package built by tools/otapack.py to every slave
+// at once. The package is a header followed by a zlib stream of delta ops
+// that rebuild the new image from the one the slaves run now (or from
+// literals alone for a full image):
+//
+//   "GOTA" <version:1> <flags:1> <reserved:2> <image size:4>
+//   <image SHA-256:32> <target digest:32> <base digest:32> <zlib stream>
+//
+//   'C' <offset:4> <length:4>      copy from the running image
+//   'L' <length:4> <bytes>         literal bytes
+//
+// Digests are what esp_partition_get_sha256() reports for an app image.
+//
+// Master -> all:   A <session> <blocks:2> <package size:4> <image size:4> <flags>
+//                    <base digest:8> <target digest:8>    announce, and poll after each pass
+//                  B <session> <block:2> <data>           package block
+//                  C <session>                            commit: boot the new image
+// Slave -> master: S <session> <node:2> <received:2> <state>
+//                  N <session> <node:2> <received:2> <first:2> <bitmap>
+//                                                         blocks still missing from first
+//
+// Multi-byte fields are little-endian. Slaves decode blocks as they arrive
+// and write the image straight to the OTA partition; blocks that arrive
+// ahead of a gap wait in SPIFFS. After each pass the master announces again,
+// and the blocks any slave is missing go out once more for all of them.
+// Transfers need frame authentication: without a key, slaves refuse them.
+#define OTA_PACKAGE_FILE "/ota.pkg"
+#define OTA_SPILL_FILE "/ota_blocks"
+#define OTA_PACKAGE_VERSION 1
+#define OTA_HEADER_BYTES 108
+#define OTA_HEADER_IMAGE_SIZE 8         // Offsets in the header
+#define OTA_HEADER_IMAGE_SHA 12
+#define OTA_HEADER_TARGET_DIGEST 44
+#define OTA_HEADER_BASE_DIGEST 76
+#define OTA_FLAG_DELTA 0x01
+#define OTA_DIGEST_BYTES 32
+#define OTA_ANNOUNCE_DIGEST_BYTES 8     // Digest prefix in announces, enough to pick eligible slaves
+#define OTA_ANNOUNCE_BYTES (13 + 2 * OTA_ANNOUNCE_DIGEST_BYTES)
+#define OTA_REPLY_HEADER_BYTES 6        // Op, session, node, received
+
+#define OTA_OP_ANNOUNCE 'A'
+#define OTA_OP_BLOCK 'B'
+#define OTA_OP_COMMIT 'C'
+#define OTA_OP_STATE 'S'
+#define OTA_OP_MISSING 'N'
+
+#define OTA_DELTA_COPY 'C'
+#define OTA_DELTA_LITERAL 'L'
+
+// Transfer sizing and timing
+#define OTA_BLOCK_SIZE 200              // Package bytes per frame
+#define OTA_MAX_BLOCKS 4096             // 800 KB packages
+#define OTA_NACK_BLOCKS 1024            // Blocks per missing bitmap, 128 bytes
+#define OTA_REPLY_JITTER 3000           // Max random delay before a slave answers an announce
+#define OTA_MAX_PASSES 12               // Announces before the master gives up on slow nodes
+#define OTA_MAX_SILENT_POLLS 3          // Unanswered announces before a node counts as lost
+#define OTA_DECODE_BUDGET 4096          // Image bytes written per loop, about one flash sector
+#define OTA_SESSION_TIMEOUT 3600000     // Slave drops a transfer after an hour without frames
+#define OTA_COMMIT_REPEATS 2
+#define OTA_REBOOT_JITTER 5000          // Slaves reboot within this long after the commit
+#define OTA_MAX_NODES 64                // As MAX_NODES
+
+// Slave states, as reported in S frames
+#define OTA_STATE_IDLE 0
+#define OTA_STATE_RECEIVING 1
+#define OTA_STATE_VERIFIED 2            // Image written and its SHA-256 checked; waiting for the commit
+#define OTA_STATE_FAILED 3
+#define OTA_STATE_CURRENT 4             // Already runs the target image
+#define OTA_STATE_WRONG_BASE 5          // Delta built against another image
+#define OTA_STATE_REFUSED 6             // No frame authentication, or package too large
+#define OTA_STATE_LOST 7                // Master only: stopped answering
+
+// Transfer counters; on the master they cover the current or last session
+struct LoRaOtaStats {
+    uint32_t sessions;
+    uint32_t packageBytes;
+    uint16_t blocks;
+    uint8_t passes;
+    uint32_t blocksSent;
+    uint32_t blocksResent;
+    uint32_t blocksSpilled;         // Slave: parked in SPIFFS behind a gap
+    uint32_t blocksDuplicate;       // Slave: resends it already had
+    uint64_t txAirtimeUs;
+    uint64_t rxAirtimeUs;           // Master: replies heard
+    uint32_t durationMs;
+    uint8_t nodesUpdated;           // Master: verified and committed
+};
+
+// Function declarations
+void setupLoRaOta();
+void loopLoRaOta();
+void handleLoRaOtaFrame(const uint8_t* data, size_t length);
+bool startLoRaOta();
+void cancelLoRaOta();
+bool isLoRaOtaActive();
+const LoRaOtaStats& getLoRaOtaStats();
+String getLoRaOtaJSON();
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Low-power listening for battery slaves ("low_power": true and a
+// "wake_period" in the "lora" section of gong.conf).
+//
+// The ESP32 light-sleeps with the radio asleep, wakes every wake period for
+// one CAD, and only stays up when a preamble is detected. The master sends
+// gong, schedule and ADR frames with a preamble one wake period long, so a
+// sample always lands inside it. Worst-case gong latency is therefore the
+// airtime of the long-preamble frame plus the wakeup overhead.
+#define LPL_CPU_FREQ_MHZ 80
+#define LPL_WAKE_OVERHEAD_US 1000     // Light-sleep exit and SPI setup
+#define LPL_GONG_FRAME_BYTES 64       // Typical "1:{...}" gong frame
+
+// Current model for the estimates, in mA
+#define LPL_ESP_SLEEP_MA 0.8f         // ESP32 light sleep
+#define LPL_ESP_ACTIVE_MA 30.0f       // ESP32 at LPL_CPU_FREQ_MHZ, WiFi off
+#define LPL_RADIO_RX_MA 10.8f         // SX1278 RX and CAD
+
+// Function declarations
+void setupLowPower();
+void loopLowPower();
+void addLowPowerJSON(JsonObject obj);
@@ -5,24 +5,213 @@
 // MP3-TF-16P pin definitions
 #define MP3_RX_PIN 16  // ESP32 GPIO16 -> MP3 TX
 #define MP3_TX_PIN 17  // ESP32 GPIO17 -> MP3 RX
-#define MP3_BUSY_PIN 18 // ESP32 GPIO18 -> MP3 BUSY
+#define MP3_BUSY_PIN 4  // ESP32 GPIO4 -> MP3 BUSY (GPIO18 is the LoRa SPI clock)
+#define MP3_AMP_PIN -1  // Set to e.g. 27 when the amplifier has an enable input (active high)
+
+// Amplifier enable: on ahead of scheduled strikes and for manual plays,
+// off again once nothing has played for a while
+#define MP3_AMP_WAKE_MS 150         // Amplifier power-up before the first sound
+#define MP3_AMP_IDLE_OFF 10000      // ms without playback before switching it off
+
+// Module supply switch, when fitted: off once nothing has played or been
+// sent for a while, on again for the next command, which waits until the
+// module reports itself online. The power manager switches it on ahead of
+// scheduled gongs; a manual gong while it is off is late by the boot time.
+#define MP3_POWER_PIN -1            // Set to e.g. 32 when the module's supply has a switch (active high)
+#define MP3_POWER_BOOT_MS 3000      // Power-up to taking commands, if it never says it is online
+#define MP3_POWER_IDLE_OFF 60000    // ms without playback or commands before switching it off
+
+// Serial frames, both directions (9600 8N1):
+//
+//   7E FF 06 <command> <feedback> <param hi> <param lo> <checksum hi> <checksum lo> EF
+//
+// The checksum is the 16-bit two's complement of the sum of the six bytes
+// from FF through <param lo>. With <feedback> set, the module ACKs the
+// command (MP3_MSG_ACK) or reports why it could not carry it out
+// (MP3_MSG_ERROR); queries are answered with a frame of their own command.
+#define MP3_FRAME_BYTES 10
+#define MP3_FRAME_START 0x7E
+#define MP3_FRAME_VERSION 0xFF
+#define MP3_FRAME_LENGTH 0x06
+#define MP3_FRAME_END 0xEF
 
 // MP3 commands
-#define MP3_CMD_PLAY 0x01
-#define MP3_CMD_PAUSE 0x02
-#define MP3_CMD_STOP 0x0E
-#define MP3_CMD_NEXT 0x03
-#define MP3_CMD_PREV 0x04
-#define MP3_CMD_VOL_UP 0x05
-#define MP3_CMD_VOL_DOWN 0x06
-#define MP3_CMD_SET_VOL 0x07
-#define MP3_CMD_PLAY_TRACK 0x12
+#define MP3_CMD_NEXT 0x01
+#define MP3_CMD_PREV 0x02
+#define MP3_CMD_PLAY_INDEX 0x03     // Track by its index on the card
+#define MP3_CMD_VOL_UP 0x04
+#define MP3_CMD_VOL_DOWN 0x05
+#define MP3_CMD_SET_VOL 0x06
+#define MP3_CMD_RESET 0x0C
+#define MP3_CMD_PLAY 0x0D
+#define MP3_CMD_PAUSE 0x0E
+#define MP3_CMD_STOP 0x16
+#define MP3_CMD_PLAY_TRACK 0x12     // Track in the /MP3 folder, 1-3000
+#define MP3_CMD_QUERY_STATUS 0x42
+#define MP3_CMD_QUERY_VOLUME 0x43
+#define MP3_CMD_QUERY_TRACKS 0x48   // Tracks on the TF card
+#define MP3_CMD_QUERY_FOLDER_TRACKS 0x4E    // Tracks in a numbered folder, 1-99
+#define MP3_CMD_QUERY_FOLDERS 0x4F  // Folders on the TF card
+
+// Messages from the module
+#define MP3_MSG_CARD_INSERTED 0x3A
+#define MP3_MSG_CARD_REMOVED 0x3B
+#define MP3_MSG_TRACK_FINISHED 0x3D // Parameter: the track
+#define MP3_MSG_ONLINE 0x3F         // Sent after power-up or reset
+#define MP3_MSG_ERROR 0x40
+#define MP3_MSG_ACK 0x41
+
+// Error codes in MP3_MSG_ERROR
+#define MP3_ERROR_BUSY 0x01         // Still initializing
+#define MP3_ERROR_SLEEPING 0x02
+#define MP3_ERROR_SERIAL 0x03       // Frame received incompletely
+#define MP3_ERROR_CHECKSUM 0x04
+#define MP3_ERROR_TRACK_RANGE 0x05
+#define MP3_ERROR_TRACK_NOT_FOUND 0x06
+
+// Command queue; one command is in flight at a time
+#define MP3_QUEUE_SIZE 8
+#define MP3_ACK_TIMEOUT 200         // ms for the ACK or query reply
+#define MP3_MAX_RETRIES 2           // Resends after a timeout or a transient error
+#define MP3_COMMAND_GAP 30          // ms between frames; the module drops frames sent back to back
+#define MP3_BUSY_RETRY_DELAY 500    // ms before resending a command the module was too busy for
+#define MP3_MAX_TRACK 3000
+#define MP3_MAX_VOLUME 30
+
+// Playback states, driven by BUSY edge interrupts and module messages
+#define MP3_STATE_IDLE 0
+#define MP3_STATE_STARTING 1        // Play command queued or sent, BUSY still high
+#define MP3_STATE_PLAYING 2         // BUSY low
+#define MP3_STATE_FINISHED 3
+#define MP3_STATE_FAILED 4          // Rejected, unanswered, or BUSY never went low
+#define MP3_STATES 5
+#define MP3_START_TIMEOUT 1000      // ms from the play frame to BUSY low
+#define MP3_GONG_TRACK 1
+#define MP3_MAX_STRIKES 12
+
+// Start latency calibration: play frame to BUSY low per track, learned from
+// every measured start and kept in MP3_CALIBRATION_FILE. The silent lead-in
+// at the start of a track does not show on BUSY; it is set per track in the
+// "mp3" section of gong.conf: {"lead_in": {"1": 180}} (ms).
+#define MP3_CALIBRATION_FILE "/mp3latency.json"
+#define MP3_CALIBRATED_TRACKS 16
+#define MP3_MAX_LEAD_IN 2000            // ms
+#define MP3_DEFAULT_START_LATENCY 150   // ms, until a track has been measured
+#define MP3_LATENCY_EWMA_WEIGHT 0.25f
+#define MP3_CALIBRATION_SAVE_INTERVAL 600000    // ms between writes, to spare the flash
+
+// Volume ramps: loopMP3() moves the volume along a straight line, at most
+// one volume frame per MP3_RAMP_STEP_INTERVAL, skipping levels on steep
+// ramps. A volume change while another still waits in the queue updates
+// that frame instead of adding one, so ramps cannot flood the 9600-baud line.
+#define MP3_RAMP_STEP_INTERVAL 100  // ms between volume frames of a ramp
+#define MP3_KEEP_VOLUME -1          // fadeOutPlayback(): restore the volume from before the fade
+
+struct MP3VolumeRamp {
+    bool active;
+    uint8_t from;
+    uint8_t to;
+    unsigned long startMillis;
+    uint32_t durationMs;
+    bool stopAtEnd;                 // Fade-out: stop playback at the end, then restore the volume
+    uint8_t restoreVolume;
+};
+
+struct MP3TrackCalibration {
+    uint16_t track;
+    uint16_t leadInMs;
+    uint32_t latencyUs;         // Smoothed play frame to BUSY low
+    uint32_t samples;
+};
+
+// The current or last playback
+struct MP3Playback {
+    uint8_t state;
+    uint16_t track;
+    uint8_t strikesLeft;                    // Gong strikes to follow this one
+    unsigned long stateMillis[MP3_STATES];  // When each state was last entered
+    unsigned long commandMicros;            // Play frame written, 0 = still queued
+    unsigned long startMicros;              // BUSY low
+    unsigned long endMicros;                // BUSY high, or the track-finished message
+    bool edgeStart;                         // Start seen as a BUSY edge, so its time is exact
+    uint16_t lastTrack;                     // Last playback that ran to its end
+    uint32_t lastDurationMs;                // Its length; 0 = start not seen on BUSY
+};
+
+// Playback counters; latency is from the play frame to BUSY low
+struct MP3PlaybackStats {
+    uint32_t started;
+    uint32_t finished;
+    uint32_t failed;
+    uint32_t latencySamples;    // Starts seen as a BUSY edge
+    uint64_t latencyUs;
+    uint32_t lastLatencyUs;
+    uint32_t maxLatencyUs;
+};
+
+// What the module last reported
+struct MP3Status {
+    bool online;                // Answered since boot
+    uint8_t volume;
+    uint16_t trackCount;        // TF card, 0 = unknown or no card
+    uint16_t playbackStatus;    // Raw MP3_CMD_QUERY_STATUS reply
+    uint16_t lastTrackFinished;
+    uint8_t lastError;          // Last MP3_ERROR_* code, 0 = none
+};
+
+// Driver counters
+struct MP3DriverStats {
+    uint32_t commands;          // Completed, acknowledged or answered
+    uint32_t framesSent;        // Retries included
+    uint32_t retries;
+    uint32_t timeouts;          // Given up without an answer
+    uint32_t failed;            // Rejected by the module
+    uint32_t queueFull;
+    uint32_t volumeCoalesced;   // Volume changes merged into a frame still queued
+    uint32_t framesReceived;
+    uint32_t badFrames;         // Wrong checksum, version or end byte
+    uint32_t maxReplyMs;        // Command sent to ACK or reply
+    uint32_t powerUps;          // Module supply switched on
+    uint32_t maxBootMs;         // Power-up to online
+};
 
 // Function declarations
 void setupMP3();
 void playGong();
-void playTrack(uint8_t trackNumber);
+void playGongStrikes(uint8_t strikes);
+void playTrack(uint16_t trackNumber);
 void setVolume(uint8_t volume);
+void rampVolume(uint8_t volume, uint32_t durationMs);
+void fadeOutPlayback(uint32_t durationMs, int16_t restoreVolume = MP3_KEEP_VOLUME);
+bool isVolumeRamping();
+const MP3VolumeRamp& getMP3VolumeRamp();
 void stopPlayback();
+bool queryMP3Status();
+bool queryMP3Volume();
+bool queryMP3TrackCount();
+bool queueMP3Command(uint8_t command, uint16_t param = 0);
+void buildMP3Frame(uint8_t* frame, uint8_t command, uint16_t param, bool feedback);
+bool isMP3Idle();
 bool isPlaying();
+unsigned long getLastGongMillis();
+const MP3Status& getMP3Status();
+const MP3DriverStats& getMP3DriverStats();
+const MP3Playback& getMP3Playback();
+const MP3PlaybackStats& getMP3PlaybackStats();
+const MP3TrackCalibration* getMP3Calibration(uint16_t track);
+uint32_t getMP3PreRoll(uint16_t track);
+void setMP3LeadIn(uint16_t track, uint16_t leadInMs);
+void loadMP3LeadIns();
+void wakeMP3Amplifier();
+bool isMP3AmplifierOn();
+void wakeMP3Module();
+bool isMP3ModuleOn();
+bool isMP3ModuleReady();
+String getMP3StatusJSON();
 void loopMP3();
+
+// Called on every playback state change
+extern void (*onMP3Playback)(uint8_t state, uint16_t track);
+
+// Called with every valid frame from the module: query replies and messages
+extern void (*onMP3Message)(uint8_t command, uint16_t param);
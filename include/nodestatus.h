@@ -0,0 +1,68 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Battery monitoring (optional voltage divider on an ADC pin)
+#define BATTERY_ADC_PIN -1          // Set to e.g. 35 when a divider is fitted
+#define BATTERY_DIVIDER_RATIO 2
+
+// Heartbeat timing
+#define HEARTBEAT_BASE_PERIOD 60000   // Weak or unknown links report every minute
+#define HEARTBEAT_MAX_PERIOD 240000   // Strong links report every 4 minutes
+#define HEARTBEAT_GOOD_MARGIN 8       // dB above the demodulation floor: 2x base period
+#define HEARTBEAT_STRONG_MARGIN 15    // dB above the demodulation floor: max period
+#define HEARTBEAT_MASTER_TIMEOUT 600000 // Forget the master link after 10 minutes of silence
+#define HEARTBEAT_MISSED_LIMIT 3      // Missed periods before a node is reported down
+
+// Heartbeat payload of MSG_TYPE_STATUS frames:
+// H<node>,<flags>,<seq>,<uptime s>,<epoch>,<battery mV>,<last gong age s>,<rssi>,<snr x4>,<period s>,
+//  <sf>,<tx power>,<energy saved mJ>,<airtime saved ms>
+// rssi/snr are what the sender measured on the last frame it heard from the master
+#define STATUS_OP_HEARTBEAT 'H'
+#define STATUS_OP_ADR 'A'             // Link adaptation command, see linkadapt.h
+#define HEARTBEAT_FLAG_MASTER 0x01
+#define HEARTBEAT_FLAG_TIME_SYNCED 0x02
+#define HEARTBEAT_FLAG_LOW_POWER 0x04
+
+#define MAX_NODES 64
+#define LINK_EWMA_WEIGHT 0.125f
+
+// Node table entry kept by the master
+struct NodeInfo {
+    uint16_t id;
+    uint8_t flags;
+    uint16_t lastSeq;
+    uint32_t uptime;
+    int32_t clockOffset;       // Node epoch minus master epoch, seconds
+    uint16_t batteryMv;
+    int32_t lastGongAge;       // Seconds, -1 = never
+    uint32_t period;           // Announced heartbeat period, ms
+    unsigned long lastSeen;
+    uint32_t heartbeats;
+    uint32_t missed;           // Sequence gaps
+    int16_t rssi;              // Master's view of the node
+    float snr;
+    float rssiAverage;
+    float snrAverage;
+    float snrMin;
+    int16_t reportedRssi;      // Node's view of the master
+    float reportedSnr;
+    uint8_t spreadingFactor;
+    int8_t txPower;
+    int32_t energySavedMj;     // Versus the robust profile
+    int32_t airtimeSavedMs;
+};
+
+// Function declarations
+void setupNodeStatus();
+void loopNodeStatus();
+void handleNodeStatusMessage(const String& content);
+uint32_t getHeartbeatPeriod();
+void requestHeartbeat(unsigned long maxDelay);
+void noteMasterFrame();
+unsigned long getMasterLastHeard();
+uint8_t getNodeCount();
+const NodeInfo* getNode(uint8_t index);
+bool isNodeAlive(const NodeInfo& node);
+String getNodeTableJSON();
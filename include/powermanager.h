@@ -0,0 +1,74 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Power manager for mains-powered nodes, which do useful work a few times a
+// day. While nothing is going on, the CPU runs at the idle clock, the radio,
+// audio and scheduler tasks wake every POWER_IDLE_TASK_PERIOD_MS instead of
+// every tick, and WiFi sleeps between beacons. A request, a gong, an HTTP
+// call, playback or LoRa traffic brings the node back to full speed for
+// POWER_ACTIVE_HOLD_MS; an HTTP call also keeps WiFi awake for
+// POWER_UI_HOLD_MS, so the web interface stays quick while it is in use.
+//
+// POWER_GONG_LEAD_MS before a scheduled gong the node is at full speed and
+// the MP3 module, if its supply is switched (MP3_POWER_PIN), is powered up,
+// whatever else is going on. The amplifier is woken by the scheduler as
+// before. Gong readiness is checked at every scheduled gong and counted.
+//
+// Where the SDK is built with tickless idle (CONFIG_FREERTOS_USE_TICKLESS_IDLE),
+// esp_pm lowers the clock and light-sleeps between task wake-ups by itself;
+// the power manager then only holds a full-speed lock while active. Battery
+// slaves are left to low-power listening (lowpower.h).
+//
+// Time in each state is accounted, and the average current and battery
+// life are estimated from the current model below. Settings come from the
+// "power" section of gong.conf, and a change applies without a restart:
+//
+//   "power": {"enabled": true, "idle_mhz": 80, "battery_mah": 10000}
+#define POWER_ACTIVE_MHZ 240
+#define POWER_IDLE_MHZ 80               // The lowest clock WiFi runs at
+#define POWER_ACTIVE_HOLD_MS 10000      // Full speed after the last activity
+#define POWER_UI_HOLD_MS 60000          // WiFi awake after the last HTTP request
+#define POWER_GONG_LEAD_MS 5000         // Up before a scheduled gong; covers MP3_POWER_BOOT_MS
+#define POWER_IDLE_TASK_PERIOD_MS 20    // Task wake-ups while idle
+
+// Current model for the estimates, in mA
+#define POWER_CPU_ACTIVE_MA 50.0f       // ESP32 cores at POWER_ACTIVE_MHZ
+#define POWER_CPU_IDLE_MA 20.0f         // At POWER_IDLE_MHZ
+#define POWER_WIFI_AWAKE_MA 70.0f       // Receiver on: modem sleep off, or AP mode
+#define POWER_WIFI_SLEEP_MA 8.0f        // Modem sleep, averaged over the beacons it wakes for
+#define POWER_MP3_MA 20.0f              // MP3 module powered, not playing
+#define POWER_AMP_MA 6.0f               // Amplifier enabled, silent
+
+// Power states accounted; CPU and WiFi each add up to the time since boot
+#define POWER_TIME_CPU_ACTIVE 0
+#define POWER_TIME_CPU_IDLE 1
+#define POWER_TIME_WIFI_AWAKE 2
+#define POWER_TIME_WIFI_SLEEP 3
+#define POWER_TIME_MP3_ON 4
+#define POWER_TIME_AMP_ON 5
+#define POWER_TIMES 6
+
+// Power manager counters
+struct PowerStats {
+    uint64_t timeMs[POWER_TIMES];
+    uint32_t wakes;             // Idle to full speed
+    uint32_t gongWakes;         // Of them, ahead of a scheduled gong
+    uint32_t gongs;             // Scheduled gongs prepared for
+    uint32_t gongsUnready;      // Clock still low or the MP3 module still booting when one fired
+    uint32_t minGongLeadMs;     // Shortest time at full speed before one fired
+};
+
+// Function declarations
+void setupPowerManager();
+void loopPowerManager();
+void holdPowerActive();
+void holdPowerUi();
+bool isPowerIdle();
+uint32_t getPowerTaskPeriodMs(uint8_t task);
+float getPowerAverageMa();
+const PowerStats& getPowerStats();
+String getPowerJSON();
+
+// External functions
+extern bool setWiFiSleep(bool sleep);
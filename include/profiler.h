@@ -0,0 +1,100 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Loop profiler: every module entry point the tasks call, and every REST
+// handler, is timed with the CPU cycle counter and counted into a
+// log-scaled histogram, so GET /profile can tell which one makes a pass
+// late. Each section belongs to one task, which is pinned to one core, so
+// its start and end read the same counter and no lock is needed.
+//
+// A task's pass is timed the same way. The sections a pass ran, with their
+// offsets, are kept for the slowest pass of each task: the worst-iteration
+// trace. The profiler times its own probes at setup and reports its share
+// of each task's pass time.
+//
+// Counts are kept in cycles at the clock the profiler was set up at. When
+// the power manager lowers the clock, setProfileCpuMhz() scales what is
+// counted after it; a section running across the change is off by the ratio.
+#define PROFILE_FIRST_OCTAVE 8          // Bucket 0: below 256 cycles
+#define PROFILE_SUB_BUCKETS 4           // Per doubling, a power of 2: bounds 19% apart
+#define PROFILE_BUCKETS (1 + (32 - PROFILE_FIRST_OCTAVE) * PROFILE_SUB_BUCKETS)
+#define PROFILE_TRACE_ENTRIES 16        // Sections kept per pass
+#define PROFILE_TASKS 4                 // As SYSTEM_TASKS
+#define PROFILE_REPORT_INTERVAL 300000  // ms between summaries on Serial
+#define PROFILE_SLOW_PASS_US 20000      // A new slowest pass above this is logged at once
+#define PROFILE_CALIBRATION_PROBES 1000 // Per batch
+#define PROFILE_CALIBRATION_BATCHES 8   // The cheapest counts: an interrupt or task switch inflates a batch
+
+// Sections, by task
+#define PROFILE_RADIO_REQUESTS 0        // Radio requests and received-frame events
+#define PROFILE_LORA 1
+#define PROFILE_SYNC 2
+#define PROFILE_NODES 3
+#define PROFILE_ADR 4
+#define PROFILE_OTA 5
+#define PROFILE_AUDIO_REQUESTS 6        // Audio requests and gong events, up to the strike
+#define PROFILE_MP3 7
+#define PROFILE_CATALOG 8
+#define PROFILE_SYNTH 9
+#define PROFILE_PROGRAM 10
+#define PROFILE_SCHEDULE_CHECK 11       // Planning the next instant
+#define PROFILE_SCHEDULE 12             // Firing it
+#define PROFILE_WEB 13                  // WiFi upkeep and handleClient(), REST handlers included
+#define PROFILE_HTTP 14                 // One REST handler
+#define PROFILE_LOG 15
+#define PROFILE_POWER 16                // Power manager, on the scheduler task
+#define PROFILE_SECTIONS 17
+
+// Counters and histogram of one section or of a task's passes
+struct ProfileStats {
+    uint32_t count;
+    uint32_t maxCycles;
+    uint64_t totalCycles;
+    const char* maxLabel;       // What the slowest call was, if labelled: a REST handler's route
+    uint32_t buckets[PROFILE_BUCKETS];
+};
+
+struct ProfileTraceEntry {
+    uint8_t section;
+    uint32_t offsetCycles;      // From the start of the pass
+    uint32_t cycles;
+};
+
+// The sections one pass ran, in the order they finished
+struct ProfileTrace {
+    uint32_t passCycles;
+    uint32_t timeMs;            // millis() at the end of the pass
+    uint8_t entries;
+    bool overflowed;            // More sections than PROFILE_TRACE_ENTRIES
+    ProfileTraceEntry entry[PROFILE_TRACE_ENTRIES];
+};
+
+// Function declarations
+void setupProfiler();
+void loopProfiler();
+void beginProfilePass(uint8_t task);
+void endProfilePass(uint8_t task);
+void endProfileSection(uint8_t section, uint32_t startCycles, const char* label = nullptr);
+void resetProfiler();
+void setProfileCpuMhz(uint32_t mhz);
+uint32_t getProfilePercentile(const ProfileStats& stats, uint16_t perMille);
+uint32_t getProfileProbeCycles();
+uint32_t getProfileOverheadPerMille(uint8_t task);
+const ProfileStats& getProfileSectionStats(uint8_t section);
+const ProfileStats& getProfilePassStats(uint8_t task);
+const ProfileTrace& getProfileWorstTrace(uint8_t task);
+const char* getProfileSectionName(uint8_t section);
+String getProfileJSON(bool histograms);
+
+inline uint32_t getProfileCycles() {
+    return ESP.getCycleCount();
+}
+
+// Times one call as a section
+#define PROFILE(section, call) \
+    do { \
+        uint32_t profileStart = getProfileCycles(); \
+        call; \
+        endProfileSection(section, profileStart); \
+    } while (0)
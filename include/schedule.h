@@ -3,6 +3,33 @@
 #include <Arduino.h>
 #include <ArduinoJson.h>
 
+#define MAX_SCHEDULE_ENTRIES 20
+#define SCHEDULE_ALL_ZONES 0xFFFFFFFFUL     // Entry rings in every zone (LORA_ZONE_ALL)
+#define SCHEDULE_VOLUME_PROFILE 0           // Entry volume from the volume profile
+#define SCHEDULE_MAX_FADE_IN 60000          // ms
+#define SCHEDULE_DESCRIPTION_LENGTH 48      // "default_schedules" entries in gong.conf
+
+// Time-of-day volume curve, from the "volume_profile" section of gong.conf:
+//
+//   "volume_profile": [
+//     {"hour": 6, "minute": 0, "volume": 14},
+//     {"hour": 9, "minute": 0, "volume": 24},
+//     {"hour": 20, "minute": 0, "volume": 24},
+//     {"hour": 22, "minute": 0, "volume": 10}
+//   ]
+//
+// The volume runs in straight lines from point to point, around midnight
+// from the last point to the first. Between gongs the module follows it;
+// a change that falls on a ringing gong waits until the gong has ended.
+// A new profile in gong.conf applies without a restart.
+#define MAX_VOLUME_PROFILE_POINTS 8
+
+struct VolumeProfilePoint {
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t volume;
+};
+
 // Schedule entry structure
 struct ScheduleEntry {
     uint8_t hour;
@@ -10,19 +37,49 @@ struct ScheduleEntry {
     bool enabled;
     String description;
     uint32_t id;
+    uint32_t zones;         // Zones whose nodes ring, as a LoRa zone mask
+    String program;         // Gong program to run, empty = a single gong
+    uint8_t volume;         // MP3 volume, SCHEDULE_VOLUME_PROFILE = from the volume profile
+    uint16_t fadeIn;        // ms from silence up to the volume; single gongs only
 };
 
 // Schedule management functions
 void setupSchedule();
 void checkSchedule();
-bool addScheduleEntry(uint8_t hour, uint8_t minute, const String& description);
+void loopSchedule();
+bool addScheduleEntry(uint8_t hour, uint8_t minute, const String& description, uint32_t zones = SCHEDULE_ALL_ZONES,
+                      const String& program = "", uint8_t volume = SCHEDULE_VOLUME_PROFILE, uint16_t fadeIn = 0);
 bool deleteScheduleEntry(uint32_t id);
-bool editScheduleEntry(uint32_t id, uint8_t hour, uint8_t minute, const String& description, bool enabled = true);
+bool editScheduleEntry(uint32_t id, uint8_t hour, uint8_t minute, const String& description, bool enabled = true,
+                       uint32_t zones = SCHEDULE_ALL_ZONES, const String& program = "",
+                       uint8_t volume = SCHEDULE_VOLUME_PROFILE, uint16_t fadeIn = 0);
 String getScheduleJSON();
 void loadScheduleFromSPIFFS();
 void saveScheduleToSPIFFS();
 void loadDefaultSchedules();
 void triggerGong();
+void triggerScheduleEntry(const ScheduleEntry& entry);
+bool isTimeSynced();
+long getScheduleFireInMs();
+unsigned long getCurrentEpoch();
+uint64_t getCurrentEpochMillis();
+
+// Volume profile
+void loadVolumeProfile();
+bool setVolumeProfile(const VolumeProfilePoint* points, uint8_t count);
+int16_t getProfileVolume(uint16_t minuteOfDay);
+String getVolumeProfileJSON();
 
-// External callback for gong trigger
-extern void (*onGongTrigger)();
+// Schedule versioning and bulk updates (used by LoRa schedule sync). The
+// functions above lock the entry table themselves; a reader that walks it
+// with getScheduleEntry() or keeps a findScheduleEntry() pointer holds
+// lockSchedule() meanwhile.
+void lockSchedule();
+void unlockSchedule();
+uint8_t getScheduleCount();
+const ScheduleEntry* getScheduleEntry(uint8_t index);
+const ScheduleEntry* findScheduleEntry(uint32_t id);
+uint32_t getScheduleEntryHash(const ScheduleEntry& entry);
+uint32_t getScheduleVersionHash();
+uint8_t upsertScheduleEntries(const ScheduleEntry* entries, uint8_t count);
+uint8_t pruneScheduleEntries(const uint32_t* keepIds, uint8_t keepCount);
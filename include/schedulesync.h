@@ -0,0 +1,58 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Schedule synchronization over LoRa (payload of MSG_TYPE_SCHEDULE frames)
+//
+// Master -> all:  V<version>                       periodic version advert
+//                 D<version>;<id>:<hash16>,...      digest of every entry
+//                 D<version>,<start>,<count>;...    digest part from index start,
+//                                                   when it takes several frames
+//                 P<xfer>,<seq>,<total>;<chunk>     fragment of a patch
+// Slave  -> master: Q<node>,<version>               "my version differs"
+//                   R<node>,<version>,<mask>        digest indices it needs
+//                   N<node>,<xfer>,<missing>        fragments it lost
+//
+// Versions, masks and hashes are hex. Slaves delay their replies by a random
+// jitter and drop them when they overhear another slave asking for the same
+// (or more), so a whole network usually converges on one or two requests.
+#define SYNC_OP_VERSION 'V'
+#define SYNC_OP_DIGEST 'D'
+#define SYNC_OP_PATCH 'P'
+#define SYNC_OP_QUERY 'Q'
+#define SYNC_OP_REQUEST 'R'
+#define SYNC_OP_NACK 'N'
+
+// Sync timing and sizing
+#define SYNC_ADVERT_INTERVAL 60000     // Master re-announces its version every minute
+#define SYNC_COLLECT_WINDOW 2000       // Master gathers requests before answering once
+#define SYNC_REPLY_JITTER 1500         // Max random delay before a slave replies
+#define SYNC_SETTLE_DELAY 3000         // Re-advert delay after a patch went out
+#define SYNC_QUIET_PERIOD 6000         // No requests for this long = converged
+#define SYNC_FRAGMENT_SIZE 180         // Patch bytes per LoRa packet
+#define SYNC_DIGEST_SIZE 180           // Digest entry bytes per LoRa packet
+#define SYNC_MAX_FRAGMENTS 16
+#define SYNC_TX_BACKLOG 2              // Queued LoRa frames before fragments are held back
+#define SYNC_REASSEMBLY_TIMEOUT 4000   // Slave NACKs missing fragments after this
+#define SYNC_MAX_NACKS 3
+
+// Sync counters, exposed over /sync
+struct SyncStats {
+    uint32_t framesSent;
+    uint32_t framesReceived;
+    uint32_t bytesSent;
+    uint64_t txAirtimeUs;
+    uint32_t patchesApplied;
+    uint32_t fragmentsResent;
+    uint32_t repliesSuppressed;
+    uint32_t lastConvergenceMs;        // Master: first change to quiet network
+    uint32_t lastConvergenceAirtimeMs; // Master: airtime it sent and heard meanwhile
+};
+
+// Function declarations
+void setupScheduleSync();
+void loopScheduleSync();
+void handleScheduleSyncMessage(const String& content);
+const SyncStats& getScheduleSyncStats();
+String getScheduleSyncJSON();
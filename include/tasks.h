@@ -0,0 +1,115 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Task layout: the modules that used to share one loop() run in four
+// FreeRTOS tasks, each pinned to a core with its own priority. Radio and
+// web sit on core 0 with the WiFi stack; audio and scheduler have core 1
+// to themselves, so a slow HTTP request or a LoRa frame being decoded
+// never holds up a strike.
+//
+//   radio      LoRa, schedule sync, node status, link adaptation, OTA
+//   audio      MP3 driver, track catalog, synthesizer, gong programs
+//   scheduler  NTP, planning the next instant and firing it on time, power manager
+//   web        HTTP server, WiFi upkeep and printing the log (logger.h)
+//
+// Audio and radio own their modules: other tasks hand them work through
+// bounded queues instead of calling in. Gongs reach the audio task as
+// events (eventbus.h) that wake it at once; the radio's DIO0 interrupt
+// wakes the radio task directly. Each task is subscribed to the task
+// watchdog and feeds it once per pass. Battery slaves keep running
+// everything from loop(), which drains the same queues.
+// At boot, audio and web first set up their own modules (boot.h); no task
+// starts its loop before setup() releases them all.
+#define TASK_RADIO_CORE 0
+#define TASK_RADIO_PRIORITY 3
+#define TASK_RADIO_STACK 8192
+#define TASK_AUDIO_CORE 1
+#define TASK_AUDIO_PRIORITY 5
+#define TASK_AUDIO_STACK 6144
+#define TASK_SCHEDULER_CORE 1
+#define TASK_SCHEDULER_PRIORITY 4
+#define TASK_SCHEDULER_STACK 6144
+#define TASK_WEB_CORE 0
+#define TASK_WEB_PRIORITY 1
+#define TASK_WEB_STACK 8192
+#define TASK_PERIOD_MS 1                // Radio, audio and scheduler: at most a tick between passes
+#define TASK_WEB_PERIOD_MS 5
+#define TASK_WATCHDOG_TIMEOUT 10        // s without a pass before the task watchdog resets the node
+#define SCHEDULE_CHECK_INTERVAL 1000    // ms between schedule plans
+
+// Tasks, as indices into the task stats
+#define TASK_RADIO 0
+#define TASK_AUDIO 1
+#define TASK_SCHEDULER 2
+#define TASK_WEB 3
+#define SYSTEM_TASKS 4
+
+// Request queues
+#define TASK_AUDIO_QUEUE_LENGTH 16
+#define TASK_RADIO_QUEUE_LENGTH 8
+#define TASK_REQUEST_NAME_LENGTH 24     // As GONG_PROGRAM_NAME_LENGTH
+
+// Audio requests; gongs and programs are EVENT_GONG_REQUESTED events
+#define AUDIO_REQUEST_STRIKES 1         // param: strikes on the MP3 module
+#define AUDIO_REQUEST_TRACK 2           // param: track in /mp3
+#define AUDIO_REQUEST_PREPARE 3         // name: gong program whose first volume is set ahead
+#define AUDIO_REQUEST_STOP 4            // value: fade-out ms, 0 = at once
+#define AUDIO_REQUEST_VOLUME 5          // param: volume, value: ramp ms
+#define AUDIO_REQUEST_AMP_WAKE 6
+#define AUDIO_REQUEST_RESCAN 7          // Track catalog
+#define AUDIO_REQUEST_MP3_WAKE 8        // MP3 module supply, ahead of a scheduled gong (powermanager.h)
+
+// Radio requests
+#define RADIO_REQUEST_GONG 1            // value: LoRa zone mask
+#define RADIO_REQUEST_OTA_START 2
+#define RADIO_REQUEST_OTA_CANCEL 3
+#define RADIO_REQUEST_CAPTURE 4         // param: 1 = on, 0 = off
+#define RADIO_REQUEST_CAPTURE_CLEAR 5
+
+struct TaskRequest {
+    uint8_t type;
+    uint16_t param;
+    uint32_t value;
+    uint32_t postedUs;          // micros() when posted
+    char name[TASK_REQUEST_NAME_LENGTH];
+};
+
+// Per-task counters
+struct SystemTaskStats {
+    uint32_t passes;
+    uint32_t maxPassUs;
+    uint64_t busyUs;
+    uint32_t stackFree;         // Stack high-water mark, bytes never used
+};
+
+// Per-queue counters; latency runs from posting to the request being
+// carried out
+struct TaskQueueStats {
+    uint32_t posted;
+    uint32_t dropped;           // Queue full
+    uint32_t maxDepth;
+    uint32_t handled;
+    uint64_t latencyUs;
+    uint32_t maxLatencyUs;
+};
+
+// Function declarations
+void setupTasks();
+void startTasks();
+bool waitForTaskBoot(uint32_t timeoutMs);
+void releaseTasks();
+bool areTasksRunning();
+void wakeRadioTask(bool fromIsr);
+void runRadioPass();
+void runAudioPass();
+void runSchedulerPass();
+bool postAudioRequest(uint8_t type, uint16_t param = 0, uint32_t value = 0, const String& name = "");
+bool postRadioRequest(uint8_t type, uint16_t param = 0, uint32_t value = 0);
+void processAudioRequests();
+void processRadioRequests();
+const char* getSystemTaskName(uint8_t task);
+const SystemTaskStats& getSystemTaskStats(uint8_t task);
+const TaskQueueStats& getAudioQueueStats();
+const TaskQueueStats& getRadioQueueStats();
+String getTasksJSON();
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Track catalog: what is on the MP3 module's TF card. On first boot, and
+// whenever a card is inserted, the module is asked for its file count, its
+// folder count and the tracks in each numbered folder; the tracks left
+// over are those in /mp3, the ones playTrack() reaches. Track lengths are
+// learned from BUSY as tracks play. All of it is kept in a compact binary
+// index on SPIFFS, so after a reboot the catalog is there at once. It is
+// confirmed by the one track count query the driver sends anyway; only a
+// different count, or a card change, has the card scanned again.
+#define TRACK_CATALOG_FILE "/tracks.idx"
+#define TRACK_CATALOG_MAGIC 0x54434154UL    // "TCAT"
+#define TRACK_CATALOG_VERSION 1
+#define TRACK_CATALOG_MAX_FOLDERS 16        // Numbered folders counted, 01-16
+#define TRACK_CATALOG_MAX_TRACKS 255        // /mp3 tracks with a known length
+#define TRACK_CATALOG_DURATION_UNIT 10      // ms per unit of a stored length
+#define TRACK_CATALOG_QUERY_TIMEOUT 2000    // ms for a scan query, queueing and retries included
+#define TRACK_CATALOG_SAVE_INTERVAL 600000  // ms between writes of learned lengths
+
+// Catalog states
+#define TRACK_CATALOG_UNKNOWN 0     // No index and no answer from the card yet
+#define TRACK_CATALOG_CACHED 1      // Index from flash, not yet confirmed by the card
+#define TRACK_CATALOG_SCANNING 2
+#define TRACK_CATALOG_VALID 3
+#define TRACK_CATALOG_NO_CARD 4
+#define TRACK_CATALOG_STATES 5
+
+struct TrackCatalog {
+    uint8_t state;
+    uint16_t totalTracks;       // Files on the card
+    uint8_t folderCount;        // Numbered folders, up to TRACK_CATALOG_MAX_FOLDERS
+    uint16_t folderTracks[TRACK_CATALOG_MAX_FOLDERS];
+    uint16_t mp3Tracks;         // In /mp3: the files not in a numbered folder
+    uint16_t durations[TRACK_CATALOG_MAX_TRACKS];  // TRACK_CATALOG_DURATION_UNIT, 0 = not played yet
+};
+
+// Catalog counters
+struct TrackCatalogStats {
+    uint32_t loadUs;            // Reading and checking the index at boot
+    uint32_t scans;
+    uint32_t queries;           // Sent for scans
+    uint32_t queryTimeouts;
+    uint32_t lastScanMs;
+    uint32_t lengthsLearned;
+    uint32_t saves;
+    uint32_t rejected;          // Index files refused: wrong magic, version, size or checksum
+};
+
+// Function declarations
+void setupTrackCatalog();
+void loopTrackCatalog();
+void rescanTrackCatalog();
+bool isTrackAvailable(uint16_t track);
+uint32_t getTrackDuration(uint16_t track);
+const TrackCatalog& getTrackCatalog();
+const TrackCatalogStats& getTrackCatalogStats();
+String getTrackCatalogJSON();
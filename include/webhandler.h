@@ -7,9 +7,8 @@
 // Web server configuration
 #define WEB_SERVER_PORT 80
 #define WIFI_TIMEOUT 60000  // 1 minute
-#define WIFI_CONFIG_FILE "/wifi.conf"
 
-// WiFi credentials structure
+// WiFi credentials: the "wifi" section of gong.conf, {"ssid", "password", "configured"}
 struct WiFiConfig {
     char ssid[32];
     char password[64];
@@ -30,23 +29,72 @@ void handleDeleteSchedule();
 void handleDeleteScheduleById();
 void handlePlay();
 void handlePlayLoRa();
+void handleStop();
+void handleVolume();
+void handleSetVolume();
 void handleWiFiConfig();
 void handleWiFiSave();
 void handleWiFiReset();
 void handleWiFiStatus();
+void handleSyncStatus();
+void handleNodes();
+void handleLoRaStats();
+void handleOtaUpload();
+void handleOtaUploadDone();
+void handleOtaStart();
+void handleOtaCancel();
+void handleOtaStatus();
+void handleLoRaCapture();
+void handleLoRaCaptureControl();
+void handleMP3Status();
+void handleGongPrograms();
+void handleGongSynth();
+void handleTracks();
+void handleTracksRescan();
+void handleTasks();
+void handleEvents();
+void handleLog();
+void handleLogConfig();
+void handleLogConfigSave();
+void handleProfile();
+void handleProfileReset();
+void handlePower();
+void handleBoot();
+void handleHealth();
+void handleConfig();
+void handleConfigSave();
 void handleNotFound();
 bool isWiFiConnected();
+bool isWiFiAPMode();
+bool isWiFiConfigured();
+bool setWiFiSleep(bool sleep);
 String getWiFiStatus();
 
 // WiFi configuration functions
 bool loadWiFiConfig();
+void applyWiFiConfig();
 bool saveWiFiConfig(const String& ssid, const String& password);
-void resetWiFiConfig();
+bool resetWiFiConfig();
 
 // External functions
-extern void playGong();
-extern void sendGongLoRa();
+extern bool hasGongProgramTracks(const String& name);
+extern int8_t findGongProgramIndex(const String& name);
+extern String getGongProgramsJSON();
+extern bool isGongSynthEnabled();
+extern String getGongSynthJSON();
+extern bool isTrackAvailable(uint16_t track);
+extern String getTrackCatalogJSON();
 extern String getScheduleJSON();
-extern bool addScheduleEntry(uint8_t hour, uint8_t minute, const String& description);
+extern String getVolumeProfileJSON();
+extern bool addScheduleEntry(uint8_t hour, uint8_t minute, const String& description, uint32_t zones,
+                             const String& program, uint8_t volume, uint16_t fadeIn);
 extern bool deleteScheduleEntry(uint32_t id);
-extern bool editScheduleEntry(uint32_t id, uint8_t hour, uint8_t minute, const String& description, bool enabled);
+extern bool editScheduleEntry(uint32_t id, uint8_t hour, uint8_t minute, const String& description, bool enabled,
+                              uint32_t zones, const String& program, uint8_t volume, uint16_t fadeIn);
+extern String getScheduleSyncJSON();
+extern String getNodeTableJSON();
+extern String getLoRaStatsJSON();
+extern bool isLoRaOtaActive();
+extern String getLoRaOtaJSON();
+extern unsigned long getCurrentEpoch();
+extern String getMP3StatusJSON();
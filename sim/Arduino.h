@@ -0,0 +1,250 @@
+#pragma once
+
+// Host stand-in for the parts of the ESP32 Arduino core the LoRa stack uses.
+// Time comes from the simulator clock, and ESP.getEfuseMac() from the
+// virtual node currently running.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
+#include <string>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define IRAM_ATTR
+#define __NOINIT_ATTR
+#define HEX 16
+#define DEC 10
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 5
+#define RISING 1
+#define FALLING 2
+#define CHANGE 3
+#define SERIAL_8N1 0x800001c
+
+// Kept out of the global namespace so firmware calls taking a String do not
+// pull the simulator's global dispatchers into overload resolution
+namespace arduino {
+
+class String {
+public:
+    String() {}
+    String(const char* text) : value(text ? text : "") {}
+    String(const std::string& text) : value(text) {}
+    explicit String(char c) : value(1, c) {}
+    String(int number, unsigned char base = DEC) { format(number, base); }
+    String(unsigned int number, unsigned char base = DEC) { formatUnsigned(number, base); }
+    String(long number, unsigned char base = DEC) { format(number, base); }
+    String(unsigned long number, unsigned char base = DEC) { formatUnsigned(number, base); }
+    String(unsigned char number, unsigned char base = DEC) { formatUnsigned(number, base); }
+    String(float number, unsigned char decimals = 2) { formatFloat(number, decimals); }
+    String(double number, unsigned char decimals = 2) { formatFloat(number, decimals); }
+    
+    const char* c_str() const { return value.c_str(); }
+    unsigned int length() const { return value.size(); }
+    bool reserve(unsigned int size) { value.reserve(size); return true; }
+    char charAt(unsigned int index) const { return index < value.size() ? value[index] : 0; }
+    char operator[](unsigned int index) const { return charAt(index); }
+    char& operator[](unsigned int index) { return value[index]; }
+    
+    int indexOf(char c, unsigned int from = 0) const { return position(value.find(c, from)); }
+    int indexOf(const String& text, unsigned int from = 0) const { return position(value.find(text.value, from)); }
+    int lastIndexOf(char c) const { return position(value.rfind(c)); }
+    String substring(unsigned int from) const { return from < value.size() ? String(value.substr(from)) : String(); }
+    String substring(unsigned int from, unsigned int to) const {
+        return from < value.size() && to > from ? String(value.substr(from, to - from)) : String();
+    }
+    bool startsWith(const String& prefix) const { return value.compare(0, prefix.value.size(), prefix.value) == 0; }
+    long toInt() const { return atol(value.c_str()); }
+    
+    bool concat(const char* text) { value += text; return true; }
+    bool concat(const char* text, unsigned int length) { value.append(text, length); return true; }
+    bool concat(const String& text) { value += text.value; return true; }
+    bool concat(char c) { value += c; return true; }
+    String& operator+=(const String& text) { value += text.value; return *this; }
+    String& operator+=(const char* text) { value += text; return *this; }
+    String& operator+=(char c) { value += c; return *this; }
+    String& operator+=(int number) { value += String(number).value; return *this; }
+    String& operator+=(unsigned int number) { value += String(number).value; return *this; }
+    String& operator+=(long number) { value += String(number).value; return *this; }
+    String& operator+=(unsigned long number) { value += String(number).value; return *this; }
+    
+    bool operator==(const String& other) const { return value == other.value; }
+    bool operator==(const char* other) const { return value == other; }
+    bool operator!=(const String& other) const { return value != other.value; }
+    bool operator!=(const char* other) const { return value != other; }
+    bool operator<(const String& other) const { return value < other.value; }
+    
+    const std::string& str() const { return value; }
+
+private:
+    std::string value;
+    
+    static int position(size_t index) { return index == std::string::npos ? -1 : (int)index; }
+    void format(long number, unsigned char base) {
+        char buffer[24];
+        if (base == HEX) snprintf(buffer, sizeof(buffer), "%lx", number);
+        else snprintf(buffer, sizeof(buffer), "%ld", number);
+        value = buffer;
+    }
+    void formatUnsigned(unsigned long number, unsigned char base) {
+        char buffer[24];
+        snprintf(buffer, sizeof(buffer), base == HEX ? "%lx" : "%lu", number);
+        value = buffer;
+    }
+    void formatFloat(double number, unsigned char decimals) {
+        char buffer[48];
+        snprintf(buffer, sizeof(buffer), "%.*f", decimals, number);
+        value = buffer;
+    }
+};
+
+// Result type of String concatenation in the Arduino core; ArduinoJson names it
+class StringSumHelper : public String {
+public:
+    StringSumHelper(const String& text) : String(text) {}
+};
+
+inline StringSumHelper operator+(const String& left, const String& right) { String r(left); r += right; return r; }
+inline StringSumHelper operator+(const String& left, const char* right) { String r(left); r += right; return r; }
+inline StringSumHelper operator+(const char* left, const String& right) { String r(left); r += right; return r; }
+inline StringSumHelper operator+(const String& left, char right) { String r(left); r += right; return r; }
+
+} // namespace arduino
+
+using arduino::String;
+using arduino::StringSumHelper;
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+        size_t n = 0;
+        while (size--) n += write(*buffer++);
+        return n;
+    }
+    size_t print(const String& text) { return write((const uint8_t*)text.c_str(), text.length()); }
+    size_t print(const char* text) { return write((const uint8_t*)text, strlen(text)); }
+    size_t println(const String& text) { return print(text) + print("\n"); }
+    size_t println(const char* text = "") { return print(text) + print("\n"); }
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    void flush() {}
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    size_t readBytes(char* buffer, size_t length) {
+        size_t count = 0;
+        while (count < length && available()) buffer[count++] = (char)read();
+        return count;
+    }
+    size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*)buffer, length); }
+    String readString() {
+        String text;
+        while (available()) text += (char)read();
+        return text;
+    }
+    void setTimeout(unsigned long) {}
+};
+
+// UART 0 is the Serial output of all virtual nodes, prefixed with the node
+// and quiet unless verbose. The other UARTs go to the simulated device
+// attached with simAttachUart(), if any.
+class HardwareSerial : public Stream {
+public:
+    HardwareSerial(int uart = 0) : uart(uart) {}
+    void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int rxPin = -1, int txPin = -1) {}
+    size_t setTxBufferSize(size_t size) { return size; }
+    int availableForWrite() { return 4096; }
+    using Print::write;
+    size_t write(uint8_t c) override;
+    int available() override;
+    int read() override;
+    int peek() override;
+
+private:
+    int uart;
+};
+
+// A device on the far end of a simulated UART
+struct SimUartDevice {
+    void (*receive)(uint8_t c);     // Byte from the firmware
+    int (*available)();             // Bytes for the firmware that have arrived by now
+    int (*read)();
+    int (*peek)();
+};
+
+extern HardwareSerial Serial;
+
+class EspClass {
+public:
+    uint64_t getEfuseMac();
+    uint32_t getFreeHeap() { return 200000; }
+    uint32_t getCycleCount();       // Host time, not simulated time, at getCpuFrequencyMhz()
+    void restart();
+};
+
+extern EspClass ESP;
+
+unsigned long millis();
+unsigned long micros();
+uint32_t getCpuFrequencyMhz();
+void delay(unsigned long ms);
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+int digitalRead(uint8_t pin);
+void simAttachUart(int uart, const SimUartDevice* device);
+void simSetPinReader(int (*reader)(uint8_t pin));
+void simPinChanged(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*isr)(), int mode);
+void detachInterrupt(uint8_t pin);
+inline uint8_t digitalPinToInterrupt(uint8_t pin) { return pin; }
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+// As FreeRTOS's spinlocks; every node runs on the one simulator thread
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) (void)(mux)
+#define portEXIT_CRITICAL(mux) (void)(mux)
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+bool setCpuFrequencyMhz(uint32_t mhz);
+
+// As esp_system.h; every simulated boot is a power-on
+typedef enum {
+    ESP_RST_UNKNOWN,
+    ESP_RST_POWERON,
+} esp_reset_reason_t;
+esp_reset_reason_t esp_reset_reason();
+
+// newlib has strlcpy; glibc only from 2.38
+#if defined(__GLIBC__) && __GLIBC__ == 2 && __GLIBC_MINOR__ < 38
+inline size_t strlcpy(char* dest, const char* src, size_t size) {
+    size_t length = strlen(src);
+    if (size) {
+        size_t copied = length < size - 1 ? length : size - 1;
+        memcpy(dest, src, copied);
+        dest[copied] = 0;
+    }
+    return length;
+}
+#endif
+
+template <typename T> inline T min(T a, T b) { return b < a ? b : a; }
+template <typename T> inline T max(T a, T b) { return a < b ? b : a; }
+#define constrain(a, l, h) ((a) < (l) ? (l) : ((a) > (h) ? (h) : (a)))
+#define PI 3.1415926535897932384626433832795
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Per-node files: gong.conf comes from the node configuration, anything
+// the firmware writes is kept in memory for that node
+namespace fs {
+
+class File : public Stream {
+public:
+    File() {}
+    File(const std::string& content) : data(content), valid(true) {}
+    File(std::string* target, bool append = false) : valid(true), target(target) {
+        if (!append) target->clear();
+    }
+    
+    operator bool() const { return valid; }
+    void close() { valid = false; }
+    size_t size() const { return data.size(); }
+    int available() override { return (int)(data.size() - offset); }
+    int read() override { return offset < data.size() ? (uint8_t)data[offset++] : -1; }
+    int peek() override { return offset < data.size() ? (uint8_t)data[offset] : -1; }
+    size_t read(uint8_t* buffer, size_t length) { return readBytes(buffer, length); }
+    bool seek(uint32_t position) {
+        if (position > data.size()) return false;
+        offset = position;
+        return true;
+    }
+    using Print::write;
+    size_t write(uint8_t c) override {
+        if (!target) return 0;
+        *target += (char)c;
+        return 1;
+    }
+
+private:
+    std::string data;
+    size_t offset = 0;
+    bool valid = false;
+    std::string* target = nullptr;     // Written file, open for writing
+};
+
+class FS {
+public:
+    bool begin(bool formatOnFail = false) { return true; }
+    bool exists(const char* path);
+    bool exists(const String& path) { return exists(path.c_str()); }
+    File open(const char* path, const char* mode = "r");
+    File open(const String& path, const char* mode = "r") { return open(path.c_str(), mode); }
+    bool remove(const char* path);
+    bool remove(const String& path) { return remove(path.c_str()); }
+};
+
+} // namespace fs
+
+using fs::File;
+using fs::FS;
@@ -0,0 +1,4 @@
+#pragma once
+
+// HardwareSerial is declared in Arduino.h, as in the ESP32 core
+#include <Arduino.h>
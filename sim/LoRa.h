@@ -0,0 +1,46 @@
+#pragma once
+
+#include <Arduino.h>
+
+#define PA_OUTPUT_RFO_PIN 0
+#define PA_OUTPUT_PA_BOOST_PIN 1
+
+// Same API as sandeepmistry/LoRa, less the interrupt callbacks the firmware
+// does not use. Every call goes to the simulated radio of the virtual node
+// the simulator is currently running (see lorasim.h).
+class LoRaClass : public Stream {
+public:
+    void setPins(int ss, int reset, int dio0) {}
+    int begin(long frequency);
+    void end();
+    
+    int beginPacket(int implicitHeader = false);
+    int endPacket(bool async = false);
+    size_t write(uint8_t byte) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    
+    int parsePacket(int size = 0);
+    int packetRssi();
+    float packetSnr();
+    long packetFrequencyError() { return 0; }  // The channel model has no oscillator offsets
+    int available() override;
+    int read() override;
+    int peek() override;
+    
+    void receive(int size = 0);
+    void channelActivityDetection();
+    void idle();
+    void sleep();
+    
+    void setTxPower(int level, int outputPin = PA_OUTPUT_PA_BOOST_PIN);
+    void setFrequency(long frequency);
+    void setSpreadingFactor(int sf);
+    void setSignalBandwidth(long sbw);
+    void setCodingRate4(int denominator);
+    void setPreambleLength(long length);
+    void setSyncWord(int sw);
+    void enableCrc() {}
+    void disableCrc() {}
+};
+
+extern LoRaClass LoRa;
@@ -0,0 +1,17 @@
+#pragma once
+
+// Host stand-in for the ESP32 Update library: each node writes into a
+// buffer that ESP.restart() turns into the image the node runs (see simota.cpp)
+#include <Arduino.h>
+
+class UpdateClass {
+public:
+    bool begin(size_t size);
+    size_t write(uint8_t* data, size_t length);
+    bool end(bool evenIfRemaining = false);
+    void abort();
+    bool isRunning();
+    const char* errorString();
+};
+
+extern UpdateClass Update;
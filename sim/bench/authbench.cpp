@@ -0,0 +1,265 @@
+// Frame authentication benchmark: checks the CMAC against the RFC 4493
+// vectors, the replay window against replayed and reordered frames, and
+// replays across a reset and a key change; then measures sign/verify time
+// per frame size and the airtime the trailer adds; last, that a full sender
+// table refuses a new sender instead of forgetting an old one.
+//
+//   authbench [--iterations n]
+#include <chrono>
+#include <vector>
+#include "frameauth.h"
+#include "lorahandler.h"
+#include "lorasim.h"
+#include "benchcheck.h"
+#include <SPIFFS.h>
+
+#define BENCH_KEY "2b7e151628aed2a6abf7158809cf4f3c"    // RFC 4493 example key
+#define BENCH_OTHER_KEY "000102030405060708090a0b0c0d0e0f"
+
+uint16_t benchNodeId = 0x1000;
+
+// The one lorahandler.cpp function frameauth.cpp uses
+uint16_t getLoRaNodeId() {
+    return benchNodeId;
+}
+
+size_t parseHex(const char* hex, uint8_t* out) {
+    size_t length = strlen(hex) / 2;
+    for (size_t i = 0; i < length; i++) {
+        char byteHex[3] = {hex[i * 2], hex[i * 2 + 1], 0};
+        out[i] = strtoul(byteHex, NULL, 16);
+    }
+    return length;
+}
+
+void checkCmacVectors() {
+    // RFC 4493 section 4
+    static const char* message =
+        "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+        "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710";
+    static const size_t lengths[] = {0, 16, 40, 64};
+    static const char* macs[] = {
+        "bb1d6929e95937287fa37d129b756746",
+        "070a16b46b4d4144f79bdd9dd04a287c",
+        "dfa66747de9ae63030ca32611497c827",
+        "51f0bebf7e3b9d92fc49741779363cfe",
+    };
+    
+    uint8_t data[64];
+    parseHex(message, data);
+    printf("AES-CMAC, RFC 4493 vectors:\n");
+    for (uint8_t i = 0; i < 4; i++) {
+        uint8_t expected[16];
+        uint8_t mac[16];
+        parseHex(macs[i], expected);
+        computeFrameAuthCmac(data, lengths[i], mac);
+        
+        char what[48];
+        snprintf(what, sizeof(what), "%u-byte message", (unsigned)lengths[i]);
+        check(memcmp(mac, expected, 16) == 0, what);
+    }
+}
+
+size_t makeFrame(uint8_t* frame, const char* text) {
+    size_t length = strlen(text);
+    memcpy(frame, text, length);
+    return signLoRaFrame(frame, length);
+}
+
+void checkReplayWindow() {
+    uint8_t frames[40][LORA_MAX_PACKET];
+    size_t lengths[40];
+    for (uint8_t i = 0; i < 40; i++) {
+        lengths[i] = makeFrame(frames[i], "1:{\"type\":\"gong\"}");
+    }
+    
+    printf("\nReplay window (%u counters):\n", FRAME_AUTH_REPLAY_WINDOW);
+    check(verifyLoRaFrame(frames[1], lengths[1]) == (int)lengths[1] - FRAME_AUTH_TRAILER_BYTES,
+          "signed frame accepted, trailer stripped");
+    check(verifyLoRaFrame(frames[1], lengths[1]) < 0, "same frame again rejected");
+    check(verifyLoRaFrame(frames[0], lengths[0]) >= 0, "older unseen frame accepted once");
+    check(verifyLoRaFrame(frames[0], lengths[0]) < 0, "older frame replayed rejected");
+    check(verifyLoRaFrame(frames[36], lengths[36]) >= 0, "frame after a gap accepted");
+    check(verifyLoRaFrame(frames[3], lengths[3]) < 0, "frame below the window rejected");
+    check(verifyLoRaFrame(frames[5], lengths[5]) >= 0, "skipped frame inside the window accepted");
+    
+    uint8_t tampered[LORA_MAX_PACKET];
+    memcpy(tampered, frames[37], lengths[37]);
+    tampered[5] ^= 0x01;
+    check(verifyLoRaFrame(tampered, lengths[37]) < 0, "flipped payload bit rejected");
+    memcpy(tampered, frames[37], lengths[37]);
+    tampered[lengths[37] - FRAME_AUTH_TRAILER_BYTES + 2] ^= 0x01;
+    check(verifyLoRaFrame(tampered, lengths[37]) < 0, "rewritten counter rejected");
+    check(verifyLoRaFrame((const uint8_t*)"1:{\"type\":\"gong\"}", 17) < 0, "unsigned frame rejected");
+    
+    // Another sender's counters are tracked on their own
+    benchNodeId = 0x2000;
+    uint8_t other[LORA_MAX_PACKET];
+    size_t otherLength = makeFrame(other, "3:H");
+    check(verifyLoRaFrame(other, otherLength) >= 0, "second sender, own window");
+    check(verifyLoRaFrame(frames[37], lengths[37]) >= 0, "first sender unaffected");
+    benchNodeId = 0x1000;
+}
+
+void resetFrameAuth() {
+    // As a reset or power loss: what is only in RAM is gone, SPIFFS stays
+    setupFrameAuth("");
+    setupFrameAuth(BENCH_KEY);
+}
+
+void checkReset() {
+    printf("\nAcross a reset:\n");
+    uint8_t frames[4][LORA_MAX_PACKET];
+    size_t lengths[4];
+    for (uint8_t i = 0; i < 4; i++) {
+        lengths[i] = makeFrame(frames[i], "1:{\"type\":\"gong\"}");
+    }
+    
+    // A gong is acted on once its counter is stored, as the radio task does
+    check(verifyLoRaFrame(frames[2], lengths[2]) >= 0, "gong accepted");
+    uint32_t saves = getFrameAuthStats().senderSaves;
+    persistFrameAuthSenders(false);
+    check(getFrameAuthStats().senderSaves == saves + 1, "counters stored after a minute or more");
+    persistFrameAuthSenders(true);
+    check(getFrameAuthStats().senderSaves == saves + 1, "nothing stored again while unchanged");
+    check(verifyLoRaFrame(frames[3], lengths[3]) >= 0, "next gong accepted");
+    persistFrameAuthSenders(false);
+    check(getFrameAuthStats().senderSaves == saves + 1, "other frames wait for the interval");
+    persistFrameAuthSenders(true);
+    check(getFrameAuthStats().senderSaves == saves + 2, "a gong's counter stored at once");
+    
+    resetFrameAuth();
+    check(verifyLoRaFrame(frames[3], lengths[3]) < 0, "gong replayed after a reset rejected");
+    check(verifyLoRaFrame(frames[2], lengths[2]) < 0, "earlier gong replayed after a reset rejected");
+    check(verifyLoRaFrame(frames[0], lengths[0]) < 0, "older unseen frame rejected after a reset");
+    uint8_t next[LORA_MAX_PACKET];
+    size_t nextLength = makeFrame(next, "1:{\"type\":\"gong\"}");
+    check(verifyLoRaFrame(next, nextLength) >= 0, "new frame from the sender accepted");
+    
+    // A damaged file: the sender starts over, and says so
+    File file = SPIFFS.open(FRAME_AUTH_SENDERS_FILE, "w");
+    file.print("damaged");
+    file.close();
+    resetFrameAuth();
+    check(verifyLoRaFrame(frames[1], lengths[1]) >= 0, "damaged counters file ignored");
+    
+    // A sender whose SPIFFS was erased counts from the start again, which only a new key lets through
+    persistFrameAuthSenders(true);
+    file = SPIFFS.open(FRAME_AUTH_COUNTER_FILE, "r");
+    String reserved = file.readString();
+    file.close();
+    SPIFFS.remove(FRAME_AUTH_COUNTER_FILE);
+    resetFrameAuth();
+    check(verifyLoRaFrame(next, makeFrame(next, "3:H")) < 0, "sender with erased SPIFFS rejected");
+    setupFrameAuth(BENCH_OTHER_KEY);
+    check(verifyLoRaFrame(next, makeFrame(next, "3:H")) >= 0, "same sender accepted under a new key");
+    
+    file = SPIFFS.open(FRAME_AUTH_COUNTER_FILE, "w");
+    file.print(reserved);
+    file.close();
+    resetFrameAuth();
+}
+
+void checkFullTable() {
+    printf("\nSender table (%u senders):\n", FRAME_AUTH_MAX_SENDERS);
+    
+    // More senders of one frame each than there is room for
+    uint32_t accepted = 0;
+    std::vector<uint8_t> frame(LORA_MAX_PACKET);
+    for (benchNodeId = 0x4000; benchNodeId < 0x4000 + FRAME_AUTH_MAX_SENDERS; benchNodeId++) {
+        accepted += verifyLoRaFrame(frame.data(), makeFrame(frame.data(), "3:H")) >= 0;
+    }
+    uint32_t refused = getFrameAuthStats().rejectedFull;
+    check(refused > 0 && accepted + refused == FRAME_AUTH_MAX_SENDERS, "new senders refused once the table is full");
+    
+    benchNodeId = 0x1000;
+    size_t length = makeFrame(frame.data(), "1:{\"type\":\"gong\"}");
+    check(verifyLoRaFrame(frame.data(), length) >= 0, "known sender still accepted");
+    check(verifyLoRaFrame(frame.data(), length) < 0, "known sender's replay still rejected");
+}
+
+void benchmarkFrame(const char* name, size_t textLength, uint32_t iterations) {
+    uint8_t frame[LORA_MAX_PACKET];
+    memset(frame, 'x', textLength);
+    frame[0] = '2';
+    frame[1] = ':';
+    
+    auto start = std::chrono::steady_clock::now();
+    size_t length = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        length = signLoRaFrame(frame, textLength);
+    }
+    double signNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+    
+    // Each signed frame verifies once; the copies keep the replay window from rejecting them
+    benchNodeId++;
+    std::vector<std::vector<uint8_t>> copies(iterations);
+    for (uint32_t i = 0; i < iterations; i++) {
+        signLoRaFrame(frame, textLength);
+        copies[i].assign(frame, frame + length);
+    }
+    start = std::chrono::steady_clock::now();
+    uint32_t accepted = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        accepted += verifyLoRaFrame(copies[i].data(), length) >= 0;
+    }
+    double verifyNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+    
+    size_t blocks = (textLength + 6 + 15) / 16;
+    printf("%-9s %5u %7u %10.2f %10.2f %9s\n", name, (unsigned)textLength, (unsigned)blocks, signNs / 1000,
+           verifyNs / 1000, accepted == iterations ? "ok" : "FAILED");
+    if (accepted != iterations) {
+        benchFailures++;
+    }
+}
+
+void printAirtimeOverhead(size_t textLength) {
+    printf("\nAirtime of a %u-byte gong frame, %u-byte trailer (125 kHz, CR 4/%d):\n", (unsigned)textLength,
+           FRAME_AUTH_TRAILER_BYTES, LORA_CODING_RATE);
+    printf("%-4s %10s %10s %10s %8s\n", "SF", "plain ms", "signed ms", "added ms", "added");
+    for (int sf = 7; sf <= 12; sf++) {
+        uint32_t plain = simAirtimeUs(textLength, sf, LORA_BANDWIDTH, LORA_CODING_RATE, LORA_PREAMBLE_LENGTH);
+        uint32_t signedUs = simAirtimeUs(textLength + FRAME_AUTH_TRAILER_BYTES, sf, LORA_BANDWIDTH,
+                                         LORA_CODING_RATE, LORA_PREAMBLE_LENGTH);
+        printf("SF%-2d %10.1f %10.1f %10.1f %7.1f%%\n", sf, plain / 1000.0, signedUs / 1000.0,
+               (signedUs - plain) / 1000.0, 100.0 * (signedUs - plain) / plain);
+    }
+}
+
+int main(int argc, char** argv) {
+    uint32_t iterations = 100000;
+    if (argc == 3 && strcmp(argv[1], "--iterations") == 0) {
+        iterations = max(atoi(argv[2]), 1);
+    } else if (argc != 1) {
+        fprintf(stderr, "usage: authbench [--iterations n]\n");
+        return 1;
+    }
+    
+    SimChannelConfig config = {};
+    simInit(config, 1);
+    if (!isFrameAuthKeyValid(BENCH_KEY)) {
+        fprintf(stderr, "Bad benchmark key\n");
+        return 1;
+    }
+    setupFrameAuth(BENCH_KEY);
+    
+    checkCmacVectors();
+    checkReplayWindow();
+    simAdvance(FRAME_AUTH_SENDERS_SAVE_MS * 1000ULL);
+    checkReset();
+    
+    // Same payload sendGongLoRa() produces
+    const char* gong = "1:{\"type\":\"gong\",\"timestamp\":4294967295,\"device\":\"ESP32_Gong\"}";
+    
+    printf("\nHost software AES, %u frames each (the ESP32 runs the blocks on its AES unit):\n", iterations);
+    printf("%-9s %5s %7s %10s %10s %9s\n", "frame", "bytes", "blocks", "sign us", "verify us", "verified");
+    benchmarkFrame("heartbeat", 60, iterations);
+    benchmarkFrame("gong", strlen(gong), iterations);
+    benchmarkFrame("fragment", 180, iterations);
+    benchmarkFrame("maximum", LORA_MAX_PACKET - FRAME_AUTH_TRAILER_BYTES, iterations);
+    
+    printAirtimeOverhead(strlen(gong));
+    checkFullTable();
+    
+    return finishBenchChecks();
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+// Pass/fail lines shared by the host benches. Each check prints one line;
+// main() ends with finishBenchChecks(), whose result is the exit status.
+#include <stdio.h>
+
+inline int benchFailures = 0;
+
+inline void check(bool ok, const char* what) {
+    printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok) {
+        benchFailures++;
+    }
+}
+
+inline int finishBenchChecks() {
+    printf("\n%s\n", benchFailures ? "FAILED" : "All checks passed");
+    return benchFailures ? 1 : 0;
+}
@@ -0,0 +1,206 @@
+// Track catalog benchmark: runs src/trackcatalog.cpp and the MP3 driver
+// against the simulated MP3-TF-16P (sim/dfplayersim.h). It scans a card on
+// first boot, learns track lengths from BUSY, reboots from the index on
+// flash without scanning again, refuses a damaged index, rescans a swapped
+// card with the same file count, and checks that gong programs start only
+// on tracks the card has, and are kept while it does not.
+//
+//   catalogbench [--tracks n] [--folders n]
+#include <string>
+#include "trackcatalog.h"
+#include "gongprogram.h"
+#include "mp3handler.h"
+#include "dfplayersim.h"
+#include "lorasim.h"
+#include "benchcheck.h"
+#include <SPIFFS.h>
+
+#define BENCH_UART 2
+
+void runFor(uint32_t ms) {
+    for (uint32_t i = 0; i < ms; i++) {
+        loopMP3();
+        loopTrackCatalog();
+        simAdvance(1000);
+    }
+}
+
+bool runUntilState(uint8_t state, uint32_t maxMs) {
+    for (uint32_t i = 0; i < maxMs && getTrackCatalog().state != state; i++) {
+        runFor(1);
+    }
+    return getTrackCatalog().state == state;
+}
+
+std::string readIndex() {
+    File file = SPIFFS.open(TRACK_CATALOG_FILE, "r");
+    std::string content;
+    while (file && file.available()) {
+        content += (char)file.read();
+    }
+    return content;
+}
+
+void writeIndex(const std::string& content) {
+    File file = SPIFFS.open(TRACK_CATALOG_FILE, "w");
+    file.write((const uint8_t*)content.data(), content.size());
+    file.close();
+}
+
+void boot(const SimDFPlayerConfig& config) {
+    // Module and firmware power up together
+    simDFPlayerStart(BENCH_UART, config);
+    setupMP3();
+    setupTrackCatalog();
+}
+
+void checkFirstBoot(const SimDFPlayerConfig& config) {
+    printf("First boot (%u tracks in /mp3, %u folders of %u):\n", config.tracks, config.folders,
+           config.folderTracks);
+    boot(config);
+    check(getTrackCatalog().state == TRACK_CATALOG_UNKNOWN && isTrackAvailable(config.tracks + 1),
+          "no index: nothing ruled out");
+    check(runUntilState(TRACK_CATALOG_VALID, 10000), "card scanned");
+    
+    const TrackCatalog& catalog = getTrackCatalog();
+    bool folders = catalog.folderCount == config.folders;
+    for (uint8_t i = 0; i < catalog.folderCount; i++) {
+        folders = folders && catalog.folderTracks[i] == config.folderTracks;
+    }
+    check(catalog.totalTracks == config.tracks + config.folders * config.folderTracks && folders,
+          "files and folders counted");
+    check(catalog.mp3Tracks == config.tracks, "tracks in /mp3 worked out");
+    check(getTrackCatalogStats().queries == 1u + config.folders, "one query per folder");
+    uint16_t lengths = min(config.tracks, (uint16_t)TRACK_CATALOG_MAX_TRACKS);
+    check(readIndex().size() == 16u + 2 * (config.folders + lengths), "index written");
+    check(isTrackAvailable(config.tracks) && !isTrackAvailable(config.tracks + 1) && !isTrackAvailable(0),
+          "tracks beyond the card refused");
+    printf("  scan: %u ms, %u queries; index: %zu bytes\n", getTrackCatalogStats().lastScanMs,
+           getTrackCatalogStats().queries, readIndex().size());
+}
+
+void checkLengths(const SimDFPlayerConfig& config) {
+    printf("\nTrack lengths:\n");
+    for (uint16_t track = 1; track <= 2; track++) {
+        playTrack(track);
+        runFor(config.busyDelayUs / 1000 + config.trackMs + 100);
+    }
+    uint32_t length = getTrackDuration(1);
+    check(length + TRACK_CATALOG_DURATION_UNIT >= config.trackMs &&
+          length <= config.trackMs + TRACK_CATALOG_DURATION_UNIT, "length learned from BUSY");
+    check(getTrackDuration(2) == length && getTrackDuration(3) == 0, "only tracks that played");
+    
+    // Written between strikes, at most every TRACK_CATALOG_SAVE_INTERVAL
+    uint32_t saves = getTrackCatalogStats().saves;
+    runFor(1000);
+    check(getTrackCatalogStats().saves == saves, "not written at once");
+    runFor(TRACK_CATALOG_SAVE_INTERVAL);
+    check(getTrackCatalogStats().saves == saves + 1, "written after the save interval");
+    printf("  track 1: %u ms, the simulated module plays %u ms\n", length, config.trackMs);
+}
+
+void checkReboot(const SimDFPlayerConfig& config) {
+    printf("\nReboot:\n");
+    uint32_t scans = getTrackCatalogStats().scans;
+    uint32_t queries = getTrackCatalogStats().queries;
+    uint32_t length = getTrackDuration(1);
+    boot(config);
+    check(getTrackCatalog().state == TRACK_CATALOG_CACHED && getTrackCatalog().mp3Tracks == config.tracks &&
+          !isTrackAvailable(config.tracks + 1), "catalog from flash at once");
+    check(getTrackDuration(1) == length, "lengths kept");
+    check(runUntilState(TRACK_CATALOG_VALID, 2000), "confirmed by the track count");
+    runFor(3000);
+    check(getTrackCatalogStats().scans == scans && getTrackCatalogStats().queries == queries, "card not scanned again");
+    printf("  boot: %zu bytes read from flash instead of %u queries to the card\n", readIndex().size(),
+           1 + config.folders);
+    
+    // One flipped bit in the index
+    std::string index = readIndex();
+    index[index.size() - 1] ^= 0x04;
+    writeIndex(index);
+    uint32_t rejected = getTrackCatalogStats().rejected;
+    boot(config);
+    check(getTrackCatalogStats().rejected == rejected + 1 && getTrackCatalog().state == TRACK_CATALOG_UNKNOWN,
+          "damaged index refused");
+    check(runUntilState(TRACK_CATALOG_VALID, 10000) && getTrackCatalogStats().scans == scans + 1,
+          "card scanned instead");
+    check(getTrackDuration(1) == 0, "lengths from the damaged index dropped");
+}
+
+void checkCardChange(const SimDFPlayerConfig& config) {
+    printf("\nCard change:\n");
+    uint32_t scans = getTrackCatalogStats().scans;
+    playTrack(1);
+    runFor(config.busyDelayUs / 1000 + config.trackMs + 100);
+    check(getTrackDuration(1) > 0, "length learned");
+    
+    // As many files, laid out differently: one folder moved into /mp3
+    uint16_t tracks = config.tracks + config.folderTracks;
+    simDFPlayerChangeCard(tracks, config.folders - 1, config.folderTracks);
+    runFor(100);
+    check(getTrackCatalog().state == TRACK_CATALOG_NO_CARD, "card removed");
+    check(runUntilState(TRACK_CATALOG_VALID, 10000) && getTrackCatalogStats().scans == scans + 1,
+          "same file count scanned again");
+    check(getTrackCatalog().mp3Tracks == tracks && isTrackAvailable(tracks) && !isTrackAvailable(tracks + 1),
+          "new layout");
+    check(getTrackDuration(1) == 0, "lengths from the other card dropped");
+    
+    // A rescan asked for by hand finds the same card
+    rescanTrackCatalog();
+    check(runUntilState(TRACK_CATALOG_SCANNING, 1000) && runUntilState(TRACK_CATALOG_VALID, 10000) &&
+          getTrackCatalog().mp3Tracks == tracks, "rescan on request");
+}
+
+void checkPrograms() {
+    printf("\nGong programs:\n");
+    uint16_t tracks = getTrackCatalog().mp3Tracks;
+    const GongProgramStep good[] = {{1, GONG_VOLUME_KEEP, 1, 1000}, {0, GONG_VOLUME_KEEP, 1, 500},
+                                    {tracks, GONG_VOLUME_KEEP, 1, 0}};
+    const GongProgramStep bad[] = {{1, GONG_VOLUME_KEEP, 1, 1000}, {(uint16_t)(tracks + 1), GONG_VOLUME_KEEP, 1, 0}};
+    check(setGongProgram("good", good, 3) && setGongProgram("bad", bad, 2), "programs kept whatever the card holds");
+    check(hasGongProgramTracks("good") && hasGongProgramTracks("elsewhere"), "programs checked against the card");
+    check(!hasGongProgramTracks("bad") && !startGongProgram("bad"), "program with a missing track not started");
+    
+    // A card with fewer tracks leaves the program pointing past its end
+    simDFPlayerChangeCard(tracks - 1, 0, 0);
+    runUntilState(TRACK_CATALOG_SCANNING, 1000);
+    check(runUntilState(TRACK_CATALOG_VALID, 10000) && !hasGongProgramTracks("good") && !startGongProgram("good"),
+          "smaller card: program flagged");
+    
+    // The card back: the same program starts again without being set again
+    simDFPlayerChangeCard(tracks, 0, 0);
+    runUntilState(TRACK_CATALOG_SCANNING, 1000);
+    check(runUntilState(TRACK_CATALOG_VALID, 10000) && hasGongProgramTracks("good") && startGongProgram("good"),
+          "card back: program starts");
+    stopGongProgram();
+}
+
+int main(int argc, char** argv) {
+    SimDFPlayerConfig config;
+    config.tracks = 40;
+    config.folders = 3;
+    config.folderTracks = 2;
+    config.trackMs = 1500;
+    bool usage = argc % 2 == 0;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--tracks") == 0) config.tracks = constrain(atoi(argv[i + 1]), 3, MP3_MAX_TRACK);
+        else if (strcmp(argv[i], "--folders") == 0) config.folders = constrain(atoi(argv[i + 1]), 1,
+                                                                              TRACK_CATALOG_MAX_FOLDERS);
+        else usage = true;
+    }
+    if (usage) {
+        fprintf(stderr, "usage: catalogbench [--tracks n] [--folders n]\n");
+        return 1;
+    }
+    
+    SimChannelConfig channel = {};
+    simInit(channel, 1);
+    
+    checkFirstBoot(config);
+    checkLengths(config);
+    checkReboot(config);
+    checkCardChange(config);
+    checkPrograms();
+    
+    return finishBenchChecks();
+}
@@ -0,0 +1,204 @@
+// Event bus benchmark: checks masks, ordering, full rings, drop counts and
+// wake-ups on one thread, then runs real publisher threads against one
+// subscriber thread. Every event carries its publisher and a sequence
+// number, so lost, duplicated or reordered events are caught, and a
+// steady-clock stamp for the publish-to-handler latency (the bus's own
+// timestamps use the simulated micros()).
+//
+//   eventbench [--events n]
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "eventbus.h"
+#include "benchcheck.h"
+
+#define BENCH_MAX_PUBLISHERS 4
+#define BENCH_TIMEOUT_S 30
+
+// Single-threaded checks
+std::vector<Event> received;
+uint32_t wakes = 0;
+uint32_t wakesFromIsr = 0;
+
+void recordEvent(const Event& event) {
+    received.push_back(event);
+}
+
+void countWake(bool fromIsr) {
+    wakes++;
+    wakesFromIsr += fromIsr;
+}
+
+void checkDelivery() {
+    printf("Delivery:\n");
+    setupEventBus();
+    int8_t gongs = subscribeEvents("gongs", EVENT_MASK(EVENT_GONG_REQUESTED), recordEvent, 0, countWake);
+    int8_t radio = subscribeEvents("radio", EVENT_MASK(EVENT_LORA_FRAME_RECEIVED), nullptr, EVENT_RING_SPSC, nullptr);
+    int8_t both = subscribeEvents("both", EVENT_MASK(EVENT_GONG_REQUESTED) | EVENT_MASK(EVENT_SCHEDULE_CHANGED),
+                                  nullptr, 0, nullptr);
+    
+    check(publishEvent(EVENT_SCHEDULE_CHANGED, EVENT_SOURCE_NONE, 3, 0x1234), "event with one subscriber delivered");
+    check(publishEvent(EVENT_TIME_SYNCED, EVENT_SOURCE_NONE, 0, 0), "event without subscribers accepted");
+    check(!publishEvent(0, EVENT_SOURCE_NONE, 0, 0) && !publishEvent(EVENT_TYPES, EVENT_SOURCE_NONE, 0, 0),
+          "unknown event types refused");
+    check(dispatchEvents(gongs) == 0, "masked subscriber sees nothing");
+    check(dispatchEvents(both) == 1, "subscribed type taken once");
+    check(dispatchEvents(both) == 0, "ring empty afterwards");
+    
+    for (uint16_t i = 0; i < EVENT_RING_SIZE; i++) {
+        publishEvent(EVENT_GONG_REQUESTED, EVENT_SOURCE_WEB, i, 100 + i);
+    }
+    check(wakes == EVENT_RING_SIZE && wakesFromIsr == 0, "subscriber woken once per event");
+    check(!publishEvent(EVENT_GONG_REQUESTED, EVENT_SOURCE_WEB, 99, 0), "full ring refuses the next event");
+    check(getEventSubscriberStats(gongs).dropped == 1 && getEventSubscriberStats(both).dropped == 1,
+          "drop counted per subscriber");
+    check(getEventBusStats().dropped == 1, "drop counted once on the bus");
+    check(wakes == EVENT_RING_SIZE, "no wake-up for a dropped event");
+    
+    check(dispatchEvents(gongs) == EVENT_RING_SIZE, "whole ring taken in one call");
+    bool ordered = received.size() == EVENT_RING_SIZE;
+    for (uint16_t i = 0; ordered && i < EVENT_RING_SIZE; i++) {
+        ordered = received[i].type == EVENT_GONG_REQUESTED && received[i].source == EVENT_SOURCE_WEB &&
+                  received[i].param == i && received[i].value == 100u + i;
+    }
+    check(ordered, "events handled in order, fields intact");
+    check(getEventSubscriberStats(gongs).maxDepth == EVENT_RING_SIZE, "deepest backlog recorded");
+    check(dispatchEvents(both) == EVENT_RING_SIZE, "second subscriber has its own copy");
+    
+    // Many laps round the ring
+    received.clear();
+    for (uint16_t i = 0; i < EVENT_RING_SIZE * 10; i++) {
+        publishEvent(EVENT_GONG_REQUESTED, EVENT_SOURCE_LORA, i, 0);
+        dispatchEvents(gongs);
+    }
+    ordered = received.size() == EVENT_RING_SIZE * 10;
+    for (uint16_t i = 0; ordered && i < received.size(); i++) {
+        ordered = received[i].param == i;
+    }
+    check(ordered, "ten laps round the ring, nothing lost");
+    
+    uint32_t isrWakes = wakesFromIsr;
+    publishEventFromISR(EVENT_GONG_REQUESTED, EVENT_SOURCE_LORA, 0, 0);
+    publishEventFromISR(EVENT_LORA_FRAME_RECEIVED, EVENT_SOURCE_LORA, 42, 0);
+    check(wakesFromIsr == isrWakes + 1, "interrupt publish wakes with fromIsr");
+    check(getEventBusStats().fromIsr == 2, "interrupt publishes counted");
+    check(dispatchEvents(radio) == 1, "single-publisher ring delivers");
+    check(getEventBusStats().published[EVENT_GONG_REQUESTED] == EVENT_RING_SIZE * 11 + 2,
+          "published count includes the refused event");
+    check(dispatchEvents(-1) == 0 && dispatchEvents(MAX_EVENT_SUBSCRIBERS) == 0, "bad subscriber index ignored");
+    
+    for (uint8_t i = 3; i < MAX_EVENT_SUBSCRIBERS; i++) {
+        subscribeEvents("filler", 0, nullptr, 0, nullptr);
+    }
+    check(subscribeEvents("extra", 0, nullptr, 0, nullptr) < 0, "subscriber table full refused");
+}
+
+// Threaded run
+std::atomic<bool> publishersGo;
+uint32_t expectedSequence[BENCH_MAX_PUBLISHERS];
+uint32_t handledEvents = 0;
+uint32_t outOfOrder = 0;
+std::vector<uint32_t> latencies;
+
+uint32_t nowNs() {
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void checkThreadedEvent(const Event& event) {
+    latencies.push_back(nowNs() - event.value);
+    if (event.source >= BENCH_MAX_PUBLISHERS || event.param != (uint16_t)expectedSequence[event.source]) {
+        outOfOrder++;
+    } else {
+        expectedSequence[event.source]++;
+    }
+    handledEvents++;
+}
+
+void publishEvents(uint8_t publisher, uint32_t events, uint64_t* retries) {
+    while (!publishersGo.load()) {
+        std::this_thread::yield();
+    }
+    for (uint32_t i = 0; i < events; i++) {
+        // A full ring refuses the event; publishers here retry instead of losing it
+        while (!publishEvent(EVENT_GONG_REQUESTED, publisher, (uint16_t)i, nowNs())) {
+            (*retries)++;
+            std::this_thread::yield();
+        }
+    }
+}
+
+void runThreaded(const char* name, uint8_t publishers, uint8_t flags, uint32_t events) {
+    setupEventBus();
+    int8_t subscriber = subscribeEvents("bench", EVENT_MASK(EVENT_GONG_REQUESTED), checkThreadedEvent, flags, nullptr);
+    for (uint8_t i = 0; i < BENCH_MAX_PUBLISHERS; i++) {
+        expectedSequence[i] = 0;
+    }
+    handledEvents = 0;
+    outOfOrder = 0;
+    latencies.clear();
+    latencies.reserve((size_t)events * publishers);
+    publishersGo = false;
+    
+    uint64_t retries[BENCH_MAX_PUBLISHERS] = {};
+    std::vector<std::thread> threads;
+    for (uint8_t i = 0; i < publishers; i++) {
+        threads.emplace_back(publishEvents, i, events, &retries[i]);
+    }
+    
+    uint32_t total = events * publishers;
+    auto start = std::chrono::steady_clock::now();
+    publishersGo = true;
+    // A lost event would leave the count short for good
+    while (handledEvents < total &&
+           std::chrono::steady_clock::now() - start < std::chrono::seconds(BENCH_TIMEOUT_S)) {
+        if (dispatchEvents(subscriber) == 0) {
+            std::this_thread::yield();
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    bool drained = dispatchEvents(subscriber) == 0;
+    
+    uint64_t retried = 0;
+    bool complete = true;
+    for (uint8_t i = 0; i < publishers; i++) {
+        retried += retries[i];
+        complete = complete && expectedSequence[i] == events;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    printf("%-6s %4u %12.0f %10.2f %10.2f %10.2f %10.1f%% %6s\n", name, publishers, total / seconds,
+           latencies[latencies.size() / 2] / 1000.0, latencies[latencies.size() * 99 / 100] / 1000.0,
+           latencies.back() / 1000.0, 100.0 * retried / total,
+           complete && outOfOrder == 0 && drained ? "ok" : "FAILED");
+    if (!complete || outOfOrder || !drained) {
+        benchFailures++;
+    }
+}
+
+int main(int argc, char** argv) {
+    uint32_t events = 200000;
+    if (argc == 3 && strcmp(argv[1], "--events") == 0) {
+        events = max(atoi(argv[2]), 1);
+    } else if (argc != 1) {
+        fprintf(stderr, "usage: eventbench [--events n]\n");
+        return 1;
+    }
+    
+    checkDelivery();
+    
+    printf("\n%u events per publisher, %u-event ring, %u host cores:\n", events, EVENT_RING_SIZE,
+           std::thread::hardware_concurrency());
+    printf("%-6s %4s %12s %10s %10s %10s %11s %6s\n", "ring", "pubs", "events/s", "p50 us", "p99 us", "max us",
+           "full", "order");
+    runThreaded("spsc", 1, EVENT_RING_SPSC, events);
+    runThreaded("mpsc", 1, 0, events);
+    runThreaded("mpsc", 2, 0, events);
+    runThreaded("mpsc", 4, 0, events);
+    
+    return finishBenchChecks();
+}
@@ -0,0 +1,358 @@
+// MP3 driver benchmark: runs src/mp3handler.cpp against the simulated
+// MP3-TF-16P (sim/dfplayersim.h) and checks framing, response parsing,
+// ACK/retry/timeout handling, queries and the BUSY-pin playback state
+// machine and volume ramps, then measures command completion over a lossy
+// serial line.
+//
+//   mp3bench [--commands n] [--drop p]
+#include <chrono>
+#include <vector>
+#include "mp3handler.h"
+#include "dfplayersim.h"
+#include "lorasim.h"
+#include "benchcheck.h"
+
+#define BENCH_UART 2
+
+uint32_t benchMaxLoopUs = 0;
+
+// Playback state changes as reported to onMP3Playback
+struct BenchTransition {
+    uint8_t state;
+    uint16_t track;
+    uint64_t atUs;
+};
+std::vector<BenchTransition> benchTransitions;
+
+void recordTransition(uint8_t state, uint16_t track) {
+    benchTransitions.push_back({state, track, simNowUs()});
+}
+
+bool sawStates(const std::vector<uint8_t>& states) {
+    if (benchTransitions.size() != states.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < states.size(); i++) {
+        if (benchTransitions[i].state != states[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void runFor(uint32_t ms) {
+    // loopMP3() once per simulated millisecond, as the main loop would
+    for (uint32_t i = 0; i < ms; i++) {
+        auto start = std::chrono::steady_clock::now();
+        loopMP3();
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        benchMaxLoopUs = max(benchMaxLoopUs,
+                             (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+        simAdvance(1000);
+    }
+}
+
+bool runUntilIdle(uint32_t maxMs) {
+    for (uint32_t i = 0; i < maxMs && !isMP3Idle(); i++) {
+        runFor(1);
+    }
+    return isMP3Idle();
+}
+
+void startPlayer(const SimDFPlayerConfig& config) {
+    simDFPlayerStart(BENCH_UART, config);
+}
+
+void checkFraming() {
+    printf("Framing:\n");
+    // Datasheet example: play track 1, no feedback
+    static const uint8_t play[MP3_FRAME_BYTES] = {0x7E, 0xFF, 0x06, 0x03, 0x00, 0x00, 0x01, 0xFE, 0xF7, 0xEF};
+    uint8_t frame[MP3_FRAME_BYTES];
+    buildMP3Frame(frame, MP3_CMD_PLAY_INDEX, 1, false);
+    check(memcmp(frame, play, MP3_FRAME_BYTES) == 0, "datasheet frame, checksum FEF7");
+    buildMP3Frame(frame, MP3_CMD_PLAY_TRACK, 1234, true);
+    check(frame[5] == 0x04 && frame[6] == 0xD2 && frame[7] == 0xFE && frame[8] == 0x12,
+          "16-bit track number and checksum");
+}
+
+void checkCommands() {
+    printf("\nCommands and queries:\n");
+    SimDFPlayerConfig config;
+    config.tracks = 12;
+    startPlayer(config);
+    setupMP3();
+    check(runUntilIdle(1000), "setup commands answered");
+    check(getMP3Status().online, "module online");
+    check(getMP3Status().trackCount == 12, "track count queried");
+    
+    uint32_t commands = getMP3DriverStats().commands;
+    setVolume(25);
+    playTrack(7);
+    queryMP3Volume();
+    queryMP3Status();
+    check(runUntilIdle(1000), "queued commands answered");
+    check(getMP3DriverStats().commands == commands + 4, "four commands completed");
+    check(simDFPlayerVolume() == 25 && getMP3Status().volume == 25, "volume set and read back");
+    runFor(100);
+    check(isPlaying(), "BUSY low while the track plays");
+    
+    runFor(config.trackMs + 200);
+    check(!isPlaying() && getMP3Status().lastTrackFinished == 7, "track finished reported");
+    
+    uint32_t failed = getMP3DriverStats().failed;
+    uint32_t framesSent = getMP3DriverStats().framesSent;
+    playTrack(11);
+    playTrack(13);
+    check(runUntilIdle(1000), "missing track answered");
+    check(getMP3DriverStats().failed == failed + 1 && getMP3Status().lastError == MP3_ERROR_TRACK_NOT_FOUND,
+          "missing track fails without retry");
+    check(getMP3DriverStats().framesSent == framesSent + 2, "one frame per command");
+    stopPlayback();
+    runUntilIdle(1000);
+    
+    uint32_t queueFull = getMP3DriverStats().queueFull;
+    for (uint8_t i = 0; i <= MP3_QUEUE_SIZE; i++) {
+        queryMP3Status();
+    }
+    check(getMP3DriverStats().queueFull == queueFull + 1, "full queue refuses the extra command");
+    check(runUntilIdle(2000), "queue drained");
+}
+
+void checkParser() {
+    printf("\nResponse parser:\n");
+    uint8_t frame[MP3_FRAME_BYTES];
+    buildMP3Frame(frame, MP3_MSG_TRACK_FINISHED, 2, false);
+    
+    // Half a frame: the loop must return without waiting for the rest
+    uint32_t received = getMP3DriverStats().framesReceived;
+    simDFPlayerInject(frame, 5);
+    runFor(20);
+    check(getMP3DriverStats().framesReceived == received, "partial frame left pending");
+    simDFPlayerInject(frame + 5, 5);
+    runFor(20);
+    check(getMP3DriverStats().framesReceived == received + 1 && getMP3Status().lastTrackFinished == 2,
+          "frame completed by later bytes");
+    
+    // Noise, a damaged frame, a truncated one, then a good one
+    static const uint8_t noise[] = {0x00, 0xEF, 0x13};
+    uint8_t damaged[MP3_FRAME_BYTES];
+    buildMP3Frame(damaged, MP3_MSG_TRACK_FINISHED, 9, false);
+    damaged[6] ^= 0x40;
+    buildMP3Frame(frame, MP3_MSG_TRACK_FINISHED, 3, false);
+    uint32_t badFrames = getMP3DriverStats().badFrames;
+    simDFPlayerInject(noise, sizeof(noise));
+    simDFPlayerInject(damaged, MP3_FRAME_BYTES);
+    check(getMP3DriverStats().badFrames == badFrames, "noise skipped");
+    runFor(50);
+    check(getMP3DriverStats().badFrames == badFrames + 1 && getMP3Status().lastTrackFinished == 2,
+          "damaged frame rejected");
+    simDFPlayerInject(damaged, 4);
+    simDFPlayerInject(frame, MP3_FRAME_BYTES);
+    runFor(50);
+    check(getMP3DriverStats().badFrames == badFrames + 2 && getMP3Status().lastTrackFinished == 3,
+          "resynchronized after a truncated frame");
+}
+
+void checkRecovery() {
+    printf("\nRetries and timeouts:\n");
+    SimDFPlayerConfig config;
+    config.bootMs = 300;
+    startPlayer(config);
+    uint32_t retries = getMP3DriverStats().retries;
+    setVolume(18);
+    check(runUntilIdle(2000), "command during module boot answered");
+    check(simDFPlayerVolume() == 18 && getMP3DriverStats().retries > retries, "retried until the module was ready");
+    
+    config.bootMs = 0;
+    config.dropRate = 1;
+    startPlayer(config);
+    uint32_t timeouts = getMP3DriverStats().timeouts;
+    uint32_t framesSent = getMP3DriverStats().framesSent;
+    playTrack(1);
+    check(runUntilIdle(2000), "unanswered command given up");
+    check(getMP3DriverStats().timeouts == timeouts + 1 &&
+          getMP3DriverStats().framesSent == framesSent + 1 + MP3_MAX_RETRIES, "sent 1 + MP3_MAX_RETRIES times");
+}
+
+void checkPlayback() {
+    printf("\nPlayback state machine:\n");
+    SimDFPlayerConfig config;
+    config.trackMs = 1500;
+    startPlayer(config);
+    runUntilIdle(1000);
+    onMP3Playback = recordTransition;
+    
+    benchTransitions.clear();
+    MP3PlaybackStats before = getMP3PlaybackStats();
+    playTrack(2);
+    runFor(config.trackMs + 500);
+    check(sawStates({MP3_STATE_STARTING, MP3_STATE_PLAYING, MP3_STATE_FINISHED}),
+          "starting, playing, finished");
+    const MP3Playback& playback = getMP3Playback();
+    uint32_t latencyUs = getMP3PlaybackStats().lastLatencyUs;
+    check(getMP3PlaybackStats().started == before.started + 1 && latencyUs >= config.busyDelayUs &&
+          latencyUs <= config.busyDelayUs + 1000, "command-to-audio latency from the BUSY edge");
+    uint32_t playedMs = (playback.endMicros - playback.startMicros) / 1000;
+    check(playedMs >= config.trackMs - 1 && playedMs <= config.trackMs + 1, "playing time from BUSY low to high");
+    check(playback.stateMillis[MP3_STATE_STARTING] <= playback.stateMillis[MP3_STATE_PLAYING] &&
+          playback.stateMillis[MP3_STATE_PLAYING] < playback.stateMillis[MP3_STATE_FINISHED],
+          "per-state timestamps in order");
+    
+    // Strikes follow each other as soon as BUSY rises
+    benchTransitions.clear();
+    uint32_t plays = simDFPlayerStats().plays;
+    playGongStrikes(3);
+    runFor(3 * (config.trackMs + 200));
+    check(simDFPlayerStats().plays == plays + 3 && getMP3Playback().state == MP3_STATE_FINISHED &&
+          getMP3Playback().strikesLeft == 0, "three strikes played");
+    uint64_t maxGapUs = 0;
+    for (size_t i = 1; i < benchTransitions.size(); i++) {
+        if (benchTransitions[i].state == MP3_STATE_PLAYING && benchTransitions[i - 1].state == MP3_STATE_STARTING &&
+            i >= 2 && benchTransitions[i - 2].state == MP3_STATE_FINISHED) {
+            maxGapUs = max(maxGapUs, benchTransitions[i].atUs - benchTransitions[i - 2].atUs);
+        }
+    }
+    printf("  silence between strikes: %.1f ms (module start latency %.1f ms)\n", maxGapUs / 1000.0,
+           config.busyDelayUs / 1000.0);
+    check(maxGapUs > 0 && maxGapUs <= config.busyDelayUs + 2000, "next strike sent the moment BUSY rose");
+    
+    // Rejected, unanswered, and never started
+    benchTransitions.clear();
+    playTrack(config.tracks + 1);
+    runUntilIdle(1000);
+    check(getMP3Playback().state == MP3_STATE_FAILED, "missing track fails");
+    
+    config.dropRate = 1;
+    startPlayer(config);
+    playTrack(1);
+    runUntilIdle(2000);
+    check(getMP3Playback().state == MP3_STATE_FAILED, "unanswered play command fails");
+    
+    config.dropRate = 0;
+    config.busyDelayUs = 5000000;
+    startPlayer(config);
+    uint32_t failed = getMP3PlaybackStats().failed;
+    playTrack(1);
+    runFor(MP3_START_TIMEOUT + 200);
+    check(getMP3Playback().state == MP3_STATE_FAILED && getMP3PlaybackStats().failed == failed + 1,
+          "BUSY never low: failed after MP3_START_TIMEOUT");
+    
+    config.busyDelayUs = 60000;
+    startPlayer(config);
+    playTrack(1);
+    runFor(200);
+    stopPlayback();
+    runFor(200);
+    check(getMP3Playback().state == MP3_STATE_IDLE && !isPlaying(), "stop returns to idle");
+    onMP3Playback = nullptr;
+}
+
+void checkVolumeRamps() {
+    printf("\nVolume ramps:\n");
+    SimDFPlayerConfig config;
+    config.trackMs = 10000;
+    startPlayer(config);
+    runUntilIdle(1000);
+    setVolume(0);
+    runUntilIdle(1000);
+    
+    // One frame per step at most, and the ramp lands on its target
+    uint32_t frames = simDFPlayerStats().framesReceived;
+    rampVolume(30, 3000);
+    check(isVolumeRamping(), "ramp running");
+    runFor(3200);
+    uint32_t rampFrames = simDFPlayerStats().framesReceived - frames;
+    check(!isVolumeRamping() && simDFPlayerVolume() == 30 && getMP3Status().volume == 30, "ramp ends on its volume");
+    check(rampFrames <= 3000 / MP3_RAMP_STEP_INTERVAL + 1, "no more than one volume frame per step");
+    
+    // A burst of volume changes while one is on the line
+    frames = simDFPlayerStats().framesReceived;
+    uint32_t coalesced = getMP3DriverStats().volumeCoalesced;
+    for (uint8_t i = 0; i < 20; i++) {
+        setVolume(10 + i);
+    }
+    runUntilIdle(1000);
+    uint32_t burstFrames = simDFPlayerStats().framesReceived - frames;
+    check(burstFrames <= 2 && getMP3DriverStats().volumeCoalesced >= coalesced + 18, "burst coalesced");
+    check(simDFPlayerVolume() == 29, "last volume of the burst wins");
+    
+    // Fade-out stops the track at 0 and brings the volume back
+    playTrack(1);
+    runFor(500);
+    fadeOutPlayback(1000);
+    runFor(500);
+    bool fading = isPlaying() && simDFPlayerVolume() > 0 && simDFPlayerVolume() < 29;
+    runFor(700);
+    check(fading, "volume falls while the track plays");
+    check(!isPlaying() && !simDFPlayerIsPlaying() && simDFPlayerVolume() == 29, "fade-out stops and restores");
+    
+    // Playing again during a fade-out cancels it at the old volume
+    playTrack(1);
+    runFor(500);
+    fadeOutPlayback(2000);
+    runFor(500);
+    playTrack(2);
+    runFor(300);
+    check(!isVolumeRamping() && simDFPlayerIsPlaying() && simDFPlayerVolume() == 29, "new play cancels the fade-out");
+    stopPlayback();
+    runUntilIdle(1000);
+    
+    printf("  3 s ramp 0 -> 30: %u volume frames; 20 volume changes: %u frames\n", rampFrames, burstFrames);
+}
+
+void benchmarkLossyLine(uint32_t count, float dropRate) {
+    SimDFPlayerConfig config;
+    config.dropRate = dropRate;
+    config.corruptRate = dropRate / 2;
+    config.seed = 7;
+    startPlayer(config);
+    runUntilIdle(2000);
+    
+    MP3DriverStats before = getMP3DriverStats();
+    uint64_t startUs = simNowUs();
+    for (uint32_t i = 0; i < count; i++) {
+        if (i % 2) {
+            queryMP3Status();
+        } else {
+            setVolume(10 + i % 20);
+        }
+        runUntilIdle(5000);
+    }
+    const MP3DriverStats& after = getMP3DriverStats();
+    uint32_t completed = after.commands - before.commands;
+    
+    printf("\n%u commands, %.0f%% of commands lost and %.0f%% of replies damaged on the line:\n", count,
+           dropRate * 100, config.corruptRate * 100);
+    printf("  completed %u (%.1f%%), %u retries, %u timeouts, %u bad frames, %.1f ms per command\n", completed,
+           100.0 * completed / count, after.retries - before.retries, after.timeouts - before.timeouts,
+           after.badFrames - before.badFrames, (simNowUs() - startUs) / 1000.0 / count);
+    printf("  longest loopMP3() call: %u us host time\n", benchMaxLoopUs);
+}
+
+int main(int argc, char** argv) {
+    uint32_t commands = 1000;
+    float dropRate = 0.1f;
+    bool usage = argc % 2 == 0;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--commands") == 0) commands = max(atoi(argv[i + 1]), 1);
+        else if (strcmp(argv[i], "--drop") == 0) dropRate = atof(argv[i + 1]);
+        else usage = true;
+    }
+    if (usage) {
+        fprintf(stderr, "usage: mp3bench [--commands n] [--drop p]\n");
+        return 1;
+    }
+    
+    SimChannelConfig config = {};
+    simInit(config, 1);
+    
+    checkFraming();
+    checkCommands();
+    checkParser();
+    checkRecovery();
+    checkPlayback();
+    checkVolumeRamps();
+    benchmarkLossyLine(commands, dropRate);
+    
+    return finishBenchChecks();
+}
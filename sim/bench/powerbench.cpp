@@ -0,0 +1,353 @@
+// Power manager benchmark: runs the power manager through simulated days
+// of scheduled gongs, LoRa traffic and bursts of web interface use, with
+// the modules around it stubbed. Checks that every gong fires at full
+// speed with the MP3 module up, that the web interface keeps WiFi awake,
+// and that the time accounting adds up; then prints the estimated current
+// and battery life against the node always at full speed.
+//
+//   powerbench [--days n] [--gongs n] [--bursts n] [--boot-ms ms]
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include "powermanager.h"
+#include "mp3handler.h"
+#include "tasks.h"
+#include "eventbus.h"
+#include "profiler.h"
+#include "logger.h"
+#include "lorasim.h"
+#include "benchcheck.h"
+
+#define BENCH_DAY_MS 86400000ULL
+#define BENCH_GONG_PLAY_MS 8000         // Gong track length
+#define BENCH_LORA_INTERVAL_MS 300000   // Node status and sync traffic
+#define BENCH_LORA_BUSY_MS 200
+#define BENCH_BURST_MS 30000            // A visit to the web interface
+#define BENCH_BURST_REQUEST_MS 2000     // Its requests, as the status page polls
+
+// The node around the power manager: schedule, MP3 module, amplifier and radio
+std::vector<uint64_t> benchGongs;       // ms, play command instants
+size_t benchNextGong = 0;
+uint32_t benchBootMs = 1500;
+bool benchModuleOn = false;
+uint64_t benchModuleOnAt = 0;
+uint64_t benchModuleActiveAt = 0;
+uint64_t benchPlayingUntil = 0;
+bool benchWiFiSleeping = false;
+bool benchLoRaReady = true;
+uint32_t benchWiFiCalls = 0;
+std::vector<Event> benchEvents;
+EventHandler benchPowerHandler = nullptr;
+
+uint64_t benchNow() {
+    return simNowUs() / 1000;
+}
+
+long getScheduleFireInMs() {
+    if (benchNextGong >= benchGongs.size()) {
+        return -1;
+    }
+    return (long)(benchGongs[benchNextGong] > benchNow() ? benchGongs[benchNextGong] - benchNow() : 0);
+}
+
+bool isPlaying() {
+    return benchNow() < benchPlayingUntil;
+}
+
+bool isMP3Idle() {
+    return true;
+}
+
+bool isVolumeRamping() {
+    return false;
+}
+
+bool isMP3ModuleOn() {
+    return benchModuleOn;
+}
+
+bool isMP3ModuleReady() {
+    return benchModuleOn && benchNow() - benchModuleOnAt >= benchBootMs;
+}
+
+bool isMP3AmplifierOn() {
+    // Woken ahead of each gong, off MP3_AMP_IDLE_OFF after it
+    uint64_t now = benchNow();
+    for (uint64_t gong : benchGongs) {
+        if (now + MP3_AMP_WAKE_MS >= gong && now < gong + BENCH_GONG_PLAY_MS + MP3_AMP_IDLE_OFF) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool isGongSynthEnabled() {
+    return false;
+}
+
+bool isGongSynthPlaying() {
+    return false;
+}
+
+bool isGongProgramRunning() {
+    return false;
+}
+
+bool isLoRaLowPower() {
+    return false;
+}
+
+bool isLoRaReady() {
+    return benchLoRaReady;
+}
+
+bool isLoRaIdle() {
+    return benchLoRaReady && benchNow() % BENCH_LORA_INTERVAL_MS >= BENCH_LORA_BUSY_MS;
+}
+
+bool isLoRaOtaActive() {
+    return false;
+}
+
+bool setWiFiSleep(bool sleep) {
+    benchWiFiCalls++;
+    benchWiFiSleeping = sleep;
+    return sleep;
+}
+
+// tasks.cpp and eventbus.cpp need FreeRTOS; the audio task is taken to
+// carry a request out at once
+bool postAudioRequest(uint8_t type, uint16_t param, uint32_t value, const String& name) {
+    holdPowerActive();
+    if (type == AUDIO_REQUEST_MP3_WAKE && !benchModuleOn) {
+        benchModuleOn = true;
+        benchModuleOnAt = benchNow();
+    }
+    benchModuleActiveAt = benchNow();
+    return true;
+}
+
+const char* getSystemTaskName(uint8_t task) {
+    static const char* const names[SYSTEM_TASKS] = {"radio", "audio", "scheduler", "web"};
+    return task < SYSTEM_TASKS ? names[task] : "unknown";
+}
+
+int8_t subscribeEvents(const char* name, uint32_t mask, EventHandler handler, uint8_t flags, EventWake wake) {
+    benchPowerHandler = handler;
+    return 0;
+}
+
+uint8_t dispatchEvents(int8_t subscriber) {
+    uint8_t count = benchEvents.size();
+    for (const Event& event : benchEvents) {
+        benchPowerHandler(event);
+    }
+    benchEvents.clear();
+    return count;
+}
+
+void postEvent(uint8_t type, uint8_t source, uint16_t param = 0) {
+    Event event = {type, source, param, 0, (uint32_t)micros()};
+    benchEvents.push_back(event);
+}
+
+bool publishEvent(uint8_t type, uint8_t source, uint16_t param, uint32_t value) {
+    postEvent(type, source, param);
+    return true;
+}
+
+struct BenchDay {
+    uint32_t gongs;
+    uint32_t gongsSlow;         // Clock low at the play command
+    uint32_t gongsUnready;      // MP3 module off or still booting
+    uint64_t minWakeLeadMs;     // Module switched on before the play command
+    uint32_t requests;
+    uint32_t requestsAsleep;    // WiFi still asleep after the pass that followed
+    uint64_t periodMs;          // Scheduler task periods, summed
+    uint32_t passes;
+};
+
+void fireGong(BenchDay& day, uint64_t now) {
+    // As loopSchedule() does, in the pass before the power manager's
+    day.gongs++;
+    if (isPowerIdle() || getCpuFrequencyMhz() != POWER_ACTIVE_MHZ) {
+        day.gongsSlow++;
+    }
+    if (!isMP3ModuleReady()) {
+        day.gongsUnready++;
+    }
+    day.minWakeLeadMs = min(day.minWakeLeadMs, benchModuleOn ? now - benchModuleOnAt : 0);
+    benchPlayingUntil = now + BENCH_GONG_PLAY_MS;
+    benchModuleActiveAt = benchPlayingUntil;
+    benchNextGong++;
+    postEvent(EVENT_GONG_REQUESTED, EVENT_SOURCE_SCHEDULE);
+}
+
+BenchDay runDays(uint32_t days, uint32_t gongsPerDay, uint32_t burstsPerDay, std::mt19937& rng) {
+    // Gongs spread over the waking hours, web visits at random
+    uint64_t start = benchNow();
+    benchGongs.clear();
+    benchNextGong = 0;
+    std::vector<uint64_t> bursts;
+    for (uint32_t d = 0; d < days; d++) {
+        uint64_t dayStart = start + d * BENCH_DAY_MS;
+        for (uint32_t i = 0; i < gongsPerDay; i++) {
+            benchGongs.push_back(dayStart + 6 * 3600000ULL + i * (16 * 3600000ULL / max(gongsPerDay, 1u)) + 1234);
+        }
+        for (uint32_t i = 0; i < burstsPerDay; i++) {
+            bursts.push_back(dayStart + std::uniform_int_distribution<uint64_t>(0, BENCH_DAY_MS - BENCH_BURST_MS)(rng));
+        }
+    }
+    std::sort(bursts.begin(), bursts.end());
+    
+    BenchDay day = {};
+    day.minWakeLeadMs = UINT64_MAX;
+    size_t nextBurst = 0;
+    uint64_t nextRequest = UINT64_MAX;
+    uint64_t burstEnd = 0;
+    uint64_t end = start + days * BENCH_DAY_MS;
+    while (benchNow() < end) {
+        uint64_t now = benchNow();
+        if (benchNextGong < benchGongs.size() && now >= benchGongs[benchNextGong]) {
+            fireGong(day, now);
+        }
+        
+        // Web requests, each held through onRoute()
+        bool request = false;
+        if (nextBurst < bursts.size() && now >= bursts[nextBurst]) {
+            burstEnd = bursts[nextBurst++] + BENCH_BURST_MS;
+            nextRequest = now;
+        }
+        if (now >= nextRequest) {
+            holdPowerUi();
+            request = true;
+            day.requests++;
+            nextRequest = now + BENCH_BURST_REQUEST_MS < burstEnd ? now + BENCH_BURST_REQUEST_MS : UINT64_MAX;
+        }
+        
+        // The module's own idle switch-off, as updateMP3Playback() does it
+        if (benchModuleOn && !isPlaying() && now - benchModuleActiveAt >= MP3_POWER_IDLE_OFF) {
+            benchModuleOn = false;
+        }
+        
+        loopPowerManager();
+        if (request && benchWiFiSleeping) {
+            day.requestsAsleep++;
+        }
+        uint32_t periodMs = getPowerTaskPeriodMs(TASK_SCHEDULER);
+        day.periodMs += periodMs;
+        day.passes++;
+        simAdvance(periodMs * 1000ULL);
+    }
+    return day;
+}
+
+void checkDays(uint32_t days, uint32_t gongsPerDay, uint32_t burstsPerDay) {
+    printf("%u days, %u scheduled gongs and %u web visits a day, MP3 module boots in %u ms:\n", days, gongsPerDay,
+           burstsPerDay, benchBootMs);
+    std::mt19937 rng(11);
+    PowerStats before = getPowerStats();
+    uint64_t startMs = benchNow();
+    BenchDay day = runDays(days, gongsPerDay, burstsPerDay, rng);
+    const PowerStats& stats = getPowerStats();
+    uint64_t elapsedMs = benchNow() - startMs;
+    
+    uint64_t cpuMs = stats.timeMs[POWER_TIME_CPU_ACTIVE] + stats.timeMs[POWER_TIME_CPU_IDLE] -
+                     before.timeMs[POWER_TIME_CPU_ACTIVE] - before.timeMs[POWER_TIME_CPU_IDLE];
+    uint64_t wifiMs = stats.timeMs[POWER_TIME_WIFI_AWAKE] + stats.timeMs[POWER_TIME_WIFI_SLEEP] -
+                      before.timeMs[POWER_TIME_WIFI_AWAKE] - before.timeMs[POWER_TIME_WIFI_SLEEP];
+    uint64_t idleMs = stats.timeMs[POWER_TIME_CPU_IDLE] - before.timeMs[POWER_TIME_CPU_IDLE];
+    uint64_t sleepMs = stats.timeMs[POWER_TIME_WIFI_SLEEP] - before.timeMs[POWER_TIME_WIFI_SLEEP];
+    uint32_t gongs = stats.gongs - before.gongs;
+    
+    printf("  %u gongs, shortest module wake ahead %llu ms, shortest full speed ahead %u ms\n", day.gongs,
+           (unsigned long long)day.minWakeLeadMs, stats.minGongLeadMs);
+    printf("  clock low %.1f%% of the time, WiFi asleep %.1f%%, %u wakes, mean scheduler period %.1f ms\n",
+           100.0 * idleMs / max(elapsedMs, (uint64_t)1), 100.0 * sleepMs / max(elapsedMs, (uint64_t)1),
+           stats.wakes - before.wakes, (double)day.periodMs / max(day.passes, 1u));
+    check(day.gongs == days * gongsPerDay && gongs == day.gongs, "every scheduled gong prepared for");
+    check(day.gongsSlow == 0, "every gong fired at full speed");
+    check(day.gongsUnready == 0 && stats.gongsUnready == before.gongsUnready, "MP3 module up for every gong");
+    check(day.minWakeLeadMs + POWER_IDLE_TASK_PERIOD_MS >= POWER_GONG_LEAD_MS,
+          "module switched on the full lead ahead");
+    check(stats.minGongLeadMs + POWER_IDLE_TASK_PERIOD_MS >= POWER_GONG_LEAD_MS, "full speed the full lead ahead");
+    check(stats.gongWakes - before.gongWakes == day.gongs, "each gong woke the node from idle");
+    check(day.requests > 0 && day.requestsAsleep == 0, "WiFi awake for every web request");
+    check(cpuMs + POWER_IDLE_TASK_PERIOD_MS >= elapsedMs && cpuMs <= elapsedMs, "CPU time adds up to the run");
+    check(wifiMs == cpuMs, "WiFi time adds up to the run");
+    check(idleMs > elapsedMs * 9 / 10, "clock low over 90% of the time");
+}
+
+void checkRequests() {
+    printf("\nWake-ups:\n");
+    
+    // Idle, a request arrives: short task periods at once, full speed on the next pass
+    simAdvance((POWER_UI_HOLD_MS + 1000) * 1000ULL);
+    loopPowerManager();
+    bool idle = isPowerIdle() && getCpuFrequencyMhz() == POWER_IDLE_MHZ &&
+                getPowerTaskPeriodMs(TASK_AUDIO) == POWER_IDLE_TASK_PERIOD_MS;
+    check(idle && benchWiFiSleeping, "idle at the idle clock with WiFi asleep");
+    postAudioRequest(AUDIO_REQUEST_TRACK, 2);
+    check(getPowerTaskPeriodMs(TASK_AUDIO) == TASK_PERIOD_MS && getPowerTaskPeriodMs(TASK_WEB) == TASK_WEB_PERIOD_MS,
+          "request shortens task periods before the next pass");
+    loopPowerManager();
+    check(!isPowerIdle() && getCpuFrequencyMhz() == POWER_ACTIVE_MHZ && benchWiFiSleeping,
+          "full speed on the next pass, WiFi left asleep");
+    
+    // A LoRa gong arrives as an event
+    simAdvance((POWER_ACTIVE_HOLD_MS + 1000) * 1000ULL);
+    loopPowerManager();
+    postEvent(EVENT_GONG_REQUESTED, EVENT_SOURCE_LORA);
+    loopPowerManager();
+    check(!isPowerIdle(), "gong from LoRa brings full speed");
+    
+    // A new WiFi mode gets its sleep setting again
+    uint32_t calls = benchWiFiCalls;
+    postEvent(EVENT_WIFI_STATE, EVENT_SOURCE_NONE, EVENT_WIFI_CONNECTED);
+    loopPowerManager();
+    check(benchWiFiCalls == calls + 1 && benchWiFiSleeping, "modem sleep set again after a WiFi change");
+    
+    // A node whose radio failed at boot is never idle on the radio's account
+    benchLoRaReady = false;
+    simAdvance((POWER_ACTIVE_HOLD_MS + 1000) * 1000ULL);
+    loopPowerManager();
+    check(isPowerIdle(), "idle without a radio");
+    benchLoRaReady = true;
+}
+
+int main(int argc, char** argv) {
+    uint32_t days = 7;
+    uint32_t gongsPerDay = 8;
+    uint32_t burstsPerDay = 6;
+    bool usage = argc % 2 == 0;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--days") == 0) days = max(atoi(argv[i + 1]), 1);
+        else if (strcmp(argv[i], "--gongs") == 0) gongsPerDay = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--bursts") == 0) burstsPerDay = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--boot-ms") == 0) benchBootMs = atoi(argv[i + 1]);
+        else usage = true;
+    }
+    if (usage) {
+        fprintf(stderr, "usage: powerbench [--days n] [--gongs n] [--bursts n] [--boot-ms ms]\n");
+        return 1;
+    }
+    
+    SimChannelConfig channel = {};
+    simInit(channel, 1);
+    simSetNodeConfig(0, "{\"power\": {\"enabled\": true, \"idle_mhz\": 80, \"battery_mah\": 10000}}");
+    setupLog();
+    setupProfiler();
+    setupPowerManager();
+    
+    checkDays(days, gongsPerDay, burstsPerDay);
+    checkRequests();
+    
+    float averageMa = getPowerAverageMa();
+    float alwaysOnMa = POWER_CPU_ACTIVE_MA + POWER_WIFI_AWAKE_MA + POWER_MP3_MA;
+    printf("\nEstimated current %.1f mA against %.1f mA always on: %.0f h against %.0f h on 10000 mAh\n",
+           averageMa, alwaysOnMa, 10000 / averageMa, 10000 / alwaysOnMa);
+    check(averageMa < alwaysOnMa / 2, "estimate under half the always-on current");
+    
+    return finishBenchChecks();
+}
@@ -0,0 +1,231 @@
+// Loop profiler benchmark: checks the histogram percentiles against the
+// exact ones, the worst-pass trace, route labels and the slow-pass log
+// line, and that the probe cost calibrates alike each time; then runs
+// passes of busy sections with and without probes and prints the measured
+// overhead next to the profiler's own estimate. The measured figure is
+// wall-clock time on a shared host and only informational.
+// Cycles here are host time at the simulated clock, 240 MHz unless set.
+//
+//   profbench [--passes n] [--section-us us]
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+#include "profiler.h"
+#include "tasks.h"
+#include "logger.h"
+#include "benchcheck.h"
+
+#define BENCH_SECTIONS 6                // As the radio task's
+#define BENCH_ROUNDS 8                  // Timed rounds per row and mode
+
+// tasks.cpp needs FreeRTOS; the profiler only asks it for names
+const char* getSystemTaskName(uint8_t task) {
+    static const char* const names[SYSTEM_TASKS] = {"radio", "audio", "scheduler", "web"};
+    return task < SYSTEM_TASKS ? names[task] : "unknown";
+}
+
+// Counts a section as if it had taken the given cycles; the probe itself adds a few
+void countCycles(uint8_t section, uint32_t cycles, const char* label = nullptr) {
+    endProfileSection(section, getProfileCycles() - cycles, label);
+}
+
+void spinCycles(uint32_t cycles) {
+    uint32_t start = getProfileCycles();
+    while (getProfileCycles() - start < cycles) {
+    }
+}
+
+class StringPrint : public Print {
+public:
+    std::string text;
+    size_t write(uint8_t c) override {
+        text += (char)c;
+        return 1;
+    }
+};
+
+void checkHistograms() {
+    printf("Histograms:\n");
+    resetProfiler();
+    
+    // Log-uniform from 0.5 us to 50 ms, as module loops spread
+    std::mt19937 rng(7);
+    std::vector<uint32_t> values;
+    for (uint32_t i = 0; i < 100000; i++) {
+        uint32_t cycles = (uint32_t)(120 * pow(1e5, std::uniform_real_distribution<double>(0, 1)(rng)));
+        values.push_back(cycles);
+        countCycles(PROFILE_LORA, cycles);
+    }
+    std::sort(values.begin(), values.end());
+    
+    // Each probe adds its own cycles on top, so allow a little below the bucket's bound as well
+    const ProfileStats& stats = getProfileSectionStats(PROFILE_LORA);
+    bool close = true;
+    for (uint16_t perMille : {100, 500, 900, 990, 999}) {
+        uint32_t exact = values[((size_t)values.size() * perMille + 999) / 1000 - 1];
+        uint32_t reported = getProfilePercentile(stats, perMille);
+        close = close && reported >= exact && reported <= exact * 1.25 + 2 * getProfileProbeCycles() + 256;
+    }
+    check(stats.count == values.size(), "every call counted");
+    check(close, "p10 to p99.9 within one bucket (25%) above exact");
+    check(stats.maxCycles >= values.back() && stats.maxCycles < values.back() + 10000, "maximum kept exactly");
+    check(getProfilePercentile(stats, 1000) == stats.maxCycles, "p100 is the maximum");
+    check(getProfilePercentile(getProfileSectionStats(PROFILE_MP3), 500) == 0, "empty section reports 0");
+    
+    countCycles(PROFILE_HTTP, 1000, "/tracks");
+    countCycles(PROFILE_HTTP, 50000, "/schedule");
+    countCycles(PROFILE_HTTP, 2000, "/tasks");
+    const char* slowest = getProfileSectionStats(PROFILE_HTTP).maxLabel;
+    check(slowest && strcmp(slowest, "/schedule") == 0, "slowest REST call labelled with its route");
+    countCycles(PROFILE_WEB, UINT32_MAX / 2);
+    check(getProfilePercentile(getProfileSectionStats(PROFILE_WEB), 500) >= UINT32_MAX / 2, "9 s call fits");
+}
+
+void runPass(uint8_t sections, uint32_t sectionCycles) {
+    beginProfilePass(TASK_RADIO);
+    for (uint8_t i = 0; i < sections; i++) {
+        PROFILE(PROFILE_RADIO_REQUESTS + i % BENCH_SECTIONS, spinCycles(sectionCycles));
+    }
+    endProfilePass(TASK_RADIO);
+}
+
+void checkTraces() {
+    printf("Worst-pass trace:\n");
+    resetProfiler();
+    runPass(BENCH_SECTIONS, 2400);
+    
+    // A slower pass replaces the trace; a faster one after it does not
+    beginProfilePass(TASK_RADIO);
+    PROFILE(PROFILE_RADIO_REQUESTS, spinCycles(2400));
+    PROFILE(PROFILE_LORA, spinCycles(PROFILE_SLOW_PASS_US * 240));
+    PROFILE(PROFILE_OTA, spinCycles(2400));
+    endProfilePass(TASK_RADIO);
+    runPass(BENCH_SECTIONS, 2400);
+    
+    const ProfileTrace& trace = getProfileWorstTrace(TASK_RADIO);
+    check(trace.entries == 3 && !trace.overflowed, "slowest pass kept, with its three sections");
+    check(trace.entry[0].section == PROFILE_RADIO_REQUESTS && trace.entry[1].section == PROFILE_LORA &&
+          trace.entry[2].section == PROFILE_OTA, "sections in the order they ran");
+    check(trace.entry[1].offsetCycles >= trace.entry[0].cycles &&
+          trace.entry[2].offsetCycles >= trace.entry[1].offsetCycles + trace.entry[1].cycles,
+          "offsets follow one another");
+    check(trace.entry[1].cycles >= PROFILE_SLOW_PASS_US * 240 && trace.passCycles >= trace.entry[1].cycles,
+          "slow section and pass timed");
+    check(getProfilePassStats(TASK_RADIO).count == 3, "passes counted");
+    
+    loopProfiler();
+    StringPrint out;
+    exportLog(out, false);
+    check(out.text.find("Slow radio pass") != std::string::npos && out.text.find("longest section lora") !=
+          std::string::npos, "slow pass logged, naming its section");
+    
+    resetProfiler();
+    runPass(PROFILE_TRACE_ENTRIES + 4, 100);
+    check(getProfileWorstTrace(TASK_RADIO).entries == PROFILE_TRACE_ENTRIES &&
+          getProfileWorstTrace(TASK_RADIO).overflowed, "long pass trace cut and flagged");
+    
+    // Sections outside a pass, as on battery slaves, are counted but not traced
+    resetProfiler();
+    PROFILE(PROFILE_LORA, spinCycles(100));
+    check(getProfileSectionStats(PROFILE_LORA).count == 1 && getProfileWorstTrace(TASK_RADIO).entries == 0,
+          "section outside a pass counted, not traced");
+}
+
+void checkClockScaling() {
+    printf("Clock scaling:\n");
+    
+    // 1 ms at 80 MHz reads 80000 cycles on the counter, and is counted as 240000
+    resetProfiler();
+    setCpuFrequencyMhz(80);
+    setProfileCpuMhz(80);
+    beginProfilePass(TASK_RADIO);
+    PROFILE(PROFILE_LORA, spinCycles(80000));
+    endProfilePass(TASK_RADIO);
+    setCpuFrequencyMhz(240);
+    setProfileCpuMhz(240);
+    uint32_t cycles = getProfileSectionStats(PROFILE_LORA).maxCycles;
+    check(cycles >= 240000 && cycles < 300000, "cycles at a low clock scaled up");
+    check(getProfilePassStats(TASK_RADIO).maxCycles >= cycles, "pass scaled alike");
+}
+
+void checkCalibration() {
+    printf("Calibration:\n");
+    
+    // The cheapest batch is what a probe costs, whatever else the host runs meanwhile
+    uint32_t least = UINT32_MAX;
+    uint32_t most = 0;
+    for (uint8_t i = 0; i < 6; i++) {
+        setupProfiler();
+        least = min(least, getProfileProbeCycles());
+        most = max(most, getProfileProbeCycles());
+    }
+    printf("  %u to %u cycles per probe\n", least, most);
+    check(least > 0 && most <= least + least / 2 + 1, "probe cost alike over 6 calibrations");
+}
+
+double timePasses(uint32_t passes, uint32_t sectionCycles, bool probed) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < passes; i++) {
+        if (probed) {
+            runPass(BENCH_SECTIONS, sectionCycles);
+        } else {
+            for (uint8_t j = 0; j < BENCH_SECTIONS; j++) {
+                spinCycles(sectionCycles);
+            }
+        }
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void measureOverhead(uint32_t passes, uint32_t sectionUs) {
+    printf("\nOverhead, %u passes of %u sections, %u cycles per probe:\n", passes, BENCH_SECTIONS,
+           getProfileProbeCycles());
+    printf("%12s %12s %12s %12s\n", "section us", "pass us", "measured %", "estimated %");
+    for (uint32_t us : {sectionUs / 10, sectionUs, sectionUs * 10}) {
+        uint32_t cycles = max(us, 1u) * 240;
+        resetProfiler();
+        
+        // Interleaved, so both see the same host load; the quickest round of each is the one
+        // no other process took time from
+        double plain = 1e9;
+        double probed = 1e9;
+        for (uint8_t round = 0; round < BENCH_ROUNDS; round++) {
+            plain = std::min(plain, timePasses(passes / BENCH_ROUNDS, cycles, false));
+            probed = std::min(probed, timePasses(passes / BENCH_ROUNDS, cycles, true));
+        }
+        double measured = 100.0 * (probed - plain) / plain;
+        double estimated = getProfileOverheadPerMille(TASK_RADIO) / 10.0;
+        printf("%12u %12u %12.2f %12.1f\n", max(us, 1u), max(us, 1u) * BENCH_SECTIONS, measured, estimated);
+    }
+    
+    // Not checked: on a loaded host, time the process is switched out counts into both
+    // figures. The 1% budget is the device's, in its own cycles
+}
+
+int main(int argc, char** argv) {
+    uint32_t passes = 20000;
+    uint32_t sectionUs = 10;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--passes") == 0 && i + 1 < argc) {
+            passes = max(atoi(argv[++i]), 4);
+        } else if (strcmp(argv[i], "--section-us") == 0 && i + 1 < argc) {
+            sectionUs = max(atoi(argv[++i]), 1);
+        } else {
+            fprintf(stderr, "usage: profbench [--passes n] [--section-us us]\n");
+            return 1;
+        }
+    }
+    
+    setupLog();
+    setupProfiler();
+    checkHistograms();
+    checkTraces();
+    checkClockScaling();
+    checkCalibration();
+    measureOverhead(passes, sectionUs);
+    
+    return finishBenchChecks();
+}
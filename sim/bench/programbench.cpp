@@ -0,0 +1,226 @@
+// Gong program benchmark: runs the sequencer in src/gongprogram.cpp and the
+// MP3 driver against the simulated MP3-TF-16P (sim/dfplayersim.h), and
+// checks when each strike is heard, at which volume, and that the main
+// loop is never held up. Then it issues strikes early by the calibrated
+// pre-roll, as the scheduler does, and checks they are heard on the instant.
+//
+//   programbench [--latency us]
+#include <chrono>
+#include <vector>
+#include "gongprogram.h"
+#include "mp3handler.h"
+#include "dfplayersim.h"
+#include "lorasim.h"
+#include "benchcheck.h"
+
+#define BENCH_UART 2
+
+uint32_t benchMaxLoopUs = 0;
+
+// Strikes as heard: BUSY low
+struct BenchStrike {
+    uint64_t atUs;
+    uint16_t track;
+    uint16_t volume;
+};
+std::vector<BenchStrike> benchStrikes;
+
+void recordStrike(uint8_t state, uint16_t track) {
+    if (state == MP3_STATE_PLAYING) {
+        benchStrikes.push_back({simNowUs(), track, simDFPlayerVolume()});
+    }
+}
+
+void runFor(uint32_t ms) {
+    // The parts of the main loop the sequencer shares time with
+    for (uint32_t i = 0; i < ms; i++) {
+        auto start = std::chrono::steady_clock::now();
+        loopMP3();
+        loopGongProgram();
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        benchMaxLoopUs = max(benchMaxLoopUs,
+                             (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+        simAdvance(1000);
+    }
+}
+
+bool runUntilDone(uint32_t maxMs) {
+    for (uint32_t i = 0; i < maxMs && isGongProgramRunning(); i++) {
+        runFor(1);
+    }
+    return !isGongProgramRunning();
+}
+
+void checkCeremony(uint32_t latencyUs) {
+    printf("Ceremony program:\n");
+    const GongProgramStep steps[] = {
+        {1, 26, 3, 3000},
+        {0, GONG_VOLUME_KEEP, 1, 2000},
+        {2, 20, 5, 400},
+        {3, GONG_VOLUME_KEEP, 2, 0},
+    };
+    check(setGongProgram("ceremony", steps, 4), "program defined");
+    check(!setGongProgram("", steps, 4) && !setGongProgram("empty", steps, 0), "unnamed and empty programs refused");
+    check(!startGongProgram("missing"), "unknown program refused");
+    
+    benchStrikes.clear();
+    uint64_t startUs = simNowUs();
+    uint8_t volumeBefore = getMP3Status().volume;
+    check(startGongProgram("ceremony"), "program started");
+    check(runUntilDone(30000), "program ran to the end");
+    
+    // Planned command times; a step that changes the volume sends that first
+    const uint32_t plannedMs[] = {0, 3000, 6000, 11000, 11400, 11800, 12200, 12600, 13000};
+    const uint16_t tracks[] = {1, 1, 1, 2, 2, 2, 2, 2, 3};
+    const uint16_t volumes[] = {26, 26, 26, 20, 20, 20, 20, 20, 20};
+    bool timing = benchStrikes.size() == 10;
+    bool order = timing;
+    printf("  strike  track  volume  planned ms  heard ms\n");
+    for (size_t i = 0; i < benchStrikes.size(); i++) {
+        const BenchStrike& strike = benchStrikes[i];
+        double heardMs = (strike.atUs - startUs) / 1000.0;
+        if (i < 9) {
+            double expectedMs = plannedMs[i] + latencyUs / 1000.0;
+            timing = timing && heardMs >= expectedMs - 1 && heardMs <= expectedMs + MP3_COMMAND_GAP + 2;
+            order = order && strike.track == tracks[i] && strike.volume == volumes[i];
+            printf("  %6zu  %5u  %6u  %10u  %8.1f\n", i + 1, strike.track, strike.volume, plannedMs[i], heardMs);
+        } else {
+            order = order && strike.track == 3;
+            printf("  %6zu  %5u  %6u  %10s  %8.1f\n", i + 1, strike.track, strike.volume, "at end", heardMs);
+        }
+    }
+    check(order, "tracks and volumes per step");
+    check(timing, "strikes heard at plan + module latency");
+    
+    // The interval-0 strike follows the end of the one before
+    if (benchStrikes.size() == 10) {
+        uint64_t gapUs = benchStrikes[9].atUs - benchStrikes[8].atUs;
+        SimDFPlayerConfig config;
+        check(gapUs >= config.trackMs * 1000ULL && gapUs <= config.trackMs * 1000ULL + 2 * latencyUs + 2000,
+              "interval 0 waits for the previous strike");
+    }
+    runFor(100);
+    check(simDFPlayerVolume() == volumeBefore && getMP3Status().volume == volumeBefore, "volume restored afterwards");
+    check(getGongProgramStats().completed == 1, "counted as completed");
+}
+
+void checkStallAndStop() {
+    printf("\nStalls and stop:\n");
+    const GongProgramStep roll[] = {{1, GONG_VOLUME_KEEP, 20, 500}};
+    setGongProgram("roll", roll, 1);
+    
+    // A main loop held up for 3 s must not be followed by a burst of strikes
+    benchStrikes.clear();
+    startGongProgram("roll");
+    runFor(1200);
+    simAdvance(3000000);
+    runFor(2000);
+    uint64_t minGapUs = UINT64_MAX;
+    for (size_t i = 1; i < benchStrikes.size(); i++) {
+        minGapUs = min(minGapUs, benchStrikes[i].atUs - benchStrikes[i - 1].atUs);
+    }
+    check(benchStrikes.size() >= 5 && minGapUs >= 450000, "no catch-up burst after a stalled loop");
+    check(getGongProgramStats().maxLateMs >= 2500, "lateness reported");
+    
+    uint32_t aborted = getGongProgramStats().aborted;
+    stopGongProgram();
+    runFor(300);
+    check(!isGongProgramRunning() && !isPlaying() && getGongProgramStats().aborted == aborted + 1,
+          "stop ends the program and the strike");
+    
+    // A new program replaces the running one
+    startGongProgram("roll");
+    runFor(100);
+    startGongProgram("ceremony");
+    check(getGongProgramStats().aborted == aborted + 2 && isGongProgramRunning(),
+          "replaced program counted as aborted");
+    stopGongProgram();
+    runFor(300);
+}
+
+double heardAfterInstant(uint64_t instantUs, uint16_t track, uint8_t volume, const char* program) {
+    // The scheduler's sequence: amplifier and volume first, play command
+    // one pre-roll ahead of the instant
+    uint64_t fireUs = instantUs - getMP3PreRoll(track) * 1000ULL;
+    runFor((fireUs - MP3_AMP_WAKE_MS * 1000ULL - simNowUs()) / 1000);
+    wakeMP3Amplifier();
+    if (program) {
+        prepareGongProgram(program);
+    } else if (volume != getMP3Status().volume) {
+        setVolume(volume);
+    }
+    runFor((fireUs - simNowUs()) / 1000);
+    benchStrikes.clear();
+    if (program) {
+        startGongProgram(program);
+    } else {
+        playTrack(track);
+    }
+    runFor(500);
+    return benchStrikes.empty() ? 1e9 : ((int64_t)benchStrikes[0].atUs - (int64_t)instantUs) / 1000.0;
+}
+
+void checkPreRoll(uint32_t latencyUs) {
+    printf("\nPre-roll (module start latency %.0f ms, lead-in 100 ms on track 2):\n", latencyUs / 1000.0);
+    SimDFPlayerConfig config;
+    config.busyDelayUs = latencyUs;
+    config.trackMs = 400;
+    simDFPlayerStart(BENCH_UART, config);
+    runFor(500);
+    
+    // Learned from ordinary plays; the smoothing forgets the other module
+    for (uint8_t i = 0; i < 40; i++) {
+        playTrack(1 + i % 2);
+        runFor(config.trackMs + 300);
+    }
+    setMP3LeadIn(2, 100);
+    const MP3TrackCalibration* calibration = getMP3Calibration(1);
+    check(calibration && calibration->samples >= 1 && calibration->latencyUs + 1000 >= latencyUs &&
+          calibration->latencyUs <= latencyUs + 1000, "start latency calibrated from BUSY");
+    check(getMP3PreRoll(2) == getMP3PreRoll(1) + 100, "lead-in added to the pre-roll");
+    
+    double uncompensatedMs = heardAfterInstant(simNowUs() + 3000000, 1, getMP3Status().volume, nullptr) +
+                             getMP3PreRoll(1);
+    double gongMs = heardAfterInstant(simNowUs() + 3000000, 1, getMP3Status().volume, nullptr);
+    double volumeMs = heardAfterInstant(simNowUs() + 3000000, 1, 12, nullptr);
+    const GongProgramStep steps[] = {{2, 28, 2, 1500}};
+    setGongProgram("preroll", steps, 1);
+    double programMs = heardAfterInstant(simNowUs() + 3000000, 2, 0, "preroll") + 100;
+    runUntilDone(5000);
+    printf("  audible strike after the instant: %.1f ms without pre-roll, %.1f ms gong, %.1f ms after a volume change,"
+           " %.1f ms program after its lead-in\n", uncompensatedMs, gongMs, volumeMs, programMs);
+    check(gongMs >= -1 && gongMs <= 2, "gong heard on the instant");
+    check(volumeMs >= -1 && volumeMs <= 2, "volume set ahead does not delay the strike");
+    check(programMs >= -1 && programMs <= 2 && benchStrikes.size() == 2 && benchStrikes[0].volume == 28,
+          "program heard on the instant at its volume");
+    check(getMP3Status().volume == 12, "volume from before the program restored");
+}
+
+int main(int argc, char** argv) {
+    uint32_t latencyUs = 60000;
+    bool usage = argc % 2 == 0;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--latency") == 0) latencyUs = atoi(argv[i + 1]);
+        else usage = true;
+    }
+    if (usage) {
+        fprintf(stderr, "usage: programbench [--latency us]\n");
+        return 1;
+    }
+    
+    SimChannelConfig channel = {};
+    simInit(channel, 1);
+    SimDFPlayerConfig config;
+    config.busyDelayUs = latencyUs;
+    simDFPlayerStart(BENCH_UART, config);
+    setupMP3();
+    runFor(500);
+    onMP3Playback = recordStrike;
+    
+    checkCeremony(latencyUs);
+    checkStallAndStop();
+    checkPreRoll(180000);
+    printf("\n  longest loopMP3() + loopGongProgram(): %u us host time\n", benchMaxLoopUs);
+    
+    return finishBenchChecks();
+}
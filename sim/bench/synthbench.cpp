@@ -0,0 +1,298 @@
+// Gong synthesizer benchmark: renders src/gongsynth.cpp on the host and
+// checks that the output is deterministic, in tune, decays as voiced and
+// saturates instead of wrapping; times the render loop in samples per
+// second per voice; then strikes through the simulated I2S DMA ring
+// (sim/i2ssim.cpp) to measure how soon a strike is heard.
+//
+//   synthbench [--seconds s] [--wav file]
+#include <chrono>
+#include <cmath>
+#include <vector>
+#include <driver/i2s.h>
+#include "gongsynth.h"
+#include "lorasim.h"
+#include "benchcheck.h"
+
+std::vector<int16_t> render(float seconds) {
+    std::vector<int16_t> out(seconds * GONG_SYNTH_RATE);
+    renderGongSynth(out.data(), out.size());
+    return out;
+}
+
+uint32_t hashSamples(const std::vector<int16_t>& samples) {
+    uint32_t hash = 2166136261u;
+    for (int16_t sample : samples) {
+        hash = (hash ^ (uint16_t)sample) * 16777619u;
+    }
+    return hash;
+}
+
+double goertzelDb(const std::vector<int16_t>& samples, size_t from, size_t count, double frequency) {
+    double coefficient = 2 * cos(2 * M_PI * frequency / GONG_SYNTH_RATE);
+    double s1 = 0, s2 = 0;
+    for (size_t i = from; i < from + count; i++) {
+        double s0 = samples[i] + coefficient * s1 - s2;
+        s2 = s1;
+        s1 = s0;
+    }
+    double power = s1 * s1 + s2 * s2 - coefficient * s1 * s2;
+    return 10 * log10(power + 1e-9);
+}
+
+double rmsDb(const std::vector<int16_t>& samples, size_t from, size_t count) {
+    double sum = 0;
+    for (size_t i = from; i < from + count; i++) {
+        sum += (double)samples[i] * samples[i];
+    }
+    return 10 * log10(sum / count + 1e-9);
+}
+
+GongSynthPatch singleMode(float frequency, float decay) {
+    GongSynthPatch patch = {frequency, 0.8f, 0, 60, 1, {{1.0f, 1.0f, decay}}};
+    return patch;
+}
+
+void checkDeterminism(const GongSynthPatch& patch) {
+    printf("Determinism:\n");
+    uint32_t hashes[2];
+    for (uint8_t run = 0; run < 2; run++) {
+        stopGongSynth();
+        setGongSynthPatch(patch);
+        strikeGongSynth(GONG_SYNTH_FULL_VELOCITY);
+        std::vector<int16_t> out = render(0.5f);
+        strikeGongSynth(GONG_SYNTH_FULL_VELOCITY / 2);
+        std::vector<int16_t> rest = render(1.5f);
+        out.insert(out.end(), rest.begin(), rest.end());
+        hashes[run] = hashSamples(out);
+    }
+    printf("  output hash %08x\n", hashes[0]);
+    check(hashes[0] == hashes[1], "same strikes render the same samples");
+}
+
+void checkTuning(const GongSynthPatch& patch) {
+    printf("\nTuning:\n");
+    stopGongSynth();
+    setGongSynthPatch(singleMode(220, 8));
+    strikeGongSynth(GONG_SYNTH_FULL_VELOCITY);
+    std::vector<int16_t> out = render(1.1f);
+    
+    double peakHz = 0, peakDb = -1e9;
+    for (double hz = 210; hz <= 230; hz += 0.05) {
+        double db = goertzelDb(out, GONG_SYNTH_RATE / 10, GONG_SYNTH_RATE, hz);
+        if (db > peakDb) {
+            peakDb = db;
+            peakHz = hz;
+        }
+    }
+    printf("  single partial at 220 Hz measured at %.2f Hz\n", peakHz);
+    check(fabs(peakHz - 220) < 0.2, "partial frequency within 0.2 Hz");
+    
+    // Every partial of the default gong stands out from the spectrum between them
+    stopGongSynth();
+    setGongSynthPatch(patch);
+    strikeGongSynth(GONG_SYNTH_FULL_VELOCITY);
+    out = render(1.1f);
+    bool partials = true;
+    printf("  partial  Hz       level dB  between dB\n");
+    for (uint8_t i = 0; i < patch.modeCount; i++) {
+        double hz = patch.fundamental * patch.modes[i].ratio;
+        double nextHz = i + 1 < patch.modeCount ? patch.fundamental * patch.modes[i + 1].ratio : hz * 1.15;
+        double levelDb = goertzelDb(out, GONG_SYNTH_RATE / 20, GONG_SYNTH_RATE, hz);
+        double betweenDb = goertzelDb(out, GONG_SYNTH_RATE / 20, GONG_SYNTH_RATE, (hz + nextHz) / 2);
+        partials = partials && levelDb - betweenDb >= 20;
+        printf("  %7u  %7.1f  %8.1f  %10.1f\n", i + 1, hz, levelDb, betweenDb);
+    }
+    check(partials, "each partial 20 dB above its surroundings");
+}
+
+void checkDecay() {
+    printf("\nDecay:\n");
+    stopGongSynth();
+    setGongSynthPatch(singleMode(220, 2));
+    strikeGongSynth(GONG_SYNTH_FULL_VELOCITY);
+    std::vector<int16_t> out = render(1.2f);
+    
+    // 2 s to -60 dB: -30 dB after one second
+    size_t window = GONG_SYNTH_RATE / 20;
+    double dropDb = rmsDb(out, GONG_SYNTH_RATE / 10, window) - rmsDb(out, GONG_SYNTH_RATE * 11 / 10, window);
+    printf("  level after 1 s of a 2 s decay: -%.2f dB\n", dropDb);
+    check(fabs(dropDb - 30) < 0.5, "exponential decay as voiced");
+    
+    // The voice is freed once the partial no longer reaches the output
+    float freedAt = 1.2f;
+    int16_t block[GONG_SYNTH_BLOCK];
+    while (getGongSynthVoices() > 0 && freedAt < 10) {
+        renderGongSynth(block, GONG_SYNTH_BLOCK);
+        freedAt += (float)GONG_SYNTH_BLOCK / GONG_SYNTH_RATE;
+    }
+    printf("  voice freed after %.2f s\n", freedAt);
+    check(freedAt > 2 && freedAt < 3.5 && !isGongSynthPlaying(), "voice freed after the tail");
+}
+
+void checkOverflow(const GongSynthPatch& patch) {
+    printf("\nFull-scale strikes:\n");
+    stopGongSynth();
+    GongSynthPatch loud = patch;
+    loud.volume = 1.0f;
+    setGongSynthPatch(loud);
+    
+    // All voices struck together add up to four times full scale; a fifth
+    // strike a little later has to take one of them
+    uint32_t stolen = getGongSynthStats().stolen;
+    for (uint8_t i = 0; i < GONG_SYNTH_VOICES; i++) {
+        strikeGongSynth(GONG_SYNTH_FULL_VELOCITY);
+    }
+    std::vector<int16_t> out = render(0.01f);
+    strikeGongSynth(GONG_SYNTH_FULL_VELOCITY);
+    std::vector<int16_t> rest = render(2.0f);
+    out.insert(out.end(), rest.begin(), rest.end());
+    
+    uint32_t clipped = 0, maxStep = 0;
+    for (size_t i = 1; i < out.size(); i++) {
+        clipped += out[i] == 32767 || out[i] == -32768;
+        maxStep = max(maxStep, (uint32_t)abs(out[i] - out[i - 1]));
+    }
+    printf("  %u samples saturated, largest sample-to-sample step %u\n", clipped, maxStep);
+    check(clipped > 0 && maxStep < 32768, "saturates instead of wrapping");
+    check(getGongSynthVoices() == GONG_SYNTH_VOICES && getGongSynthStats().stolen == stolen + 1,
+          "fifth strike takes the quietest voice");
+}
+
+void checkThroughput(const GongSynthPatch& patch, float seconds) {
+    printf("\nThroughput (%.0f s of audio per run, host CPU):\n", seconds);
+    printf("  voices  samples/s per voice  real time x\n");
+    bool realTime = true;
+    for (uint8_t voices = 1; voices <= GONG_SYNTH_VOICES; voices++) {
+        stopGongSynth();
+        setGongSynthPatch(patch);
+        for (uint8_t i = 0; i < voices; i++) {
+            strikeGongSynth(GONG_SYNTH_FULL_VELOCITY);
+        }
+        std::vector<int16_t> out(seconds * GONG_SYNTH_RATE);
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < out.size(); i += GONG_SYNTH_DMA_FRAMES) {
+            renderGongSynth(out.data() + i, min((size_t)GONG_SYNTH_DMA_FRAMES, out.size() - i));
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double perVoice = out.size() * voices / elapsed;
+        realTime = realTime && out.size() / elapsed >= GONG_SYNTH_RATE;
+        printf("  %6u  %19.0f  %11.0f\n", voices, perVoice, out.size() / elapsed / GONG_SYNTH_RATE);
+    }
+    check(realTime, "faster than real time with all voices");
+}
+
+void runLoop(uint32_t ms, uint32_t loopMs) {
+    for (uint32_t t = 0; t < ms; t += loopMs) {
+        loopGongSynth();
+        simAdvance(loopMs * 1000);
+    }
+}
+
+void checkLatency(const GongSynthPatch& patch) {
+    printf("\nI2S output (%d x %d frame DMA buffers):\n", GONG_SYNTH_DMA_BUFFERS, GONG_SYNTH_DMA_FRAMES);
+    setGongSynthPatch(patch);
+    check(startGongSynthOutput() && isGongSynthEnabled(), "I2S driver installed");
+    
+    // Strikes at odd times against the DMA buffer boundaries
+    int64_t maxLatencyUs = 0;
+    int64_t sumLatencyUs = 0;
+    bool heard = true;
+    const uint8_t trials = 20;
+    for (uint8_t i = 0; i < trials; i++) {
+        stopGongSynth();
+        runLoop(30, 1);
+        simAdvance(i * 317);
+        uint64_t strikeUs = simNowUs();
+        strikeGongSynth(GONG_SYNTH_FULL_VELOCITY);
+        runLoop(50, 1);
+        
+        const std::vector<int16_t>& out = simI2SOutput();
+        size_t first = (strikeUs - simI2SStartUs()) * GONG_SYNTH_RATE / 1000000;
+        while (first < out.size() && out[first] == 0) {
+            first++;
+        }
+        heard = heard && first < out.size();
+        int64_t latencyUs = simI2SStartUs() + first * 1000000ULL / GONG_SYNTH_RATE - strikeUs;
+        maxLatencyUs = max(maxLatencyUs, latencyUs);
+        sumLatencyUs += latencyUs;
+    }
+    int64_t bufferUs = GONG_SYNTH_DMA_FRAMES * 1000000LL / GONG_SYNTH_RATE;
+    printf("  strike to first sample: %.2f ms mean, %.2f ms max (one DMA buffer %.2f ms)\n",
+           sumLatencyUs / 1000.0 / trials, maxLatencyUs / 1000.0, bufferUs / 1000.0);
+    check(heard && maxLatencyUs <= bufferUs + 2 * 1000000 / GONG_SYNTH_RATE, "heard within one DMA buffer");
+    
+    // With the main loop's 10 ms delay the ring never runs dry while the gong rings
+    stopGongSynth();
+    runLoop(30, 1);
+    uint64_t strikeUs = simNowUs();
+    strikeGongSynth(GONG_SYNTH_FULL_VELOCITY);
+    runLoop(2000, 10);
+    const std::vector<int16_t>& out = simI2SOutput();
+    size_t from = (strikeUs - simI2SStartUs()) * GONG_SYNTH_RATE / 1000000 + GONG_SYNTH_DMA_FRAMES * 2;
+    size_t zeroRun = 0, longestZeroRun = 0;
+    for (size_t i = from; i < from + GONG_SYNTH_RATE && i < out.size(); i++) {
+        zeroRun = out[i] == 0 ? zeroRun + 1 : 0;
+        longestZeroRun = max(longestZeroRun, zeroRun);
+    }
+    check(longestZeroRun < 8, "no gaps at a 10 ms main loop");
+}
+
+bool writeWav(const char* path, const std::vector<int16_t>& samples) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    uint32_t dataBytes = samples.size() * sizeof(int16_t);
+    uint32_t riffBytes = 36 + dataBytes, formatBytes = 16, rate = GONG_SYNTH_RATE, byteRate = rate * 2;
+    uint16_t format = 1, channels = 1, align = 2, bits = 16;
+    fwrite("RIFF", 1, 4, file);
+    fwrite(&riffBytes, 4, 1, file);
+    fwrite("WAVEfmt ", 1, 8, file);
+    fwrite(&formatBytes, 4, 1, file);
+    fwrite(&format, 2, 1, file);
+    fwrite(&channels, 2, 1, file);
+    fwrite(&rate, 4, 1, file);
+    fwrite(&byteRate, 4, 1, file);
+    fwrite(&align, 2, 1, file);
+    fwrite(&bits, 2, 1, file);
+    fwrite("data", 1, 4, file);
+    fwrite(&dataBytes, 4, 1, file);
+    fwrite(samples.data(), sizeof(int16_t), samples.size(), file);
+    return fclose(file) == 0;
+}
+
+int main(int argc, char** argv) {
+    float seconds = 10;
+    const char* wavPath = nullptr;
+    bool usage = argc % 2 == 0;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--seconds") == 0) seconds = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "--wav") == 0) wavPath = argv[i + 1];
+        else usage = true;
+    }
+    if (usage || seconds <= 0) {
+        fprintf(stderr, "usage: synthbench [--seconds s] [--wav file]\n");
+        return 1;
+    }
+    
+    SimChannelConfig channel = {};
+    simInit(channel, 1);
+    setupGongSynth();
+    const GongSynthPatch patch = getGongSynthPatch();
+    
+    if (wavPath) {
+        stopGongSynth();
+        strikeGongSynth(GONG_SYNTH_FULL_VELOCITY);
+        bool written = writeWav(wavPath, render(12));
+        printf("%s %s\n\n", written ? "Wrote" : "Could not write", wavPath);
+    }
+    
+    checkDeterminism(patch);
+    checkTuning(patch);
+    checkDecay();
+    checkOverflow(patch);
+    checkThroughput(patch, seconds);
+    checkLatency(patch);
+    
+    return finishBenchChecks();
+}
@@ -0,0 +1,253 @@
+#include "dfplayersim.h"
+#include "lorasim.h"
+#include "mp3handler.h"
+#include <deque>
+#include <random>
+
+// Byte on its way to the firmware, readable once it has fully arrived
+struct SimUartByte {
+    uint64_t atUs;
+    uint8_t value;
+};
+
+SimDFPlayerConfig simPlayerConfig;
+SimDFPlayerStats simPlayerStats;
+std::deque<SimUartByte> simPlayerOutput;
+std::mt19937 simPlayerRng;
+uint8_t simPlayerFrame[MP3_FRAME_BYTES];
+uint8_t simPlayerFrameLength = 0;
+uint64_t simPlayerLineFreeUs = 0;   // When the module's TX line is free again
+uint64_t simPlayerBootUs = 0;
+bool simPlayerOnlineSent = false;
+uint16_t simPlayerVolume = 20;
+uint16_t simPlayerTrack = 0;
+uint64_t simPlayerBusyFromUs = 0;
+uint64_t simPlayerPlayingUntilUs = 0;
+int simPlayerBusyLevel = HIGH;
+
+void simPlayerBuildFrame(uint8_t* frame, uint8_t command, uint16_t param, uint8_t feedback) {
+    // Written out from the datasheet, as a cross-check of the driver's framing
+    uint8_t body[6] = {MP3_FRAME_VERSION, MP3_FRAME_LENGTH, command, feedback, (uint8_t)(param >> 8),
+                       (uint8_t)param};
+    int sum = 0;
+    for (uint8_t b : body) {
+        sum += b;
+    }
+    uint16_t checksum = 0x10000 - sum;
+    frame[0] = MP3_FRAME_START;
+    memcpy(frame + 1, body, 6);
+    frame[7] = checksum >> 8;
+    frame[8] = checksum;
+    frame[9] = MP3_FRAME_END;
+}
+
+float simPlayerUniform() {
+    return std::uniform_real_distribution<float>(0, 1)(simPlayerRng);
+}
+
+void simPlayerSend(uint8_t command, uint16_t param, uint64_t atUs) {
+    // Replies queue up behind each other on the line
+    uint8_t frame[MP3_FRAME_BYTES];
+    simPlayerBuildFrame(frame, command, param, 0);
+    if (simPlayerUniform() < simPlayerConfig.corruptRate) {
+        frame[3 + simPlayerRng() % 6] ^= 1 << (simPlayerRng() % 8);
+        simPlayerStats.corrupted++;
+    }
+    
+    uint64_t startUs = max(atUs, simPlayerLineFreeUs);
+    for (uint8_t i = 0; i < MP3_FRAME_BYTES; i++) {
+        simPlayerOutput.push_back({startUs + (i + 1) * SIM_DFPLAYER_BYTE_US, frame[i]});
+    }
+    simPlayerLineFreeUs = startUs + MP3_FRAME_BYTES * SIM_DFPLAYER_BYTE_US;
+}
+
+void simPlayerUpdate() {
+    // Events due by now: end of boot, end of the track
+    uint64_t now = simNowUs();
+    if (!simPlayerOnlineSent && now >= simPlayerBootUs) {
+        simPlayerOnlineSent = true;
+        if (simPlayerConfig.bootMs > 0) {
+            simPlayerSend(MP3_MSG_ONLINE, 0x02, simPlayerBootUs);
+        }
+    }
+    if (simPlayerTrack && now >= simPlayerPlayingUntilUs) {
+        // The module reports the end of a track twice
+        simPlayerSend(MP3_MSG_TRACK_FINISHED, simPlayerTrack, simPlayerPlayingUntilUs);
+        simPlayerSend(MP3_MSG_TRACK_FINISHED, simPlayerTrack, simPlayerPlayingUntilUs);
+        simPlayerTrack = 0;
+    }
+    
+    // BUSY edges reach the firmware's interrupt handler when the module is
+    // next looked at, at most a loop iteration late
+    int busyLevel = simDFPlayerIsPlaying() ? LOW : HIGH;
+    if (busyLevel != simPlayerBusyLevel) {
+        simPlayerBusyLevel = busyLevel;
+        simPinChanged(MP3_BUSY_PIN);
+    }
+}
+
+void simPlayerExecute(const uint8_t* frame) {
+    uint8_t command = frame[3];
+    bool feedback = frame[4];
+    uint16_t param = (frame[5] << 8) | frame[6];
+    uint64_t replyUs = simNowUs() + simPlayerConfig.replyDelayUs;
+    
+    if (simNowUs() < simPlayerBootUs) {
+        simPlayerSend(MP3_MSG_ERROR, MP3_ERROR_BUSY, replyUs);
+        return;
+    }
+    
+    switch (command) {
+        case MP3_CMD_QUERY_STATUS:
+            simPlayerSend(command, 0x0200 | (simDFPlayerIsPlaying() ? 1 : 0), replyUs);
+            return;
+        case MP3_CMD_QUERY_VOLUME:
+            simPlayerSend(command, simPlayerVolume, replyUs);
+            return;
+        case MP3_CMD_QUERY_TRACKS:
+            // Every file on the card, in /mp3 and in the numbered folders
+            simPlayerSend(command, simPlayerConfig.tracks + simPlayerConfig.folders * simPlayerConfig.folderTracks,
+                          replyUs);
+            return;
+        case MP3_CMD_QUERY_FOLDERS:
+            simPlayerSend(command, simPlayerConfig.folders, replyUs);
+            return;
+        case MP3_CMD_QUERY_FOLDER_TRACKS:
+            if (param < 1 || param > simPlayerConfig.folders) {
+                simPlayerSend(MP3_MSG_ERROR, MP3_ERROR_TRACK_NOT_FOUND, replyUs);
+                return;
+            }
+            simPlayerSend(command, simPlayerConfig.folderTracks, replyUs);
+            return;
+        case MP3_CMD_PLAY_TRACK:
+            if (param < 1 || param > simPlayerConfig.tracks) {
+                simPlayerSend(MP3_MSG_ERROR, MP3_ERROR_TRACK_NOT_FOUND, replyUs);
+                return;
+            }
+            simPlayerTrack = param;
+            simPlayerBusyFromUs = simNowUs() + simPlayerConfig.busyDelayUs;
+            simPlayerPlayingUntilUs = simPlayerBusyFromUs + simPlayerConfig.trackMs * 1000ULL;
+            simPlayerStats.plays++;
+            break;
+        case MP3_CMD_STOP:
+            simPlayerTrack = 0;
+            break;
+        case MP3_CMD_SET_VOL:
+            simPlayerVolume = min(param, (uint16_t)MP3_MAX_VOLUME);
+            break;
+    }
+    if (feedback) {
+        simPlayerSend(MP3_MSG_ACK, 0, replyUs);
+    }
+}
+
+void simPlayerReceive(uint8_t c) {
+    simPlayerUpdate();
+    if (simPlayerFrameLength == 0 && c != MP3_FRAME_START) {
+        return;
+    }
+    simPlayerFrame[simPlayerFrameLength++] = c;
+    if (simPlayerFrameLength < MP3_FRAME_BYTES) {
+        return;
+    }
+    
+    simPlayerFrameLength = 0;
+    simPlayerStats.framesReceived++;
+    if (simPlayerUniform() < simPlayerConfig.dropRate) {
+        simPlayerStats.dropped++;
+        return;
+    }
+    
+    uint8_t expected[MP3_FRAME_BYTES];
+    simPlayerBuildFrame(expected, simPlayerFrame[3], (simPlayerFrame[5] << 8) | simPlayerFrame[6], simPlayerFrame[4]);
+    if (memcmp(expected, simPlayerFrame, MP3_FRAME_BYTES) != 0) {
+        simPlayerStats.badFrames++;
+        simPlayerSend(MP3_MSG_ERROR, MP3_ERROR_CHECKSUM, simNowUs() + simPlayerConfig.replyDelayUs);
+        return;
+    }
+    simPlayerExecute(simPlayerFrame);
+}
+
+int simPlayerAvailable() {
+    simPlayerUpdate();
+    int count = 0;
+    for (const SimUartByte& b : simPlayerOutput) {
+        if (b.atUs > simNowUs()) {
+            break;
+        }
+        count++;
+    }
+    return count;
+}
+
+int simPlayerRead() {
+    if (simPlayerAvailable() == 0) {
+        return -1;
+    }
+    uint8_t value = simPlayerOutput.front().value;
+    simPlayerOutput.pop_front();
+    return value;
+}
+
+int simPlayerPeek() {
+    return simPlayerAvailable() > 0 ? simPlayerOutput.front().value : -1;
+}
+
+int simPlayerReadPin(uint8_t pin) {
+    // BUSY is low while playing; every other pin reads low
+    if (pin == MP3_BUSY_PIN) {
+        simPlayerUpdate();
+        return simPlayerBusyLevel;
+    }
+    return LOW;
+}
+
+const SimUartDevice simPlayerDevice = {simPlayerReceive, simPlayerAvailable, simPlayerRead, simPlayerPeek};
+
+void simDFPlayerStart(int uart, const SimDFPlayerConfig& config) {
+    // Power-up: nothing playing, nothing on the line
+    simPlayerConfig = config;
+    simPlayerStats = {};
+    simPlayerOutput.clear();
+    simPlayerRng.seed(config.seed);
+    simPlayerFrameLength = 0;
+    simPlayerLineFreeUs = 0;
+    simPlayerBootUs = simNowUs() + config.bootMs * 1000ULL;
+    simPlayerOnlineSent = false;
+    simPlayerTrack = 0;
+    simPlayerBusyLevel = HIGH;
+    simAttachUart(uart, &simPlayerDevice);
+    simSetPinReader(simPlayerReadPin);
+}
+
+void simDFPlayerInject(const uint8_t* bytes, size_t length) {
+    // Raw bytes for the firmware, as line noise or a partial frame would arrive
+    uint64_t startUs = max(simNowUs(), simPlayerLineFreeUs);
+    for (size_t i = 0; i < length; i++) {
+        simPlayerOutput.push_back({startUs + (i + 1) * SIM_DFPLAYER_BYTE_US, bytes[i]});
+    }
+    simPlayerLineFreeUs = startUs + length * SIM_DFPLAYER_BYTE_US;
+}
+
+void simDFPlayerChangeCard(uint16_t tracks, uint8_t folders, uint16_t folderTracks) {
+    // Card pulled and another pushed in 200 ms later, as the module reports it
+    simPlayerTrack = 0;
+    simPlayerSend(MP3_MSG_CARD_REMOVED, 0x02, simNowUs());
+    simPlayerConfig.tracks = tracks;
+    simPlayerConfig.folders = folders;
+    simPlayerConfig.folderTracks = folderTracks;
+    simPlayerSend(MP3_MSG_CARD_INSERTED, 0x02, simNowUs() + 200000);
+}
+
+bool simDFPlayerIsPlaying() {
+    uint64_t now = simNowUs();
+    return simPlayerTrack && now >= simPlayerBusyFromUs && now < simPlayerPlayingUntilUs;
+}
+
+uint16_t simDFPlayerVolume() {
+    return simPlayerVolume;
+}
+
+const SimDFPlayerStats& simDFPlayerStats() {
+    return simPlayerStats;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Simulated MP3-TF-16P (DFPlayer Mini) on a UART of the fake Arduino core,
+// for driving src/mp3handler.cpp on the host. It speaks the 10-byte serial
+// protocol at 9600 baud timing, answers queries, ACKs commands that ask for
+// it, reports errors, plays tracks of a fixed length with the BUSY pin low
+// while playing (its edges raise the pin interrupt), and can lose commands
+// or damage replies on purpose.
+#define SIM_DFPLAYER_BYTE_US 1042       // 10 bits at 9600 baud
+
+struct SimDFPlayerConfig {
+    uint16_t tracks = 3;            // In /mp3
+    uint8_t folders = 0;            // Numbered folders, 01 up
+    uint16_t folderTracks = 0;      // Tracks in each of them
+    uint32_t trackMs = 2000;        // Length of every track
+    uint32_t bootMs = 0;            // MP3_ERROR_BUSY until then, then MP3_MSG_ONLINE
+    uint32_t replyDelayUs = 8000;   // End of a command to the start of the reply
+    uint32_t busyDelayUs = 60000;   // Play command to BUSY low
+    float dropRate = 0;             // Commands lost on the wire
+    float corruptRate = 0;          // Replies with a flipped bit
+    uint32_t seed = 1;
+};
+
+struct SimDFPlayerStats {
+    uint32_t framesReceived;
+    uint32_t badFrames;
+    uint32_t dropped;
+    uint32_t corrupted;
+    uint32_t plays;
+};
+
+// Function declarations
+void simDFPlayerStart(int uart, const SimDFPlayerConfig& config);
+void simDFPlayerInject(const uint8_t* bytes, size_t length);
+void simDFPlayerChangeCard(uint16_t tracks, uint8_t folders, uint16_t folderTracks);
+bool simDFPlayerIsPlaying();
+uint16_t simDFPlayerVolume();
+const SimDFPlayerStats& simDFPlayerStats();
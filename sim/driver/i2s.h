@@ -0,0 +1,63 @@
+#pragma once
+
+// Host stand-in for the ESP32 I2S driver (legacy driver/i2s.h API) the
+// gong synthesizer writes to. Output is consumed at the sample rate on the
+// simulator clock, through a DMA ring of dma_buf_count x dma_buf_len frames
+// that plays silence when it runs dry, so writes see a full ring and a
+// strike after silence waits for the next DMA buffer.
+#include <Arduino.h>
+#include <vector>
+
+#ifndef ESP_OK
+typedef int esp_err_t;
+#define ESP_OK 0
+#endif
+#define ESP_FAIL -1
+typedef uint32_t TickType_t;
+
+typedef int i2s_port_t;
+#define I2S_NUM_0 0
+
+#define I2S_MODE_MASTER 0x01
+#define I2S_MODE_TX 0x04
+#define I2S_BITS_PER_SAMPLE_16BIT 16
+#define I2S_CHANNEL_FMT_ONLY_LEFT 4
+#define I2S_COMM_FORMAT_STAND_I2S 0x01
+#define I2S_PIN_NO_CHANGE -1
+
+typedef int i2s_mode_t;
+typedef int i2s_bits_per_sample_t;
+typedef int i2s_channel_fmt_t;
+typedef int i2s_comm_format_t;
+
+struct i2s_config_t {
+    int mode;
+    uint32_t sample_rate;
+    int bits_per_sample;
+    int channel_format;
+    int communication_format;
+    int intr_alloc_flags;
+    int dma_buf_count;
+    int dma_buf_len;
+    bool use_apll;
+    bool tx_desc_auto_clear;
+};
+
+struct i2s_pin_config_t {
+    int bck_io_num;
+    int ws_io_num;
+    int data_out_num;
+    int data_in_num;
+};
+
+esp_err_t i2s_driver_install(i2s_port_t port, const i2s_config_t* config, int queueSize, void* queue);
+esp_err_t i2s_driver_uninstall(i2s_port_t port);
+esp_err_t i2s_set_pin(i2s_port_t port, const i2s_pin_config_t* pins);
+esp_err_t i2s_write(i2s_port_t port, const void* source, size_t size, size_t* written, TickType_t ticksToWait);
+esp_err_t i2s_zero_dma_buffer(i2s_port_t port);
+
+// What has been played, one 16-bit mono sample per frame, from the time
+// the driver was installed (silence included)
+const std::vector<int16_t>& simI2SOutput();
+uint64_t simI2SStartUs();
+void simI2SReset();
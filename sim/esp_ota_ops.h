@@ -0,0 +1,12 @@
+#pragma once
+
+#include "esp_partition.h"
+
+// The fields the firmware reads
+struct esp_app_desc_t {
+    char version[32];
+    uint8_t app_elf_sha256[32];
+};
+
+const esp_partition_t* esp_ota_get_running_partition();
+const esp_app_desc_t* esp_ota_get_app_description();
@@ -0,0 +1,18 @@
+#pragma once
+
+// Host stand-in for the partition API: a node's app partition is the image
+// the simulator gave it (simSetNodeImage)
+#include <stdint.h>
+#include <stddef.h>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+struct esp_partition_t {
+    uint8_t node;
+    uint32_t size;
+};
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t offset, void* destination, size_t size);
+esp_err_t esp_partition_get_sha256(const esp_partition_t* partition, uint8_t* sha256);
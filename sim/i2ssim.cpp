@@ -0,0 +1,87 @@
+#include <driver/i2s.h>
+#include "lorasim.h"
+
+i2s_config_t simI2SConfig;
+bool simI2SInstalled = false;
+uint64_t simI2SInstalledUs = 0;
+std::vector<int16_t> simI2SPlayed;     // Frame n played at simI2SInstalledUs + n / rate
+std::vector<int16_t> simI2SQueue;      // Written, not yet played
+uint64_t simI2SPlayedFrames = 0;
+
+uint64_t simI2SFrameAt(uint64_t us) {
+    return (us - simI2SInstalledUs) * simI2SConfig.sample_rate / 1000000;
+}
+
+void simI2SUpdate() {
+    // Move what the DMA has played by now from the queue to the output;
+    // a dry ring plays silence a whole DMA buffer at a time
+    uint64_t due = simI2SFrameAt(simNowUs());
+    while (simI2SPlayedFrames < due) {
+        if (simI2SQueue.empty()) {
+            uint64_t length = simI2SConfig.dma_buf_len;
+            uint64_t silence = (due + length - 1) / length * length - simI2SPlayedFrames;
+            simI2SPlayed.insert(simI2SPlayed.end(), silence, 0);
+            simI2SPlayedFrames += silence;
+            break;
+        }
+        size_t count = min((size_t)(due - simI2SPlayedFrames), simI2SQueue.size());
+        simI2SPlayed.insert(simI2SPlayed.end(), simI2SQueue.begin(), simI2SQueue.begin() + count);
+        simI2SQueue.erase(simI2SQueue.begin(), simI2SQueue.begin() + count);
+        simI2SPlayedFrames += count;
+    }
+}
+
+esp_err_t i2s_driver_install(i2s_port_t port, const i2s_config_t* config, int queueSize, void* queue) {
+    simI2SConfig = *config;
+    simI2SInstalled = true;
+    simI2SReset();
+    return ESP_OK;
+}
+
+esp_err_t i2s_driver_uninstall(i2s_port_t port) {
+    simI2SInstalled = false;
+    return ESP_OK;
+}
+
+esp_err_t i2s_set_pin(i2s_port_t port, const i2s_pin_config_t* pins) {
+    return ESP_OK;
+}
+
+esp_err_t i2s_write(i2s_port_t port, const void* source, size_t size, size_t* written, TickType_t ticksToWait) {
+    *written = 0;
+    if (!simI2SInstalled) {
+        return ESP_FAIL;
+    }
+    simI2SUpdate();
+    
+    // Whatever fits in the ring; the part of the playing buffer already out counts as free
+    size_t capacity = simI2SConfig.dma_buf_count * simI2SConfig.dma_buf_len;
+    size_t room = capacity > simI2SQueue.size() ? capacity - simI2SQueue.size() : 0;
+    size_t frames = min(size / sizeof(int16_t), room);
+    const int16_t* samples = (const int16_t*)source;
+    simI2SQueue.insert(simI2SQueue.end(), samples, samples + frames);
+    *written = frames * sizeof(int16_t);
+    return ESP_OK;
+}
+
+esp_err_t i2s_zero_dma_buffer(i2s_port_t port) {
+    simI2SUpdate();
+    simI2SQueue.clear();
+    return ESP_OK;
+}
+
+const std::vector<int16_t>& simI2SOutput() {
+    simI2SUpdate();
+    return simI2SPlayed;
+}
+
+uint64_t simI2SStartUs() {
+    return simI2SInstalledUs;
+}
+
+void simI2SReset() {
+    simI2SInstalledUs = simNowUs();
+    simI2SPlayed.clear();
+    simI2SQueue.clear();
+    simI2SPlayedFrames = 0;
+}
@@ -0,0 +1,533 @@
+#include "lorasim.h"
+#include <LoRa.h>
+#include <SPI.h>
+#include <algorithm>
+#include <random>
+
+// SX1278 registers and interrupt flags the firmware reads over SPI
+#define SIM_REG_FIFO 0x00
+#define SIM_REG_FIFO_ADDR_PTR 0x0D
+#define SIM_REG_FIFO_RX_CURRENT_ADDR 0x10
+#define SIM_REG_IRQ_FLAGS 0x12
+#define SIM_REG_RX_NB_BYTES 0x13
+#define SIM_REG_DIO_MAPPING_1 0x40
+#define SIM_IRQ_CAD_DETECTED 0x01
+#define SIM_IRQ_CAD_DONE 0x04
+#define SIM_IRQ_TX_DONE 0x08
+#define SIM_IRQ_RX_DONE 0x40
+
+// Simulated SX1278 of one virtual node
+struct SimRadio {
+    int mode;
+    long frequency;
+    int spreadingFactor;
+    long bandwidth;
+    int codingRate;
+    int preambleLength;
+    int txPower;
+    int syncWord;
+    uint64_t rxSinceUs;         // Listening on the current settings since
+    uint64_t busyUntilUs;       // End of the TX or CAD in progress
+    bool cadBusy;
+    std::string txBuffer;
+    std::string rxBuffer;
+    size_t rxOffset;
+    int packetRssi;
+    float packetSnr;
+    uint8_t irqFlags;
+    uint8_t dioMapping;
+    int spiAddress;             // Register of the SPI transaction in progress, -1 before its first byte
+};
+
+LoRaClass LoRa;
+
+// Channel state
+SimChannelConfig simConfig;
+uint8_t simNodes = 0;
+uint8_t simNode = 0;
+uint64_t simClockUs = 0;
+bool simVerbose = false;
+SimDeliveryHook simDeliveryHook = nullptr;
+
+SimRadio simRadios[SIM_MAX_NODES];
+SimNodeRadioStats simRadioStats[SIM_MAX_NODES];
+std::string simNodeConfigs[SIM_MAX_NODES];
+float simPositions[SIM_MAX_NODES][2];
+float simPathLoss[SIM_MAX_NODES][SIM_MAX_NODES];
+
+std::vector<SimTransmission> simAir;     // In flight and recently ended
+uint32_t simNextTxId = 1;
+SimChannelStats simStats;
+std::mt19937 simRng;
+
+void simInit(const SimChannelConfig& config, uint8_t nodeCount) {
+    simConfig = config;
+    simNodes = min(nodeCount, (uint8_t)SIM_MAX_NODES);
+    simClockUs = 0;
+    simAir.clear();
+    simStats = SimChannelStats();
+    simRng.seed(config.seed);
+    
+    std::uniform_real_distribution<float> place(0, config.areaMeters);
+    std::normal_distribution<float> shadowing(0, config.shadowingDb);
+    for (uint8_t i = 0; i < simNodes; i++) {
+        simPositions[i][0] = place(simRng);
+        simPositions[i][1] = place(simRng);
+        simRadios[i] = SimRadio();
+        simRadios[i].mode = SIM_RADIO_SLEEP;
+        simRadioStats[i] = SimNodeRadioStats();
+    }
+    
+    // Symmetric links: same loss both ways
+    for (uint8_t i = 0; i < simNodes; i++) {
+        for (uint8_t j = i + 1; j < simNodes; j++) {
+            float distance = max(simDistance(i, j), 1.0f);
+            float loss = config.referenceLossDb + 10 * config.pathLossExponent * log10f(distance) + shadowing(simRng);
+            simPathLoss[i][j] = loss;
+            simPathLoss[j][i] = loss;
+        }
+    }
+}
+
+uint8_t simNodeCount() {
+    return simNodes;
+}
+
+void simSetCurrentNode(uint8_t node) {
+    simNode = node;
+}
+
+uint8_t simCurrentNode() {
+    return simNode;
+}
+
+void simSetNodeConfig(uint8_t node, const std::string& json) {
+    simNodeConfigs[node] = json;
+}
+
+const std::string& simGetNodeConfig(uint8_t node) {
+    return simNodeConfigs[node];
+}
+
+void simSetVerbose(bool verbose) {
+    simVerbose = verbose;
+}
+
+bool simIsVerbose() {
+    return simVerbose;
+}
+
+void simSetDeliveryHook(SimDeliveryHook hook) {
+    simDeliveryHook = hook;
+}
+
+uint64_t simNowUs() {
+    return simClockUs;
+}
+
+float simDistance(uint8_t from, uint8_t to) {
+    float dx = simPositions[from][0] - simPositions[to][0];
+    float dy = simPositions[from][1] - simPositions[to][1];
+    return sqrtf(dx * dx + dy * dy);
+}
+
+float simLinkSnr(uint8_t from, uint8_t to, int txPower) {
+    return txPower - simPathLoss[from][to] - simConfig.noiseFloorDbm;
+}
+
+float simSnrFloor(int spreadingFactor) {
+    return -7.5f - 2.5f * (spreadingFactor - 7);
+}
+
+uint32_t simAirtimeUs(size_t payloadLength, int spreadingFactor, long bandwidth, int codingRate, int preambleLength) {
+    // Semtech AN1200.13, explicit header, CRC off; floating point on purpose,
+    // as a cross-check of the firmware's integer version
+    double symbolUs = (double)(1 << spreadingFactor) / bandwidth * 1e6;
+    int lowDataRateOptimize = symbolUs > 16000 ? 1 : 0;
+    double payloadSymbols = 8 + max(ceil((8.0 * payloadLength - 4.0 * spreadingFactor + 28) /
+                                         (4.0 * (spreadingFactor - 2 * lowDataRateOptimize))) * codingRate, 0.0);
+    return (uint32_t)((preambleLength + 4.25 + payloadSymbols) * symbolUs);
+}
+
+uint32_t simSymbolUs(const SimRadio& radio) {
+    return (uint32_t)((1000000ULL << radio.spreadingFactor) / radio.bandwidth);
+}
+
+const SimChannelStats& simGetChannelStats() {
+    return simStats;
+}
+
+const SimNodeRadioStats& simGetNodeRadioStats(uint8_t node) {
+    return simRadioStats[node];
+}
+
+bool simDio0Level(const SimRadio& radio) {
+    // RegDioMapping1 bits 7-6 pick the flag DIO0 follows: RX done, TX done, CAD done
+    static const uint8_t mapped[4] = {SIM_IRQ_RX_DONE, SIM_IRQ_TX_DONE, SIM_IRQ_CAD_DONE, 0};
+    return (radio.irqFlags & mapped[radio.dioMapping >> 6]) != 0;
+}
+
+void simSetRadioIrq(SimRadio& radio, uint8_t irqFlags, uint8_t dioMapping) {
+    // DIO0 rising reaches the interrupt handler of the node being run
+    bool wasHigh = simDio0Level(radio);
+    radio.irqFlags = irqFlags;
+    radio.dioMapping = dioMapping;
+    if (!wasHigh && simDio0Level(radio)) {
+        simPinChanged(SIM_RADIO_DIO0_PIN);
+    }
+}
+
+int simRadioDio0() {
+    return simDio0Level(simRadios[simNode]) ? HIGH : LOW;
+}
+
+// ---- Channel ----
+
+bool simOverlaps(const SimTransmission& a, uint64_t startUs, uint64_t endUs) {
+    return a.startUs < endUs && startUs < a.endUs;
+}
+
+bool simCollided(const SimTransmission& tx, uint8_t receiver, float rssi) {
+    for (const SimTransmission& other : simAir) {
+        if (other.id == tx.id || other.sender == receiver || other.spreadingFactor != tx.spreadingFactor) {
+            continue;
+        }
+        if (!simOverlaps(other, tx.startUs, tx.endUs)) {
+            continue;
+        }
+        float otherRssi = other.txPower - simPathLoss[other.sender][receiver];
+        if (rssi - otherRssi < simConfig.captureDb) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void simDeliver(const SimTransmission& tx) {
+    std::normal_distribution<float> fading(0, simConfig.fadingDb);
+    std::uniform_real_distribution<float> chance(0, 1);
+    
+    for (uint8_t r = 0; r < simNodes; r++) {
+        if (r == tx.sender) {
+            continue;
+        }
+        
+        SimRadio& radio = simRadios[r];
+        float rssi = tx.txPower - simPathLoss[tx.sender][r] + fading(simRng);
+        float snr = rssi - simConfig.noiseFloorDbm;
+        if (snr < simSnrFloor(tx.spreadingFactor)) {
+            simStats.lostWeak++;
+            continue;
+        }
+        
+        // In RX on the frame's SF, and early enough to lock on the preamble
+        bool listening = radio.mode == SIM_RADIO_RX && radio.spreadingFactor == tx.spreadingFactor &&
+                         radio.rxSinceUs <= tx.lockDeadlineUs;
+        if (!listening) {
+            simStats.lostNotListening++;
+            continue;
+        }
+        if (chance(simRng) < simConfig.linkLoss) {
+            simStats.lostLink++;
+            continue;
+        }
+        if (simCollided(tx, r, rssi)) {
+            simStats.lostCollision++;
+            continue;
+        }
+        
+        simStats.delivered++;
+        simRadioStats[r].rxFrames++;
+        radio.rxBuffer = tx.data;
+        radio.rxOffset = 0;
+        radio.packetRssi = (int)lroundf(rssi);
+        radio.packetSnr = roundf(snr * 4) / 4;  // The SX1278 reports quarter dB
+        
+        uint8_t previous = simNode;
+        simNode = r;
+        if (simDeliveryHook) {
+            simDeliveryHook(tx, r, radio.packetRssi, radio.packetSnr);
+        }
+        simSetRadioIrq(radio, radio.irqFlags | SIM_IRQ_RX_DONE, radio.dioMapping);
+        simNode = previous;
+    }
+}
+
+bool simChannelActive(uint8_t node, int spreadingFactor, uint64_t startUs, uint64_t endUs) {
+    // CAD: any frame on this SF in the window, strong enough to demodulate
+    for (const SimTransmission& tx : simAir) {
+        if (tx.sender == node || tx.spreadingFactor != spreadingFactor || !simOverlaps(tx, startUs, endUs)) {
+            continue;
+        }
+        if (simLinkSnr(tx.sender, node, tx.txPower) >= simSnrFloor(spreadingFactor)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void simAdvance(uint64_t us) {
+    uint64_t target = simClockUs + us;
+    
+    // Radio events up to the target time, in time order
+    while (true) {
+        uint64_t next = UINT64_MAX;
+        for (uint8_t i = 0; i < simNodes; i++) {
+            const SimRadio& radio = simRadios[i];
+            if ((radio.mode == SIM_RADIO_TX || radio.mode == SIM_RADIO_CAD) && radio.busyUntilUs < next) {
+                next = radio.busyUntilUs;
+            }
+        }
+        if (next > target) {
+            break;
+        }
+        simClockUs = max(simClockUs, next);
+        
+        for (uint8_t i = 0; i < simNodes; i++) {
+            SimRadio& radio = simRadios[i];
+            if (radio.busyUntilUs != next) {
+                continue;
+            }
+            
+            simNode = i;
+            if (radio.mode == SIM_RADIO_TX) {
+                radio.mode = SIM_RADIO_STANDBY;
+                for (const SimTransmission& tx : simAir) {
+                    if (tx.sender == i && tx.endUs == next) {
+                        simDeliver(tx);
+                        break;
+                    }
+                }
+                simSetRadioIrq(radio, radio.irqFlags | SIM_IRQ_TX_DONE, radio.dioMapping);
+            } else if (radio.mode == SIM_RADIO_CAD) {
+                radio.mode = SIM_RADIO_STANDBY;
+                if (radio.cadBusy) {
+                    simStats.cadBusy++;
+                }
+                uint8_t detected = radio.cadBusy ? SIM_IRQ_CAD_DETECTED : 0;
+                simSetRadioIrq(radio, radio.irqFlags | SIM_IRQ_CAD_DONE | detected, radio.dioMapping);
+            }
+        }
+    }
+    simClockUs = target;
+    
+    // Frames that can no longer overlap anything on air
+    uint64_t longest = 0;
+    for (const SimTransmission& tx : simAir) {
+        longest = max(longest, tx.endUs - tx.startUs);
+    }
+    simAir.erase(std::remove_if(simAir.begin(), simAir.end(),
+                                [&](const SimTransmission& tx) { return tx.endUs + longest < simClockUs; }),
+                 simAir.end());
+}
+
+// ---- LoRa object ----
+
+SimRadio& simRadio() {
+    return simRadios[simNode];
+}
+
+void simSetMode(SimRadio& radio, int mode) {
+    if (mode == SIM_RADIO_RX && radio.mode != SIM_RADIO_RX) {
+        radio.rxSinceUs = simClockUs;
+    }
+    radio.mode = mode;
+}
+
+int LoRaClass::begin(long frequency) {
+    SimRadio& radio = simRadio();
+    radio.frequency = frequency;
+    radio.spreadingFactor = 7;
+    radio.bandwidth = 125000;
+    radio.codingRate = 5;
+    radio.preambleLength = 8;
+    radio.txPower = 17;
+    radio.syncWord = 0x12;
+    simSetMode(radio, SIM_RADIO_STANDBY);
+    return 1;
+}
+
+void LoRaClass::end() {
+    sleep();
+}
+
+int LoRaClass::beginPacket(int implicitHeader) {
+    SimRadio& radio = simRadio();
+    if (radio.mode == SIM_RADIO_TX) {
+        return 0;
+    }
+    
+    // As the library's isTransmitting(): a TX-done flag left over is cleared
+    simSetRadioIrq(radio, radio.irqFlags & ~SIM_IRQ_TX_DONE, radio.dioMapping);
+    simSetMode(radio, SIM_RADIO_STANDBY);
+    radio.txBuffer.clear();
+    return 1;
+}
+
+int LoRaClass::endPacket(bool async) {
+    SimRadio& radio = simRadio();
+    uint32_t airtimeUs = simAirtimeUs(radio.txBuffer.size(), radio.spreadingFactor, radio.bandwidth,
+                                      radio.codingRate, radio.preambleLength);
+    
+    SimTransmission tx;
+    tx.id = simNextTxId++;
+    tx.sender = simNode;
+    tx.spreadingFactor = radio.spreadingFactor;
+    tx.txPower = radio.txPower;
+    tx.startUs = simClockUs;
+    tx.lockDeadlineUs = simClockUs + (uint64_t)max(radio.preambleLength - SIM_LOCK_SYMBOLS, 0) * simSymbolUs(radio);
+    tx.endUs = simClockUs + airtimeUs;
+    tx.data = radio.txBuffer;
+    simAir.push_back(tx);
+    
+    simStats.transmissions++;
+    simStats.airtimeUs += airtimeUs;
+    simRadioStats[simNode].txFrames++;
+    simRadioStats[simNode].txAirtimeUs += airtimeUs;
+    
+    // Blocking sends are not simulated; the firmware only uses async TX
+    simSetMode(radio, SIM_RADIO_TX);
+    radio.busyUntilUs = tx.endUs;
+    return 1;
+}
+
+size_t LoRaClass::write(uint8_t byte) {
+    simRadio().txBuffer += (char)byte;
+    return 1;
+}
+
+size_t LoRaClass::write(const uint8_t* buffer, size_t size) {
+    simRadio().txBuffer.append((const char*)buffer, size);
+    return size;
+}
+
+int LoRaClass::parsePacket(int size) {
+    // Polling mode: a frame waiting in the FIFO
+    SimRadio& radio = simRadio();
+    return radio.rxOffset < radio.rxBuffer.size() ? (int)radio.rxBuffer.size() : 0;
+}
+
+int LoRaClass::packetRssi() {
+    return simRadio().packetRssi;
+}
+
+float LoRaClass::packetSnr() {
+    return simRadio().packetSnr;
+}
+
+int LoRaClass::available() {
+    SimRadio& radio = simRadio();
+    return (int)(radio.rxBuffer.size() - radio.rxOffset);
+}
+
+int LoRaClass::read() {
+    SimRadio& radio = simRadio();
+    return radio.rxOffset < radio.rxBuffer.size() ? (uint8_t)radio.rxBuffer[radio.rxOffset++] : -1;
+}
+
+int LoRaClass::peek() {
+    SimRadio& radio = simRadio();
+    return radio.rxOffset < radio.rxBuffer.size() ? (uint8_t)radio.rxBuffer[radio.rxOffset] : -1;
+}
+
+void LoRaClass::receive(int size) {
+    SimRadio& radio = simRadio();
+    if (radio.mode == SIM_RADIO_TX) {
+        return;
+    }
+    simSetRadioIrq(radio, radio.irqFlags, 0x00);   // DIO0 on RX done
+    simSetMode(radio, SIM_RADIO_RX);
+}
+
+void LoRaClass::channelActivityDetection() {
+    SimRadio& radio = simRadio();
+    simSetRadioIrq(radio, radio.irqFlags, 0x80);   // DIO0 on CAD done
+    uint64_t durationUs = 2ULL * simSymbolUs(radio);
+    simStats.cadChecks++;
+    radio.cadBusy = simChannelActive(simNode, radio.spreadingFactor, simClockUs, simClockUs + durationUs);
+    simSetMode(radio, SIM_RADIO_CAD);
+    radio.busyUntilUs = simClockUs + durationUs;
+}
+
+void LoRaClass::idle() {
+    simSetMode(simRadio(), SIM_RADIO_STANDBY);
+}
+
+void LoRaClass::sleep() {
+    simSetMode(simRadio(), SIM_RADIO_SLEEP);
+}
+
+void LoRaClass::setTxPower(int level, int outputPin) {
+    simRadio().txPower = level;
+}
+
+void LoRaClass::setFrequency(long frequency) {
+    simRadio().frequency = frequency;
+    simRadio().rxSinceUs = simClockUs;
+}
+
+void LoRaClass::setSpreadingFactor(int sf) {
+    simRadio().spreadingFactor = sf;
+    simRadio().rxSinceUs = simClockUs;
+}
+
+void LoRaClass::setSignalBandwidth(long sbw) {
+    simRadio().bandwidth = sbw;
+    simRadio().rxSinceUs = simClockUs;
+}
+
+void LoRaClass::setCodingRate4(int denominator) {
+    simRadio().codingRate = denominator;
+}
+
+void LoRaClass::setPreambleLength(long length) {
+    simRadio().preambleLength = (int)length;
+}
+
+void LoRaClass::setSyncWord(int sw) {
+    simRadio().syncWord = sw;
+}
+
+// ---- Registers over SPI ----
+
+void SPIClass::beginTransaction(SPISettings settings) {
+    simRadio().spiAddress = -1;
+}
+
+uint8_t SPIClass::transfer(uint8_t data) {
+    SimRadio& radio = simRadio();
+    if (radio.spiAddress < 0) {
+        radio.spiAddress = data;
+        return 0;
+    }
+    
+    // Bursts stay on the one register, as the firmware only bursts the FIFO
+    bool write = radio.spiAddress & 0x80;
+    switch (radio.spiAddress & 0x7F) {
+        case SIM_REG_FIFO:
+            // The last frame received, always at FIFO address 0
+            return !write && radio.rxOffset < radio.rxBuffer.size() ? (uint8_t)radio.rxBuffer[radio.rxOffset++] : 0;
+        case SIM_REG_FIFO_ADDR_PTR:
+            if (write) {
+                radio.rxOffset = data;
+            }
+            return (uint8_t)radio.rxOffset;
+        case SIM_REG_FIFO_RX_CURRENT_ADDR:
+            return 0;
+        case SIM_REG_IRQ_FLAGS:
+            // Writing a one clears that flag
+            if (write) {
+                simSetRadioIrq(radio, radio.irqFlags & ~data, radio.dioMapping);
+            }
+            return radio.irqFlags;
+        case SIM_REG_RX_NB_BYTES:
+            return (uint8_t)radio.rxBuffer.size();
+        case SIM_REG_DIO_MAPPING_1:
+            if (write) {
+                simSetRadioIrq(radio, radio.irqFlags, data);
+            }
+            return radio.dioMapping;
+        default:
+            return 0;
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <Arduino.h>
+#include <string>
+#include <vector>
+
+// Host-side LoRa channel simulator.
+//
+// N virtual nodes share one channel in one process. Each node has a
+// simulated SX1278 behind the fake LoRa object, and its own copy of the
+// firmware LoRa stack (see simnode.h). The channel models:
+//   - log-distance path loss with fixed per-link shadowing, per-packet fading
+//   - the demodulation floor per SF, plus an extra per-link loss probability
+//   - airtime from SF/BW/CR/preamble/payload (computed independently here)
+//   - collisions on the same SF, with capture when one frame is stronger
+//   - half duplex, and the preamble lock needed to receive a frame
+// The firmware reads the interrupt flags and the FIFO over SPI itself; the
+// simulated radio answers those registers and raises DIO0 as the SX1278 does.
+#define SIM_MAX_NODES 64              // As many as the master tracks (MAX_NODES)
+#define SIM_LOCK_SYMBOLS 5            // Preamble symbols a receiver needs to lock
+#define SIM_RADIO_DIO0_PIN 2          // As LORA_DIO0_PIN
+
+// Radio modes
+#define SIM_RADIO_SLEEP 0
+#define SIM_RADIO_STANDBY 1
+#define SIM_RADIO_TX 2
+#define SIM_RADIO_RX 3
+#define SIM_RADIO_CAD 4
+
+struct SimChannelConfig {
+    uint32_t seed;
+    float areaMeters;           // Nodes placed uniformly in a square this wide
+    float pathLossExponent;
+    float referenceLossDb;      // Path loss at 1 m
+    float shadowingDb;          // Standard deviation, fixed per link
+    float fadingDb;             // Standard deviation, per packet
+    float noiseFloorDbm;        // -174 + 10log10(BW) + noise figure
+    float linkLoss;             // Extra loss probability per packet and link
+    float captureDb;            // A frame survives an overlap if this much stronger
+};
+
+struct SimTransmission {
+    uint32_t id;
+    uint8_t sender;
+    int spreadingFactor;
+    int txPower;
+    uint64_t startUs;
+    uint64_t lockDeadlineUs;    // Receivers must be listening by then
+    uint64_t endUs;
+    std::string data;
+};
+
+// Reception outcome per receiver, counted over the whole run
+struct SimChannelStats {
+    uint32_t transmissions;
+    uint64_t airtimeUs;
+    uint32_t delivered;
+    uint32_t lostWeak;          // Below the demodulation floor
+    uint32_t lostLink;          // Extra per-link loss
+    uint32_t lostCollision;
+    uint32_t lostNotListening;  // Transmitting, asleep, sampling or on another SF
+    uint32_t cadChecks;
+    uint32_t cadBusy;
+};
+
+struct SimNodeRadioStats {
+    uint32_t txFrames;
+    uint64_t txAirtimeUs;
+    uint32_t rxFrames;
+};
+
+// Called for every frame handed to a node's firmware
+typedef void (*SimDeliveryHook)(const SimTransmission& tx, uint8_t receiver, int rssi, float snr);
+
+// Function declarations
+void simInit(const SimChannelConfig& config, uint8_t nodeCount);
+uint8_t simNodeCount();
+void simSetCurrentNode(uint8_t node);
+uint8_t simCurrentNode();
+void simSetNodeConfig(uint8_t node, const std::string& json);
+const std::string& simGetNodeConfig(uint8_t node);
+void simSetNodeImage(uint8_t node, const std::string& image);
+const std::string& simGetNodeImage(uint8_t node);
+uint32_t simGetNodeRestarts(uint8_t node);
+void simSetVerbose(bool verbose);
+bool simIsVerbose();
+void simSetDeliveryHook(SimDeliveryHook hook);
+
+int simRadioDio0();
+
+uint64_t simNowUs();
+void simAdvance(uint64_t us);
+
+uint32_t simAirtimeUs(size_t payloadLength, int spreadingFactor, long bandwidth, int codingRate, int preambleLength);
+float simSnrFloor(int spreadingFactor);
+float simLinkSnr(uint8_t from, uint8_t to, int txPower);
+float simDistance(uint8_t from, uint8_t to);
+
+const SimChannelStats& simGetChannelStats();
+const SimNodeRadioStats& simGetNodeRadioStats(uint8_t node);
@@ -0,0 +1,18 @@
+#pragma once
+
+// Host stand-in for the mbedtls SHA-256 calls the OTA code makes; the ESP32
+// port runs these on the SHA hardware, here they are plain software
+#include <stdint.h>
+#include <stddef.h>
+
+struct mbedtls_sha256_context {
+    uint32_t state[8];
+    uint64_t length;            // Bytes hashed so far
+    uint8_t block[64];
+};
+
+void mbedtls_sha256_init(mbedtls_sha256_context* ctx);
+void mbedtls_sha256_free(mbedtls_sha256_context* ctx);
+int mbedtls_sha256_starts(mbedtls_sha256_context* ctx, int is224);
+int mbedtls_sha256_update(mbedtls_sha256_context* ctx, const unsigned char* input, size_t length);
+int mbedtls_sha256_finish(mbedtls_sha256_context* ctx, unsigned char output[32]);
@@ -0,0 +1,30 @@
+#pragma once
+
+// Host stand-in for the ESP32 ROM inflater: the same tinfl calls on top of
+// zlib. Output goes into the caller's 32 KB circular dictionary as with tinfl.
+#include <stdint.h>
+#include <stddef.h>
+#include <zlib.h>
+
+enum tinfl_status {
+    TINFL_STATUS_BAD_PARAM = -3,
+    TINFL_STATUS_ADLER32_MISMATCH = -2,
+    TINFL_STATUS_FAILED = -1,
+    TINFL_STATUS_DONE = 0,
+    TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+    TINFL_STATUS_HAS_MORE_OUTPUT = 2,
+};
+
+#define TINFL_FLAG_PARSE_ZLIB_HEADER 1
+#define TINFL_FLAG_HAS_MORE_INPUT 2
+#define TINFL_LZ_DICT_SIZE 32768
+
+struct tinfl_decompressor {
+    uint32_t m_state;           // 0 until the first call sets up the stream
+    z_stream stream;
+};
+
+#define tinfl_init(r) do { (r)->m_state = 0; } while (0)
+
+tinfl_status tinfl_decompress(tinfl_decompressor* r, const uint8_t* in, size_t* inSize, uint8_t* outStart,
+                              uint8_t* outNext, size_t* outSize, uint32_t flags);
@@ -0,0 +1,152 @@
+// Schedule table of the simulated nodes: the part of schedule.cpp that
+// schedulesync.cpp works on, kept in memory per node. Hashes and version
+// are computed as schedule.cpp does, so nodes agree the same way.
+#include <Arduino.h>
+#include "schedule.h"
+#include "mp3handler.h"
+#include "eventbus.h"
+#include "logger.h"
+#include "lorasim.h"
+
+struct SimSchedule {
+    ScheduleEntry entries[MAX_SCHEDULE_ENTRIES];
+    uint8_t count;
+    uint32_t version;
+};
+
+SimSchedule simSchedules[SIM_MAX_NODES];
+
+void lockSchedule() {
+    // Every node runs on the one simulator thread
+}
+
+void unlockSchedule() {
+}
+
+uint8_t getScheduleCount() {
+    return simSchedules[simCurrentNode()].count;
+}
+
+const ScheduleEntry* getScheduleEntry(uint8_t index) {
+    SimSchedule& schedule = simSchedules[simCurrentNode()];
+    return index < schedule.count ? &schedule.entries[index] : nullptr;
+}
+
+const ScheduleEntry* findScheduleEntry(uint32_t id) {
+    SimSchedule& schedule = simSchedules[simCurrentNode()];
+    for (uint8_t i = 0; i < schedule.count; i++) {
+        if (schedule.entries[i].id == id) {
+            return &schedule.entries[i];
+        }
+    }
+    return nullptr;
+}
+
+uint32_t fnv1a(uint32_t hash, const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+uint32_t getScheduleEntryHash(const ScheduleEntry& entry) {
+    uint8_t fields[7] = {
+        (uint8_t)entry.id, (uint8_t)(entry.id >> 8), (uint8_t)(entry.id >> 16), (uint8_t)(entry.id >> 24),
+        entry.hour, entry.minute, (uint8_t)entry.enabled
+    };
+    
+    uint32_t hash = fnv1a(2166136261UL, fields, sizeof(fields));
+    hash = fnv1a(hash, (const uint8_t*)entry.description.c_str(), entry.description.length());
+    
+    if (entry.zones != SCHEDULE_ALL_ZONES) {
+        uint8_t zones[4] = {
+            (uint8_t)entry.zones, (uint8_t)(entry.zones >> 8), (uint8_t)(entry.zones >> 16), (uint8_t)(entry.zones >> 24)
+        };
+        hash = fnv1a(hash, zones, sizeof(zones));
+    }
+    if (entry.program.length() > 0) {
+        hash = fnv1a(hash, (const uint8_t*)entry.program.c_str(), entry.program.length());
+    }
+    if (entry.volume != SCHEDULE_VOLUME_PROFILE || entry.fadeIn > 0) {
+        uint8_t sound[3] = {entry.volume, (uint8_t)entry.fadeIn, (uint8_t)(entry.fadeIn >> 8)};
+        hash = fnv1a(hash, sound, sizeof(sound));
+    }
+    return hash;
+}
+
+uint32_t getScheduleVersionHash() {
+    return simSchedules[simCurrentNode()].version;
+}
+
+void updateScheduleVersion() {
+    SimSchedule& schedule = simSchedules[simCurrentNode()];
+    uint32_t version = schedule.count * 0x9E3779B1UL;
+    for (uint8_t i = 0; i < schedule.count; i++) {
+        version ^= getScheduleEntryHash(schedule.entries[i]);
+    }
+    schedule.version = version;
+    publishEvent(EVENT_SCHEDULE_CHANGED, EVENT_SOURCE_NONE, schedule.count, version);
+}
+
+uint8_t upsertScheduleEntries(const ScheduleEntry* entries, uint8_t count) {
+    SimSchedule& schedule = simSchedules[simCurrentNode()];
+    uint8_t applied = 0;
+    
+    for (uint8_t i = 0; i < count; i++) {
+        const ScheduleEntry& incoming = entries[i];
+        if (incoming.id == 0 || incoming.hour > 23 || incoming.minute > 59 || incoming.volume > MP3_MAX_VOLUME ||
+            incoming.fadeIn > SCHEDULE_MAX_FADE_IN) {
+            continue;
+        }
+        
+        ScheduleEntry* entry = (ScheduleEntry*)findScheduleEntry(incoming.id);
+        if (!entry) {
+            if (schedule.count >= MAX_SCHEDULE_ENTRIES) {
+                continue;
+            }
+            entry = &schedule.entries[schedule.count++];
+        }
+        *entry = incoming;
+        applied++;
+    }
+    
+    if (applied > 0) {
+        updateScheduleVersion();
+        LOG_INFO(LOG_MODULE_SCHEDULE, "Upserted %d schedule entries", applied);
+    }
+    return applied;
+}
+
+uint8_t pruneScheduleEntries(const uint32_t* keepIds, uint8_t keepCount) {
+    SimSchedule& schedule = simSchedules[simCurrentNode()];
+    uint8_t removed = 0;
+    uint8_t i = 0;
+    
+    while (i < schedule.count) {
+        bool keep = false;
+        for (uint8_t k = 0; k < keepCount; k++) {
+            if (keepIds[k] == schedule.entries[i].id) {
+                keep = true;
+                break;
+            }
+        }
+        
+        if (keep) {
+            i++;
+            continue;
+        }
+        
+        for (uint8_t j = i; j < schedule.count - 1; j++) {
+            schedule.entries[j] = schedule.entries[j + 1];
+        }
+        schedule.count--;
+        removed++;
+    }
+    
+    if (removed > 0) {
+        updateScheduleVersion();
+        LOG_INFO(LOG_MODULE_SCHEDULE, "Pruned %d schedule entries", removed);
+    }
+    return removed;
+}
@@ -0,0 +1,187 @@
+#include <Arduino.h>
+#include <SPI.h>
+#include <SPIFFS.h>
+#include <esp_ota_ops.h>
+#include <random>
+#include <chrono>
+#include <map>
+#include "lorasim.h"
+
+HardwareSerial Serial;
+EspClass ESP;
+SPIClass SPI;
+fs::FS SPIFFS;
+
+// Firmware random() draws from a generator per node, apart from the channel's
+std::mt19937 simNodeRngs[SIM_MAX_NODES];
+bool simInLine[SIM_MAX_NODES];
+std::map<std::string, std::string> simNodeFiles[SIM_MAX_NODES];
+
+// CPU clock as last set; shared by all nodes
+uint32_t simCpuMhz = 240;
+
+size_t Print::printf(const char* format, ...) {
+    char buffer[512];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    return write((const uint8_t*)buffer, min((size_t)max(length, 0), sizeof(buffer) - 1));
+}
+
+// Simulated devices on UARTs 1 and 2, what drives the input pins, and
+// each node's edge interrupts on them
+const SimUartDevice* simUarts[3];
+int (*simPinReader)(uint8_t pin) = nullptr;
+void (*simPinIsrs[SIM_MAX_NODES][40])() = {};
+
+void simAttachUart(int uart, const SimUartDevice* device) {
+    simUarts[uart] = device;
+}
+
+void simSetPinReader(int (*reader)(uint8_t pin)) {
+    simPinReader = reader;
+}
+
+void simPinChanged(uint8_t pin) {
+    // Called by the device driving the pin; every edge counts as CHANGE
+    if (pin < 40 && simPinIsrs[simCurrentNode()][pin]) {
+        simPinIsrs[simCurrentNode()][pin]();
+    }
+}
+
+void attachInterrupt(uint8_t pin, void (*isr)(), int mode) {
+    if (pin < 40) {
+        simPinIsrs[simCurrentNode()][pin] = isr;
+    }
+}
+
+void detachInterrupt(uint8_t pin) {
+    if (pin < 40) {
+        simPinIsrs[simCurrentNode()][pin] = nullptr;
+    }
+}
+
+int HardwareSerial::available() {
+    return uart > 0 && simUarts[uart] ? simUarts[uart]->available() : 0;
+}
+
+int HardwareSerial::read() {
+    return uart > 0 && simUarts[uart] ? simUarts[uart]->read() : -1;
+}
+
+int HardwareSerial::peek() {
+    return uart > 0 && simUarts[uart] ? simUarts[uart]->peek() : -1;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+    if (uart > 0) {
+        if (simUarts[uart]) {
+            simUarts[uart]->receive(c);
+        }
+        return 1;
+    }
+    if (!simIsVerbose()) {
+        return 1;
+    }
+    
+    uint8_t node = simCurrentNode();
+    if (!simInLine[node]) {
+        simInLine[node] = true;
+        ::printf("%10.3f [%04X] ", simNowUs() / 1e6, (unsigned)(ESP.getEfuseMac() >> 32));
+    }
+    ::putchar(c);
+    if (c == '\n') {
+        simInLine[node] = false;
+    }
+    return 1;
+}
+
+uint64_t EspClass::getEfuseMac() {
+    // Node ids 1000, 1001, ... as seen by getLoRaNodeId()
+    return (uint64_t)(0x1000 + simCurrentNode()) << 32;
+}
+
+uint32_t EspClass::getCycleCount() {
+    // Profiled code runs on the host for real, so it is timed by the host's clock
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    return (uint32_t)(ns * getCpuFrequencyMhz() / 1000);
+}
+
+uint32_t getCpuFrequencyMhz() {
+    return simCpuMhz;
+}
+
+unsigned long millis() {
+    return (unsigned long)(simNowUs() / 1000);
+}
+
+unsigned long micros() {
+    return (unsigned long)simNowUs();
+}
+
+void delay(unsigned long ms) {
+}
+
+long random(long max) {
+    return max > 0 ? (long)(simNodeRngs[simCurrentNode()]() % (unsigned long)max) : 0;
+}
+
+long random(long min, long max) {
+    return max > min ? min + random(max - min) : min;
+}
+
+void randomSeed(unsigned long seed) {
+    simNodeRngs[simCurrentNode()].seed(seed);
+}
+
+int digitalRead(uint8_t pin) {
+    // DIO0 is the current node's radio's
+    if (pin == SIM_RADIO_DIO0_PIN) {
+        return simRadioDio0();
+    }
+    return simPinReader ? simPinReader(pin) : LOW;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+}
+
+bool setCpuFrequencyMhz(uint32_t mhz) {
+    simCpuMhz = mhz;
+    return true;
+}
+
+esp_reset_reason_t esp_reset_reason() {
+    return ESP_RST_POWERON;
+}
+
+const esp_app_desc_t* esp_ota_get_app_description() {
+    // One build for every node
+    static const esp_app_desc_t app = {};
+    return &app;
+}
+
+bool fs::FS::exists(const char* path) {
+    if (strcmp(path, "/gong.conf") == 0) {
+        return !simGetNodeConfig(simCurrentNode()).empty();
+    }
+    return simNodeFiles[simCurrentNode()].count(path) > 0;
+}
+
+fs::File fs::FS::open(const char* path, const char* mode) {
+    if (strcmp(path, "/gong.conf") == 0) {
+        return exists(path) ? File(simGetNodeConfig(simCurrentNode())) : File();
+    }
+    if (mode[0] == 'w' || mode[0] == 'a') {
+        return File(&simNodeFiles[simCurrentNode()][path], mode[0] == 'a');
+    }
+    return exists(path) ? File(simNodeFiles[simCurrentNode()][path]) : File();
+}
+
+bool fs::FS::remove(const char* path) {
+    return simNodeFiles[simCurrentNode()].erase(path) > 0;
+}
@@ -0,0 +1,633 @@
+// LoRa network benchmark on the simulated channel.
+//
+// Node 0 is the master: it broadcasts gongs and, every --sync-interval,
+// changes its schedule: one entry edited, then every entry replaced, in
+// turn. The nodes' own schedulesync.cpp brings the slaves up to date, and
+// every change must reach every slave. Every slave sends periodic status
+// frames to the master. All traffic goes through the firmware's own queue,
+// LBT and duty-cycle code.
+// With --zones n, slaves are spread over n zones and each gong goes to the
+// next zone in turn; slaves outside it should drop the frame at the header.
+// With --ota-package, every node starts out running the --ota-base image and
+// the master distributes the package (tools/otapack.py) alongside the normal
+// traffic from --ota-start on; frame authentication (--key) is required.
+// With --capture, the master captures every frame it sends and hears, and
+// the capture is written to the given file as pcapng at the end.
+//
+//   simbench [--nodes N] [--duration s] [--seed n] [--area m] [--sf n]
+//            [--gong-interval s] [--status-interval s] [--sync-interval s] [--first-id n]
+//            [--loss p] [--tick us] [--key hex] [--zones n]
+//            [--ota-package file --ota-base file] [--ota-start s] [--capture file] [--verbose]
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <SPIFFS.h>
+#include "simnode.h"
+#include "mbedtls/sha256.h"
+#include "schedule.h"
+#include "schedulesync.h"
+#include "nodestatus.h"
+#include "linkadapt.h"
+
+#define SIM_STATUS_BYTES 60
+
+// Traffic classes, as the firmware's TX classes
+#define SIM_CLASSES 3
+static const char* simClassNames[SIM_CLASSES] = {"gong", "schedule", "status"};
+
+struct SimBenchOptions {
+    uint8_t nodes = 16;
+    uint32_t durationS = 600;
+    uint32_t seed = 1;
+    float areaMeters = 2000;
+    int spreadingFactor = LORA_SPREADING_FACTOR;
+    uint32_t gongIntervalS = 60;
+    uint32_t statusIntervalS = 30;
+    uint32_t syncIntervalS = 120;
+    uint32_t firstScheduleId = 1;   // Ten-digit ids make the digest take two frames
+    float linkLoss = 0.01f;
+    uint32_t tickUs = 1000;
+    std::string key;            // Network key for frame authentication, empty = off
+    uint8_t zones = 0;          // Slave zones, 0 = no zone addressing
+    std::string otaPackage;     // Firmware package for the master to distribute
+    std::string otaBase;        // Image all nodes run at the start
+    uint32_t otaStartS = 10;
+    std::string capture;        // pcapng file for the master's capture
+    bool verbose = false;
+};
+
+// A message submitted by the traffic generator, tracked to its receivers
+struct SimMessage {
+    uint8_t txClass;
+    uint8_t sender;
+    uint64_t submittedUs;
+    uint32_t zones;             // Target zones, LORA_ZONE_ALL for a broadcast
+    uint32_t expected;          // Receivers that should get it
+    std::vector<bool> received;
+};
+
+struct SimClassResult {
+    uint32_t submitted;
+    uint32_t rejected;          // sendLoRaMessage returned false
+    uint64_t expected;
+    uint64_t delivered;
+    std::vector<uint32_t> latenciesUs;
+};
+
+// A schedule change on the master and how the slaves caught up with it
+struct SimSyncRound {
+    bool replacement;           // Every entry replaced, else one edited
+    uint64_t changedUs;
+    uint64_t convergedUs;       // Every slave on the master's version, 0 = not yet
+    uint8_t slavesSynced;
+    uint64_t startAirtimeUs;    // Sync totals of all nodes at the change
+    uint32_t startFrames;
+    uint32_t startResent;
+    uint64_t airtimeUs;         // Sync airtime of all nodes, up to quiet after convergence
+    uint32_t frames;
+    uint32_t resent;            // Fragments the master sent again on NACKs
+    uint32_t masterMs;          // The master's own measurement, as GET /sync
+    uint32_t masterAirtimeMs;
+};
+
+SimBenchOptions options;
+std::map<uint32_t, SimMessage> simMessages;
+uint32_t simNextMessageId = 1;
+SimClassResult simResults[SIM_CLASSES];
+uint32_t simGongTriggers = 0;
+uint8_t simNextGongZone = 0;
+std::vector<SimSyncRound> simSyncRounds;
+uint32_t simNextScheduleId = 1;
+
+// ---- Firmware hooks: the modules lorahandler.cpp hands frames to ----
+
+void handleNodeStatusMessage(const String& content) {
+}
+
+void noteMasterFrame() {
+}
+
+void recordLinkTransmission(size_t frameLength, int spreadingFactor, int txPower) {
+}
+
+void wakeRadioTask(bool fromIsr) {
+    // Every node's loop runs each step; there is no task to wake
+}
+
+void countGongTrigger(const Event& event) {
+    simGongTriggers++;
+}
+
+bool isPlaying() {
+    return false;
+}
+
+bool isGongSynthPlaying() {
+    return false;
+}
+
+// ---- Traffic ----
+
+uint32_t getSimNodeZones(uint8_t node) {
+    // The master hears every zone; slaves are dealt round robin
+    if (options.zones == 0 || node == 0) {
+        return LORA_ZONE_ALL;
+    }
+    return 1UL << ((node - 1) % options.zones);
+}
+
+bool isExpectedReceiver(const SimMessage& message, uint8_t receiver) {
+    // Status frames are for the master; everything else goes to the target zones
+    if (message.txClass == LORA_TX_CLASS_STATUS) {
+        return receiver == 0;
+    }
+    return receiver != message.sender && (message.zones & getSimNodeZones(receiver));
+}
+
+uint32_t parseMessageTag(const std::string& frame) {
+    // Payloads carry "#<id>#"
+    size_t start = frame.find('#');
+    if (start == std::string::npos) {
+        return 0;
+    }
+    return (uint32_t)strtoul(frame.c_str() + start + 1, nullptr, 10);
+}
+
+void onFrameDelivered(const SimTransmission& tx, uint8_t receiver, int rssi, float snr) {
+    // Firmware blocks and schedule sync frames carry no tag
+    if (tx.data.compare(0, 2, "4:") == 0 || tx.data.compare(0, 2, "2:") == 0) {
+        return;
+    }
+    
+    auto it = simMessages.find(parseMessageTag(tx.data));
+    if (it == simMessages.end()) {
+        return;
+    }
+    
+    SimMessage& message = it->second;
+    if (!isExpectedReceiver(message, receiver) || message.received[receiver]) {
+        return;
+    }
+    message.received[receiver] = true;
+    
+    SimClassResult& result = simResults[message.txClass];
+    result.delivered++;
+    result.latenciesUs.push_back((uint32_t)(tx.endUs - message.submittedUs));
+}
+
+void submitMessage(uint8_t txClass, uint8_t type, const String& payload, uint32_t id,
+                   uint32_t zones = LORA_ZONE_ALL) {
+    SimMessage message;
+    message.txClass = txClass;
+    message.sender = simCurrentNode();
+    message.submittedUs = simNowUs();
+    message.zones = zones;
+    message.received.assign(simNodeCount(), false);
+    message.expected = 0;
+    for (uint8_t r = 0; r < simNodeCount(); r++) {
+        if (isExpectedReceiver(message, r)) {
+            message.expected++;
+        }
+    }
+    
+    SimClassResult& result = simResults[txClass];
+    result.submitted++;
+    bool queued = zones == LORA_ZONE_ALL
+        ? sendLoRaMessage(payload, type)
+        : sendLoRaMessageAt(payload, type, getLoRaSpreadingFactor(), getLoRaTxPower(), true, zones);
+    if (!queued) {
+        result.rejected++;
+    }
+    result.expected += message.expected;
+    simMessages[id] = message;
+}
+
+String padPayload(String payload, size_t length) {
+    while (payload.length() < length) {
+        payload += '.';
+    }
+    return payload;
+}
+
+void sendSimGong() {
+    uint32_t id = simNextMessageId++;
+    char payload[96];
+    snprintf(payload, sizeof(payload), "{\"type\":\"gong\",\"timestamp\":%lu,\"device\":\"SIM\",\"tag\":\"#%u#\"}",
+             millis(), id);
+    
+    uint32_t zones = LORA_ZONE_ALL;
+    if (options.zones > 0) {
+        zones = 1UL << simNextGongZone;
+        simNextGongZone = (simNextGongZone + 1) % options.zones;
+    }
+    submitMessage(LORA_TX_CLASS_GONG, MSG_TYPE_GONG, payload, id, zones);
+}
+
+ScheduleEntry makeSimScheduleEntry(uint32_t id, uint8_t index) {
+    // Gongs through the day, with descriptions of the usual length
+    static const char* names[] = {"Morning bell", "Lessons start", "Short break", "Lunch", "End of the day"};
+    ScheduleEntry entry;
+    entry.id = id;
+    entry.hour = 7 + index / 2;
+    entry.minute = (id * 7) % 60;
+    entry.enabled = true;
+    entry.description = String(names[index % 5]) + " " + String(index + 1);
+    entry.zones = SCHEDULE_ALL_ZONES;
+    entry.program = "";
+    entry.volume = SCHEDULE_VOLUME_PROFILE;
+    entry.fadeIn = 0;
+    return entry;
+}
+
+void loadSimSchedule() {
+    // Every node starts out with the same full schedule
+    ScheduleEntry entries[MAX_SCHEDULE_ENTRIES];
+    for (uint8_t i = 0; i < MAX_SCHEDULE_ENTRIES; i++) {
+        entries[i] = makeSimScheduleEntry(options.firstScheduleId + i, i);
+    }
+    upsertScheduleEntries(entries, MAX_SCHEDULE_ENTRIES);
+    simNextScheduleId = options.firstScheduleId + MAX_SCHEDULE_ENTRIES;
+}
+
+void addSimSyncTotals(uint64_t& airtimeUs, uint32_t& frames) {
+    for (uint8_t i = 0; i < options.nodes; i++) {
+        simSetCurrentNode(i);
+        const SyncStats& stats = getScheduleSyncStats();
+        airtimeUs += stats.txAirtimeUs;
+        frames += stats.framesSent;
+    }
+}
+
+void changeSimSchedule() {
+    SimSyncRound round = {};
+    round.replacement = simSyncRounds.size() % 2 == 1;
+    round.changedUs = simNowUs();
+    addSimSyncTotals(round.startAirtimeUs, round.startFrames);
+    
+    simSetCurrentNode(0);
+    round.startResent = getScheduleSyncStats().fragmentsResent;
+    if (round.replacement) {
+        ScheduleEntry entries[MAX_SCHEDULE_ENTRIES];
+        for (uint8_t i = 0; i < MAX_SCHEDULE_ENTRIES; i++) {
+            entries[i] = makeSimScheduleEntry(simNextScheduleId++, i);
+        }
+        pruneScheduleEntries(nullptr, 0);
+        upsertScheduleEntries(entries, MAX_SCHEDULE_ENTRIES);
+    } else {
+        // One gong moved by a minute, as edited in the web interface
+        ScheduleEntry entry = *getScheduleEntry(simSyncRounds.size() / 2 % getScheduleCount());
+        entry.minute = (entry.minute + 1) % 60;
+        upsertScheduleEntries(&entry, 1);
+    }
+    simSyncRounds.push_back(round);
+}
+
+void updateSimSyncRound() {
+    if (simSyncRounds.empty()) {
+        return;
+    }
+    
+    // Counted until the network has been quiet for as long as the master waits
+    SimSyncRound& round = simSyncRounds.back();
+    if (round.convergedUs && simNowUs() > round.convergedUs + SYNC_QUIET_PERIOD * 1000ULL) {
+        return;
+    }
+    
+    simSetCurrentNode(0);
+    uint32_t version = getScheduleVersionHash();
+    uint32_t resent = getScheduleSyncStats().fragmentsResent;
+    round.slavesSynced = 0;
+    for (uint8_t i = 1; i < options.nodes; i++) {
+        simSetCurrentNode(i);
+        round.slavesSynced += getScheduleVersionHash() == version;
+    }
+    if (!round.convergedUs && round.slavesSynced == options.nodes - 1) {
+        round.convergedUs = simNowUs();
+    }
+    
+    uint64_t airtimeUs = 0;
+    uint32_t frames = 0;
+    addSimSyncTotals(airtimeUs, frames);
+    round.airtimeUs = airtimeUs - round.startAirtimeUs;
+    round.frames = frames - round.startFrames;
+    round.resent = resent - round.startResent;
+}
+
+void finishSimSyncRound() {
+    // The master closes its own round after SYNC_QUIET_PERIOD without requests
+    if (simSyncRounds.empty()) {
+        return;
+    }
+    SimSyncRound& round = simSyncRounds.back();
+    simSetCurrentNode(0);
+    round.masterMs = getScheduleSyncStats().lastConvergenceMs;
+    round.masterAirtimeMs = getScheduleSyncStats().lastConvergenceAirtimeMs;
+}
+
+void sendSimStatus() {
+    uint32_t id = simNextMessageId++;
+    submitMessage(LORA_TX_CLASS_STATUS, MSG_TYPE_STATUS,
+                  padPayload(String("S#") + String(id) + "#", SIM_STATUS_BYTES), id);
+}
+
+// ---- Run ----
+
+bool parseOptions(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (arg == "--verbose") {
+            options.verbose = true;
+            continue;
+        }
+        if (!value) {
+            fprintf(stderr, "Missing value for %s\n", arg.c_str());
+            return false;
+        }
+        i++;
+        
+        if (arg == "--nodes") options.nodes = (uint8_t)min(atoi(value), SIM_MAX_NODES);
+        else if (arg == "--duration") options.durationS = atoi(value);
+        else if (arg == "--seed") options.seed = atoi(value);
+        else if (arg == "--area") options.areaMeters = atof(value);
+        else if (arg == "--sf") options.spreadingFactor = atoi(value);
+        else if (arg == "--gong-interval") options.gongIntervalS = atoi(value);
+        else if (arg == "--status-interval") options.statusIntervalS = atoi(value);
+        else if (arg == "--sync-interval") options.syncIntervalS = atoi(value);
+        else if (arg == "--first-id") options.firstScheduleId = max(strtoul(value, nullptr, 10), 1UL);
+        else if (arg == "--loss") options.linkLoss = atof(value);
+        else if (arg == "--tick") options.tickUs = max(atoi(value), 1);
+        else if (arg == "--key") options.key = value;
+        else if (arg == "--zones") options.zones = (uint8_t)min(atoi(value), LORA_MAX_ZONES);
+        else if (arg == "--ota-package") options.otaPackage = value;
+        else if (arg == "--ota-base") options.otaBase = value;
+        else if (arg == "--ota-start") options.otaStartS = atoi(value);
+        else if (arg == "--capture") options.capture = value;
+        else {
+            fprintf(stderr, "Unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+    return options.nodes >= 2 && options.otaPackage.empty() == options.otaBase.empty();
+}
+
+bool readFile(const std::string& path, std::string& content) {
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    content = buffer.str();
+    return file.good() && !content.empty();
+}
+
+std::string getImageDigest(const std::string& image) {
+    // As the sim's esp_partition_get_sha256()
+    uint8_t digest[OTA_DIGEST_BYTES];
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts(&ctx, 0);
+    mbedtls_sha256_update(&ctx, (const uint8_t*)image.data(), image.size());
+    mbedtls_sha256_finish(&ctx, digest);
+    return std::string((const char*)digest, sizeof(digest));
+}
+
+void printOtaReport(const std::string& package) {
+    simSetCurrentNode(0);
+    const LoRaOtaStats& stats = getLoRaOtaStats();
+    std::string target = package.substr(OTA_HEADER_TARGET_DIGEST, OTA_DIGEST_BYTES);
+    
+    uint8_t updated = 0;
+    uint64_t slaveAirtimeUs = 0;
+    for (uint8_t i = 1; i < options.nodes; i++) {
+        updated += getImageDigest(simGetNodeImage(i)) == target;
+        simSetCurrentNode(i);
+        slaveAirtimeUs += getLoRaOtaStats().txAirtimeUs;
+    }
+    
+    // Everything OTA put on air: the master's frames and every slave's replies
+    uint64_t airtimeUs = stats.txAirtimeUs + slaveAirtimeUs;
+    printf("\nfirmware update:    %u-byte package, %u blocks, %u passes, %u blocks sent (%u resent)\n",
+           stats.packageBytes, stats.blocks, stats.passes, stats.blocksSent, stats.blocksResent);
+    printf("                    %u of %u slaves running the new image, %u verified by the master, %.1f s\n",
+           updated, options.nodes - 1, stats.nodesUpdated, stats.durationMs / 1000.0);
+    printf("                    %.1f s airtime (%.1f s master), %.1f s per node updated\n", airtimeUs / 1e6,
+           stats.txAirtimeUs / 1e6, updated ? airtimeUs / 1e6 / updated : 0.0);
+}
+
+uint32_t percentile(std::vector<uint32_t>& values, float fraction) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[min((size_t)(fraction * values.size()), values.size() - 1)];
+}
+
+void printReport() {
+    const SimChannelStats& channel = simGetChannelStats();
+    double durationUs = options.durationS * 1e6;
+    
+    printf("LoRa channel simulation: %u nodes, SF%d, %u s, %.0f m area, seed %u\n",
+           options.nodes, options.spreadingFactor, options.durationS, options.areaMeters, options.seed);
+    printf("\n%-9s %9s %9s %9s %9s %9s %9s\n", "class", "submitted", "rejected", "delivery", "avg ms", "p95 ms", "max ms");
+    
+    for (uint8_t c = 0; c < SIM_CLASSES; c++) {
+        SimClassResult& result = simResults[c];
+        if (result.submitted == 0) {
+            continue;
+        }
+        double sum = 0;
+        for (uint32_t latency : result.latenciesUs) {
+            sum += latency;
+        }
+        double average = result.latenciesUs.empty() ? 0 : sum / result.latenciesUs.size();
+        printf("%-9s %9u %9u %8.1f%% %9.1f %9.1f %9.1f\n", simClassNames[c], result.submitted, result.rejected,
+               result.expected ? 100.0 * result.delivered / result.expected : 0.0, average / 1000,
+               percentile(result.latenciesUs, 0.95f) / 1000.0, percentile(result.latenciesUs, 1.0f) / 1000.0);
+    }
+    
+    uint64_t maxNodeAirtimeUs = 0;
+    for (uint8_t i = 0; i < options.nodes; i++) {
+        maxNodeAirtimeUs = max(maxNodeAirtimeUs, simGetNodeRadioStats(i).txAirtimeUs);
+    }
+    
+    printf("\nframes on air:      %u (%.1f s airtime, %.1f%% channel load)\n", channel.transmissions,
+           channel.airtimeUs / 1e6, 100.0 * channel.airtimeUs / durationUs);
+    printf("busiest node:       %.1f s airtime (%.2f%% duty cycle)\n", maxNodeAirtimeUs / 1e6,
+           100.0 * maxNodeAirtimeUs / durationUs);
+    printf("receptions:         %u delivered, %u collided, %u below floor, %u not listening, %u link loss\n",
+           channel.delivered, channel.lostCollision, channel.lostWeak, channel.lostNotListening, channel.lostLink);
+    printf("listen before talk: %u CAD, %u busy\n", channel.cadChecks, channel.cadBusy);
+    printf("gong triggers:      %u\n", simGongTriggers);
+}
+
+bool printSyncReport() {
+    // A change counts as converged once every slave has the master's version
+    bool converged = true;
+    printf("\n%-11s %6s %7s %11s %10s %7s %7s %9s %12s\n", "sync change", "at s", "synced", "converged s",
+           "airtime s", "frames", "resent", "master s", "master air s");
+    for (const SimSyncRound& round : simSyncRounds) {
+        char time[16] = "-";
+        if (round.convergedUs) {
+            snprintf(time, sizeof(time), "%.1f", (round.convergedUs - round.changedUs) / 1e6);
+        }
+        printf("%-11s %6.0f %4u/%-2u %11s %10.2f %7u %7u %9.1f %12.2f\n", round.replacement ? "replacement" : "edit",
+               round.changedUs / 1e6, round.slavesSynced, options.nodes - 1, time, round.airtimeUs / 1e6, round.frames,
+               round.resent, round.masterMs / 1000.0, round.masterAirtimeMs / 1000.0);
+        converged = converged && round.convergedUs;
+    }
+    if (!converged) {
+        printf("schedule sync:      FAILED, a change did not reach every slave\n");
+    }
+    return converged;
+}
+
+// Print into a host file, for exportLoRaCapture()
+class SimFilePrint : public Print {
+public:
+    SimFilePrint(FILE* file) : file(file) {}
+    size_t write(uint8_t c) override { return fwrite(&c, 1, 1, file); }
+    size_t write(const uint8_t* buffer, size_t size) override { return fwrite(buffer, 1, size, file); }
+private:
+    FILE* file;
+};
+
+void writeCapture(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        fprintf(stderr, "Cannot write %s\n", path.c_str());
+        return;
+    }
+    
+    simSetCurrentNode(0);
+    SimFilePrint out(file);
+    LoRaCaptureSnapshot snapshot;
+    if (takeLoRaCaptureSnapshot(snapshot)) {
+        exportLoRaCapture(snapshot, out, 0);
+        releaseLoRaCaptureSnapshot(snapshot);
+    }
+    fclose(file);
+    
+    const LoRaCaptureStats& stats = getLoRaCaptureStats();
+    printf("\ncapture:            %u frames in %s (%u overwritten, avg %u us per frame)\n",
+           stats.records, path.c_str(), stats.overwritten,
+           stats.captured ? (uint32_t)(stats.captureUs / stats.captured) : 0);
+}
+
+int main(int argc, char** argv) {
+    if (!parseOptions(argc, argv)) {
+        fprintf(stderr, "usage: simbench [--nodes N] [--duration s] [--seed n] [--area m] [--sf n] "
+                        "[--gong-interval s] [--status-interval s] [--sync-interval s] [--first-id n] "
+                        "[--loss p] [--tick us] [--key hex] [--zones n] "
+                        "[--ota-package file --ota-base file] [--ota-start s] [--capture file] [--verbose]\n");
+        return 1;
+    }
+    
+    std::string otaPackage;
+    std::string otaBase;
+    if (!options.otaPackage.empty() &&
+        (!readFile(options.otaPackage, otaPackage) || !readFile(options.otaBase, otaBase))) {
+        fprintf(stderr, "Cannot read %s or %s\n", options.otaPackage.c_str(), options.otaBase.c_str());
+        return 1;
+    }
+    
+    SimChannelConfig config;
+    config.seed = options.seed;
+    config.areaMeters = options.areaMeters;
+    config.pathLossExponent = 2.7f;
+    config.referenceLossDb = 25.2f;     // Free space at 1 m, 433 MHz
+    config.shadowingDb = 4;
+    config.fadingDb = 2;
+    config.noiseFloorDbm = -117;        // 125 kHz, 6 dB noise figure
+    config.linkLoss = options.linkLoss;
+    config.captureDb = 6;
+    
+    simInit(config, options.nodes);
+    simSetVerbose(options.verbose);
+    simSetDeliveryHook(onFrameDelivered);
+    
+    std::vector<uint64_t> nextStatusUs(options.nodes);
+    std::vector<int8_t> gongSubscribers(options.nodes);
+    for (uint8_t i = 0; i < options.nodes; i++) {
+        simSetCurrentNode(i);
+        std::string config = std::string("{\"lora\":{\"role\":\"") + (i == 0 ? "master" : "slave") + "\"";
+        if (!options.key.empty()) {
+            config += ",\"key\":\"" + options.key + "\"";
+        }
+        if (getSimNodeZones(i) != LORA_ZONE_ALL) {
+            config += ",\"zones\":[" + std::to_string((i - 1) % options.zones + 1) + "]";
+        }
+        simSetNodeConfig(i, config + "}}");
+        randomSeed(options.seed * 1000 + i);
+        setupLog();
+        setupEventBus();
+        gongSubscribers[i] = subscribeEvents("gong", EVENT_MASK(EVENT_GONG_REQUESTED), countGongTrigger, 0, nullptr);
+        setupLoRa();
+        setLoRaProfile(options.spreadingFactor, LORA_TX_POWER);
+        setLoRaCaptureEnabled(i == 0 && !options.capture.empty());
+        simSetNodeImage(i, otaBase);
+        setupLoRaOta();
+        loadSimSchedule();
+        setupScheduleSync();
+        nextStatusUs[i] = (uint64_t)random(options.statusIntervalS * 1000) * 1000;
+    }
+    
+    uint64_t endUs = (uint64_t)options.durationS * 1000000;
+    uint64_t nextGongUs = options.gongIntervalS * 500000ULL;
+    uint64_t nextSyncUs = options.syncIntervalS * 750000ULL;
+    uint64_t otaStartUs = otaPackage.empty() ? UINT64_MAX : options.otaStartS * 1000000ULL;
+    if (!otaPackage.empty()) {
+        simSetCurrentNode(0);
+        File file = SPIFFS.open(OTA_PACKAGE_FILE, "w");
+        file.write((const uint8_t*)otaPackage.data(), otaPackage.size());
+        file.close();
+    }
+    
+    while (simNowUs() < endUs) {
+        for (uint8_t i = 0; i < options.nodes; i++) {
+            simSetCurrentNode(i);
+            
+            if (i == 0) {
+                if (simNowUs() >= nextGongUs) {
+                    nextGongUs += options.gongIntervalS * 1000000ULL;
+                    sendSimGong();
+                }
+                // Only changes the slaves have at least one version advert to catch
+                if (simNowUs() >= nextSyncUs && simNowUs() + SYNC_ADVERT_INTERVAL * 1000ULL <= endUs) {
+                    nextSyncUs += options.syncIntervalS * 1000000ULL;
+                    finishSimSyncRound();
+                    changeSimSchedule();
+                    simSetCurrentNode(0);
+                }
+                if (simNowUs() >= otaStartUs) {
+                    otaStartUs = UINT64_MAX;
+                    startLoRaOta();
+                }
+            } else if (simNowUs() >= nextStatusUs[i]) {
+                // +-10% jitter, as heartbeats
+                uint32_t periodMs = options.statusIntervalS * 1000;
+                nextStatusUs[i] += (uint64_t)(periodMs - periodMs / 10 + random(periodMs / 5)) * 1000;
+                sendSimStatus();
+            }
+            
+            loopLoRa();
+            loopLoRaOta();
+            loopScheduleSync();
+            dispatchEvents(gongSubscribers[i]);
+            loopLog();
+        }
+        updateSimSyncRound();
+        simAdvance(options.tickUs);
+    }
+    
+    finishSimSyncRound();
+    printReport();
+    bool converged = printSyncReport();
+    if (!otaPackage.empty()) {
+        printOtaReport(otaPackage);
+    }
+    if (!options.capture.empty()) {
+        writeCapture(options.capture);
+    }
+    return converged ? 0 : 1;
+}
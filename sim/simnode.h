@@ -0,0 +1,140 @@
+#pragma once
+
+#include "lorahandler.h"
+#include "loraota.h"
+#include "loracapture.h"
+#include "eventbus.h"
+#include "logger.h"
+#include "schedulesync.h"
+#include "lorasim.h"
+
+// Every virtual node runs its own copy of src/lorahandler.cpp and the
+// modules behind it (configstore.cpp, logger.cpp, eventbus.cpp, frameauth.cpp,
+// loraota.cpp, loracapture.cpp, schedulesync.cpp): the files are compiled once per node inside a namespace
+// of its own (simnodes.cpp), so the nodes keep separate globals while the
+// firmware stays unmodified.
+//
+// The global lorahandler.h functions dispatch to the copy of the current
+// node (simSetCurrentNode), so simulator code calls them like firmware does.
+#define SIM_LORA_API(X) \
+    X(void, setupLoRa, (), ()) \
+    X(void, loopLoRa, (), ()) \
+    X(void, sendGongLoRa, (uint32_t zones), (zones)) \
+    X(bool, sendLoRaMessage, (const String& message, uint8_t type), (message, type)) \
+    X(bool, sendLoRaMessageAt, \
+      (const String& message, uint8_t type, int spreadingFactor, int txPower, bool wakeSleepers, uint32_t zones), \
+      (message, type, spreadingFactor, txPower, wakeSleepers, zones)) \
+    X(bool, sendLoRaBinary, (const uint8_t* payload, size_t length, uint8_t type, bool wakeSleepers), \
+      (payload, length, type, wakeSleepers)) \
+    X(uint8_t, getLoRaTxQueueDepth, (), ()) \
+    X(bool, isLoRaTransmitting, (), ()) \
+    X(String, getLoRaStatsJSON, (), ()) \
+    X(bool, isLoRaMessageAvailable, (), ()) \
+    X(String, receiveLoRaMessage, (), ()) \
+    X(void, onLoRaMessageReceived, (const String& message), (message)) \
+    X(bool, isLoRaMaster, (), ()) \
+    X(uint32_t, getLoRaZones, (), ()) \
+    X(uint32_t, parseLoRaZones, (JsonVariantConst zones), (zones)) \
+    X(void, addLoRaZonesJSON, (JsonObject obj, uint32_t zones), (obj, zones)) \
+    X(bool, isLoRaLowPower, (), ()) \
+    X(uint32_t, getLoRaWakePeriod, (), ()) \
+    X(uint16_t, getLoRaWakePreamble, (int spreadingFactor, uint32_t wakePeriod), (spreadingFactor, wakePeriod)) \
+    X(bool, isLoRaIdle, (), ()) \
+    X(void, sleepLoRa, (), ()) \
+    X(void, startLoRaChannelSample, (), ()) \
+    X(bool, finishLoRaChannelSample, (), ()) \
+    X(unsigned long, getLastPacketMillis, (), ()) \
+    X(uint16_t, getLoRaNodeId, (), ()) \
+    X(uint32_t, getLoRaAirtimeUs, (size_t payloadLength), (payloadLength)) \
+    X(uint32_t, calculateLoRaAirtimeUs, \
+      (size_t payloadLength, int spreadingFactor, long bandwidth, int codingRate, int preambleLength), \
+      (payloadLength, spreadingFactor, bandwidth, codingRate, preambleLength)) \
+    X(uint32_t, getLoRaDutyCycleUsedUs, (), ()) \
+    X(uint32_t, getLoRaDutyCycleBudgetUs, (), ()) \
+    X(void, setLoRaProfile, (int spreadingFactor, int txPower), (spreadingFactor, txPower)) \
+    X(int, getLoRaSpreadingFactor, (), ()) \
+    X(int, getLoRaTxPower, (), ()) \
+    X(float, getLoRaSnrFloor, (int spreadingFactor), (spreadingFactor)) \
+    X(int, getLastPacketRssi, (), ()) \
+    X(float, getLastPacketSnr, (), ())
+
+// The loraota.h functions, dispatched the same way
+#define SIM_OTA_API(X) \
+    X(void, setupLoRaOta, (), ()) \
+    X(void, loopLoRaOta, (), ()) \
+    X(void, handleLoRaOtaFrame, (const uint8_t* data, size_t length), (data, length)) \
+    X(bool, startLoRaOta, (), ()) \
+    X(void, cancelLoRaOta, (), ()) \
+    X(bool, isLoRaOtaActive, (), ()) \
+    X(const LoRaOtaStats&, getLoRaOtaStats, (), ()) \
+    X(String, getLoRaOtaJSON, (), ())
+
+// The loracapture.h functions, dispatched the same way
+#define SIM_CAPTURE_API(X) \
+    X(void, setLoRaCaptureEnabled, (bool enabled), (enabled)) \
+    X(bool, isLoRaCaptureEnabled, (), ()) \
+    X(void, captureLoRaFrame, \
+      (const uint8_t* data, size_t length, size_t frameLength, uint8_t flags, int spreadingFactor, int rssi, \
+       float snr, long frequencyError), \
+      (data, length, frameLength, flags, spreadingFactor, rssi, snr, frequencyError)) \
+    X(void, clearLoRaCapture, (), ()) \
+    X(bool, takeLoRaCaptureSnapshot, (LoRaCaptureSnapshot& snapshot), (snapshot)) \
+    X(void, releaseLoRaCaptureSnapshot, (LoRaCaptureSnapshot& snapshot), (snapshot)) \
+    X(size_t, getLoRaCaptureSize, (const LoRaCaptureSnapshot& snapshot), (snapshot)) \
+    X(void, exportLoRaCapture, (const LoRaCaptureSnapshot& snapshot, Print& out, uint32_t epochNow), \
+      (snapshot, out, epochNow)) \
+    X(const LoRaCaptureStats&, getLoRaCaptureStats, (), ()) \
+    X(void, addLoRaCaptureJSON, (JsonObject obj), (obj))
+
+// The eventbus.h functions: each node has a bus of its own
+#define SIM_EVENT_API(X) \
+    X(void, setupEventBus, (), ()) \
+    X(int8_t, subscribeEvents, \
+      (const char* name, uint32_t mask, EventHandler handler, uint8_t flags, EventWake wake), \
+      (name, mask, handler, flags, wake)) \
+    X(bool, publishEvent, (uint8_t type, uint8_t source, uint16_t param, uint32_t value), \
+      (type, source, param, value)) \
+    X(bool, publishEventFromISR, (uint8_t type, uint8_t source, uint16_t param, uint32_t value), \
+      (type, source, param, value)) \
+    X(uint8_t, dispatchEvents, (int8_t subscriber), (subscriber)) \
+    X(const char*, getEventName, (uint8_t type), (type)) \
+    X(const EventSubscriberStats&, getEventSubscriberStats, (int8_t subscriber), (subscriber)) \
+    X(const EventBusStats&, getEventBusStats, (), ()) \
+    X(String, getEventBusJSON, (), ())
+
+// The logger.h functions: each node has a log of its own
+#define SIM_LOG_API(X) \
+    X(void, setupLog, (), ()) \
+    X(void, loopLog, (), ()) \
+    X(void, flushLog, (), ()) \
+    X(bool, isLogEnabled, (uint8_t module, uint8_t level), (module, level)) \
+    X(void, writeLog, (uint8_t module, uint8_t level, const char* format, const LogArgs& args), \
+      (module, level, format, args)) \
+    X(bool, setLogLevel, (const String& module, const String& level), (module, level)) \
+    X(void, exportLog, (Print& out, bool kept), (out, kept)) \
+    X(const LogStats&, getLogStats, (), ()) \
+    X(String, getLogConfigJSON, (), ())
+
+// The schedulesync.h functions; the schedule table behind them is schedulesim.cpp
+#define SIM_SYNC_API(X) \
+    X(void, setupScheduleSync, (), ()) \
+    X(void, loopScheduleSync, (), ()) \
+    X(void, handleScheduleSyncMessage, (const String& content), (content)) \
+    X(const SyncStats&, getScheduleSyncStats, (), ()) \
+    X(String, getScheduleSyncJSON, (), ())
+
+// One node's copy of the LoRa stack
+struct SimNodeApi {
+#define SIM_API_FIELD(ret, name, params, args) ret (*name) params;
+    SIM_LORA_API(SIM_API_FIELD)
+    SIM_OTA_API(SIM_API_FIELD)
+    SIM_CAPTURE_API(SIM_API_FIELD)
+    SIM_EVENT_API(SIM_API_FIELD)
+    SIM_LOG_API(SIM_API_FIELD)
+    SIM_SYNC_API(SIM_API_FIELD)
+#undef SIM_API_FIELD
+};
+
+// Function declarations
+void simRegisterNode(const SimNodeApi* api);
+const SimNodeApi& simNodeApi(uint8_t node);
@@ -0,0 +1,184 @@
+// Per-node copies of the firmware LoRa stack, see simnode.h.
+//
+// Headers the firmware includes are pulled in here first, at global scope,
+// so their #pragma once keeps them out of the node namespaces.
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <SPI.h>
+#include <LoRa.h>
+#include <SPIFFS.h>
+#include "mbedtls/aes.h"
+#include "mbedtls/sha256.h"
+#include <Update.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include "rom/miniz.h"
+#include "lorahandler.h"
+#include "frameauth.h"
+#include "loraota.h"
+#include "loracapture.h"
+#include "eventbus.h"
+#include "logger.h"
+#include "configstore.h"
+#include "mp3handler.h"
+#include "gongsynth.h"
+#include "schedule.h"
+#include "schedulesync.h"
+#include "nodestatus.h"
+#include "linkadapt.h"
+#include "tasks.h"
+#include "simnode.h"
+
+const SimNodeApi* simNodeApis[SIM_MAX_NODES];
+uint8_t simRegisteredNodes = 0;
+
+void simRegisterNode(const SimNodeApi* api) {
+    if (simRegisteredNodes < SIM_MAX_NODES) {
+        simNodeApis[simRegisteredNodes++] = api;
+    }
+}
+
+const SimNodeApi& simNodeApi(uint8_t node) {
+    return *simNodeApis[node];
+}
+
+#define SIM_NODE_NAMESPACE simnode0
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode1
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode2
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode3
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode4
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode5
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode6
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode7
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode8
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode9
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode10
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode11
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode12
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode13
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode14
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode15
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode16
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode17
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode18
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode19
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode20
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode21
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode22
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode23
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode24
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode25
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode26
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode27
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode28
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode29
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode30
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode31
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode32
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode33
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode34
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode35
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode36
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode37
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode38
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode39
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode40
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode41
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode42
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode43
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode44
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode45
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode46
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode47
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode48
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode49
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode50
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode51
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode52
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode53
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode54
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode55
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode56
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode57
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode58
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode59
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode60
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode61
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode62
+#include "simnode.inc"
+#define SIM_NODE_NAMESPACE simnode63
+#include "simnode.inc"
+
+// Global lorahandler.h, loraota.h, loracapture.h, eventbus.h, logger.h and schedulesync.h functions run the
+// current node's copy
+#define SIM_API_DISPATCH(ret, name, params, args) \
+    ret name params { return simNodeApi(simCurrentNode()).name args; }
+SIM_LORA_API(SIM_API_DISPATCH)
+SIM_OTA_API(SIM_API_DISPATCH)
+SIM_CAPTURE_API(SIM_API_DISPATCH)
+SIM_EVENT_API(SIM_API_DISPATCH)
+SIM_LOG_API(SIM_API_DISPATCH)
+SIM_SYNC_API(SIM_API_DISPATCH)
+#undef SIM_API_DISPATCH
@@ -0,0 +1,144 @@
+// Flash side of firmware updates on the simulated nodes: the image each node
+// runs, the Update library writing the next one, and the ROM inflater
+#include <Arduino.h>
+#include <Update.h>
+#include <esp_ota_ops.h>
+#include "rom/miniz.h"
+#include "mbedtls/sha256.h"
+#include "lorasim.h"
+
+struct SimOtaFlash {
+    std::string image;          // Running app partition
+    esp_partition_t partition;
+    std::string next;           // Update target partition
+    size_t nextSize;
+    bool writing;
+    bool bootNext;              // Update.end() succeeded
+    uint32_t restarts;
+};
+
+UpdateClass Update;
+SimOtaFlash simOtaFlash[SIM_MAX_NODES];
+
+void simSetNodeImage(uint8_t node, const std::string& image) {
+    SimOtaFlash& flash = simOtaFlash[node];
+    flash.image = image;
+    flash.partition.node = node;
+    flash.partition.size = image.size();
+}
+
+const std::string& simGetNodeImage(uint8_t node) {
+    return simOtaFlash[node].image;
+}
+
+uint32_t simGetNodeRestarts(uint8_t node) {
+    return simOtaFlash[node].restarts;
+}
+
+void EspClass::restart() {
+    // The firmware keeps running; only the image it runs changes
+    SimOtaFlash& flash = simOtaFlash[simCurrentNode()];
+    flash.restarts++;
+    if (flash.bootNext) {
+        simSetNodeImage(simCurrentNode(), flash.next);
+        flash.bootNext = false;
+    }
+}
+
+bool UpdateClass::begin(size_t size) {
+    SimOtaFlash& flash = simOtaFlash[simCurrentNode()];
+    flash.next.clear();
+    flash.nextSize = size;
+    flash.writing = true;
+    flash.bootNext = false;
+    return true;
+}
+
+size_t UpdateClass::write(uint8_t* data, size_t length) {
+    SimOtaFlash& flash = simOtaFlash[simCurrentNode()];
+    if (!flash.writing || flash.next.size() + length > flash.nextSize) {
+        return 0;
+    }
+    flash.next.append((const char*)data, length);
+    return length;
+}
+
+bool UpdateClass::end(bool evenIfRemaining) {
+    SimOtaFlash& flash = simOtaFlash[simCurrentNode()];
+    if (!flash.writing || (!evenIfRemaining && flash.next.size() != flash.nextSize)) {
+        return false;
+    }
+    flash.writing = false;
+    flash.bootNext = true;
+    return true;
+}
+
+void UpdateClass::abort() {
+    simOtaFlash[simCurrentNode()].writing = false;
+}
+
+bool UpdateClass::isRunning() {
+    return simOtaFlash[simCurrentNode()].writing;
+}
+
+const char* UpdateClass::errorString() {
+    return "simulated flash error";
+}
+
+const esp_partition_t* esp_ota_get_running_partition() {
+    return &simOtaFlash[simCurrentNode()].partition;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t offset, void* destination, size_t size) {
+    const std::string& image = simOtaFlash[partition->node].image;
+    if (offset + size > image.size()) {
+        return ESP_FAIL;
+    }
+    memcpy(destination, image.data() + offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_get_sha256(const esp_partition_t* partition, uint8_t* sha256) {
+    // Images here carry no appended hash, so it is the hash of the whole partition content
+    const std::string& image = simOtaFlash[partition->node].image;
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts(&ctx, 0);
+    mbedtls_sha256_update(&ctx, (const uint8_t*)image.data(), image.size());
+    mbedtls_sha256_finish(&ctx, sha256);
+    return ESP_OK;
+}
+
+tinfl_status tinfl_decompress(tinfl_decompressor* r, const uint8_t* in, size_t* inSize, uint8_t* outStart,
+                              uint8_t* outNext, size_t* outSize, uint32_t flags) {
+    if (r->m_state == 0) {
+        memset(&r->stream, 0, sizeof(r->stream));
+        if (inflateInit2(&r->stream, (flags & TINFL_FLAG_PARSE_ZLIB_HEADER) ? MAX_WBITS : -MAX_WBITS) != Z_OK) {
+            return TINFL_STATUS_FAILED;
+        }
+        r->m_state = 1;
+    } else if (r->m_state != 1) {
+        *inSize = 0;
+        *outSize = 0;
+        return r->m_state == 2 ? TINFL_STATUS_DONE : TINFL_STATUS_FAILED;
+    }
+    
+    r->stream.next_in = (Bytef*)in;
+    r->stream.avail_in = *inSize;
+    r->stream.next_out = outNext;
+    r->stream.avail_out = *outSize;
+    int result = inflate(&r->stream, Z_NO_FLUSH);
+    *inSize -= r->stream.avail_in;
+    *outSize -= r->stream.avail_out;
+    
+    // zlib keeps its own state; it is released once the stream ends either way
+    if (result == Z_STREAM_END || (result != Z_OK && result != Z_BUF_ERROR)) {
+        inflateEnd(&r->stream);
+        r->m_state = result == Z_STREAM_END ? 2 : 3;
+        return result == Z_STREAM_END ? TINFL_STATUS_DONE : TINFL_STATUS_FAILED;
+    }
+    if (r->stream.avail_out == 0) {
+        return TINFL_STATUS_HAS_MORE_OUTPUT;
+    }
+    return (flags & TINFL_FLAG_HAS_MORE_INPUT) ? TINFL_STATUS_NEEDS_MORE_INPUT : TINFL_STATUS_FAILED;
+}
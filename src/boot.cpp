@@ -0,0 +1,343 @@
+#include "boot.h"
+#include "tasks.h"
+#include "eventbus.h"
+#include "webhandler.h"
+#include "lorahandler.h"
+#include "loraota.h"
+#include "mp3handler.h"
+#include "gongprogram.h"
+#include "trackcatalog.h"
+#include "gongsynth.h"
+#include "schedule.h"
+#include "schedulesync.h"
+#include "nodestatus.h"
+#include "linkadapt.h"
+#include "lowpower.h"
+#include "powermanager.h"
+#include "configstore.h"
+#include "logger.h"
+#include "profiler.h"
+#include <SPIFFS.h>
+
+bool bootConfigOpen = true;             // Until every stage has loaded its sections
+unsigned long bootStartMs = 0;          // millis() when setup() began: the time since reset
+unsigned long bootStartUs = 0;
+uint32_t bootSetupMs = 0;
+BootStageRecord bootStages[BOOT_STAGES] = {};
+bool bootStageDone[BOOT_STAGES] = {};
+uint32_t bootMilestones[BOOT_MILESTONES] = {};     // ms from the start of setup(), 0 = not yet
+uint8_t bootFaults = 0;                 // Found during setup; the rest are checked as they stand
+uint8_t bootFaultsReported = 0;
+
+const char* const bootStageNames[BOOT_STAGES] = {
+    "storage", "config", "core", "radio", "scheduler", "audio", "web"
+};
+
+const uint8_t bootStageTasks[BOOT_STAGES] = {
+    BOOT_ON_SETUP, BOOT_ON_SETUP, BOOT_ON_SETUP, BOOT_ON_SETUP, BOOT_ON_SETUP, TASK_AUDIO, TASK_WEB
+};
+
+const char* const bootResultNames[BOOT_RESULTS] = {"pending", "ok", "failed", "timeout", "skipped"};
+
+const char* const bootMilestoneNames[BOOT_MILESTONES] = {"network", "time", "audio", "ready"};
+
+const char* const bootFaultNames[BOOT_FAULTS] = {
+    "storage", "config", "stage_timeout", "lora", "wifi", "time", "audio"
+};
+
+bool mountBootStorage() {
+    // Formats a blank or damaged partition, so the node comes up with an empty one
+    return SPIFFS.begin(true);
+}
+
+bool setupCore() {
+    setupLog();
+    setupProfiler();
+    setupEventBus();
+    setupTasks();
+    return true;
+}
+
+bool setupRadio() {
+    setupLoRa();
+    setupScheduleSync();
+    setupNodeStatus();
+    setupLinkAdapt();
+    setupLowPower();
+    setupLoRaOta();
+    return isLoRaReady();
+}
+
+bool setupScheduler() {
+    setupSchedule();
+    setupPowerManager();
+    return true;
+}
+
+bool setupAudio() {
+    setupMP3();
+    setupTrackCatalog();
+    setupGongSynth();
+    setupGongPrograms();
+    return true;
+}
+
+bool setupWeb() {
+    setupWiFi();
+    setupWebServer();
+    return true;
+}
+
+bool (*const bootStageSetups[BOOT_STAGES])() = {
+    mountBootStorage, setupConfig, setupCore, setupRadio, setupScheduler, setupAudio, setupWeb
+};
+
+void runBootStage(uint8_t stage) {
+    BootStageRecord& record = bootStages[stage];
+    if (stage == BOOT_STAGE_WEB && isLoRaLowPower()) {
+        record.result = BOOT_RESULT_SKIPPED;
+        bootStageDone[stage] = true;
+        return;
+    }
+    
+    record.startUs = micros() - bootStartUs;
+    bool ok = bootStageSetups[stage]();
+    record.durationUs = micros() - bootStartUs - record.startUs;
+    
+    // One that overran keeps its flag; setup() has gone on without it
+    if (record.result == BOOT_RESULT_PENDING) {
+        record.result = ok ? BOOT_RESULT_OK : BOOT_RESULT_FAILED;
+    }
+    bootStageDone[stage] = true;
+}
+
+uint8_t getBootStageTask(uint8_t stage) {
+    return stage < BOOT_STAGES ? bootStageTasks[stage] : BOOT_ON_SETUP;
+}
+
+void reportBootFaults(uint8_t faults) {
+    for (uint8_t i = 0; i < BOOT_FAULTS; i++) {
+        uint8_t fault = 1 << i;
+        if ((faults & fault) && !(bootFaultsReported & fault)) {
+            LOG_WARN(LOG_MODULE_MAIN, "Degraded: %s", bootFaultNames[i]);
+        } else if (!(faults & fault) && (bootFaultsReported & fault)) {
+            LOG_INFO(LOG_MODULE_MAIN, "Recovered: %s", bootFaultNames[i]);
+        }
+    }
+    bootFaultsReported = faults;
+}
+
+void bootSystem() {
+    bootStartMs = millis();
+    bootStartUs = micros();
+    
+    // Storage and configuration before anything reads them, then what the tasks need
+    for (uint8_t stage = BOOT_STAGE_STORAGE; stage <= BOOT_STAGE_SCHEDULER; stage++) {
+        runBootStage(stage);
+    }
+    if (bootStages[BOOT_STAGE_STORAGE].result != BOOT_RESULT_OK) {
+        bootFaults |= BOOT_FAULT_STORAGE;
+    }
+    
+    // Battery slaves keep one loop; the others set up audio and web on their own tasks at once
+    if (isLoRaLowPower()) {
+        runBootStage(BOOT_STAGE_AUDIO);
+        runBootStage(BOOT_STAGE_WEB);
+    } else {
+        startTasks();
+        if (!waitForTaskBoot(BOOT_STAGE_TIMEOUT_MS)) {
+            for (uint8_t stage = 0; stage < BOOT_STAGES; stage++) {
+                if (!bootStageDone[stage]) {
+                    bootStages[stage].result = BOOT_RESULT_TIMEOUT;
+                    bootFaults |= BOOT_FAULT_STAGE;
+                    LOG_ERROR(LOG_MODULE_MAIN, "Boot stage %s still running after %d ms", bootStageNames[stage],
+                              BOOT_STAGE_TIMEOUT_MS);
+                }
+            }
+        }
+        releaseTasks();
+    }
+    bootSetupMs = (micros() - bootStartUs) / 1000;
+    
+    uint32_t stagesUs = 0;
+    for (uint8_t stage = 0; stage < BOOT_STAGES; stage++) {
+        const BootStageRecord& record = bootStages[stage];
+        stagesUs += record.durationUs;
+        LOG_DEBUG(LOG_MODULE_MAIN, "Boot stage %s: %s, %lu us from %lu us", bootStageNames[stage],
+                  bootResultNames[record.result], (unsigned long)record.durationUs, (unsigned long)record.startUs);
+    }
+    LOG_INFO(LOG_MODULE_MAIN, "Boot took %lu ms after %lu ms from reset (%lu ms of stages)",
+             (unsigned long)bootSetupMs, bootStartMs, (unsigned long)(stagesUs / 1000));
+    reportBootFaults(getBootFaults());
+}
+
+void reportBootConfig() {
+    const ConfigStats& stats = getConfigStats();
+    if (stats.parsed) {
+        LOG_INFO(LOG_MODULE_MAIN, "Configuration parsed in %lu us, %u bytes cached", (unsigned long)stats.parseUs,
+                 stats.imageBytes);
+    } else {
+        LOG_INFO(LOG_MODULE_MAIN, "Configuration loaded from its image in %lu us", (unsigned long)stats.imageLoadUs);
+    }
+    for (uint8_t i = 0; i < CONFIG_SECTIONS; i++) {
+        const char* error = getConfigSectionError(i);
+        if (error) {
+            LOG_WARN(LOG_MODULE_MAIN, "Section %s of gong.conf ignored: %s", getConfigSectionName(i), error);
+        }
+    }
+    if (stats.unknownSections > 0) {
+        LOG_WARN(LOG_MODULE_MAIN, "%u unknown sections in gong.conf", stats.unknownSections);
+    }
+}
+
+void loopBoot() {
+    // Once no stage can still be loading a section, the parsed sources go and the image is written
+    if (bootConfigOpen) {
+        bool done = true;
+        for (uint8_t stage = 0; stage < BOOT_STAGES; stage++) {
+            done = done && bootStageDone[stage];
+        }
+        if (done) {
+            finishConfig();
+            reportBootConfig();
+            bootConfigOpen = false;
+        }
+    }
+    
+    if (millis() - bootStartMs >= BOOT_READY_TIMEOUT_MS) {
+        uint8_t faults = getBootFaults();
+        if (faults != bootFaultsReported) {
+            reportBootFaults(faults);
+        }
+    }
+    if (bootMilestones[BOOT_MILESTONE_READY] != 0) {
+        return;
+    }
+    
+    // Time from the start of setup() to each step towards the first scheduled gong. Battery
+    // slaves have no WiFi and no schedule of their own: they are ready once they can sound a LoRa gong.
+    uint32_t nowMs = max(millis() - bootStartMs, 1UL);
+    bool lowPower = isLoRaLowPower();
+    bool reached[BOOT_MILESTONES] = {
+        lowPower || isWiFiConnected() || isWiFiAPMode(),
+        lowPower || isTimeSynced(),
+        getMP3Status().online || isGongSynthEnabled(),
+        false
+    };
+    reached[BOOT_MILESTONE_READY] = reached[BOOT_MILESTONE_NETWORK] && reached[BOOT_MILESTONE_TIME] &&
+                                    reached[BOOT_MILESTONE_AUDIO] && (lowPower || getScheduleFireInMs() >= 0);
+    for (uint8_t i = 0; i < BOOT_MILESTONES; i++) {
+        if (reached[i] && bootMilestones[i] == 0) {
+            bootMilestones[i] = nowMs;
+        }
+    }
+    if (reached[BOOT_MILESTONE_READY]) {
+        LOG_INFO(LOG_MODULE_MAIN, "Ready for scheduled gongs %lu ms after boot (network %lu, time %lu, audio %lu ms)",
+                 (unsigned long)nowMs, (unsigned long)bootMilestones[BOOT_MILESTONE_NETWORK],
+                 (unsigned long)bootMilestones[BOOT_MILESTONE_TIME],
+                 (unsigned long)bootMilestones[BOOT_MILESTONE_AUDIO]);
+    }
+}
+
+uint8_t getBootFaults() {
+    // What the node found at setup, and what it still lacks
+    uint8_t faults = bootFaults;
+    const ConfigStats& config = getConfigStats();
+    if (config.sourceStatus != CONFIG_SOURCE_OK || config.invalidSections > 0) {
+        faults |= BOOT_FAULT_CONFIG;
+    }
+    if (!isLoRaReady()) {
+        faults |= BOOT_FAULT_LORA;
+    }
+    if (millis() - bootStartMs < BOOT_READY_TIMEOUT_MS) {
+        return faults;
+    }
+    if (isWiFiAPMode() && isWiFiConfigured()) {
+        faults |= BOOT_FAULT_WIFI;
+    }
+    if (!isTimeSynced() && !isLoRaLowPower()) {
+        faults |= BOOT_FAULT_TIME;
+    }
+    if (!getMP3Status().online && !isGongSynthEnabled()) {
+        faults |= BOOT_FAULT_AUDIO;
+    }
+    return faults;
+}
+
+bool isBootDegraded() {
+    return getBootFaults() != 0;
+}
+
+const BootStageRecord& getBootStage(uint8_t stage) {
+    return bootStages[stage];
+}
+
+uint32_t getBootMilestoneMs(uint8_t milestone) {
+    return bootMilestones[milestone];
+}
+
+const char* getBootStatus(uint8_t faults) {
+    if (faults != 0) {
+        return "degraded";
+    }
+    return bootMilestones[BOOT_MILESTONE_READY] != 0 ? "ok" : "starting";
+}
+
+void addBootFaults(JsonArray array, uint8_t faults) {
+    for (uint8_t i = 0; i < BOOT_FAULTS; i++) {
+        if (faults & (1 << i)) {
+            array.add(bootFaultNames[i]);
+        }
+    }
+}
+
+String getBootJSON() {
+    DynamicJsonDocument doc(2048);
+    uint8_t faults = getBootFaults();
+    doc["status"] = getBootStatus(faults);
+    doc["reset_ms"] = bootStartMs;
+    doc["setup_ms"] = bootSetupMs;
+    
+    uint32_t stagesUs = 0;
+    JsonArray stages = doc.createNestedArray("stages");
+    for (uint8_t i = 0; i < BOOT_STAGES; i++) {
+        const BootStageRecord& record = bootStages[i];
+        JsonObject stage = stages.createNestedObject();
+        stage["name"] = bootStageNames[i];
+        stage["task"] = bootStageTasks[i] == BOOT_ON_SETUP || isLoRaLowPower() ? "setup"
+                      : getSystemTaskName(bootStageTasks[i]);
+        stage["result"] = bootResultNames[record.result];
+        stage["start_ms"] = record.startUs / 1000.0;
+        stage["ms"] = record.durationUs / 1000.0;
+        stagesUs += record.durationUs;
+    }
+    // Above setup_ms when stages ran side by side
+    doc["stages_ms"] = stagesUs / 1000;
+    
+    JsonObject milestones = doc.createNestedObject("milestones");
+    for (uint8_t i = 0; i < BOOT_MILESTONES; i++) {
+        if (bootMilestones[i] != 0) {
+            milestones[bootMilestoneNames[i]] = bootMilestones[i];
+        }
+    }
+    addBootFaults(doc.createNestedArray("faults"), faults);
+    
+    String result;
+    serializeJson(doc, result);
+    return result;
+}
+
+String getHealthJSON() {
+    DynamicJsonDocument doc(512);
+    uint8_t faults = getBootFaults();
+    doc["status"] = getBootStatus(faults);
+    doc["uptime_s"] = millis() / 1000;
+    if (bootMilestones[BOOT_MILESTONE_READY] != 0) {
+        doc["ready_ms"] = bootMilestones[BOOT_MILESTONE_READY];
+    }
+    addBootFaults(doc.createNestedArray("faults"), faults);
+    
+    String result;
+    serializeJson(doc, result);
+    return result;
+}
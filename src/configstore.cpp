@@ -0,0 +1,462 @@
+#include "configstore.h"
+#include "eventbus.h"
+#include <SPIFFS.h>
+#include <esp_ota_ops.h>
+#include <atomic>
+
+#define CONFIG_HASH_SEED 2166136261UL
+
+// Image file: this header, then the sections, each a ConfigImageSection
+// followed by the settings as its parser left them
+struct ConfigImageHeader {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t sourceStatus;
+    uint16_t size;              // Bytes of sections after the header
+    uint32_t firmwareId;        // Build that wrote it: another may lay its settings out differently
+    uint32_t sourceHash;        // FNV-1a of gong.conf and wifi.conf as they were parsed
+    uint32_t configVersion;
+    uint32_t checksum;          // FNV-1a of the header (checksum 0) and the sections
+};
+
+struct ConfigImageSection {
+    uint8_t section;
+    uint8_t reserved;
+    uint16_t size;
+};
+
+// Where each section is in the image, and how its module parses it
+struct ConfigSlot {
+    bool present;               // In the image
+    uint16_t offset;            // Of the settings in configImage
+    uint16_t size;
+    ConfigParser parser;        // Set once the module has loaded the section
+    const char* error;          // Schema failure, nullptr = valid
+};
+
+const char* const configSectionNames[CONFIG_SECTIONS] = {
+    "wifi", "lora", "log", "power", "mp3", "synth", "programs", "volume_profile", "default_schedules"
+};
+
+const char* const configSourceNames[CONFIG_SOURCE_STATES] = {"ok", "missing", "invalid"};
+
+uint8_t configImage[CONFIG_IMAGE_SIZE];
+ConfigSlot configSlots[CONFIG_SECTIONS] = {};
+ConfigStats configStats = {};
+bool configOpened = false;
+bool configDirty = false;                       // Sections added since the image was read
+uint32_t configSourceHash = 0;
+DynamicJsonDocument* configSources = nullptr;   // Parsed, until boot is done
+std::atomic_flag configLock = ATOMIC_FLAG_INIT;
+
+void lockConfig() {
+    // Held for a section's parse or copy; the audio and web stages load theirs side by side
+    while (configLock.test_and_set(std::memory_order_acquire)) {
+        delay(1);
+    }
+}
+
+void unlockConfig() {
+    configLock.clear(std::memory_order_release);
+}
+
+uint32_t hashConfig(uint32_t hash, const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+uint32_t hashConfigFile(uint32_t hash, const char* path) {
+    // Read, not parsed: a few kB hashed in a fraction of the time a parse takes
+    if (!SPIFFS.exists(path)) {
+        return hash;
+    }
+    File file = SPIFFS.open(path, "r");
+    uint8_t buffer[256];
+    size_t length;
+    while (file && (length = file.read(buffer, sizeof(buffer))) > 0) {
+        hash = hashConfig(hash, buffer, length);
+    }
+    file.close();
+    return hash;
+}
+
+uint32_t getConfigSourceHash() {
+    return hashConfigFile(hashConfigFile(CONFIG_HASH_SEED, CONFIG_FILE), CONFIG_WIFI_FILE);
+}
+
+uint32_t getConfigFirmwareId() {
+    uint32_t id;
+    memcpy(&id, esp_ota_get_app_description()->app_elf_sha256, sizeof(id));
+    return id;
+}
+
+uint32_t getConfigImageChecksum(const ConfigImageHeader& header, const uint8_t* sections) {
+    ConfigImageHeader fields = header;
+    fields.checksum = 0;
+    uint32_t hash = hashConfig(CONFIG_HASH_SEED, (const uint8_t*)&fields, sizeof(fields));
+    return hashConfig(hash, sections, header.size);
+}
+
+int8_t findConfigSection(const char* name) {
+    for (uint8_t i = 0; i < CONFIG_SECTIONS; i++) {
+        if (strcmp(name, configSectionNames[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool indexConfigImage(uint16_t size) {
+    // Every section whole, and each once
+    uint16_t offset = 0;
+    while (offset < size) {
+        ConfigImageSection section;
+        if (offset + sizeof(section) > size) {
+            return false;
+        }
+        memcpy(&section, configImage + offset, sizeof(section));
+        offset += sizeof(section);
+        if (section.section >= CONFIG_SECTIONS || configSlots[section.section].present ||
+            section.size > size - offset) {
+            return false;
+        }
+        ConfigSlot& slot = configSlots[section.section];
+        slot.present = true;
+        slot.offset = offset;
+        slot.size = section.size;
+        offset += section.size;
+    }
+    return true;
+}
+
+bool loadConfigImage() {
+    // The sections as this firmware parsed them from these very sources
+    if (!SPIFFS.exists(CONFIG_IMAGE_FILE)) {
+        return false;
+    }
+    File file = SPIFFS.open(CONFIG_IMAGE_FILE, "r");
+    if (!file) {
+        return false;
+    }
+    
+    ConfigImageHeader header;
+    bool ok = file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) && header.magic == CONFIG_IMAGE_MAGIC &&
+              header.version == CONFIG_IMAGE_VERSION && header.firmwareId == getConfigFirmwareId() &&
+              header.sourceHash == configSourceHash && header.sourceStatus < CONFIG_SOURCE_STATES &&
+              header.size <= CONFIG_IMAGE_SIZE && file.size() == sizeof(header) + header.size &&
+              file.read(configImage, header.size) == header.size &&
+              getConfigImageChecksum(header, configImage) == header.checksum && indexConfigImage(header.size);
+    file.close();
+    
+    if (!ok) {
+        for (ConfigSlot& slot : configSlots) {
+            slot = {};
+        }
+        configStats.rejected++;
+        return false;
+    }
+    configStats.sourceStatus = header.sourceStatus;
+    configStats.imageBytes = header.size;
+    configStats.version = header.configVersion;
+    return true;
+}
+
+void saveConfigImage() {
+    File file = SPIFFS.open(CONFIG_IMAGE_FILE, "w");
+    if (!file) {
+        return;
+    }
+    
+    lockConfig();
+    ConfigImageHeader header;
+    header.magic = CONFIG_IMAGE_MAGIC;
+    header.version = CONFIG_IMAGE_VERSION;
+    header.sourceStatus = configStats.sourceStatus;
+    header.size = configStats.imageBytes;
+    header.firmwareId = getConfigFirmwareId();
+    header.sourceHash = configSourceHash;
+    header.configVersion = configStats.version;
+    header.checksum = getConfigImageChecksum(header, configImage);
+    file.write((const uint8_t*)&header, sizeof(header));
+    file.write(configImage, header.size);
+    configDirty = false;
+    unlockConfig();
+    file.close();
+}
+
+uint8_t readConfigFile(const char* path, JsonDocument& doc) {
+    if (!SPIFFS.exists(path)) {
+        return CONFIG_SOURCE_MISSING;
+    }
+    File file = SPIFFS.open(path, "r");
+    if (!file) {
+        return CONFIG_SOURCE_INVALID;
+    }
+    DeserializationError error = deserializeJson(doc, file);
+    file.close();
+    return error || !doc.is<JsonObject>() ? CONFIG_SOURCE_INVALID : CONFIG_SOURCE_OK;
+}
+
+void parseConfigSources() {
+    unsigned long start = micros();
+    configSources = new DynamicJsonDocument(CONFIG_DOC_SIZE);
+    configStats.sourceStatus = readConfigFile(CONFIG_FILE, *configSources);
+    if (configStats.sourceStatus != CONFIG_SOURCE_OK) {
+        // Unreadable counts as empty: every section on its defaults
+        configSources->clear();
+    }
+    
+    DynamicJsonDocument wifi(CONFIG_WIFI_DOC_SIZE);
+    if (readConfigFile(CONFIG_WIFI_FILE, wifi) == CONFIG_SOURCE_OK) {
+        (*configSources)["wifi"] = wifi.as<JsonObjectConst>();
+    }
+    
+    // Sections no module reads, such as a misspelt one
+    configStats.unknownSections = 0;
+    for (JsonPairConst item : configSources->as<JsonObjectConst>()) {
+        if (findConfigSection(item.key().c_str()) < 0) {
+            configStats.unknownSections++;
+        }
+    }
+    configStats.parsed = true;
+    configStats.parseUs += micros() - start;
+}
+
+bool setupConfig() {
+    // Once, at the boot config stage or at the first section loaded
+    if (configOpened) {
+        return configStats.sourceStatus == CONFIG_SOURCE_OK;
+    }
+    configOpened = true;
+    
+    unsigned long start = micros();
+    configSourceHash = getConfigSourceHash();
+    if (loadConfigImage()) {
+        configStats.imageLoadUs = micros() - start;
+    } else {
+        parseConfigSources();
+    }
+    return configStats.sourceStatus == CONFIG_SOURCE_OK;
+}
+
+void finishConfig() {
+    // Boot is done: the sections parsed go into the image, and the sources are freed
+    if (configDirty) {
+        saveConfigImage();
+    }
+    lockConfig();
+    delete configSources;
+    configSources = nullptr;
+    unlockConfig();
+}
+
+const char* parseConfigSection(ConfigParser parser, JsonVariantConst json, void* settings, size_t size) {
+    // A section failing its schema has every setting at its default
+    memset(settings, 0, size);
+    const char* error = parser(json, settings);
+    if (error) {
+        memset(settings, 0, size);
+        parser(JsonVariantConst(), settings);
+    }
+    return error;
+}
+
+void setConfigError(ConfigSlot& slot, const char* error) {
+    if (error && !slot.error) {
+        configStats.invalidSections++;
+    } else if (!error && slot.error) {
+        configStats.invalidSections--;
+    }
+    slot.error = error;
+}
+
+bool storeConfigSection(uint8_t section, const void* settings, size_t size) {
+    // In place when it is there already, otherwise added at the end
+    ConfigSlot& slot = configSlots[section];
+    if (slot.present) {
+        if (slot.size != size) {
+            return false;
+        }
+        memcpy(configImage + slot.offset, settings, size);
+        return true;
+    }
+    if (configStats.imageBytes + sizeof(ConfigImageSection) + size > CONFIG_IMAGE_SIZE) {
+        return false;
+    }
+    ConfigImageSection header = {section, 0, (uint16_t)size};
+    memcpy(configImage + configStats.imageBytes, &header, sizeof(header));
+    slot.present = true;
+    slot.offset = configStats.imageBytes + sizeof(header);
+    slot.size = size;
+    memcpy(configImage + slot.offset, settings, size);
+    configStats.imageBytes = slot.offset + size;
+    configDirty = true;
+    return true;
+}
+
+bool loadConfigSection(uint8_t section, void* settings, size_t size, ConfigParser parser) {
+    setupConfig();
+    lockConfig();
+    ConfigSlot& slot = configSlots[section];
+    slot.parser = parser;
+    if (slot.present && slot.size == size) {
+        memcpy(settings, configImage + slot.offset, size);
+        unlockConfig();
+        return true;
+    }
+    
+    // Not in the image: from the sources, parsed for it if they are not already
+    if (!configSources) {
+        parseConfigSources();
+    }
+    JsonVariantConst json = configSources->as<JsonObjectConst>()[configSectionNames[section]];
+    const char* error = parseConfigSection(parser, json, settings, size);
+    if (!error) {
+        storeConfigSection(section, settings, size);
+    } else {
+        slot.size = size;
+    }
+    setConfigError(slot, error);
+    unlockConfig();
+    return !error;
+}
+
+bool writeConfigFile(JsonObjectConst changes) {
+    // gong.conf stays the file a person edits: the changed sections are written back into it
+    DynamicJsonDocument doc(CONFIG_DOC_SIZE);
+    if (readConfigFile(CONFIG_FILE, doc) == CONFIG_SOURCE_INVALID) {
+        return false;
+    }
+    for (JsonPairConst item : changes) {
+        doc[item.key().c_str()] = item.value();
+    }
+    if (doc.overflowed()) {
+        return false;
+    }
+    
+    File file = SPIFFS.open(CONFIG_FILE, "w");
+    if (!file) {
+        return false;
+    }
+    bool written = serializeJsonPretty(doc, file) > 0;
+    file.close();
+    
+    // Its "wifi" section replaced wifi.conf's, which would otherwise still override it
+    if (written && changes.containsKey("wifi") && SPIFFS.exists(CONFIG_WIFI_FILE)) {
+        SPIFFS.remove(CONFIG_WIFI_FILE);
+    }
+    return written;
+}
+
+bool setConfig(JsonObjectConst changes, String& error) {
+    // Every section is checked before any is applied: a change applies whole or not at all
+    uint8_t* pending = new uint8_t[CONFIG_IMAGE_SIZE];
+    uint16_t offsets[CONFIG_SECTIONS];
+    bool changed[CONFIG_SECTIONS] = {};
+    size_t used = 0;
+    for (JsonPairConst item : changes) {
+        int8_t section = findConfigSection(item.key().c_str());
+        if (section < 0) {
+            error = String("Unknown section ") + item.key().c_str();
+            break;
+        }
+        const ConfigSlot& slot = configSlots[section];
+        if (!slot.parser) {
+            error = String("Section ") + item.key().c_str() + " not used on this node";
+            break;
+        }
+        memset(pending + used, 0, slot.size);
+        const char* failed = slot.parser(item.value(), pending + used);
+        if (failed) {
+            error = String(item.key().c_str()) + ": " + failed;
+            break;
+        }
+        offsets[section] = used;
+        changed[section] = true;
+        used += slot.size;
+    }
+    if (error.length() == 0 && !writeConfigFile(changes)) {
+        error = "Failed to write gong.conf";
+    }
+    if (error.length() > 0) {
+        delete[] pending;
+        configStats.refused++;
+        return false;
+    }
+    
+    lockConfig();
+    for (uint8_t i = 0; i < CONFIG_SECTIONS; i++) {
+        if (changed[i]) {
+            storeConfigSection(i, pending + offsets[i], configSlots[i].size);
+            setConfigError(configSlots[i], nullptr);
+        }
+    }
+    delete configSources;
+    configSources = nullptr;
+    configStats.sourceStatus = CONFIG_SOURCE_OK;
+    configStats.version++;
+    configStats.changes++;
+    unlockConfig();
+    delete[] pending;
+    
+    // The image matches the new gong.conf, so the next boot parses nothing
+    configSourceHash = getConfigSourceHash();
+    saveConfigImage();
+    
+    // Each module loads its section again on its own task
+    for (uint8_t i = 0; i < CONFIG_SECTIONS; i++) {
+        if (changed[i]) {
+            publishEvent(EVENT_CONFIG_CHANGED, EVENT_SOURCE_NONE, i, configStats.version);
+        }
+    }
+    return true;
+}
+
+const char* getConfigSectionName(uint8_t section) {
+    return section < CONFIG_SECTIONS ? configSectionNames[section] : "unknown";
+}
+
+const char* getConfigSectionError(uint8_t section) {
+    return section < CONFIG_SECTIONS ? configSlots[section].error : nullptr;
+}
+
+const ConfigStats& getConfigStats() {
+    return configStats;
+}
+
+String getConfigJSON() {
+    DynamicJsonDocument doc(2048);
+    doc["version"] = configStats.version;
+    doc["source"] = configSourceNames[configStats.sourceStatus];
+    doc["parsed"] = configStats.parsed;
+    doc["image_load_us"] = configStats.imageLoadUs;
+    doc["parse_us"] = configStats.parseUs;
+    doc["image_bytes"] = configStats.imageBytes;
+    doc["image_size"] = CONFIG_IMAGE_SIZE;
+    doc["unknown_sections"] = configStats.unknownSections;
+    doc["changes"] = configStats.changes;
+    doc["refused"] = configStats.refused;
+    doc["rejected"] = configStats.rejected;
+    
+    JsonArray sections = doc.createNestedArray("sections");
+    for (uint8_t i = 0; i < CONFIG_SECTIONS; i++) {
+        const ConfigSlot& slot = configSlots[i];
+        if (!slot.parser) {
+            continue;
+        }
+        JsonObject item = sections.createNestedObject();
+        item["name"] = configSectionNames[i];
+        item["bytes"] = slot.size;
+        item["in_image"] = slot.present;
+        if (slot.error) {
+            item["error"] = slot.error;
+        }
+    }
+    
+    String result;
+    serializeJson(doc, result);
+    return result;
+}
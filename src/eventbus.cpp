@@ -0,0 +1,224 @@
+#include "eventbus.h"
+#include "logger.h"
+#include <ArduinoJson.h>
+
+#define EVENT_RING_MASK (EVENT_RING_SIZE - 1)
+
+static_assert((EVENT_RING_SIZE & EVENT_RING_MASK) == 0, "EVENT_RING_SIZE is a power of 2");
+static_assert(EVENT_TYPES <= 32, "event types fit a subscription mask");
+
+// A slot is free for position p when its sequence is p, holds the event
+// for p once it is p + 1, and is free again for the next lap at
+// p + EVENT_RING_SIZE
+struct EventSlot {
+    std::atomic<uint32_t> sequence;
+    Event event;
+};
+
+struct EventSubscriber {
+    char name[EVENT_SUBSCRIBER_NAME_LENGTH];
+    uint32_t mask;
+    EventHandler handler;
+    EventWake wake;
+    uint8_t flags;
+    EventSlot slots[EVENT_RING_SIZE];
+    std::atomic<uint32_t> head;     // Next position to claim, by any publisher
+    uint32_t tail;                  // Next position to take, by the subscriber's task only
+    EventSubscriberStats stats;
+};
+
+EventSubscriber eventSubscribers[MAX_EVENT_SUBSCRIBERS];
+uint8_t eventSubscriberCount = 0;
+EventBusStats eventBusStats;
+
+const char* const eventNames[EVENT_TYPES] = {
+    "none", "gong_requested", "gong_fired", "schedule_changed", "time_synced", "lora_frame_received", "wifi_state",
+    "config_changed"
+};
+
+void setupEventBus() {
+    eventSubscriberCount = 0;
+    for (uint8_t i = 0; i < EVENT_TYPES; i++) {
+        eventBusStats.published[i] = 0;
+    }
+    eventBusStats.fromIsr = 0;
+    eventBusStats.dropped = 0;
+}
+
+int8_t subscribeEvents(const char* name, uint32_t mask, EventHandler handler, uint8_t flags, EventWake wake) {
+    if (eventSubscriberCount >= MAX_EVENT_SUBSCRIBERS) {
+        LOG_WARN(LOG_MODULE_EVENTS, "No room for event subscriber %s", name);
+        return -1;
+    }
+    
+    EventSubscriber& subscriber = eventSubscribers[eventSubscriberCount];
+    strlcpy(subscriber.name, name, sizeof(subscriber.name));
+    subscriber.mask = mask;
+    subscriber.handler = handler;
+    subscriber.wake = wake;
+    subscriber.flags = flags;
+    for (uint32_t i = 0; i < EVENT_RING_SIZE; i++) {
+        subscriber.slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    subscriber.head.store(0, std::memory_order_relaxed);
+    subscriber.tail = 0;
+    subscriber.stats.delivered = 0;
+    subscriber.stats.dropped = 0;
+    subscriber.stats.maxDepth = 0;
+    subscriber.stats.latencyUs = 0;
+    subscriber.stats.maxLatencyUs = 0;
+    return eventSubscriberCount++;
+}
+
+bool IRAM_ATTR pushEvent(EventSubscriber& subscriber, const Event& event) {
+    uint32_t position = subscriber.head.load(std::memory_order_relaxed);
+    EventSlot* slot;
+    
+    if (subscriber.flags & EVENT_RING_SPSC) {
+        slot = &subscriber.slots[position & EVENT_RING_MASK];
+        if (slot->sequence.load(std::memory_order_acquire) != position) {
+            return false;
+        }
+        subscriber.head.store(position + 1, std::memory_order_relaxed);
+    } else {
+        // Claim a position; only a publisher that claimed one since can make this retry
+        for (;;) {
+            slot = &subscriber.slots[position & EVENT_RING_MASK];
+            int32_t lag = (int32_t)(slot->sequence.load(std::memory_order_acquire) - position);
+            if (lag == 0) {
+                if (subscriber.head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (lag < 0) {
+                return false;
+            } else {
+                position = subscriber.head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    
+    slot->event = event;
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+bool IRAM_ATTR deliverEvent(const Event& event, bool fromIsr) {
+    bool delivered = true;
+    for (uint8_t i = 0; i < eventSubscriberCount; i++) {
+        EventSubscriber& subscriber = eventSubscribers[i];
+        if (!(subscriber.mask & EVENT_MASK(event.type))) {
+            continue;
+        }
+        if (!pushEvent(subscriber, event)) {
+            subscriber.stats.dropped.fetch_add(1, std::memory_order_relaxed);
+            delivered = false;
+            continue;
+        }
+        if (subscriber.wake) {
+            subscriber.wake(fromIsr);
+        }
+    }
+    
+    eventBusStats.published[event.type].fetch_add(1, std::memory_order_relaxed);
+    if (!delivered) {
+        eventBusStats.dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    return delivered;
+}
+
+bool publishEvent(uint8_t type, uint8_t source, uint16_t param, uint32_t value) {
+    if (type == 0 || type >= EVENT_TYPES) {
+        return false;
+    }
+    Event event = {type, source, param, value, (uint32_t)micros()};
+    return deliverEvent(event, false);
+}
+
+bool IRAM_ATTR publishEventFromISR(uint8_t type, uint8_t source, uint16_t param, uint32_t value) {
+    if (type == 0 || type >= EVENT_TYPES) {
+        return false;
+    }
+    Event event = {type, source, param, value, (uint32_t)micros()};
+    eventBusStats.fromIsr.fetch_add(1, std::memory_order_relaxed);
+    return deliverEvent(event, true);
+}
+
+uint8_t dispatchEvents(int8_t subscriberIndex) {
+    if (subscriberIndex < 0 || subscriberIndex >= eventSubscriberCount) {
+        return 0;
+    }
+    EventSubscriber& subscriber = eventSubscribers[subscriberIndex];
+    
+    // At most one ring's worth per call, so a flood of events cannot keep
+    // the subscriber's task from the rest of its pass
+    uint8_t count = 0;
+    while (count < EVENT_RING_SIZE) {
+        EventSlot& slot = subscriber.slots[subscriber.tail & EVENT_RING_MASK];
+        if (slot.sequence.load(std::memory_order_acquire) != subscriber.tail + 1) {
+            break;
+        }
+        subscriber.stats.maxDepth = max(subscriber.stats.maxDepth,
+                                        subscriber.head.load(std::memory_order_relaxed) - subscriber.tail);
+        Event event = slot.event;
+        slot.sequence.store(subscriber.tail + EVENT_RING_SIZE, std::memory_order_release);
+        subscriber.tail++;
+        
+        if (subscriber.handler) {
+            subscriber.handler(event);
+        }
+        uint32_t latency = (uint32_t)micros() - event.timeUs;
+        subscriber.stats.delivered++;
+        subscriber.stats.latencyUs += latency;
+        subscriber.stats.maxLatencyUs = max(subscriber.stats.maxLatencyUs, latency);
+        count++;
+    }
+    return count;
+}
+
+const char* getEventName(uint8_t type) {
+    return type < EVENT_TYPES ? eventNames[type] : "unknown";
+}
+
+const EventSubscriberStats& getEventSubscriberStats(int8_t subscriber) {
+    return eventSubscribers[subscriber].stats;
+}
+
+const EventBusStats& getEventBusStats() {
+    return eventBusStats;
+}
+
+String getEventBusJSON() {
+    DynamicJsonDocument doc(2048);
+    
+    JsonObject published = doc.createNestedObject("published");
+    for (uint8_t i = 1; i < EVENT_TYPES; i++) {
+        published[getEventName(i)] = eventBusStats.published[i].load();
+    }
+    doc["from_isr"] = eventBusStats.fromIsr.load();
+    doc["dropped"] = eventBusStats.dropped.load();
+    
+    JsonArray subscribers = doc.createNestedArray("subscribers");
+    for (uint8_t i = 0; i < eventSubscriberCount; i++) {
+        const EventSubscriber& subscriber = eventSubscribers[i];
+        JsonObject item = subscribers.createNestedObject();
+        item["name"] = subscriber.name;
+        JsonArray events = item.createNestedArray("events");
+        for (uint8_t j = 1; j < EVENT_TYPES; j++) {
+            if (subscriber.mask & EVENT_MASK(j)) {
+                events.add(getEventName(j));
+            }
+        }
+        item["spsc"] = (subscriber.flags & EVENT_RING_SPSC) != 0;
+        item["waiting"] = subscriber.head.load() - subscriber.tail;
+        item["max_depth"] = subscriber.stats.maxDepth;
+        item["delivered"] = subscriber.stats.delivered;
+        item["dropped"] = subscriber.stats.dropped.load();
+        item["avg_latency_us"] = subscriber.stats.delivered ?
+                                 (uint32_t)(subscriber.stats.latencyUs / subscriber.stats.delivered) : 0;
+        item["max_latency_us"] = subscriber.stats.maxLatencyUs;
+    }
+    
+    String result;
+    serializeJson(doc, result);
+    return result;
+}
@@ -0,0 +1,423 @@
+#include "frameauth.h"
+#include "lorahandler.h"
+#include "logger.h"
+#include <SPIFFS.h>
+#include "mbedtls/aes.h"
+
+// Network key, expanded once into the hardware AES context and CMAC subkeys
+bool frameAuthEnabled = false;
+mbedtls_aes_context frameAuthAes;
+uint8_t frameAuthK1[16];
+uint8_t frameAuthK2[16];
+uint32_t frameAuthKeyId = 0;        // MAC of an empty message: tells keys apart without giving one away
+
+// Own counter; values below the limit are reserved in SPIFFS
+uint32_t frameAuthCounter = 0;
+uint32_t frameAuthCounterLimit = 0;
+
+// Replay state per sender
+struct FrameAuthSender {
+    uint16_t nodeId;
+    uint32_t highest;           // Highest counter accepted
+    uint32_t window;            // Bit n: highest - n accepted; 0 = nothing heard yet
+};
+
+// Senders file: this header, then each sender's node ID and highest counter
+struct FrameAuthSendersHeader {
+    uint32_t magic;
+    uint16_t count;
+    uint16_t reserved;
+    uint32_t keyId;             // Counters of frames under another key are of no use
+    uint32_t checksum;          // FNV-1a of the entries
+};
+
+struct FrameAuthSenderEntry {
+    uint16_t nodeId;
+    uint16_t reserved;
+    uint32_t highest;
+};
+
+FrameAuthSender frameAuthSenders[FRAME_AUTH_MAX_SENDERS];
+uint8_t frameAuthSenderCount = 0;
+bool frameAuthSendersDirty = false;     // A highest counter not stored yet
+unsigned long frameAuthSendersSavedAt = 0;
+
+FrameAuthStats frameAuthStats;
+
+static_assert(FRAME_AUTH_REPLAY_WINDOW <= 32, "replay window is a 32-bit bitmap");
+static_assert(FRAME_AUTH_MAX_SENDERS <= 255, "sender count is a uint8_t");
+
+void doubleCmacSubkey(const uint8_t in[16], uint8_t out[16]) {
+    // Multiply by x in GF(2^128), RFC 4493
+    uint8_t carry = in[0] & 0x80;
+    for (uint8_t i = 0; i < 15; i++) {
+        out[i] = (in[i] << 1) | (in[i + 1] >> 7);
+    }
+    out[15] = (in[15] << 1) ^ (carry ? 0x87 : 0);
+}
+
+void computeFrameAuthCmac(const uint8_t* data, size_t length, uint8_t mac[16]) {
+    uint8_t chain[LORA_MAX_PACKET];
+    uint8_t iv[16] = {0};
+    
+    // All blocks but the last in one hardware CBC pass; iv ends up as the chaining value
+    size_t blocks = length ? (length + 15) / 16 : 1;
+    size_t head = (blocks - 1) * 16;
+    if (head > 0) {
+        mbedtls_aes_crypt_cbc(&frameAuthAes, MBEDTLS_AES_ENCRYPT, head, iv, data, chain);
+    }
+    
+    // Last block: complete ones are masked with K1, padded ones with K2
+    size_t tail = length - head;
+    const uint8_t* subkey = tail == 16 ? frameAuthK1 : frameAuthK2;
+    uint8_t last[16];
+    for (uint8_t i = 0; i < 16; i++) {
+        uint8_t b = i < tail ? data[head + i] : (i == tail ? 0x80 : 0);
+        last[i] = b ^ subkey[i] ^ iv[i];
+    }
+    mbedtls_aes_crypt_ecb(&frameAuthAes, MBEDTLS_AES_ENCRYPT, last, mac);
+}
+
+bool isFrameAuthKeyValid(const char* hexKey) {
+    if (strlen(hexKey) != FRAME_AUTH_KEY_BYTES * 2) {
+        return false;
+    }
+    for (uint8_t i = 0; i < FRAME_AUTH_KEY_BYTES * 2; i++) {
+        if (!isxdigit(hexKey[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool setFrameAuthKey(const String& hexKey) {
+    if (!isFrameAuthKeyValid(hexKey.c_str())) {
+        return false;
+    }
+    
+    uint8_t key[FRAME_AUTH_KEY_BYTES];
+    for (uint8_t i = 0; i < FRAME_AUTH_KEY_BYTES; i++) {
+        char byteHex[3] = {hexKey[i * 2], hexKey[i * 2 + 1], 0};
+        key[i] = strtoul(byteHex, NULL, 16);
+    }
+    
+    mbedtls_aes_init(&frameAuthAes);
+    mbedtls_aes_setkey_enc(&frameAuthAes, key, FRAME_AUTH_KEY_BYTES * 8);
+    
+    uint8_t zero[16] = {0};
+    uint8_t l[16];
+    mbedtls_aes_crypt_ecb(&frameAuthAes, MBEDTLS_AES_ENCRYPT, zero, l);
+    doubleCmacSubkey(l, frameAuthK1);
+    doubleCmacSubkey(frameAuthK1, frameAuthK2);
+    uint8_t mac[16];
+    computeFrameAuthCmac(zero, 0, mac);
+    memcpy(&frameAuthKeyId, mac, sizeof(frameAuthKeyId));
+    
+    frameAuthEnabled = true;
+    return true;
+}
+
+bool isFrameAuthEnabled() {
+    return frameAuthEnabled;
+}
+
+size_t getFrameAuthOverhead() {
+    return frameAuthEnabled ? FRAME_AUTH_TRAILER_BYTES : 0;
+}
+
+void persistFrameAuthCounter() {
+    // Reserve the next block once the current one is used up
+    if (!frameAuthEnabled || frameAuthCounter < frameAuthCounterLimit) {
+        return;
+    }
+    
+    // The limit moves on even if the write fails, so a bad flash costs one attempt per block
+    frameAuthCounterLimit = frameAuthCounter + FRAME_AUTH_COUNTER_RESERVE;
+    File file = SPIFFS.open(FRAME_AUTH_COUNTER_FILE, "w");
+    if (!file) {
+        LOG_ERROR(LOG_MODULE_AUTH, "Failed to reserve LoRa frame counters");
+        return;
+    }
+    file.print(String(frameAuthCounterLimit));
+    file.close();
+}
+
+void loadFrameAuthCounter() {
+    // Start at the last reserved limit: counters before it may already have been used
+    uint32_t reserved = 0;
+    if (SPIFFS.exists(FRAME_AUTH_COUNTER_FILE)) {
+        File file = SPIFFS.open(FRAME_AUTH_COUNTER_FILE, "r");
+        if (file) {
+            reserved = strtoul(file.readString().c_str(), NULL, 10);
+            file.close();
+        }
+    }
+    
+    frameAuthCounter = reserved;
+    frameAuthCounterLimit = reserved;
+    persistFrameAuthCounter();
+}
+
+FrameAuthSenderEntry getFrameAuthSenderEntry(uint8_t index) {
+    FrameAuthSenderEntry entry = {};
+    entry.nodeId = frameAuthSenders[index].nodeId;
+    entry.highest = frameAuthSenders[index].highest;
+    return entry;
+}
+
+uint32_t hashFrameAuthSenderEntry(uint32_t hash, const FrameAuthSenderEntry& entry) {
+    const uint8_t* data = (const uint8_t*)&entry;
+    for (size_t i = 0; i < sizeof(entry); i++) {
+        hash ^= data[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+void saveFrameAuthSenders() {
+    // Like the own counter, the save time moves on even if the write fails
+    frameAuthSendersDirty = false;
+    frameAuthSendersSavedAt = millis();
+    File file = SPIFFS.open(FRAME_AUTH_SENDERS_FILE, "w");
+    if (!file) {
+        LOG_ERROR(LOG_MODULE_AUTH, "Failed to store LoRa replay counters");
+        return;
+    }
+    
+    FrameAuthSendersHeader header = {};
+    header.magic = FRAME_AUTH_SENDERS_MAGIC;
+    header.count = frameAuthSenderCount;
+    header.keyId = frameAuthKeyId;
+    header.checksum = 2166136261UL;
+    for (uint8_t i = 0; i < frameAuthSenderCount; i++) {
+        header.checksum = hashFrameAuthSenderEntry(header.checksum, getFrameAuthSenderEntry(i));
+    }
+    file.write((const uint8_t*)&header, sizeof(header));
+    for (uint8_t i = 0; i < frameAuthSenderCount; i++) {
+        FrameAuthSenderEntry entry = getFrameAuthSenderEntry(i);
+        file.write((const uint8_t*)&entry, sizeof(entry));
+    }
+    file.close();
+    frameAuthStats.senderSaves++;
+}
+
+void persistFrameAuthSenders(bool now) {
+    // Now for a gong frame about to be acted on; otherwise once a while, so heartbeats do not each cost a write
+    if (!frameAuthEnabled || !frameAuthSendersDirty ||
+        (!now && millis() - frameAuthSendersSavedAt < FRAME_AUTH_SENDERS_SAVE_MS)) {
+        return;
+    }
+    saveFrameAuthSenders();
+}
+
+void loadFrameAuthSenders() {
+    // Nothing at or below a stored counter is accepted, after a reboot as before it
+    frameAuthSenderCount = 0;
+    frameAuthSendersDirty = false;
+    if (!SPIFFS.exists(FRAME_AUTH_SENDERS_FILE)) {
+        return;
+    }
+    File file = SPIFFS.open(FRAME_AUTH_SENDERS_FILE, "r");
+    if (!file) {
+        return;
+    }
+    
+    FrameAuthSendersHeader header;
+    bool ok = file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+              header.magic == FRAME_AUTH_SENDERS_MAGIC && header.count <= FRAME_AUTH_MAX_SENDERS &&
+              file.size() == sizeof(header) + header.count * sizeof(FrameAuthSenderEntry);
+    if (ok && header.keyId != frameAuthKeyId) {
+        file.close();
+        LOG_INFO(LOG_MODULE_AUTH, "New LoRa key, replay counters start over");
+        return;
+    }
+    uint32_t hash = 2166136261UL;
+    for (uint16_t i = 0; ok && i < header.count; i++) {
+        FrameAuthSenderEntry entry;
+        ok = file.read((uint8_t*)&entry, sizeof(entry)) == sizeof(entry);
+        hash = hashFrameAuthSenderEntry(hash, entry);
+        
+        // Every counter up to the highest counts as seen
+        FrameAuthSender& sender = frameAuthSenders[i];
+        sender.nodeId = entry.nodeId;
+        sender.highest = entry.highest;
+        sender.window = UINT32_MAX;
+    }
+    file.close();
+    
+    if (!ok || hash != header.checksum) {
+        LOG_ERROR(LOG_MODULE_AUTH, "LoRa replay counters unreadable, frames from before the reset may pass once");
+        return;
+    }
+    frameAuthSenderCount = header.count;
+}
+
+void setupFrameAuth(const char* hexKey) {
+    // Again on every change to the "lora" section; the counter carries on under a new key, the
+    // replay counters start over, as frames under the old key no longer verify
+    bool wasEnabled = frameAuthEnabled;
+    uint32_t previousKeyId = frameAuthKeyId;
+    frameAuthEnabled = false;
+    if (hexKey[0] == 0) {
+        LOG_WARN(LOG_MODULE_AUTH, "LoRa frame authentication off (no key in gong.conf)");
+        return;
+    }
+    if (!setFrameAuthKey(hexKey)) {
+        LOG_WARN(LOG_MODULE_AUTH, "Invalid LoRa key in gong.conf (32 hex digits), frame authentication off");
+        return;
+    }
+    
+    if (!wasEnabled) {
+        loadFrameAuthCounter();
+    }
+    if (!wasEnabled || frameAuthKeyId != previousKeyId) {
+        loadFrameAuthSenders();
+    }
+    LOG_INFO(LOG_MODULE_AUTH, "LoRa frame authentication on, counter %lu", (unsigned long)frameAuthCounter);
+}
+
+size_t signLoRaFrame(uint8_t* frame, size_t length) {
+    // The caller leaves FRAME_AUTH_TRAILER_BYTES free after the frame
+    if (!frameAuthEnabled) {
+        return length;
+    }
+    
+    unsigned long start = micros();
+    uint16_t nodeId = getLoRaNodeId();
+    uint32_t counter = frameAuthCounter++;
+    
+    uint8_t* trailer = frame + length;
+    trailer[0] = nodeId;
+    trailer[1] = nodeId >> 8;
+    for (uint8_t i = 0; i < 4; i++) {
+        trailer[2 + i] = counter >> (i * 8);
+    }
+    
+    uint8_t mac[16];
+    computeFrameAuthCmac(frame, length + 6, mac);
+    memcpy(trailer + 6, mac, FRAME_AUTH_MAC_BYTES);
+    
+    uint32_t elapsed = micros() - start;
+    frameAuthStats.signedFrames++;
+    frameAuthStats.signUs += elapsed;
+    frameAuthStats.maxSignUs = max(frameAuthStats.maxSignUs, elapsed);
+    return length + FRAME_AUTH_TRAILER_BYTES;
+}
+
+FrameAuthSender* findFrameAuthSender(uint16_t nodeId) {
+    for (uint8_t i = 0; i < frameAuthSenderCount; i++) {
+        if (frameAuthSenders[i].nodeId == nodeId) {
+            return &frameAuthSenders[i];
+        }
+    }
+    
+    // New sender; none is ever forgotten, as its old frames would then pass again
+    if (frameAuthSenderCount >= FRAME_AUTH_MAX_SENDERS) {
+        return nullptr;
+    }
+    FrameAuthSender& sender = frameAuthSenders[frameAuthSenderCount++];
+    sender.nodeId = nodeId;
+    sender.highest = 0;
+    sender.window = 0;
+    return &sender;
+}
+
+bool acceptFrameAuthCounter(FrameAuthSender& sender, uint32_t counter) {
+    if (sender.window == 0 || counter > sender.highest) {
+        // Newest frame so far: slide the window up to it
+        uint32_t shift = counter - sender.highest;
+        sender.window = sender.window == 0 || shift >= 32 ? 1 : (sender.window << shift) | 1;
+        sender.highest = counter;
+        frameAuthSendersDirty = true;
+    } else {
+        uint32_t age = sender.highest - counter;
+        if (age >= FRAME_AUTH_REPLAY_WINDOW || (sender.window & (1UL << age))) {
+            return false;
+        }
+        sender.window |= 1UL << age;
+    }
+    return true;
+}
+
+int verifyLoRaFrame(const uint8_t* frame, size_t length) {
+    // Returns the length of the text frame, or -1 to drop it
+    if (!frameAuthEnabled) {
+        return length;
+    }
+    if (length < FRAME_AUTH_TRAILER_BYTES) {
+        frameAuthStats.rejectedUnsigned++;
+        LOG_DEBUG(LOG_MODULE_AUTH, "Unsigned LoRa frame dropped");
+        return -1;
+    }
+    
+    unsigned long start = micros();
+    size_t textLength = length - FRAME_AUTH_TRAILER_BYTES;
+    const uint8_t* trailer = frame + textLength;
+    uint16_t nodeId = trailer[0] | (trailer[1] << 8);
+    uint32_t counter = 0;
+    for (uint8_t i = 0; i < 4; i++) {
+        counter |= (uint32_t)trailer[2 + i] << (i * 8);
+    }
+    
+    uint8_t mac[16];
+    computeFrameAuthCmac(frame, textLength + 6, mac);
+    uint8_t diff = 0;
+    for (uint8_t i = 0; i < FRAME_AUTH_MAC_BYTES; i++) {
+        diff |= mac[i] ^ trailer[6 + i];
+    }
+    
+    // Replay state only moves for frames with a valid MAC
+    bool authentic = diff == 0;
+    FrameAuthSender* sender = authentic ? findFrameAuthSender(nodeId) : nullptr;
+    bool fresh = sender && acceptFrameAuthCounter(*sender, counter);
+    
+    uint32_t elapsed = micros() - start;
+    frameAuthStats.verifyUs += elapsed;
+    frameAuthStats.maxVerifyUs = max(frameAuthStats.maxVerifyUs, elapsed);
+    
+    if (!authentic) {
+        frameAuthStats.rejectedMac++;
+        LOG_ERROR(LOG_MODULE_AUTH, "LoRa frame from %04X failed authentication", nodeId);
+        return -1;
+    }
+    if (!sender) {
+        frameAuthStats.rejectedFull++;
+        LOG_ERROR(LOG_MODULE_AUTH, "LoRa frame from %04X dropped, %u senders known already", nodeId,
+                  FRAME_AUTH_MAX_SENDERS);
+        return -1;
+    }
+    if (!fresh) {
+        frameAuthStats.rejectedReplay++;
+        LOG_WARN(LOG_MODULE_AUTH, "Replayed LoRa frame from %04X dropped (counter %lu)", nodeId,
+                 (unsigned long)counter);
+        return -1;
+    }
+    
+    frameAuthStats.verified++;
+    return textLength;
+}
+
+const FrameAuthStats& getFrameAuthStats() {
+    return frameAuthStats;
+}
+
+void addFrameAuthJSON(JsonObject obj) {
+    const FrameAuthStats& stats = frameAuthStats;
+    uint32_t checked = stats.verified + stats.rejectedMac + stats.rejectedReplay + stats.rejectedFull;
+    
+    obj["enabled"] = frameAuthEnabled;
+    obj["overhead_bytes"] = getFrameAuthOverhead();
+    obj["counter"] = frameAuthCounter;
+    obj["senders"] = frameAuthSenderCount;
+    obj["signed"] = stats.signedFrames;
+    obj["verified"] = stats.verified;
+    obj["rejected_mac"] = stats.rejectedMac;
+    obj["rejected_replay"] = stats.rejectedReplay;
+    obj["rejected_unsigned"] = stats.rejectedUnsigned;
+    obj["rejected_full"] = stats.rejectedFull;
+    obj["sender_saves"] = stats.senderSaves;
+    obj["avg_sign_us"] = stats.signedFrames ? (uint32_t)(stats.signUs / stats.signedFrames) : 0;
+    obj["max_sign_us"] = stats.maxSignUs;
+    obj["avg_verify_us"] = checked ? (uint32_t)(stats.verifyUs / checked) : 0;
+    obj["max_verify_us"] = stats.maxVerifyUs;
+}
@@ -0,0 +1,354 @@
+#include "gongprogram.h"
+#include "mp3handler.h"
+#include "trackcatalog.h"
+#include "configstore.h"
+#include "logger.h"
+
+// "programs" section of gong.conf
+struct GongProgramSettings {
+    uint8_t count;
+    GongProgram programs[MAX_GONG_PROGRAMS];
+};
+
+GongProgram gongPrograms[MAX_GONG_PROGRAMS];
+uint8_t gongProgramCount = 0;
+GongProgramStats gongProgramStats = {};
+
+// Program being run; the sequencer only ever waits on the clock or on
+// the playback state, never in a loop
+int8_t sequencerProgram = -1;
+uint8_t sequencerStep = 0;
+uint8_t sequencerStrike = 0;        // Strikes done in the current step
+unsigned long sequencerNextAt = 0;  // Planned time of the next strike or step
+bool sequencerWaitForEnd = false;   // Next strike once the current one has ended
+bool sequencerVolumeChanged = false;
+uint8_t sequencerRestoreVolume = 0;
+int8_t sequencerPrepared = -1;      // Program whose first volume is already set
+
+const char* parseGongProgramSettings(JsonVariantConst json, void* settings) {
+    GongProgramSettings& config = *(GongProgramSettings*)settings;
+    config.count = 0;
+    for (JsonPairConst item : json.as<JsonObjectConst>()) {
+        const char* name = item.key().c_str();
+        JsonArrayConst steps = item.value().as<JsonArrayConst>();
+        if (config.count == MAX_GONG_PROGRAMS) {
+            return "8 programs at most";
+        }
+        if (name[0] == '\0' || strlen(name) >= GONG_PROGRAM_NAME_LENGTH) {
+            return "program names are 1-23 characters";
+        }
+        if (steps.size() == 0 || steps.size() > MAX_GONG_PROGRAM_STEPS) {
+            return "a program has 1-8 steps";
+        }
+        
+        GongProgram& program = config.programs[config.count++];
+        strlcpy(program.name, name, sizeof(program.name));
+        program.stepCount = 0;
+        for (JsonObjectConst entry : steps) {
+            GongProgramStep& step = program.steps[program.stepCount++];
+            if (entry.containsKey("pause")) {
+                step.track = 0;
+                step.volume = GONG_VOLUME_KEEP;
+                step.repeat = 1;
+                step.interval = entry["pause"] | 0;
+                continue;
+            }
+            step.track = entry["track"] | MP3_GONG_TRACK;
+            step.volume = entry.containsKey("volume") ? min(entry["volume"] | 0, MP3_MAX_VOLUME) : GONG_VOLUME_KEEP;
+            step.repeat = constrain(entry["repeat"] | 1, 1, GONG_PROGRAM_MAX_REPEAT);
+            step.interval = entry["interval"] | 0;
+        }
+    }
+    return nullptr;
+}
+
+void loadGongPrograms() {
+    // Again on every change to the "programs" section; a program running is stopped first
+    GongProgramSettings settings;
+    loadConfigSection(CONFIG_SECTION_PROGRAMS, &settings, sizeof(settings), parseGongProgramSettings);
+    stopGongProgram();
+    sequencerPrepared = -1;
+    gongProgramCount = 0;
+    
+    // Kept whatever the card holds: at boot the catalog may not be confirmed yet
+    for (uint8_t i = 0; i < settings.count; i++) {
+        const GongProgram& program = settings.programs[i];
+        if (!setGongProgram(program.name, program.steps, program.stepCount)) {
+            LOG_WARN(LOG_MODULE_PROGRAM, "Gong program %s ignored", program.name);
+        }
+    }
+    LOG_INFO(LOG_MODULE_PROGRAM, "Loaded %d gong programs from gong.conf", gongProgramCount);
+}
+
+void setupGongPrograms() {
+    loadGongPrograms();
+}
+
+bool setGongProgram(const char* name, const GongProgramStep* steps, uint8_t stepCount) {
+    if (!name || name[0] == '\0' || strlen(name) >= GONG_PROGRAM_NAME_LENGTH || stepCount == 0 ||
+        stepCount > MAX_GONG_PROGRAM_STEPS) {
+        return false;
+    }
+    for (uint8_t i = 0; i < stepCount; i++) {
+        if (steps[i].repeat == 0) {
+            return false;
+        }
+    }
+    
+    // Replace a program of the same name, or add it
+    GongProgram* program = (GongProgram*)findGongProgram(name);
+    if (!program) {
+        if (gongProgramCount >= MAX_GONG_PROGRAMS) {
+            return false;
+        }
+        program = &gongPrograms[gongProgramCount++];
+    }
+    
+    strncpy(program->name, name, GONG_PROGRAM_NAME_LENGTH - 1);
+    program->name[GONG_PROGRAM_NAME_LENGTH - 1] = '\0';
+    program->stepCount = stepCount;
+    memcpy(program->steps, steps, stepCount * sizeof(GongProgramStep));
+    return true;
+}
+
+int8_t findGongProgramIndex(const String& name) {
+    for (uint8_t i = 0; i < gongProgramCount; i++) {
+        if (name == gongPrograms[i].name) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const GongProgram* findGongProgram(const String& name) {
+    int8_t index = findGongProgramIndex(name);
+    return index >= 0 ? &gongPrograms[index] : nullptr;
+}
+
+const GongProgram* getGongProgram(uint8_t index) {
+    return index < gongProgramCount ? &gongPrograms[index] : nullptr;
+}
+
+const GongProgramStep* getFirstStrikeStep(const GongProgram& program) {
+    for (uint8_t i = 0; i < program.stepCount; i++) {
+        if (program.steps[i].track != 0) {
+            return &program.steps[i];
+        }
+    }
+    return nullptr;
+}
+
+bool hasGongProgramTracks(const String& name) {
+    // Against the card as the catalog knows it now, which a scan may still
+    // change. A program missing here may exist on other nodes.
+    const GongProgram* program = findGongProgram(name);
+    if (!program) {
+        return true;
+    }
+    for (uint8_t i = 0; i < program->stepCount; i++) {
+        if (program->steps[i].track != 0 && !isTrackAvailable(program->steps[i].track)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint16_t getGongProgramFirstTrack(const String& name) {
+    const GongProgram* program = findGongProgram(name);
+    const GongProgramStep* step = program ? getFirstStrikeStep(*program) : nullptr;
+    return step ? step->track : MP3_GONG_TRACK;
+}
+
+void prepareGongProgram(const String& name) {
+    // Set the first volume ahead of a timed start, so the first play frame
+    // does not queue behind it
+    const GongProgram* program = findGongProgram(name);
+    const GongProgramStep* step = program ? getFirstStrikeStep(*program) : nullptr;
+    if (!step || sequencerProgram >= 0 || sequencerPrepared >= 0 || step->volume == GONG_VOLUME_KEEP ||
+        step->volume == getMP3Status().volume) {
+        return;
+    }
+    sequencerPrepared = program - gongPrograms;
+    sequencerRestoreVolume = getMP3Status().volume;
+    setVolume(step->volume);
+}
+
+void finishGongProgram() {
+    if (sequencerVolumeChanged) {
+        setVolume(sequencerRestoreVolume);
+    }
+    sequencerProgram = -1;
+}
+
+bool startGongProgram(const String& name) {
+    const GongProgram* program = findGongProgram(name);
+    if (!program) {
+        LOG_WARN(LOG_MODULE_PROGRAM, "Unknown gong program: %s", name.c_str());
+        return false;
+    }
+    if (!hasGongProgramTracks(name)) {
+        LOG_WARN(LOG_MODULE_PROGRAM, "Gong program %s uses tracks not on the card", program->name);
+        return false;
+    }
+    if (sequencerProgram >= 0) {
+        gongProgramStats.aborted++;
+        finishGongProgram();
+    }
+    
+    sequencerProgram = program - gongPrograms;
+    sequencerStep = 0;
+    sequencerStrike = 0;
+    sequencerNextAt = millis();
+    sequencerWaitForEnd = false;
+    sequencerVolumeChanged = sequencerPrepared >= 0;
+    if (!sequencerVolumeChanged) {
+        sequencerRestoreVolume = getMP3Status().volume;
+    }
+    sequencerPrepared = -1;
+    gongProgramStats.runs++;
+    LOG_INFO(LOG_MODULE_PROGRAM, "Gong program %s started", program->name);
+    
+    // First strike without waiting for the next loop
+    loopGongProgram();
+    return true;
+}
+
+void stopGongProgram() {
+    if (sequencerProgram < 0) {
+        return;
+    }
+    gongProgramStats.aborted++;
+    stopPlayback();
+    finishGongProgram();
+    LOG_INFO(LOG_MODULE_PROGRAM, "Gong program stopped");
+}
+
+void fadeOutGongProgram(uint32_t durationMs) {
+    // No further strikes; the one ringing fades out, and the volume from
+    // before the program comes back after it
+    if (sequencerProgram < 0) {
+        fadeOutPlayback(durationMs);
+        return;
+    }
+    if (!isPlaying()) {
+        stopGongProgram();
+        return;
+    }
+    gongProgramStats.aborted++;
+    int16_t restore = sequencerVolumeChanged ? sequencerRestoreVolume : MP3_KEEP_VOLUME;
+    sequencerProgram = -1;
+    fadeOutPlayback(durationMs, restore);
+    LOG_INFO(LOG_MODULE_PROGRAM, "Gong program fading out");
+}
+
+bool isGongProgramRunning() {
+    return sequencerProgram >= 0;
+}
+
+const GongProgramStats& getGongProgramStats() {
+    return gongProgramStats;
+}
+
+void loopGongProgram() {
+    if (sequencerProgram < 0) {
+        return;
+    }
+    const GongProgram& program = gongPrograms[sequencerProgram];
+    
+    // A strike with interval 0 goes out once the one before has ended
+    if (sequencerWaitForEnd) {
+        if (isPlaying()) {
+            return;
+        }
+        sequencerWaitForEnd = false;
+        sequencerNextAt = millis();
+    }
+    
+    // Done once the last strike has rung out
+    if (sequencerStep >= program.stepCount) {
+        if (isPlaying()) {
+            return;
+        }
+        gongProgramStats.completed++;
+        LOG_INFO(LOG_MODULE_PROGRAM, "Gong program %s finished", program.name);
+        finishGongProgram();
+        return;
+    }
+    
+    long late = millis() - sequencerNextAt;
+    if (late < 0) {
+        return;
+    }
+    
+    // After a stall, carry on from now instead of catching up with a burst of strikes
+    if (late > GONG_PROGRAM_MAX_LATE) {
+        sequencerNextAt = millis();
+    }
+    
+    const GongProgramStep& step = program.steps[sequencerStep];
+    if (step.track == 0) {
+        sequencerNextAt += step.interval;
+        sequencerStep++;
+        return;
+    }
+    
+    if (sequencerStrike == 0 && step.volume != GONG_VOLUME_KEEP && step.volume != getMP3Status().volume) {
+        setVolume(step.volume);
+        sequencerVolumeChanged = true;
+    }
+    playTrack(step.track);
+    gongProgramStats.strikes++;
+    gongProgramStats.maxLateMs = max(gongProgramStats.maxLateMs, (uint32_t)late);
+    
+    if (++sequencerStrike >= step.repeat) {
+        sequencerStep++;
+        sequencerStrike = 0;
+    }
+    if (step.interval == 0) {
+        sequencerWaitForEnd = true;
+    } else {
+        sequencerNextAt += step.interval;
+    }
+}
+
+String getGongProgramsJSON() {
+    DynamicJsonDocument doc(4096);
+    doc["running"] = sequencerProgram >= 0 ? gongPrograms[sequencerProgram].name : "";
+    if (sequencerProgram >= 0) {
+        doc["step"] = sequencerStep;
+        doc["strike"] = sequencerStrike;
+    }
+    
+    JsonObject programs = doc.createNestedObject("programs");
+    for (uint8_t i = 0; i < gongProgramCount; i++) {
+        if (!hasGongProgramTracks(gongPrograms[i].name)) {
+            doc["missing_tracks"].add(gongPrograms[i].name);
+        }
+        JsonArray steps = programs.createNestedArray(gongPrograms[i].name);
+        for (uint8_t j = 0; j < gongPrograms[i].stepCount; j++) {
+            const GongProgramStep& step = gongPrograms[i].steps[j];
+            JsonObject item = steps.createNestedObject();
+            if (step.track == 0) {
+                item["pause"] = step.interval;
+                continue;
+            }
+            item["track"] = step.track;
+            if (step.volume != GONG_VOLUME_KEEP) {
+                item["volume"] = step.volume;
+            }
+            item["repeat"] = step.repeat;
+            item["interval"] = step.interval;
+        }
+    }
+    
+    JsonObject stats = doc.createNestedObject("stats");
+    stats["runs"] = gongProgramStats.runs;
+    stats["completed"] = gongProgramStats.completed;
+    stats["aborted"] = gongProgramStats.aborted;
+    stats["strikes"] = gongProgramStats.strikes;
+    stats["max_late_ms"] = gongProgramStats.maxLateMs;
+    
+    String result;
+    serializeJson(doc, result);
+    return result;
+}
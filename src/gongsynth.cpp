@@ -0,0 +1,433 @@
+#include "gongsynth.h"
+#include "configstore.h"
+#include "logger.h"
+#include <ArduinoJson.h>
+#include <driver/i2s.h>
+
+#define GONG_SYNTH_TABLE_SIZE (1 << GONG_SYNTH_TABLE_BITS)
+#define GONG_SYNTH_ONE (1L << 30)             // Envelope full scale, Q30
+#define GONG_SYNTH_SILENT (1L << 15)          // Below this an envelope no longer reaches the output (-90 dB)
+#define GONG_SYNTH_LN_MILLI -6.9077553f       // ln(0.001): -60 dB
+
+// A partial as rendered: everything the sample loop needs, worked out once
+// from the patch
+struct GongSynthModeQ {
+    uint32_t step;          // Phase increment per sample
+    int32_t level;          // Q30 at full velocity
+    int32_t blockDecay;     // Q30 envelope factor per GONG_SYNTH_BLOCK
+};
+
+struct GongSynthVoice {
+    bool active;
+    uint32_t phase[GONG_SYNTH_MAX_MODES];
+    int32_t env[GONG_SYNTH_MAX_MODES];      // Q30
+    int32_t delta[GONG_SYNTH_MAX_MODES];    // Per sample within the block
+    int32_t noiseEnv;
+    int32_t noiseDelta;
+    int32_t noiseLowPass;
+    uint32_t noiseState;
+};
+
+const GongSynthPatch defaultGongSynthPatch = {
+    110.0f, 0.8f, 0.15f, 60.0f, 8,
+    {
+        {1.00f, 1.00f, 8.0f},
+        {1.52f, 0.70f, 6.5f},
+        {2.00f, 0.55f, 5.0f},
+        {2.48f, 0.45f, 4.0f},
+        {2.90f, 0.35f, 3.2f},
+        {3.55f, 0.25f, 2.5f},
+        {4.20f, 0.18f, 2.0f},
+        {5.10f, 0.12f, 1.5f},
+    },
+};
+
+// "synth" section of gong.conf
+struct GongSynthSettings {
+    bool enabled;
+    GongSynthPatch patch;
+};
+
+GongSynthPatch gongSynthPatch;
+GongSynthModeQ gongSynthModes[GONG_SYNTH_MAX_MODES];
+uint8_t gongSynthModeCount = 0;
+int32_t gongSynthNoiseLevel = 0;
+int32_t gongSynthNoiseDecay = 0;
+int16_t gongSynthSine[GONG_SYNTH_TABLE_SIZE];
+bool gongSynthTableReady = false;
+
+GongSynthVoice gongSynthVoices[GONG_SYNTH_VOICES];
+uint8_t gongSynthBlockLeft = 0;     // Samples until the envelopes take their next step
+GongSynthStats gongSynthStats = {};
+
+// I2S output; a rendered buffer the DMA ring had no room for goes out on the next loop
+bool gongSynthEnabled = false;
+bool gongSynthOutputReady = false;          // Driver installed
+int16_t gongSynthBuffer[GONG_SYNTH_DMA_FRAMES];
+size_t gongSynthPending = 0;
+size_t gongSynthPendingOffset = 0;
+
+void buildGongSynthTable() {
+    for (uint16_t i = 0; i < GONG_SYNTH_TABLE_SIZE; i++) {
+        gongSynthSine[i] = lroundf(32767.0f * sinf(2.0f * PI * i / GONG_SYNTH_TABLE_SIZE));
+    }
+    gongSynthTableReady = true;
+}
+
+int32_t getGongSynthBlockDecay(float secondsTo60dB) {
+    // Envelope factor per block for a decay to -60 dB in the given time
+    float samples = max(secondsTo60dB, 0.001f) * GONG_SYNTH_RATE;
+    return expf(GONG_SYNTH_LN_MILLI * GONG_SYNTH_BLOCK / samples) * GONG_SYNTH_ONE;
+}
+
+bool isGongSynthPatchValid(const GongSynthPatch& patch) {
+    if (patch.modeCount == 0 || patch.modeCount > GONG_SYNTH_MAX_MODES || patch.fundamental <= 0 ||
+        patch.volume < 0 || patch.volume > 1 || patch.noise < 0) {
+        return false;
+    }
+    float total = patch.noise;
+    for (uint8_t i = 0; i < patch.modeCount; i++) {
+        total += max(patch.modes[i].level, 0.0f);
+    }
+    return total > 0;
+}
+
+bool setGongSynthPatch(const GongSynthPatch& patch) {
+    if (!isGongSynthPatchValid(patch)) {
+        return false;
+    }
+    if (!gongSynthTableReady) {
+        buildGongSynthTable();
+    }
+    
+    // Levels are shares of one strike's peak, so any patch stays in range
+    float total = patch.noise;
+    for (uint8_t i = 0; i < patch.modeCount; i++) {
+        total += max(patch.modes[i].level, 0.0f);
+    }
+    float scale = patch.volume / total * (GONG_SYNTH_ONE - 1);
+    
+    gongSynthPatch = patch;
+    gongSynthModeCount = 0;
+    for (uint8_t i = 0; i < patch.modeCount; i++) {
+        const GongSynthMode& mode = patch.modes[i];
+        float frequency = patch.fundamental * mode.ratio;
+        if (frequency <= 0 || frequency >= GONG_SYNTH_RATE / 2 || mode.level <= 0) {
+            continue;
+        }
+        GongSynthModeQ& q = gongSynthModes[gongSynthModeCount++];
+        q.step = frequency / GONG_SYNTH_RATE * 4294967296.0;
+        q.level = mode.level * scale;
+        q.blockDecay = getGongSynthBlockDecay(mode.decay);
+    }
+    gongSynthNoiseLevel = patch.noise * scale;
+    gongSynthNoiseDecay = getGongSynthBlockDecay(patch.noiseDecay / 1000.0f);
+    return true;
+}
+
+const GongSynthPatch& getGongSynthPatch() {
+    return gongSynthPatch;
+}
+
+const char* parseGongSynthSettings(JsonVariantConst json, void* settings) {
+    GongSynthSettings& synth = *(GongSynthSettings*)settings;
+    GongSynthPatch& patch = synth.patch;
+    patch = defaultGongSynthPatch;
+    synth.enabled = json["enabled"] | false;
+    patch.fundamental = json["fundamental"] | patch.fundamental;
+    patch.volume = json["volume"] | patch.volume;
+    patch.noise = json["noise"] | patch.noise;
+    patch.noiseDecay = json["noise_decay"] | patch.noiseDecay;
+    if (!json["modes"].isNull()) {
+        JsonArrayConst modes = json["modes"].as<JsonArrayConst>();
+        if (modes.size() > GONG_SYNTH_MAX_MODES) {
+            return "8 modes at most";
+        }
+        patch.modeCount = 0;
+        for (JsonObjectConst item : modes) {
+            GongSynthMode& mode = patch.modes[patch.modeCount++];
+            mode.ratio = item["ratio"] | 1.0f;
+            mode.level = item["level"] | 1.0f;
+            mode.decay = item["decay"] | 4.0f;
+        }
+    }
+    
+    if (!isGongSynthPatchValid(patch)) {
+        return "patch needs a fundamental, a volume of 0-1 and a level above 0";
+    }
+    return nullptr;
+}
+
+void loadGongSynthConfig() {
+    // Again on every change to the "synth" section; the I2S driver, once installed, stays
+    GongSynthSettings settings;
+    loadConfigSection(CONFIG_SECTION_SYNTH, &settings, sizeof(settings), parseGongSynthSettings);
+    setGongSynthPatch(settings.patch);
+    if (settings.enabled && !gongSynthOutputReady) {
+        startGongSynthOutput();
+    } else {
+        gongSynthEnabled = settings.enabled && gongSynthOutputReady;
+    }
+}
+
+void setupGongSynth() {
+    loadGongSynthConfig();
+}
+
+bool startGongSynthOutput() {
+    i2s_config_t config = {};
+    config.mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_TX);
+    config.sample_rate = GONG_SYNTH_RATE;
+    config.bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT;
+    config.channel_format = I2S_CHANNEL_FMT_ONLY_LEFT;
+    config.communication_format = I2S_COMM_FORMAT_STAND_I2S;
+    config.intr_alloc_flags = 0;
+    config.dma_buf_count = GONG_SYNTH_DMA_BUFFERS;
+    config.dma_buf_len = GONG_SYNTH_DMA_FRAMES;
+    config.use_apll = false;
+    config.tx_desc_auto_clear = true;       // Silence when the ring runs dry
+    
+    i2s_pin_config_t pins = {};
+    pins.bck_io_num = GONG_SYNTH_BCK_PIN;
+    pins.ws_io_num = GONG_SYNTH_WS_PIN;
+    pins.data_out_num = GONG_SYNTH_DATA_PIN;
+    pins.data_in_num = I2S_PIN_NO_CHANGE;
+    
+    if (i2s_driver_install(I2S_NUM_0, &config, 0, nullptr) != ESP_OK ||
+        i2s_set_pin(I2S_NUM_0, &pins) != ESP_OK) {
+        LOG_ERROR(LOG_MODULE_SYNTH, "I2S initialization failed, gong synthesizer disabled");
+        gongSynthEnabled = false;
+        return false;
+    }
+    i2s_zero_dma_buffer(I2S_NUM_0);
+    gongSynthOutputReady = true;
+    gongSynthEnabled = true;
+    LOG_INFO(LOG_MODULE_SYNTH, "Gong synthesizer initialized: %d partials at %.1f Hz", gongSynthModeCount,
+             gongSynthPatch.fundamental);
+    return true;
+}
+
+bool isGongSynthEnabled() {
+    return gongSynthEnabled;
+}
+
+int32_t getGongSynthVoiceLevel(const GongSynthVoice& voice) {
+    int32_t level = voice.noiseEnv >> 4;
+    for (uint8_t i = 0; i < gongSynthModeCount; i++) {
+        level += voice.env[i] >> 4;
+    }
+    return level;
+}
+
+void strikeGongSynth(uint8_t velocity) {
+    if (!gongSynthTableReady) {
+        setGongSynthPatch(defaultGongSynthPatch);
+    }
+    
+    // A free voice, or the one that has rung out furthest
+    GongSynthVoice* voice = nullptr;
+    for (uint8_t i = 0; i < GONG_SYNTH_VOICES && !voice; i++) {
+        if (!gongSynthVoices[i].active) {
+            voice = &gongSynthVoices[i];
+        }
+    }
+    if (!voice) {
+        voice = &gongSynthVoices[0];
+        for (uint8_t i = 1; i < GONG_SYNTH_VOICES; i++) {
+            if (getGongSynthVoiceLevel(gongSynthVoices[i]) < getGongSynthVoiceLevel(*voice)) {
+                voice = &gongSynthVoices[i];
+            }
+        }
+        gongSynthStats.stolen++;
+    }
+    
+    // Partials start in sine phase so the strike begins at zero; the
+    // envelopes hold until the block in progress ends
+    memset(voice, 0, sizeof(GongSynthVoice));
+    voice->active = true;
+    for (uint8_t i = 0; i < gongSynthModeCount; i++) {
+        voice->env[i] = (int64_t)gongSynthModes[i].level * velocity / GONG_SYNTH_FULL_VELOCITY;
+    }
+    voice->noiseEnv = (int64_t)gongSynthNoiseLevel * velocity / GONG_SYNTH_FULL_VELOCITY;
+    voice->noiseState = 0x9E3779B9;
+    gongSynthStats.strikes++;
+    
+    // Into the DMA ring now rather than on the next loop
+    loopGongSynth();
+}
+
+void playGongSynth() {
+    strikeGongSynth(GONG_SYNTH_FULL_VELOCITY);
+}
+
+void stopGongSynth() {
+    memset(gongSynthVoices, 0, sizeof(gongSynthVoices));
+    gongSynthBlockLeft = 0;
+    gongSynthPending = 0;
+    if (gongSynthEnabled) {
+        i2s_zero_dma_buffer(I2S_NUM_0);
+    }
+}
+
+bool isGongSynthPlaying() {
+    return getGongSynthVoices() > 0 || gongSynthPending > 0;
+}
+
+uint8_t getGongSynthVoices() {
+    uint8_t active = 0;
+    for (uint8_t i = 0; i < GONG_SYNTH_VOICES; i++) {
+        active += gongSynthVoices[i].active;
+    }
+    return active;
+}
+
+void startGongSynthBlock() {
+    // Next envelope step for every voice; a voice all of whose partials
+    // have dropped below the output resolution is free again
+    for (uint8_t v = 0; v < GONG_SYNTH_VOICES; v++) {
+        GongSynthVoice& voice = gongSynthVoices[v];
+        if (!voice.active) {
+            continue;
+        }
+        bool audible = voice.noiseEnv >= GONG_SYNTH_SILENT;
+        for (uint8_t i = 0; i < gongSynthModeCount; i++) {
+            int32_t target = ((int64_t)voice.env[i] * gongSynthModes[i].blockDecay) >> 30;
+            voice.delta[i] = (target - voice.env[i]) / GONG_SYNTH_BLOCK;
+            audible = audible || voice.env[i] >= GONG_SYNTH_SILENT;
+        }
+        int32_t target = ((int64_t)voice.noiseEnv * gongSynthNoiseDecay) >> 30;
+        voice.noiseDelta = (target - voice.noiseEnv) / GONG_SYNTH_BLOCK;
+        voice.active = audible;
+    }
+}
+
+void renderGongSynthVoice(GongSynthVoice& voice, int32_t* mix, uint8_t frames) {
+    for (uint8_t i = 0; i < gongSynthModeCount; i++) {
+        uint32_t phase = voice.phase[i];
+        uint32_t step = gongSynthModes[i].step;
+        int32_t env = voice.env[i];
+        int32_t delta = voice.delta[i];
+        for (uint8_t n = 0; n < frames; n++) {
+            mix[n] += (gongSynthSine[phase >> (32 - GONG_SYNTH_TABLE_BITS)] * (env >> 15)) >> 15;
+            phase += step;
+            env += delta;
+        }
+        voice.phase[i] = phase;
+        voice.env[i] = env;
+    }
+    
+    // Strike transient: xorshift noise through a one-pole low-pass
+    if (voice.noiseEnv < GONG_SYNTH_SILENT) {
+        return;
+    }
+    uint32_t state = voice.noiseState;
+    int32_t lowPass = voice.noiseLowPass;
+    int32_t env = voice.noiseEnv;
+    for (uint8_t n = 0; n < frames; n++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        int32_t noise = ((int16_t)(state >> 16) * (env >> 15)) >> 15;
+        lowPass += (noise - lowPass) >> 2;
+        mix[n] += lowPass;
+        env += voice.noiseDelta;
+    }
+    voice.noiseState = state;
+    voice.noiseLowPass = lowPass;
+    voice.noiseEnv = env;
+}
+
+void renderGongSynth(int16_t* out, size_t frames) {
+    int32_t mix[GONG_SYNTH_BLOCK];
+    while (frames > 0) {
+        if (gongSynthBlockLeft == 0) {
+            startGongSynthBlock();
+            gongSynthBlockLeft = GONG_SYNTH_BLOCK;
+        }
+        uint8_t count = min(frames, (size_t)gongSynthBlockLeft);
+        memset(mix, 0, count * sizeof(int32_t));
+        for (uint8_t v = 0; v < GONG_SYNTH_VOICES; v++) {
+            if (gongSynthVoices[v].active) {
+                renderGongSynthVoice(gongSynthVoices[v], mix, count);
+            }
+        }
+        
+        // Overlapping strikes can add up past full scale: saturate, never wrap
+        for (uint8_t n = 0; n < count; n++) {
+            out[n] = constrain(mix[n], -32768, 32767);
+        }
+        out += count;
+        frames -= count;
+        gongSynthBlockLeft -= count;
+    }
+}
+
+void loopGongSynth() {
+    if (!gongSynthEnabled) {
+        return;
+    }
+    
+    // Keep the DMA ring full while a gong rings; once it has rung out the
+    // ring runs dry and plays silence without further writes
+    while (true) {
+        if (gongSynthPending == 0) {
+            if (getGongSynthVoices() == 0) {
+                return;
+            }
+            unsigned long start = micros();
+            renderGongSynth(gongSynthBuffer, GONG_SYNTH_DMA_FRAMES);
+            uint32_t elapsed = micros() - start;
+            gongSynthStats.samples += GONG_SYNTH_DMA_FRAMES;
+            gongSynthStats.renderUs += elapsed;
+            gongSynthStats.maxRenderUs = max(gongSynthStats.maxRenderUs, elapsed);
+            gongSynthPending = GONG_SYNTH_DMA_FRAMES;
+            gongSynthPendingOffset = 0;
+        }
+        
+        size_t written = 0;
+        i2s_write(I2S_NUM_0, gongSynthBuffer + gongSynthPendingOffset, gongSynthPending * sizeof(int16_t), &written, 0);
+        gongSynthPendingOffset += written / sizeof(int16_t);
+        gongSynthPending -= written / sizeof(int16_t);
+        if (gongSynthPending > 0) {
+            return;
+        }
+    }
+}
+
+const GongSynthStats& getGongSynthStats() {
+    return gongSynthStats;
+}
+
+String getGongSynthJSON() {
+    DynamicJsonDocument doc(2048);
+    doc["enabled"] = gongSynthEnabled;
+    doc["playing"] = isGongSynthPlaying();
+    doc["voices"] = getGongSynthVoices();
+    doc["sample_rate"] = GONG_SYNTH_RATE;
+    
+    JsonObject patch = doc.createNestedObject("patch");
+    patch["fundamental"] = gongSynthPatch.fundamental;
+    patch["volume"] = gongSynthPatch.volume;
+    patch["noise"] = gongSynthPatch.noise;
+    patch["noise_decay"] = gongSynthPatch.noiseDecay;
+    JsonArray modes = patch.createNestedArray("modes");
+    for (uint8_t i = 0; i < gongSynthPatch.modeCount; i++) {
+        JsonObject mode = modes.createNestedObject();
+        mode["ratio"] = gongSynthPatch.modes[i].ratio;
+        mode["level"] = gongSynthPatch.modes[i].level;
+        mode["decay"] = gongSynthPatch.modes[i].decay;
+    }
+    
+    // Load: render time over the audio it produced
+    JsonObject stats = doc.createNestedObject("stats");
+    stats["strikes"] = gongSynthStats.strikes;
+    stats["stolen"] = gongSynthStats.stolen;
+    stats["samples"] = gongSynthStats.samples;
+    stats["max_render_us"] = gongSynthStats.maxRenderUs;
+    stats["load_percent"] = gongSynthStats.samples ?
+        gongSynthStats.renderUs * 100.0f * GONG_SYNTH_RATE / 1000000.0f / gongSynthStats.samples : 0.0f;
+    
+    String result;
+    serializeJson(doc, result);
+    return result;
+}
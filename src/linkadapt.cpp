@@ -0,0 +1,355 @@
+#include "linkadapt.h"
+#include "lorahandler.h"
+#include "nodestatus.h"
+#include "logger.h"
+
+// Command state
+uint8_t adrSeq = 0;
+int adrLastSeqApplied = -1;
+unsigned long adrLastCommand = 0;
+unsigned long adrLastEval = 0;
+unsigned long adrLastStepDown = 0;
+unsigned long adrLastBeacon = 0;
+unsigned long adrConfirmDeadline = 0;   // Master: slaves must report the new SF by then
+uint64_t adrAliveMask = 0;              // Master: node table slots alive at the last evaluation
+
+// Scheduled profile switch (both roles)
+int adrPendingSf = 0;
+int adrPendingPower = 0;
+unsigned long adrSwitchAt = 0;
+
+// Transmit accounting for this node
+uint32_t linkFrames = 0;
+uint64_t linkAirtimeUs = 0;
+uint64_t linkRobustAirtimeUs = 0;
+float linkEnergyMj = 0;
+float linkRobustEnergyMj = 0;
+
+static_assert(MAX_NODES <= 64, "alive mask is 64 bits wide");
+
+void setupLinkAdapt() {
+    adrLastEval = millis();
+    adrLastStepDown = millis();
+    adrLastBeacon = millis();
+    
+    LOG_INFO(LOG_MODULE_ADR, "Link adaptation initialized");
+}
+
+float getTxCurrentMa(int txPower) {
+    // Approximate SX1276 supply current on PA_BOOST
+    static const int8_t levels[] = {2, 5, 8, 11, 14, 17, 20};
+    static const float currents[] = {28, 32, 38, 45, 55, 87, 120};
+    
+    if (txPower <= levels[0]) return currents[0];
+    for (uint8_t i = 1; i < sizeof(levels); i++) {
+        if (txPower <= levels[i]) {
+            float t = (float)(txPower - levels[i - 1]) / (levels[i] - levels[i - 1]);
+            return currents[i - 1] + t * (currents[i] - currents[i - 1]);
+        }
+    }
+    return currents[sizeof(levels) - 1];
+}
+
+void recordLinkTransmission(size_t frameLength, int spreadingFactor, int txPower) {
+    uint32_t airtimeUs = calculateLoRaAirtimeUs(frameLength, spreadingFactor);
+    uint32_t robustAirtimeUs = calculateLoRaAirtimeUs(frameLength, ADR_ROBUST_SF);
+    
+    linkFrames++;
+    linkAirtimeUs += airtimeUs;
+    linkRobustAirtimeUs += robustAirtimeUs;
+    
+    // ms * mA * V = uJ
+    linkEnergyMj += airtimeUs / 1000.0f * getTxCurrentMa(txPower) * ADR_SUPPLY_VOLTAGE / 1000.0f;
+    linkRobustEnergyMj += robustAirtimeUs / 1000.0f * getTxCurrentMa(LORA_TX_POWER) * ADR_SUPPLY_VOLTAGE / 1000.0f;
+}
+
+float getLinkEnergySavedMj() {
+    return linkRobustEnergyMj - linkEnergyMj;
+}
+
+float getLinkAirtimeSavedMs() {
+    return ((int64_t)linkRobustAirtimeUs - (int64_t)linkAirtimeUs) / 1000.0f;
+}
+
+void scheduleProfileSwitch(int spreadingFactor, int txPower) {
+    adrPendingSf = spreadingFactor;
+    adrPendingPower = txPower;
+    adrSwitchAt = millis() + ADR_SWITCH_DELAY;
+}
+
+void sendAdrCommand(int spreadingFactor, const String& adjustments, int txSpreadingFactor, int txPower) {
+    char header[16];
+    snprintf(header, sizeof(header), "%c%02X,%d;", STATUS_OP_ADR, adrSeq, spreadingFactor);
+    sendLoRaMessageAt(String(header) + adjustments, MSG_TYPE_STATUS, txSpreadingFactor, txPower);
+}
+
+void sendAdrCommand(int spreadingFactor, const String& adjustments) {
+    // Pinned to the current profile: the switch may happen while the frame is still queued
+    sendAdrCommand(spreadingFactor, adjustments, getLoRaSpreadingFactor(), getLoRaTxPower());
+}
+
+// ---- Master side ----
+
+void fallBackToRobust(const char* reason) {
+    LOG_WARN(LOG_MODULE_ADR, "ADR fallback to SF%d: %s", ADR_ROBUST_SF, reason);
+    
+    adrSeq++;
+    adrLastCommand = millis();
+    adrConfirmDeadline = 0;
+    adrLastStepDown = millis();
+    sendAdrCommand(ADR_ROBUST_SF, "");
+    scheduleProfileSwitch(ADR_ROBUST_SF, LORA_TX_POWER);
+}
+
+bool isLinkTrusted(const NodeInfo& node) {
+    return isNodeAlive(node) && node.heartbeats >= ADR_MIN_HEARTBEATS && node.spreadingFactor != 0;
+}
+
+bool checkLinkSafety() {
+    int currentSf = getLoRaSpreadingFactor();
+    uint64_t aliveMask = 0;
+    bool unconfirmed = false;
+    
+    for (uint8_t i = 0; i < getNodeCount(); i++) {
+        const NodeInfo* node = getNode(i);
+        if (isNodeAlive(*node)) {
+            aliveMask |= 1ULL << i;
+            if (node->spreadingFactor != currentSf) {
+                unconfirmed = true;
+            }
+        }
+    }
+    
+    uint64_t lost = adrAliveMask & ~aliveMask;
+    adrAliveMask = aliveMask;
+    
+    if (currentSf >= ADR_ROBUST_SF) {
+        adrConfirmDeadline = 0;
+        return true;
+    }
+    
+    if (lost) {
+        fallBackToRobust("node lost");
+        return false;
+    }
+    
+    if (adrConfirmDeadline && (long)(millis() - adrConfirmDeadline) >= 0) {
+        adrConfirmDeadline = 0;
+        if (unconfirmed) {
+            fallBackToRobust("SF change not confirmed");
+            return false;
+        }
+    }
+    return true;
+}
+
+void evaluateLinks() {
+    int currentSf = getLoRaSpreadingFactor();
+    int requiredSf = ADR_MIN_SF;
+    bool anyLink = false;
+    
+    // Network SF: every link must keep its margin with both ends at full power
+    for (uint8_t i = 0; i < getNodeCount(); i++) {
+        const NodeInfo& node = *getNode(i);
+        if (!isLinkTrusted(node)) continue;
+        
+        float linkSnr = node.snrAverage + (LORA_TX_POWER - node.txPower);
+        if (node.reportedRssi != 0) {
+            linkSnr = min(linkSnr, node.reportedSnr + (LORA_TX_POWER - getLoRaTxPower()));
+        }
+        
+        int sf = ADR_MIN_SF;
+        while (sf < ADR_MAX_SF && linkSnr - getLoRaSnrFloor(sf) < ADR_TARGET_MARGIN) {
+            sf++;
+        }
+        requiredSf = max(requiredSf, sf);
+        anyLink = true;
+    }
+    
+    if (!anyLink) {
+        return;
+    }
+    
+    int targetSf = requiredSf;
+    if (targetSf < currentSf) {
+        // Speed up one step at a time, and only once the last change has settled
+        bool settled = !adrConfirmDeadline && millis() - adrLastStepDown >= ADR_STEP_DOWN_HOLD;
+        targetSf = settled ? currentSf - 1 : currentSf;
+    }
+    
+    // Per-node power trims at the target SF
+    float floorDb = getLoRaSnrFloor(targetSf);
+    float masterExcess = 100;
+    String adjustments;
+    uint8_t adjustmentCount = 0;
+    
+    for (uint8_t i = 0; i < getNodeCount(); i++) {
+        const NodeInfo& node = *getNode(i);
+        if (!isLinkTrusted(node)) continue;
+        
+        // A node that has not heard us yet gets no master power trim
+        float downlinkExcess = node.reportedRssi != 0 ? node.reportedSnr - floorDb - ADR_TARGET_MARGIN : 0;
+        masterExcess = min(masterExcess, downlinkExcess);
+        
+        // Slaves restart from full power on a slower SF; reported power is stale
+        // until a heartbeat arrives after the last command
+        bool stale = (long)(node.lastSeen - adrLastCommand) < 0;
+        if (targetSf > currentSf || stale || adjustmentCount >= ADR_MAX_ADJUSTMENTS) continue;
+        
+        float excess = node.snrAverage - floorDb - ADR_TARGET_MARGIN;
+        int power = constrain(node.txPower - (int)floorf(excess), ADR_MIN_TX_POWER, LORA_TX_POWER);
+        int delta = power - node.txPower;
+        
+        // Raise right away, lower only with headroom to spare
+        if (delta > 0 || delta <= -ADR_POWER_HYSTERESIS) {
+            char item[16];
+            snprintf(item, sizeof(item), "%s%04X:%d", adjustmentCount ? "," : "", node.id, delta);
+            adjustments += item;
+            adjustmentCount++;
+        }
+    }
+    
+    int masterPower = getLoRaTxPower();
+    int wantedPower = constrain(masterPower - (int)floorf(masterExcess), ADR_MIN_TX_POWER, LORA_TX_POWER);
+    if (wantedPower > masterPower || wantedPower - masterPower <= -ADR_POWER_HYSTERESIS) {
+        masterPower = wantedPower;
+    }
+    
+    if (targetSf == currentSf && adjustmentCount == 0) {
+        setLoRaProfile(currentSf, masterPower);
+        return;
+    }
+    
+    adrSeq++;
+    adrLastCommand = millis();
+    sendAdrCommand(targetSf, adjustments);
+    
+    if (targetSf != currentSf) {
+        LOG_INFO(LOG_MODULE_ADR, "ADR: network SF%d -> SF%d", currentSf, targetSf);
+        scheduleProfileSwitch(targetSf, targetSf > currentSf ? LORA_TX_POWER : masterPower);
+        adrConfirmDeadline = millis() + ADR_SWITCH_DELAY + ADR_CONFIRM_TIMEOUT;
+        if (targetSf < currentSf) {
+            adrLastStepDown = millis();
+        }
+    } else {
+        setLoRaProfile(currentSf, masterPower);
+    }
+}
+
+void sendRendezvousBeacons() {
+    // Lost nodes sit on the robust profile, freshly booted ones on the default
+    int currentSf = getLoRaSpreadingFactor();
+    const int rendezvous[] = {ADR_ROBUST_SF, LORA_SPREADING_FACTOR};
+    
+    for (int sf : rendezvous) {
+        if (sf == currentSf) continue;
+        sendAdrCommand(currentSf, "", sf, LORA_TX_POWER);
+    }
+}
+
+void loopMasterLinkAdapt() {
+    if (millis() - adrLastEval >= ADR_EVAL_INTERVAL) {
+        adrLastEval = millis();
+        if (checkLinkSafety()) {
+            evaluateLinks();
+        }
+    }
+    
+    if (millis() - adrLastBeacon >= ADR_BEACON_INTERVAL) {
+        adrLastBeacon = millis();
+        sendRendezvousBeacons();
+    }
+}
+
+// ---- Slave side ----
+
+void handleLinkAdaptMessage(const char* body) {
+    noteMasterFrame();
+    if (isLoRaMaster()) {
+        return;
+    }
+    
+    unsigned int seq = 0;
+    int spreadingFactor = 0;
+    const char* list = strchr(body, ';');
+    if (!list || sscanf(body, "%x,%d", &seq, &spreadingFactor) != 2 ||
+        spreadingFactor < ADR_MIN_SF || spreadingFactor > ADR_MAX_SF) {
+        LOG_WARN(LOG_MODULE_ADR, "Invalid ADR command");
+        return;
+    }
+    
+    int currentSf = getLoRaSpreadingFactor();
+    int power = getLoRaTxPower();
+    
+    // Moving to a slower SF means links got worse: start again from full power
+    if (spreadingFactor > currentSf) {
+        power = LORA_TX_POWER;
+    }
+    
+    if ((int)seq != adrLastSeqApplied) {
+        adrLastSeqApplied = seq;
+        
+        char id[8];
+        snprintf(id, sizeof(id), "%04X:", getLoRaNodeId());
+        const char* mine = strstr(list, id);
+        if (mine) {
+            power = constrain(power + atoi(mine + strlen(id)), ADR_MIN_TX_POWER, LORA_TX_POWER);
+        }
+    }
+    
+    if (spreadingFactor != currentSf) {
+        LOG_INFO(LOG_MODULE_ADR, "ADR: switching to SF%d, %d dBm", spreadingFactor, power);
+        scheduleProfileSwitch(spreadingFactor, power);
+    } else if (power != getLoRaTxPower()) {
+        LOG_INFO(LOG_MODULE_ADR, "ADR: TX power %d dBm", power);
+        setLoRaProfile(currentSf, power);
+        requestHeartbeat(ADR_CONFIRM_JITTER);
+    }
+}
+
+void loopSlaveLinkAdapt() {
+    unsigned long masterLastHeard = getMasterLastHeard();
+    if (masterLastHeard == 0 || millis() - masterLastHeard < ADR_FALLBACK_TIMEOUT) {
+        return;
+    }
+    
+    // Master silent: meet it on the robust profile, at full power
+    int fallbackSf = max(getLoRaSpreadingFactor(), ADR_ROBUST_SF);
+    if (getLoRaSpreadingFactor() != fallbackSf || getLoRaTxPower() != LORA_TX_POWER) {
+        LOG_WARN(LOG_MODULE_ADR, "ADR: master silent, falling back to SF%d", fallbackSf);
+        adrSwitchAt = 0;
+        setLoRaProfile(fallbackSf, LORA_TX_POWER);
+    }
+}
+
+void loopLinkAdapt() {
+    if (adrSwitchAt && (long)(millis() - adrSwitchAt) >= 0) {
+        adrSwitchAt = 0;
+        setLoRaProfile(adrPendingSf, adrPendingPower);
+        if (!isLoRaMaster()) {
+            requestHeartbeat(ADR_CONFIRM_JITTER);
+        }
+    }
+    
+    if (isLoRaMaster()) {
+        loopMasterLinkAdapt();
+    } else {
+        loopSlaveLinkAdapt();
+    }
+}
+
+void addLinkAdaptJSON(JsonObject obj) {
+    obj["sf"] = getLoRaSpreadingFactor();
+    obj["tx_power"] = getLoRaTxPower();
+    obj["frames_sent"] = linkFrames;
+    obj["airtime_ms"] = (uint32_t)(linkAirtimeUs / 1000);
+    obj["robust_airtime_ms"] = (uint32_t)(linkRobustAirtimeUs / 1000);
+    obj["airtime_saved_ms"] = getLinkAirtimeSavedMs();
+    obj["energy_mj"] = linkEnergyMj;
+    obj["robust_energy_mj"] = linkRobustEnergyMj;
+    obj["energy_saved_mj"] = getLinkEnergySavedMj();
+    if (isLoRaMaster()) {
+        obj["adr_seq"] = adrSeq;
+        obj["adr_confirm_pending"] = adrConfirmDeadline != 0;
+    }
+}
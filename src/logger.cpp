@@ -0,0 +1,416 @@
+#include "logger.h"
+#include "configstore.h"
+#include <ArduinoJson.h>
+#include <esp_ota_ops.h>
+
+#define LOG_RING_MASK (LOG_RING_RECORDS - 1)
+#define LOG_RESET_REASONS 11
+
+static_assert((LOG_RING_RECORDS & LOG_RING_MASK) == 0, "LOG_RING_RECORDS is a power of 2");
+static_assert(LOG_MAX_ARGS <= LOG_PAYLOAD_WORDS, "arguments fit a record");
+
+// "log" section of gong.conf
+struct LogSettings {
+    uint8_t levels[LOG_MODULES];
+};
+
+// The ring and what identifies it; not cleared at reset
+struct LogRegion {
+    uint32_t magic;
+    uint32_t firmwareId;
+    std::atomic<uint32_t> head;     // Next position to claim, by any writer
+    LogRecord records[LOG_RING_RECORDS];
+};
+
+__NOINIT_ATTR LogRegion logRegion;
+uint8_t logLevels[LOG_MODULES];
+uint32_t logTail = 0;               // Next position to print, by the printing task only
+char logPendingLine[LOG_LINE_LENGTH];
+size_t logPendingLength = 0;        // Formatted, waiting for room in the UART buffer
+LogEntry logKept[LOG_KEPT_RECORDS];
+LogStats logStats;
+
+const char* const logModuleNames[LOG_MODULES] = {
+    "main", "tasks", "events", "web", "lora", "auth", "ota", "capture", "adr", "sync", "nodes", "power", "mp3",
+    "catalog", "program", "synth", "schedule", "profile"
+};
+
+const char* const logLevelNames[LOG_LEVELS] = {"none", "error", "warn", "info", "debug"};
+const char logLevelLetters[LOG_LEVELS] = {'-', 'E', 'W', 'I', 'D'};
+
+// As esp_reset_reason_t
+const char* const logResetReasons[LOG_RESET_REASONS] = {
+    "unknown", "power-on", "external", "software", "panic", "interrupt watchdog", "task watchdog", "watchdog",
+    "deep sleep", "brownout", "SDIO"
+};
+
+uint32_t getLogFirmwareId() {
+    // Another build has its format strings elsewhere, so its records cannot be read
+    uint32_t id;
+    memcpy(&id, esp_ota_get_app_description()->app_elf_sha256, sizeof(id));
+    return id;
+}
+
+bool readLogRecord(uint32_t position, LogEntry& entry) {
+    // A copy torn by a writer changes the sequence in between
+    const LogRecord& record = logRegion.records[position & LOG_RING_MASK];
+    if (record.sequence.load(std::memory_order_acquire) != position + 1) {
+        return false;
+    }
+    entry = record.entry;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return record.sequence.load(std::memory_order_relaxed) == position + 1;
+}
+
+bool isLogRecordSkipped(uint32_t position) {
+    // Its writer gave up on the slot, so it will never be published
+    const LogRecord& record = logRegion.records[position & LOG_RING_MASK];
+    return record.skipped.load(std::memory_order_acquire) == position + 1;
+}
+
+bool isLogEntryValid(const LogEntry& entry) {
+    return entry.format && entry.module < LOG_MODULES && entry.level > LOG_LEVEL_NONE && entry.level < LOG_LEVELS &&
+           entry.argCount <= LOG_MAX_ARGS &&
+           entry.textBytes <= (LOG_PAYLOAD_WORDS - entry.argCount) * sizeof(uint32_t);
+}
+
+int findLogModule(const String& name) {
+    for (uint8_t i = 0; i < LOG_MODULES; i++) {
+        if (name == logModuleNames[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int findLogLevel(const String& name) {
+    for (uint8_t i = 0; i < LOG_LEVELS; i++) {
+        if (name == logLevelNames[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool setLogLevel(const String& module, const String& level) {
+    int moduleIndex = findLogModule(module);
+    int levelIndex = findLogLevel(level);
+    if (moduleIndex < 0 || levelIndex < 0) {
+        return false;
+    }
+    logLevels[moduleIndex] = levelIndex;
+    return true;
+}
+
+const char* parseLogSettings(JsonVariantConst json, void* settings) {
+    LogSettings& log = *(LogSettings*)settings;
+    for (uint8_t i = 0; i < LOG_MODULES; i++) {
+        log.levels[i] = LOG_DEFAULT_LEVEL;
+    }
+    for (JsonPairConst item : json.as<JsonObjectConst>()) {
+        int module = findLogModule(item.key().c_str());
+        int level = findLogLevel(item.value() | "");
+        if (module < 0) {
+            return "unknown module";
+        }
+        if (level < 0) {
+            return "level is none, error, warn, info or debug";
+        }
+        log.levels[module] = level;
+    }
+    return nullptr;
+}
+
+void loadLogLevels() {
+    // Again on every change to the "log" section, replacing levels set through /log-config
+    LogSettings settings;
+    loadConfigSection(CONFIG_SECTION_LOG, &settings, sizeof(settings), parseLogSettings);
+    memcpy(logLevels, settings.levels, sizeof(logLevels));
+}
+
+void setupLog() {
+    logStats.printed = 0;
+    logStats.lost = 0;
+    logStats.truncated = 0;
+    logStats.dropped = 0;
+    logStats.waits = 0;
+    logStats.kept = 0;
+    logStats.resetReason = esp_reset_reason();
+    
+    // The end of the previous run's log, if this firmware wrote it
+    uint32_t firmwareId = getLogFirmwareId();
+    if (logRegion.magic == LOG_REGION_MAGIC && logRegion.firmwareId == firmwareId) {
+        uint32_t head = logRegion.head.load();
+        for (uint32_t position = head - min(head, (uint32_t)LOG_KEPT_RECORDS); position != head; position++) {
+            LogEntry& entry = logKept[logStats.kept];
+            if (readLogRecord(position, entry) && isLogEntryValid(entry)) {
+                logStats.kept++;
+            }
+        }
+    }
+    
+    logRegion.magic = LOG_REGION_MAGIC;
+    logRegion.firmwareId = firmwareId;
+    logRegion.head.store(0);
+    for (uint32_t i = 0; i < LOG_RING_RECORDS; i++) {
+        logRegion.records[i].sequence.store(i + 1 - LOG_RING_RECORDS);
+        logRegion.records[i].skipped.store(i + 1 - LOG_RING_RECORDS);
+    }
+    logTail = 0;
+    logPendingLength = 0;
+    
+    loadLogLevels();
+    
+    // Printed at once: a crash report is worth the wait at boot
+    const char* reason = logStats.resetReason < LOG_RESET_REASONS ? logResetReasons[logStats.resetReason] : "unknown";
+    if (logStats.kept) {
+        Serial.printf("--- Last %u log records before the reset (%s) ---\n", logStats.kept, reason);
+        exportLog(Serial, true);
+        Serial.println("---");
+    }
+    LOG_INFO(LOG_MODULE_MAIN, "Reset reason: %s, %u log records kept", reason, logStats.kept);
+}
+
+bool isLogEnabled(uint8_t module, uint8_t level) {
+    return module < LOG_MODULES && level <= logLevels[module];
+}
+
+void writeLog(uint8_t module, uint8_t level, const char* format, const LogArgs& args) {
+    uint32_t position = logRegion.head.fetch_add(1, std::memory_order_relaxed);
+    LogRecord& record = logRegion.records[position & LOG_RING_MASK];
+    
+    // The slot is taken from an earlier lap that is done with it, so no two writers fill it at once.
+    // Usually that is the previous lap; one whose writer dropped its record leaves the slot a lap
+    // further behind. A slot's sequences once written are whole laps apart, so one off by a part
+    // of a lap is busy. A slot busy, or taken by a later lap while this writer was switched out,
+    // is marked skipped instead, so neither the printer nor the next lap waits for this position
+    uint32_t sequence = record.sequence.load(std::memory_order_relaxed);
+    do {
+        if (((sequence - position - 1) & LOG_RING_MASK) != 0 || (int32_t)(position + 1 - sequence) <= 0) {
+            record.skipped.store(position + 1, std::memory_order_release);
+            logStats.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    } while (!record.sequence.compare_exchange_weak(sequence, position + 1 + LOG_RECORD_BUSY,
+                                                    std::memory_order_relaxed));
+    std::atomic_thread_fence(std::memory_order_release);
+    
+    LogEntry& entry = record.entry;
+    entry.timeMs = millis();
+    entry.format = format;
+    entry.module = module;
+    entry.level = level;
+    entry.argCount = args.argCount;
+    memcpy(entry.payload, args.words, args.argCount * sizeof(uint32_t));
+    
+    // Strings go after the arguments, cut to the room left
+    size_t room = (LOG_PAYLOAD_WORDS - args.argCount) * sizeof(uint32_t);
+    char* text = (char*)(entry.payload + args.argCount);
+    entry.textBytes = min((size_t)args.textBytes, room);
+    memcpy(text, args.text, entry.textBytes);
+    if (args.textBytes > room) {
+        text[room - 1] = 0;
+    }
+    if (args.truncated || args.textBytes > room) {
+        logStats.truncated.fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    record.sequence.store(position + 1, std::memory_order_release);
+}
+
+size_t formatLogMessage(const LogEntry& entry, char* out, size_t size) {
+    const char* text = (const char*)(entry.payload + entry.argCount);
+    size_t length = 0;
+    uint8_t arg = 0;
+    
+    for (const char* p = entry.format; *p && length + 1 < size; p++) {
+        if (*p != '%') {
+            out[length++] = *p;
+            continue;
+        }
+        if (p[1] == '%') {
+            out[length++] = '%';
+            p++;
+            continue;
+        }
+        
+        // Flags, width and precision are kept; every argument is 32 bits, so the length modifier goes
+        char spec[16] = "%";
+        size_t specLength = 1;
+        for (p++; *p && strchr("-+ #0123456789.", *p) && specLength < sizeof(spec) - 2; p++) {
+            spec[specLength++] = *p;
+        }
+        while (*p && strchr("hlLqjzt", *p)) {
+            p++;
+        }
+        if (!*p) {
+            break;
+        }
+        spec[specLength++] = *p;
+        spec[specLength] = 0;
+        
+        uint32_t word = arg < entry.argCount ? entry.payload[arg] : 0;
+        arg++;
+        int written = 0;
+        switch (*p) {
+            case 'd':
+            case 'i':
+            case 'c':
+                written = snprintf(out + length, size - length, spec, (int)word);
+                break;
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+                written = snprintf(out + length, size - length, spec, (unsigned)word);
+                break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G': {
+                float value;
+                memcpy(&value, &word, sizeof(value));
+                written = snprintf(out + length, size - length, spec, (double)value);
+                break;
+            }
+            case 's':
+                written = snprintf(out + length, size - length, spec, word < entry.textBytes ? text + word : "");
+                break;
+        }
+        if (written > 0) {
+            length += min((size_t)written, size - 1 - length);
+        }
+    }
+    out[length] = 0;
+    return length;
+}
+
+size_t formatLogEntry(const LogEntry& entry, char* line, size_t size) {
+    int prefix = snprintf(line, size, "%6lu.%03lu %c %-8s ", (unsigned long)(entry.timeMs / 1000),
+                          (unsigned long)(entry.timeMs % 1000), logLevelLetters[entry.level],
+                          logModuleNames[entry.module]);
+    size_t length = min((size_t)prefix, size - 2);
+    length += formatLogMessage(entry, line + length, size - 1 - length);
+    line[length++] = '\n';
+    line[length] = 0;
+    return length;
+}
+
+bool takeLogLine() {
+    // Fell a lap behind: the oldest records are gone
+    uint32_t head = logRegion.head.load(std::memory_order_acquire);
+    if (head - logTail > LOG_RING_RECORDS) {
+        uint32_t lost = head - logTail - LOG_RING_RECORDS;
+        logStats.lost += lost;
+        logTail += lost;
+        logPendingLength = snprintf(logPendingLine, sizeof(logPendingLine), "... %lu log records lost\n",
+                                    (unsigned long)lost);
+        return true;
+    }
+    
+    // Stops at a record still being written, passes over a skipped one
+    LogEntry entry;
+    for (; logTail != head; logTail++) {
+        if (readLogRecord(logTail, entry)) {
+            logTail++;
+            logPendingLength = formatLogEntry(entry, logPendingLine, sizeof(logPendingLine));
+            return true;
+        }
+        if (!isLogRecordSkipped(logTail)) {
+            return false;
+        }
+    }
+    return false;
+}
+
+bool printLogLine(bool wait) {
+    if (!wait && Serial.availableForWrite() < (int)logPendingLength) {
+        logStats.waits++;
+        return false;
+    }
+    Serial.write((const uint8_t*)logPendingLine, logPendingLength);
+    logPendingLength = 0;
+    logStats.printed++;
+    return true;
+}
+
+void loopLog() {
+    // Never waits for the UART: a line it has no room for stays for the next call
+    if (logPendingLength && !printLogLine(false)) {
+        return;
+    }
+    for (uint8_t i = 0; i < LOG_DRAIN_RECORDS && takeLogLine(); i++) {
+        if (!printLogLine(false)) {
+            return;
+        }
+    }
+}
+
+void flushLog() {
+    // Waits for the UART; for boot and before a restart
+    if (logPendingLength) {
+        printLogLine(true);
+    }
+    while (takeLogLine()) {
+        printLogLine(true);
+    }
+}
+
+const char* getLogModuleName(uint8_t module) {
+    return module < LOG_MODULES ? logModuleNames[module] : "unknown";
+}
+
+const char* getLogLevelName(uint8_t level) {
+    return level < LOG_LEVELS ? logLevelNames[level] : "unknown";
+}
+
+void exportLog(Print& out, bool kept) {
+    char line[LOG_LINE_LENGTH];
+    if (kept) {
+        for (uint32_t i = 0; i < logStats.kept; i++) {
+            out.write((const uint8_t*)line, formatLogEntry(logKept[i], line, sizeof(line)));
+        }
+        return;
+    }
+    
+    // The whole ring, printed or not; records overwritten meanwhile are skipped
+    uint32_t head = logRegion.head.load(std::memory_order_acquire);
+    for (uint32_t position = head - min(head, (uint32_t)LOG_RING_RECORDS); position != head; position++) {
+        LogEntry entry;
+        if (readLogRecord(position, entry)) {
+            out.write((const uint8_t*)line, formatLogEntry(entry, line, sizeof(line)));
+        }
+    }
+}
+
+const LogStats& getLogStats() {
+    logStats.written = logRegion.head.load();
+    return logStats;
+}
+
+String getLogConfigJSON() {
+    DynamicJsonDocument doc(1536);
+    
+    JsonObject levels = doc.createNestedObject("levels");
+    for (uint8_t i = 0; i < LOG_MODULES; i++) {
+        levels[logModuleNames[i]] = logLevelNames[logLevels[i]];
+    }
+    
+    const LogStats& stats = getLogStats();
+    doc["records"] = LOG_RING_RECORDS;
+    doc["written"] = stats.written;
+    doc["waiting"] = stats.written - logTail;
+    doc["printed"] = stats.printed;
+    doc["lost"] = stats.lost;
+    doc["truncated"] = stats.truncated.load();
+    doc["dropped"] = stats.dropped.load();
+    doc["waits"] = stats.waits;
+    doc["kept"] = stats.kept;
+    doc["reset_reason"] = stats.resetReason < LOG_RESET_REASONS ? logResetReasons[stats.resetReason] : "unknown";
+    
+    String result;
+    serializeJson(doc, result);
+    return result;
+}
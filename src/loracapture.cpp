@@ -0,0 +1,285 @@
+#include "loracapture.h"
+#include "lorahandler.h"
+#include "logger.h"
+
+// Ring of records: LoRaCaptureRecord, then its bytes, wrapping at the end
+uint8_t loraCaptureRing[LORA_CAPTURE_BUFFER];
+size_t loraCaptureHead = 0;     // Oldest record
+size_t loraCaptureUsed = 0;
+bool loraCaptureEnabled = false;
+LoRaCaptureStats loraCaptureStats = {};
+portMUX_TYPE loraCaptureMux = portMUX_INITIALIZER_UNLOCKED;   // Ring against the web task's snapshot
+
+// Largest enhanced packet block: headers, LoRaTap header, frame, options
+#define LORA_CAPTURE_BLOCK_MAX 512
+#define LORA_CAPTURE_COMMENT_MAX 64
+
+// pcapng block types and options
+#define PCAPNG_SECTION_HEADER 0x0A0D0D0A
+#define PCAPNG_INTERFACE_DESCRIPTION 0x00000001
+#define PCAPNG_ENHANCED_PACKET 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_COMMENT 1
+#define PCAPNG_OPT_SHB_USERAPPL 4
+#define PCAPNG_OPT_IF_NAME 2
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_OPT_EPB_FLAGS 2
+#define PCAPNG_EPB_INBOUND 0x01
+#define PCAPNG_EPB_OUTBOUND 0x02
+
+void setLoRaCaptureEnabled(bool enabled) {
+    if (enabled != loraCaptureEnabled) {
+        LOG_INFO(LOG_MODULE_CAPTURE, "LoRa capture %s", enabled ? "on" : "off");
+    }
+    loraCaptureEnabled = enabled;
+}
+
+bool isLoRaCaptureEnabled() {
+    return loraCaptureEnabled;
+}
+
+void copyToCaptureRing(size_t position, const void* data, size_t length) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    size_t first = min(length, (size_t)LORA_CAPTURE_BUFFER - position);
+    memcpy(loraCaptureRing + position, bytes, first);
+    memcpy(loraCaptureRing, bytes + first, length - first);
+}
+
+void copyFromCaptureRing(size_t position, void* data, size_t length) {
+    uint8_t* bytes = (uint8_t*)data;
+    size_t first = min(length, (size_t)LORA_CAPTURE_BUFFER - position);
+    memcpy(bytes, loraCaptureRing + position, first);
+    memcpy(bytes + first, loraCaptureRing, length - first);
+}
+
+void dropOldestCaptureRecord() {
+    LoRaCaptureRecord oldest;
+    copyFromCaptureRing(loraCaptureHead, &oldest, sizeof(oldest));
+    size_t size = sizeof(oldest) + oldest.length;
+    loraCaptureHead = (loraCaptureHead + size) % LORA_CAPTURE_BUFFER;
+    loraCaptureUsed -= size;
+    loraCaptureStats.records--;
+    loraCaptureStats.overwritten++;
+}
+
+void captureLoRaFrame(const uint8_t* data, size_t length, size_t frameLength, uint8_t flags,
+                      int spreadingFactor, int rssi, float snr, long frequencyError) {
+    if (!loraCaptureEnabled) {
+        return;
+    }
+    
+    unsigned long startUs = micros();
+    LoRaCaptureRecord record;
+    record.timeMs = millis();
+    record.frequencyError = frequencyError;
+    record.rssi = rssi;
+    record.snr = (int8_t)constrain(lroundf(snr * 4), -128L, 127L);
+    record.spreadingFactor = spreadingFactor;
+    record.flags = flags;
+    record.length = min(length, (size_t)LORA_CAPTURE_SNAPLEN);
+    record.frameLength = min(max(frameLength, length), (size_t)LORA_CAPTURE_SNAPLEN);
+    
+    size_t size = sizeof(record) + record.length;
+    portENTER_CRITICAL(&loraCaptureMux);
+    while (loraCaptureUsed + size > LORA_CAPTURE_BUFFER) {
+        dropOldestCaptureRecord();
+    }
+    
+    size_t tail = (loraCaptureHead + loraCaptureUsed) % LORA_CAPTURE_BUFFER;
+    copyToCaptureRing(tail, &record, sizeof(record));
+    copyToCaptureRing((tail + sizeof(record)) % LORA_CAPTURE_BUFFER, data, record.length);
+    loraCaptureUsed += size;
+    
+    LoRaCaptureStats& stats = loraCaptureStats;
+    stats.captured++;
+    stats.records++;
+    stats.bytesUsed = loraCaptureUsed;
+    portEXIT_CRITICAL(&loraCaptureMux);
+    uint32_t elapsedUs = micros() - startUs;
+    stats.captureUs += elapsedUs;
+    stats.maxCaptureUs = max(stats.maxCaptureUs, elapsedUs);
+}
+
+void clearLoRaCapture() {
+    portENTER_CRITICAL(&loraCaptureMux);
+    loraCaptureHead = 0;
+    loraCaptureUsed = 0;
+    loraCaptureStats.records = 0;
+    loraCaptureStats.bytesUsed = 0;
+    portEXIT_CRITICAL(&loraCaptureMux);
+}
+
+bool takeLoRaCaptureSnapshot(LoRaCaptureSnapshot& snapshot) {
+    // Room for a full ring, so the copy never has to wait for memory inside the lock
+    snapshot.data = (uint8_t*)malloc(LORA_CAPTURE_BUFFER);
+    snapshot.length = 0;
+    if (!snapshot.data) {
+        LOG_WARN(LOG_MODULE_CAPTURE, "No memory for a capture snapshot");
+        return false;
+    }
+    
+    portENTER_CRITICAL(&loraCaptureMux);
+    snapshot.length = loraCaptureUsed;
+    copyFromCaptureRing(loraCaptureHead, snapshot.data, loraCaptureUsed);
+    portEXIT_CRITICAL(&loraCaptureMux);
+    return true;
+}
+
+void releaseLoRaCaptureSnapshot(LoRaCaptureSnapshot& snapshot) {
+    free(snapshot.data);
+    snapshot.data = nullptr;
+    snapshot.length = 0;
+}
+
+// Block fields are in host byte order; the section header's byte-order
+// magic tells readers which one that is
+size_t putCaptureOption(uint8_t* out, uint16_t code, const void* value, uint16_t length) {
+    size_t padded = (length + 3) & ~3;
+    memcpy(out, &code, 2);
+    memcpy(out + 2, &length, 2);
+    memcpy(out + 4, value, length);
+    memset(out + 4 + length, 0, padded - length);
+    return 4 + padded;
+}
+
+size_t finishCaptureBlock(uint8_t* block, size_t length, uint32_t type) {
+    // Ends the options and writes the total length at both ends of the block
+    length += putCaptureOption(block + length, PCAPNG_OPT_END, "", 0);
+    uint32_t total = length + 4;
+    memcpy(block, &type, 4);
+    memcpy(block + 4, &total, 4);
+    memcpy(block + length, &total, 4);
+    return total;
+}
+
+size_t buildCaptureHeader(uint8_t* block) {
+    // Section header block, then the one interface every packet refers to
+    static const char application[] = "ESP32 Gong System";
+    static const char interfaceName[] = "lora0";
+    uint32_t magic = PCAPNG_BYTE_ORDER_MAGIC;
+    uint16_t version[2] = {1, 0};
+    int64_t sectionLength = -1;
+    memcpy(block + 8, &magic, 4);
+    memcpy(block + 12, version, 4);
+    memcpy(block + 16, &sectionLength, 8);
+    size_t length = 24;
+    length += putCaptureOption(block + length, PCAPNG_OPT_SHB_USERAPPL, application, strlen(application));
+    size_t sectionBytes = finishCaptureBlock(block, length, PCAPNG_SECTION_HEADER);
+    
+    uint8_t* idb = block + sectionBytes;
+    uint16_t linkType[2] = {PCAPNG_LINKTYPE_LORATAP, 0};
+    uint32_t snapLength = LORATAP_HEADER_BYTES + LORA_CAPTURE_SNAPLEN;
+    uint8_t tsResolution = 6;   // Microseconds
+    memcpy(idb + 8, linkType, 4);
+    memcpy(idb + 12, &snapLength, 4);
+    length = 16;
+    length += putCaptureOption(idb + length, PCAPNG_OPT_IF_NAME, interfaceName, strlen(interfaceName));
+    length += putCaptureOption(idb + length, PCAPNG_OPT_IF_TSRESOL, &tsResolution, 1);
+    return sectionBytes + finishCaptureBlock(idb, length, PCAPNG_INTERFACE_DESCRIPTION);
+}
+
+size_t buildCapturePacket(const LoRaCaptureRecord& record, const uint8_t* data, uint64_t timestampUs,
+                          uint8_t* block) {
+    // Enhanced packet block around a LoRaTap v0 header and the frame
+    uint32_t interfaceId = 0;
+    uint32_t timestamp[2] = {(uint32_t)(timestampUs >> 32), (uint32_t)timestampUs};
+    uint32_t capturedLength = LORATAP_HEADER_BYTES + record.length;
+    uint32_t originalLength = LORATAP_HEADER_BYTES + record.frameLength;
+    memcpy(block + 8, &interfaceId, 4);
+    memcpy(block + 12, timestamp, 8);
+    memcpy(block + 20, &capturedLength, 4);
+    memcpy(block + 24, &originalLength, 4);
+    
+    // LoRaTap fields are big-endian
+    bool tx = record.flags & LORA_CAPTURE_FLAG_TX;
+    uint32_t frequency = LORA_FREQUENCY;
+    uint8_t rssi = tx ? 0 : constrain(record.rssi + LORATAP_RSSI_OFFSET, 0, 255);
+    uint8_t* tap = block + 28;
+    tap[0] = 0;                 // Version
+    tap[1] = 0;
+    tap[2] = 0;
+    tap[3] = LORATAP_HEADER_BYTES;
+    tap[4] = frequency >> 24;
+    tap[5] = frequency >> 16;
+    tap[6] = frequency >> 8;
+    tap[7] = frequency;
+    tap[8] = (uint32_t)LORA_BANDWIDTH / 125000;
+    tap[9] = record.spreadingFactor;
+    tap[10] = rssi;             // Packet, max and current RSSI
+    tap[11] = rssi;
+    tap[12] = rssi;
+    tap[13] = tx ? 0 : (uint8_t)record.snr;
+    tap[14] = LORA_SYNC_WORD;
+    memcpy(tap + LORATAP_HEADER_BYTES, data, record.length);
+    
+    size_t length = 28 + ((capturedLength + 3) & ~3);
+    memset(block + 28 + capturedLength, 0, length - 28 - capturedLength);
+    
+    uint32_t direction = tx ? PCAPNG_EPB_OUTBOUND : PCAPNG_EPB_INBOUND;
+    length += putCaptureOption(block + length, PCAPNG_OPT_EPB_FLAGS, &direction, 4);
+    
+    char comment[LORA_CAPTURE_COMMENT_MAX];
+    int commentLength;
+    if (tx) {
+        commentLength = snprintf(comment, sizeof(comment), "tx %d dBm", record.rssi);
+    } else {
+        const char* verdict = record.flags & LORA_CAPTURE_FLAG_FILTERED ? ", other zone"
+                            : record.flags & LORA_CAPTURE_FLAG_AUTH_FAILED ? ", auth failed"
+                            : record.flags & LORA_CAPTURE_FLAG_AUTH_OK ? ", auth ok" : "";
+        commentLength = snprintf(comment, sizeof(comment), "rx freq error %ld Hz%s",
+                                 (long)record.frequencyError, verdict);
+    }
+    length += putCaptureOption(block + length, PCAPNG_OPT_COMMENT, comment, commentLength);
+    return finishCaptureBlock(block, length, PCAPNG_ENHANCED_PACKET);
+}
+
+size_t getLoRaCaptureSize(const LoRaCaptureSnapshot& snapshot) {
+    // Blocks vary with the frame and its comment: build each one to measure it
+    uint8_t block[LORA_CAPTURE_BLOCK_MAX];
+    size_t total = buildCaptureHeader(block);
+    
+    for (size_t offset = 0; offset < snapshot.length; ) {
+        LoRaCaptureRecord record;
+        memcpy(&record, snapshot.data + offset, sizeof(record));
+        total += buildCapturePacket(record, snapshot.data + offset + sizeof(record), 0, block);
+        offset += sizeof(record) + record.length;
+    }
+    return total;
+}
+
+void exportLoRaCapture(const LoRaCaptureSnapshot& snapshot, Print& out, uint32_t epochNow) {
+    // Wall-clock timestamps once the clock is set, time since boot before that
+    uint8_t block[LORA_CAPTURE_BLOCK_MAX];
+    out.write(block, buildCaptureHeader(block));
+    
+    unsigned long now = millis();
+    for (size_t offset = 0; offset < snapshot.length; ) {
+        LoRaCaptureRecord record;
+        memcpy(&record, snapshot.data + offset, sizeof(record));
+        
+        uint64_t timestampUs = epochNow > 0
+            ? (uint64_t)epochNow * 1000000ULL - (uint64_t)(now - record.timeMs) * 1000ULL
+            : (uint64_t)record.timeMs * 1000ULL;
+        out.write(block, buildCapturePacket(record, snapshot.data + offset + sizeof(record), timestampUs, block));
+        
+        offset += sizeof(record) + record.length;
+    }
+}
+
+const LoRaCaptureStats& getLoRaCaptureStats() {
+    return loraCaptureStats;
+}
+
+void addLoRaCaptureJSON(JsonObject obj) {
+    const LoRaCaptureStats& stats = loraCaptureStats;
+    
+    obj["enabled"] = loraCaptureEnabled;
+    obj["buffer_bytes"] = LORA_CAPTURE_BUFFER;
+    obj["used_bytes"] = stats.bytesUsed;
+    obj["records"] = stats.records;
+    obj["captured"] = stats.captured;
+    obj["overwritten"] = stats.overwritten;
+    obj["avg_capture_us"] = stats.captured ? (uint32_t)(stats.captureUs / stats.captured) : 0;
+    obj["max_capture_us"] = stats.maxCaptureUs;
+}
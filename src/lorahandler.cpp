@@ -1,16 +1,151 @@
 #include "lorahandler.h"
+#include "schedulesync.h"
+#include "nodestatus.h"
+#include "linkadapt.h"
+#include "frameauth.h"
+#include "loraota.h"
+#include "loracapture.h"
+#include "eventbus.h"
+#include "configstore.h"
+#include "logger.h"
+#include "tasks.h"
 #include <SPI.h>
 #include <LoRa.h>
+#include <SPIFFS.h>
 
-// External callback for gong trigger
-void (*onGongTrigger)() = nullptr;
+// "lora" section of gong.conf
+struct LoRaSettings {
+    bool master;
+    bool lowPower;
+    bool capture;
+    uint32_t wakePeriod;
+    uint32_t zones;
+    char key[FRAME_AUTH_KEY_BYTES * 2 + 1];
+};
+
+// Node role, from the "lora" section
+bool loraMaster = false;
+bool loraLowPower = false;
+uint32_t loraWakePeriod = 0;    // ms, 0 = nobody sleeps
+uint32_t loraZones = LORA_ZONE_ALL;
+
+// Active radio profile, adjusted at runtime by link adaptation
+int loraSpreadingFactor = LORA_SPREADING_FACTOR;
+int loraTxPower = LORA_TX_POWER;
+
+// Profile the radio is actually set to; differs while a frame goes out on another profile
+int radioSpreadingFactor = LORA_SPREADING_FACTOR;
+int radioTxPower = LORA_TX_POWER;
+int radioPreambleLength = LORA_PREAMBLE_LENGTH;
+bool loraReady = false;
+
+// Link quality of the most recently received packet
+int lastPacketRssi = 0;
+float lastPacketSnr = 0;
+unsigned long lastPacketMillis = 0;
+
+// Transmit queue, served by class, then in queueing order
+struct LoRaTxFrame {
+    uint8_t txClass;
+    uint8_t length;             // On air, auth trailer included
+    uint8_t payloadLength;      // Before the trailer, which is signed at TX time
+    int8_t spreadingFactor;     // 0 = network profile
+    int8_t txPower;
+    bool wake;                  // Long preamble for sleeping slaves
+    uint32_t seq;
+    unsigned long queuedAt;
+    uint8_t data[LORA_MAX_PACKET];
+};
+
+LoRaTxFrame loraTxQueue[LORA_TX_QUEUE_SIZE];
+uint8_t loraTxQueueDepth = 0;
+uint32_t loraTxSeq = 0;
+LoRaTxClassStats loraTxStats[LORA_TX_CLASSES];
+
+// In-flight transmission, completed by the TX-done flag
+bool loraTransmitting = false;
+uint8_t loraTxActiveClass = 0;
+unsigned long loraTxStartMicros = 0;
+uint32_t loraTxExpectedUs = 0;
+bool loraTxDone = false;
+unsigned long loraTxDoneMicros = 0;
+
+// Received frame waiting in the FIFO
+int loraRxPacketSize = 0;
+
+// Last DIO0 rise; all the interrupt handler writes
+volatile unsigned long loraDio0Micros = 0;
+
+// Listen before talk
+bool loraCadPending = false;
+unsigned long loraCadStartedAt = 0;
+unsigned long loraBackoffUntil = 0;
+uint8_t loraLbtAttempts = 0;
+bool loraCadDone = false;
+bool loraCadDetected = false;
+
+// Airtime per duty-cycle bucket, tagged with the bucket's absolute slot number
+uint32_t dutyCycleBucketUs[LORA_DUTY_CYCLE_BUCKETS];
+uint32_t dutyCycleBucketSlot[LORA_DUTY_CYCLE_BUCKETS];
+bool loraDutyCycleBlocked = false;
+
+LoRaChannelStats loraChannelStats;
 
 // Forward declarations for message handlers
 void handleGongMessage(const String& content);
 void handleScheduleMessage(const String& content);
 void handleStatusMessage(const String& content);
 
+// Forward declarations for the transmit path
+void onLoRaDio0Rise();
+void startNextLoRaTransmission();
+void finishChannelActivityDetection(bool busy);
+void finishLoRaTransmission(bool timedOut);
+
+const char* parseLoRaSettings(JsonVariantConst json, void* settings) {
+    LoRaSettings& lora = *(LoRaSettings*)settings;
+    const char* role = json["role"] | "slave";
+    lora.master = strcmp(role, "master") == 0;
+    lora.lowPower = json["low_power"] | false;
+    lora.capture = json["capture"] | false;
+    lora.wakePeriod = json["wake_period"] | 0;
+    lora.zones = parseLoRaZones(json["zones"]);
+    strlcpy(lora.key, json["key"] | "", sizeof(lora.key));
+    
+    if (!lora.master && strcmp(role, "slave") != 0) {
+        return "role is master or slave";
+    }
+    if (lora.key[0] && !isFrameAuthKeyValid(lora.key)) {
+        return "key is 32 hex digits";
+    }
+    return nullptr;
+}
+
+void loadLoRaConfig() {
+    // Again on every change to the section; role and wake period only take effect at setup
+    static bool loaded = false;
+    LoRaSettings settings;
+    loadConfigSection(CONFIG_SECTION_LORA, &settings, sizeof(settings), parseLoRaSettings);
+    
+    // Only slaves sleep; the master has to hear every heartbeat
+    bool lowPower = !settings.master && settings.wakePeriod > 0 && settings.lowPower;
+    if (!loaded) {
+        loraMaster = settings.master;
+        loraWakePeriod = settings.wakePeriod;
+        loraLowPower = lowPower;
+        loaded = true;
+    } else if (settings.master != loraMaster || settings.wakePeriod != loraWakePeriod || lowPower != loraLowPower) {
+        LOG_WARN(LOG_MODULE_LORA, "LoRa role and wake period change at the next restart");
+    }
+    
+    loraZones = settings.zones;
+    setLoRaCaptureEnabled(settings.capture);
+    setupFrameAuth(settings.key);
+}
+
 void setupLoRa() {
+    loadLoRaConfig();
+    
     // Initialize SPI for LoRa
     SPI.begin(18, 19, 23, LORA_SS_PIN); // SCK, MISO, MOSI, SS
     
@@ -19,7 +154,7 @@ void setupLoRa() {
     
     // Initialize LoRa
     if (!LoRa.begin(LORA_FREQUENCY)) {
-        Serial.println("LoRa initialization failed!");
+        LOG_ERROR(LOG_MODULE_LORA, "LoRa initialization failed!");
         return;
     }
     
@@ -28,12 +163,104 @@ void setupLoRa() {
     LoRa.setSpreadingFactor(LORA_SPREADING_FACTOR);
     LoRa.setSignalBandwidth(LORA_BANDWIDTH);
     LoRa.setCodingRate4(LORA_CODING_RATE);
-    LoRa.setTxPower(20, PA_OUTPUT_PA_BOOST_PIN);
+    LoRa.setTxPower(LORA_TX_POWER, PA_OUTPUT_PA_BOOST_PIN);
     
-    Serial.println("LoRa module initialized");
+    // DIO0 wakes the radio task, which reads the flags; the library's callbacks would do SPI in the interrupt,
+    // against the task's own SPI traffic
+    pinMode(LORA_DIO0_PIN, INPUT);
+    attachInterrupt(digitalPinToInterrupt(LORA_DIO0_PIN), onLoRaDio0Rise, RISING);
+    LoRa.receive();
+    loraReady = true;
+    
+    LOG_INFO(LOG_MODULE_LORA, "LoRa module initialized (node %04X, %s)", getLoRaNodeId(),
+             loraMaster ? "master" : "slave");
+}
+
+void IRAM_ATTR onLoRaDio0Rise() {
+    // No SPI here; only the time, which the radio task could not read back later
+    loraDio0Micros = micros();
+    wakeRadioTask(true);
+}
+
+uint8_t transferLoRaRegister(uint8_t address, uint8_t value) {
+    digitalWrite(LORA_SS_PIN, LOW);
+    SPI.beginTransaction(SPISettings(LORA_SPI_FREQUENCY, MSBFIRST, SPI_MODE0));
+    SPI.transfer(address);
+    uint8_t response = SPI.transfer(value);
+    SPI.endTransaction();
+    digitalWrite(LORA_SS_PIN, HIGH);
+    return response;
+}
+
+uint8_t readLoRaRegister(uint8_t address) {
+    return transferLoRaRegister(address & 0x7F, 0);
+}
+
+void writeLoRaRegister(uint8_t address, uint8_t value) {
+    transferLoRaRegister(address | 0x80, value);
+}
+
+void readLoRaFifo(uint8_t* buffer, size_t length) {
+    // One burst, on from the FIFO address pointer
+    digitalWrite(LORA_SS_PIN, LOW);
+    SPI.beginTransaction(SPISettings(LORA_SPI_FREQUENCY, MSBFIRST, SPI_MODE0));
+    SPI.transfer(LORA_REG_FIFO);
+    for (size_t i = 0; i < length; i++) {
+        buffer[i] = SPI.transfer(0);
+    }
+    SPI.endTransaction();
+    digitalWrite(LORA_SS_PIN, HIGH);
+}
+
+void readLoRaInterruptFlags() {
+    // Cleared by writing back what was read: a flag raised in between stays up, and so does DIO0
+    uint8_t flags = readLoRaRegister(LORA_REG_IRQ_FLAGS);
+    writeLoRaRegister(LORA_REG_IRQ_FLAGS, flags);
+    
+    if (flags & LORA_IRQ_TX_DONE) {
+        // DIO0 rose on TX done unless its rise went unseen, then the flag is all there is
+        unsigned long doneMicros = loraDio0Micros;
+        loraTxDoneMicros = (long)(doneMicros - loraTxStartMicros) > 0 ? doneMicros : micros();
+        loraTxDone = true;
+    }
+    if (flags & LORA_IRQ_CAD_DONE) {
+        loraCadDetected = flags & LORA_IRQ_CAD_DETECTED;
+        loraCadDone = true;
+    }
+    if ((flags & LORA_IRQ_RX_DONE) && (flags & LORA_IRQ_PAYLOAD_CRC_ERROR)) {
+        loraChannelStats.rxCorrupt++;
+    } else if (flags & LORA_IRQ_RX_DONE) {
+        // The frame stays in the FIFO until receiveLoRaMessage() reads it
+        loraRxPacketSize = readLoRaRegister(LORA_REG_RX_NB_BYTES);
+        writeLoRaRegister(LORA_REG_FIFO_ADDR_PTR, readLoRaRegister(LORA_REG_FIFO_RX_CURRENT_ADDR));
+        publishEvent(EVENT_LORA_FRAME_RECEIVED, EVENT_SOURCE_LORA, loraRxPacketSize, 0);
+    }
 }
 
 void loopLoRa() {
+    // DIO0 stays high until its flag is cleared, so nothing raised between wakeups is missed
+    if (loraReady && digitalRead(LORA_DIO0_PIN) == HIGH) {
+        readLoRaInterruptFlags();
+    }
+    
+    // Complete the frame in flight
+    if (loraTransmitting) {
+        if (loraTxDone) {
+            finishLoRaTransmission(false);
+        } else if (micros() - loraTxStartMicros > loraTxExpectedUs + LORA_TX_TIMEOUT_MARGIN * 1000UL) {
+            finishLoRaTransmission(true);
+        }
+    }
+    
+    // Complete listen before talk
+    if (loraCadPending) {
+        if (loraCadDone) {
+            finishChannelActivityDetection(loraCadDetected);
+        } else if (millis() - loraCadStartedAt > LORA_CAD_TIMEOUT) {
+            finishChannelActivityDetection(false);
+        }
+    }
+    
     // Check for incoming messages
     if (isLoRaMessageAvailable()) {
         String message = receiveLoRaMessage();
@@ -41,9 +268,12 @@ void loopLoRa() {
             onLoRaMessageReceived(message);
         }
     }
+    persistFrameAuthSenders(false);
+    
+    startNextLoRaTransmission();
 }
 
-void sendGongLoRa() {
+void sendGongLoRa(uint32_t zones) {
     // Create JSON message for gong trigger
     DynamicJsonDocument doc(256);
     doc["type"] = "gong";
@@ -53,35 +283,444 @@ void sendGongLoRa() {
     String message;
     serializeJson(doc, message);
     
-    sendLoRaMessage(message, MSG_TYPE_GONG);
+    sendLoRaMessageAt(message, MSG_TYPE_GONG, 0, 0, true, zones);
+}
+
+bool sendLoRaMessage(const String& message, uint8_t type) {
+    return sendLoRaMessageAt(message, type, 0, 0, true);
+}
+
+uint8_t getLoRaTxClass(uint8_t type) {
+    switch (type) {
+        case MSG_TYPE_GONG:
+            return LORA_TX_CLASS_GONG;
+        case MSG_TYPE_SCHEDULE:
+            return LORA_TX_CLASS_SCHEDULE;
+        case MSG_TYPE_OTA:
+            return LORA_TX_CLASS_BULK;
+        default:
+            return LORA_TX_CLASS_STATUS;
+    }
+}
+
+bool queueLoRaFrame(const uint8_t* data, size_t length, uint8_t type, int spreadingFactor, int txPower,
+                    bool wakeSleepers) {
+    if (length + getFrameAuthOverhead() > LORA_MAX_PACKET) {
+        LOG_WARN(LOG_MODULE_LORA, "LoRa message too long (%u bytes)", (unsigned)length);
+        return false;
+    }
+    
+    uint8_t txClass = getLoRaTxClass(type);
+    LoRaTxClassStats& stats = loraTxStats[txClass];
+    
+    uint8_t slot = loraTxQueueDepth;
+    if (loraTxQueueDepth >= LORA_TX_QUEUE_SIZE) {
+        // Full: evict the newest frame of the lowest class, if it ranks below this one
+        slot = 0;
+        for (uint8_t i = 1; i < loraTxQueueDepth; i++) {
+            const LoRaTxFrame& candidate = loraTxQueue[i];
+            const LoRaTxFrame& worst = loraTxQueue[slot];
+            if (candidate.txClass > worst.txClass ||
+                (candidate.txClass == worst.txClass && candidate.seq > worst.seq)) {
+                slot = i;
+            }
+        }
+        
+        if (loraTxQueue[slot].txClass <= txClass) {
+            stats.dropped++;
+            LOG_WARN(LOG_MODULE_LORA, "LoRa TX queue full, dropped message (Type: 0x%02X)", type);
+            return false;
+        }
+        loraTxStats[loraTxQueue[slot].txClass].dropped++;
+    } else {
+        loraTxQueueDepth++;
+    }
+    
+    LoRaTxFrame& frame = loraTxQueue[slot];
+    frame.txClass = txClass;
+    frame.payloadLength = length;
+    frame.length = length + getFrameAuthOverhead();
+    frame.spreadingFactor = spreadingFactor;
+    frame.txPower = txPower;
+    frame.wake = wakeSleepers && loraMaster && loraWakePeriod > 0;
+    frame.seq = loraTxSeq++;
+    frame.queuedAt = millis();
+    memcpy(frame.data, data, length);
+    
+    stats.queued++;
+    uint8_t depth = 0;
+    for (uint8_t i = 0; i < loraTxQueueDepth; i++) {
+        if (loraTxQueue[i].txClass == txClass) depth++;
+    }
+    stats.maxDepth = max(stats.maxDepth, depth);
+    return true;
+}
+
+bool sendLoRaMessageAt(const String& message, uint8_t type, int spreadingFactor, int txPower,
+                       bool wakeSleepers, uint32_t zones) {
+    // Add message type header, with the zone mask unless the frame is for everyone
+    String fullMessage = String(type, HEX);
+    if (zones != LORA_ZONE_ALL) {
+        fullMessage += "@" + String(zones, HEX);
+    }
+    fullMessage += ":" + message;
+    
+    if (!queueLoRaFrame((const uint8_t*)fullMessage.c_str(), fullMessage.length(), type, spreadingFactor, txPower,
+                        wakeSleepers)) {
+        return false;
+    }
+    LOG_DEBUG(LOG_MODULE_LORA, "LoRa message queued (Type: 0x%02X): %s", type, message.c_str());
+    return true;
+}
+
+bool sendLoRaBinary(const uint8_t* payload, size_t length, uint8_t type, bool wakeSleepers) {
+    // Same "<type hex>:" header, then raw bytes; never zone-addressed
+    uint8_t frame[LORA_MAX_PACKET];
+    int header = snprintf((char*)frame, sizeof(frame), "%x:", type);
+    if (header + length > sizeof(frame)) {
+        LOG_WARN(LOG_MODULE_LORA, "LoRa message too long (%u bytes)", (unsigned)(header + length));
+        return false;
+    }
+    memcpy(frame + header, payload, length);
+    return queueLoRaFrame(frame, header + length, type, 0, 0, wakeSleepers);
+}
+
+void applyRadioPreamble(int preambleLength) {
+    if (preambleLength != radioPreambleLength) {
+        LoRa.setPreambleLength(preambleLength);
+        radioPreambleLength = preambleLength;
+    }
+}
+
+void applyRadioProfile(int spreadingFactor, int txPower) {
+    if (spreadingFactor != radioSpreadingFactor) {
+        LoRa.setSpreadingFactor(spreadingFactor);
+        radioSpreadingFactor = spreadingFactor;
+    }
+    if (txPower != radioTxPower) {
+        LoRa.setTxPower(txPower, PA_OUTPUT_PA_BOOST_PIN);
+        radioTxPower = txPower;
+    }
+}
+
+uint32_t getDutyCycleSlot() {
+    return millis() / (LORA_DUTY_CYCLE_WINDOW / LORA_DUTY_CYCLE_BUCKETS);
+}
+
+uint32_t getLoRaDutyCycleUsedUs() {
+    uint32_t slot = getDutyCycleSlot();
+    uint32_t used = 0;
+    for (uint8_t i = 0; i < LORA_DUTY_CYCLE_BUCKETS; i++) {
+        if (slot - dutyCycleBucketSlot[i] < LORA_DUTY_CYCLE_BUCKETS) {
+            used += dutyCycleBucketUs[i];
+        }
+    }
+    return used;
+}
+
+uint32_t getLoRaDutyCycleBudgetUs() {
+    // ms * permille = us
+    return (uint32_t)LORA_DUTY_CYCLE_WINDOW * LORA_DUTY_CYCLE_PERMILLE;
+}
+
+void recordDutyCycleAirtime(uint32_t airtimeUs) {
+    uint32_t slot = getDutyCycleSlot();
+    uint8_t bucket = slot % LORA_DUTY_CYCLE_BUCKETS;
+    if (dutyCycleBucketSlot[bucket] != slot) {
+        dutyCycleBucketSlot[bucket] = slot;
+        dutyCycleBucketUs[bucket] = 0;
+    }
+    dutyCycleBucketUs[bucket] += airtimeUs;
+}
+
+bool hasDutyCycleBudget(uint8_t txClass, uint32_t airtimeUs) {
+    // The last part of the budget is kept for gongs
+    uint32_t budget = getLoRaDutyCycleBudgetUs();
+    if (txClass == LORA_TX_CLASS_BULK) {
+        // Firmware transfers leave the other half for normal traffic
+        budget = budget / 100 * LORA_DUTY_CYCLE_BULK_SHARE;
+    } else if (txClass != LORA_TX_CLASS_GONG) {
+        budget -= budget / 100 * LORA_DUTY_CYCLE_GONG_RESERVE;
+    }
+    return getLoRaDutyCycleUsedUs() + airtimeUs <= budget;
+}
+
+uint8_t selectNextLoRaFrame() {
+    uint8_t next = 0;
+    for (uint8_t i = 1; i < loraTxQueueDepth; i++) {
+        const LoRaTxFrame& candidate = loraTxQueue[i];
+        if (candidate.txClass < loraTxQueue[next].txClass ||
+            (candidate.txClass == loraTxQueue[next].txClass && candidate.seq < loraTxQueue[next].seq)) {
+            next = i;
+        }
+    }
+    return next;
+}
+
+int getFrameSpreadingFactor(const LoRaTxFrame& frame) {
+    return frame.spreadingFactor ? frame.spreadingFactor : loraSpreadingFactor;
+}
+
+int getFramePreambleLength(const LoRaTxFrame& frame) {
+    return frame.wake ? getLoRaWakePreamble(getFrameSpreadingFactor(frame), loraWakePeriod) : LORA_PREAMBLE_LENGTH;
+}
+
+uint32_t getFrameAirtimeUs(const LoRaTxFrame& frame) {
+    return calculateLoRaAirtimeUs(frame.length, getFrameSpreadingFactor(frame), LORA_BANDWIDTH,
+                                  LORA_CODING_RATE, getFramePreambleLength(frame));
+}
+
+void transmitLoRaFrame(uint8_t index) {
+    LoRaTxFrame& frame = loraTxQueue[index];
+    
+    // The key may have come on since the frame was queued without room for the trailer
+    if (frame.payloadLength + getFrameAuthOverhead() > LORA_MAX_PACKET) {
+        loraTxStats[frame.txClass].dropped++;
+        LOG_WARN(LOG_MODULE_LORA, "LoRa frame too long for the auth trailer, dropped");
+        loraLbtAttempts = 0;
+        loraTxQueue[index] = loraTxQueue[--loraTxQueueDepth];
+        return;
+    }
+    
+    int spreadingFactor = getFrameSpreadingFactor(frame);
+    int txPower = frame.txPower ? frame.txPower : loraTxPower;
+    applyRadioProfile(spreadingFactor, txPower);
+    applyRadioPreamble(getFramePreambleLength(frame));
+    
+    if (!LoRa.beginPacket()) {
+        return; // Radio still busy, retry on the next loop
+    }
+    
+    // Sign at TX time, so counters go out in order whatever the queue did, and with the key in use now
+    frame.length = signLoRaFrame(frame.data, frame.payloadLength);
+    LoRa.write(frame.data, frame.length);
+    captureLoRaFrame(frame.data, frame.length, frame.length, LORA_CAPTURE_FLAG_TX, spreadingFactor, txPower, 0, 0);
+    
+    LoRaTxClassStats& stats = loraTxStats[frame.txClass];
+    unsigned long waitMs = millis() - frame.queuedAt;
+    stats.waitMs += waitMs;
+    stats.maxWaitMs = max(stats.maxWaitMs, (uint32_t)waitMs);
+    recordLinkTransmission(frame.length, spreadingFactor, txPower);
+    
+    loraTxActiveClass = frame.txClass;
+    loraTxExpectedUs = getFrameAirtimeUs(frame);
+    recordDutyCycleAirtime(loraTxExpectedUs);
+    loraLbtAttempts = 0;
+    loraTxDone = false;
+    loraTransmitting = true;
+    loraTxStartMicros = micros();
+    
+    // DIO0 on TX done; the library only maps it when its own callback is set
+    writeLoRaRegister(LORA_REG_DIO_MAPPING_1, LORA_DIO0_TX_DONE);
+    LoRa.endPacket(true);
+    
+    // Any counter reservation hits flash while the frame is on air
+    persistFrameAuthCounter();
+    
+    // Dequeue; order is kept by seq, not by position
+    loraTxQueue[index] = loraTxQueue[--loraTxQueueDepth];
 }
 
-void sendLoRaMessage(const String& message, uint8_t type) {
-    // Add message type header
-    String fullMessage = String(type, HEX) + ":" + message;
+void startNextLoRaTransmission() {
+    if (!loraReady || loraTransmitting || loraCadPending || loraTxQueueDepth == 0) {
+        return;
+    }
+    if ((long)(millis() - loraBackoffUntil) < 0) {
+        return;
+    }
+    
+    uint8_t next = selectNextLoRaFrame();
+    const LoRaTxFrame& frame = loraTxQueue[next];
+    int spreadingFactor = getFrameSpreadingFactor(frame);
     
-    // Send the message
-    LoRa.beginPacket();
-    LoRa.print(fullMessage);
-    LoRa.endPacket();
+    if (!hasDutyCycleBudget(frame.txClass, getFrameAirtimeUs(frame))) {
+        if (!loraDutyCycleBlocked) {
+            loraDutyCycleBlocked = true;
+            loraChannelStats.dutyCycleDeferrals++;
+            LOG_WARN(LOG_MODULE_LORA, "LoRa duty-cycle budget exhausted, holding TX queue");
+        }
+        return;
+    }
+    loraDutyCycleBlocked = false;
+    
+    if (loraLbtAttempts >= LORA_LBT_MAX_ATTEMPTS) {
+        loraChannelStats.lbtForced++;
+        transmitLoRaFrame(next);
+        return;
+    }
     
-    Serial.printf("LoRa message sent (Type: 0x%02X): %s\n", type, message.c_str());
+    // Listen before talk on the profile the frame will go out on
+    applyRadioProfile(spreadingFactor, frame.txPower ? frame.txPower : loraTxPower);
+    loraCadDone = false;
+    loraCadPending = true;
+    loraCadStartedAt = millis();
+    loraChannelStats.cadChecks++;
+    LoRa.channelActivityDetection();
+}
+
+void finishChannelActivityDetection(bool busy) {
+    loraCadPending = false;
+    
+    if (!busy) {
+        transmitLoRaFrame(selectNextLoRaFrame());
+        return;
+    }
+    
+    // Random backoff in a window that doubles with each busy CAD
+    loraChannelStats.cadBusy++;
+    loraLbtAttempts++;
+    unsigned long backoff = random(LORA_LBT_BACKOFF_SLOT, (LORA_LBT_BACKOFF_SLOT << loraLbtAttempts) + 1);
+    loraBackoffUntil = millis() + backoff;
+    loraChannelStats.backoffMs += backoff;
+    
+    // Listen to whoever holds the channel
+    applyRadioProfile(loraSpreadingFactor, loraTxPower);
+    LoRa.receive();
+}
+
+void finishLoRaTransmission(bool timedOut) {
+    LoRaTxClassStats& stats = loraTxStats[loraTxActiveClass];
+    
+    if (timedOut) {
+        stats.timeouts++;
+        stats.airtimeUs += loraTxExpectedUs;
+        LoRa.idle();
+        LOG_WARN(LOG_MODULE_LORA, "LoRa TX timed out");
+    } else {
+        stats.sent++;
+        stats.airtimeUs += loraTxDoneMicros - loraTxStartMicros;
+    }
+    
+    loraTransmitting = false;
+    
+    // Back to the network profile and continuous RX
+    applyRadioProfile(loraSpreadingFactor, loraTxPower);
+    applyRadioPreamble(LORA_PREAMBLE_LENGTH);
+    LoRa.receive();
+}
+
+uint8_t getLoRaTxQueueDepth() {
+    return loraTxQueueDepth;
+}
+
+bool isLoRaTransmitting() {
+    return loraTransmitting;
+}
+
+bool isLoRaIdle() {
+    // DIO0 high: a frame or a completion the radio task has not read yet
+    return loraReady && !loraTransmitting && !loraCadPending && loraTxQueueDepth == 0 && loraRxPacketSize == 0 &&
+           digitalRead(LORA_DIO0_PIN) == LOW;
+}
+
+void sleepLoRa() {
+    LoRa.sleep();
+}
+
+void startLoRaChannelSample() {
+    // One CAD on the network profile; DIO0 rises when it is done
+    loraCadDone = false;
+    loraCadDetected = false;
+    LoRa.idle();
+    LoRa.channelActivityDetection();
+}
+
+bool finishLoRaChannelSample() {
+    // CAD done may still be on its way right after a light-sleep wakeup
+    unsigned long start = micros();
+    while (digitalRead(LORA_DIO0_PIN) == LOW && micros() - start < 1000) {
+    }
+    if (digitalRead(LORA_DIO0_PIN) == HIGH) {
+        readLoRaInterruptFlags();
+    }
+    
+    bool detected = loraCadDone && loraCadDetected;
+    if (detected) {
+        LoRa.receive();
+    } else {
+        LoRa.sleep();
+    }
+    return detected;
 }
 
 bool isLoRaMessageAvailable() {
-    return LoRa.parsePacket() > 0;
+    return loraRxPacketSize > 0;
+}
+
+uint32_t parseLoRaHeaderZones(const uint8_t* header, size_t length) {
+    // Zone mask between '@' and ':'; frames without one are for every zone
+    uint32_t zones = 0;
+    bool addressed = false;
+    for (size_t i = 0; i < length && header[i] != ':'; i++) {
+        if (header[i] == '@') {
+            addressed = true;
+        } else if (addressed) {
+            uint8_t c = header[i];
+            uint8_t digit = c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+            zones = (zones << 4) | (digit & 0x0F);
+        }
+    }
+    return addressed ? zones : LORA_ZONE_ALL;
+}
+
+void captureLoRaReception(const uint8_t* packet, size_t length, size_t frameLength, uint8_t flags) {
+    // Radio registers are only read when the frame is kept
+    if (isLoRaCaptureEnabled()) {
+        captureLoRaFrame(packet, length, frameLength, flags, radioSpreadingFactor,
+                         LoRa.packetRssi(), LoRa.packetSnr(), LoRa.packetFrequencyError());
+    }
 }
 
 String receiveLoRaMessage() {
-    String message = "";
+    uint8_t packet[LORA_MAX_PACKET];
+    size_t frameLength = loraRxPacketSize;
+    
+    // Header first: frames for other zones go no further than these bytes
+    size_t length = min(frameLength, (size_t)LORA_HEADER_MAX);
+    readLoRaFifo(packet, length);
+    size_t headerLength = 0;
+    while (headerLength < length && packet[headerLength++] != ':') {
+    }
+    if (length > 0 && !(parseLoRaHeaderZones(packet, length) & loraZones)) {
+        loraChannelStats.rxFiltered++;
+        captureLoRaReception(packet, headerLength, frameLength, LORA_CAPTURE_FLAG_FILTERED);
+        loraRxPacketSize = 0;
+        return "";
+    }
+    
+    // Rest of the frame; signed frames end in a binary trailer
+    readLoRaFifo(packet + length, frameLength - length);
+    length = frameLength;
+    
+    loraRxPacketSize = 0;
+    
+    // Drop forged and replayed frames before anything acts on them, link statistics included
+    int textLength = length > 0 ? verifyLoRaFrame(packet, length) : 0;
+    if (length > 0) {
+        uint8_t verdict = textLength < 0 ? LORA_CAPTURE_FLAG_AUTH_FAILED
+                        : isFrameAuthEnabled() ? LORA_CAPTURE_FLAG_AUTH_OK : 0;
+        captureLoRaReception(packet, length, frameLength, verdict);
+    }
+    if (textLength > 0) {
+        lastPacketRssi = LoRa.packetRssi();
+        lastPacketSnr = LoRa.packetSnr();
+        lastPacketMillis = millis();
+    }
+    
+    // Firmware blocks are binary and go to the OTA module as they are
+    if (textLength > 2 && packet[0] == '0' + MSG_TYPE_OTA && packet[1] == ':') {
+        handleLoRaOtaFrame(packet + 2, textLength - 2);
+        return "";
+    }
     
-    // Read the message
-    while (LoRa.available()) {
-        message += (char)LoRa.read();
+    String message = "";
+    for (int i = 0; i < textLength; i++) {
+        message += (char)packet[i];
     }
     
     if (message.length() > 0) {
-        Serial.printf("LoRa message received: %s\n", message.c_str());
+        LOG_DEBUG(LOG_MODULE_LORA, "LoRa message received (RSSI %d, SNR %.1f): %s", lastPacketRssi, lastPacketSnr,
+                  message.c_str());
     }
     
     return message;
@@ -91,7 +730,8 @@ void onLoRaMessageReceived(const String& message) {
     // Parse message type and content
     int colonIndex = message.indexOf(':');
     if (colonIndex == -1) {
-        Serial.println("Invalid LoRa message format");
+        loraChannelStats.rxCorrupt++;
+        LOG_WARN(LOG_MODULE_LORA, "Invalid LoRa message format");
         return;
     }
     
@@ -100,10 +740,12 @@ void onLoRaMessageReceived(const String& message) {
     
     uint8_t type = strtol(typeStr.c_str(), NULL, 16);
     
-    Serial.printf("Processing LoRa message type: 0x%02X, content: %s\n", type, content.c_str());
+    LOG_DEBUG(LOG_MODULE_LORA, "Processing LoRa message type: 0x%02X, content: %s", type, content.c_str());
     
     switch (type) {
         case MSG_TYPE_GONG:
+            // Its counter goes to flash first, so after a reset a recording of it cannot ring again
+            persistFrameAuthSenders(true);
             handleGongMessage(content);
             break;
         case MSG_TYPE_SCHEDULE:
@@ -113,7 +755,8 @@ void onLoRaMessageReceived(const String& message) {
             handleStatusMessage(content);
             break;
         default:
-            Serial.printf("Unknown message type: 0x%02X\n", type);
+            loraChannelStats.rxCorrupt++;
+            LOG_WARN(LOG_MODULE_LORA, "Unknown message type: 0x%02X", type);
             break;
     }
 }
@@ -124,29 +767,193 @@ void handleGongMessage(const String& content) {
     DeserializationError error = deserializeJson(doc, content);
     
     if (error) {
-        Serial.println("Failed to parse gong message JSON");
+        LOG_WARN(LOG_MODULE_LORA, "Failed to parse gong message JSON");
         return;
     }
     
     // Check if this is a gong trigger
     if (doc.containsKey("type") && doc["type"] == "gong") {
-        Serial.println("Gong message received via LoRa - triggering local playback");
+        LOG_INFO(LOG_MODULE_LORA, "Gong message received via LoRa - triggering local playback");
         
         // Trigger local gong playback
-        if (onGongTrigger) {
-            onGongTrigger();
-        }
+        publishEvent(EVENT_GONG_REQUESTED, EVENT_SOURCE_LORA, 0, 0);
     }
 }
 
 void handleScheduleMessage(const String& content) {
     // Handle schedule synchronization messages
-    Serial.println("Schedule message received via LoRa");
-    // TODO: Implement schedule sync logic
+    handleScheduleSyncMessage(content);
 }
 
 void handleStatusMessage(const String& content) {
     // Handle status/health check messages
-    Serial.println("Status message received via LoRa");
-    // TODO: Implement status handling logic
+    handleNodeStatusMessage(content);
+}
+
+bool isLoRaMaster() {
+    return loraMaster;
+}
+
+uint32_t getLoRaZones() {
+    return loraZones;
+}
+
+uint32_t parseLoRaZones(JsonVariantConst zones) {
+    // [1, 3] -> bits 0 and 2; missing or empty means every zone
+    if (!zones.is<JsonArrayConst>()) {
+        return LORA_ZONE_ALL;
+    }
+    
+    uint32_t mask = 0;
+    for (JsonVariantConst zone : zones.as<JsonArrayConst>()) {
+        int number = zone | 0;
+        if (number >= 1 && number <= LORA_MAX_ZONES) {
+            mask |= 1UL << (number - 1);
+        }
+    }
+    return mask ? mask : LORA_ZONE_ALL;
+}
+
+void addLoRaZonesJSON(JsonObject obj, uint32_t zones) {
+    // Left out when the node or entry covers every zone
+    if (zones == LORA_ZONE_ALL) {
+        return;
+    }
+    
+    JsonArray array = obj.createNestedArray("zones");
+    for (uint8_t i = 0; i < LORA_MAX_ZONES; i++) {
+        if (zones & (1UL << i)) {
+            array.add(i + 1);
+        }
+    }
+}
+
+bool isLoRaReady() {
+    return loraReady;
+}
+
+bool isLoRaLowPower() {
+    return loraLowPower;
+}
+
+uint32_t getLoRaWakePeriod() {
+    return loraWakePeriod;
+}
+
+uint16_t getLoRaWakePreamble(int spreadingFactor, uint32_t wakePeriod) {
+    // Symbols in one wake period, rounded up, so any sample lands inside the preamble
+    uint64_t symbolsScaled = (uint64_t)wakePeriod * (uint64_t)LORA_BANDWIDTH;
+    uint64_t perSymbol = 1000ULL << spreadingFactor;
+    uint32_t symbols = (symbolsScaled + perSymbol - 1) / perSymbol + LORA_WAKE_PREAMBLE_MARGIN;
+    return (uint16_t)min(symbols, (uint32_t)0xFFFF);
+}
+
+uint16_t getLoRaNodeId() {
+    // Last two bytes of the factory MAC
+    return (uint16_t)(ESP.getEfuseMac() >> 32);
+}
+
+uint32_t getLoRaAirtimeUs(size_t payloadLength) {
+    return calculateLoRaAirtimeUs(payloadLength, loraSpreadingFactor);
+}
+
+uint32_t calculateLoRaAirtimeUs(size_t payloadLength, int spreadingFactor, long bandwidth,
+                               int codingRate, int preambleLength) {
+    // Time on air per SX1276 datasheet 4.1.1.7: explicit header, CRC off (library default).
+    // Kept in integers so the result is exact to the microsecond for any bandwidth.
+    const int sf = spreadingFactor;
+    const int lowDataRateOptimize = ((1000000LL << sf) / bandwidth) > 16000 ? 1 : 0;  // As the library sets it
+    
+    int numerator = 8 * (int)payloadLength - 4 * sf + 28;
+    int denominator = 4 * (sf - 2 * lowDataRateOptimize);
+    int payloadSymbols = 8 + max((numerator + denominator - 1) / denominator, 0) * codingRate;  // 4/codingRate
+    
+    // Symbols in quarters: preamble + 4.25 sync/SFD + payload
+    int64_t quarterSymbols = 4LL * (preambleLength + payloadSymbols) + 17;
+    return (uint32_t)(((quarterSymbols << sf) * 1000000LL) / (4LL * bandwidth));
+}
+
+void setLoRaProfile(int spreadingFactor, int txPower) {
+    loraSpreadingFactor = spreadingFactor;
+    loraTxPower = txPower;
+    
+    // A frame in flight or a CAD keeps its profile; their completion applies this one
+    if (!loraTransmitting && !loraCadPending) {
+        applyRadioProfile(spreadingFactor, txPower);
+        if (loraReady) {
+            LoRa.receive();
+        }
+    }
+}
+
+int getLoRaSpreadingFactor() {
+    return loraSpreadingFactor;
+}
+
+int getLoRaTxPower() {
+    return loraTxPower;
+}
+
+float getLoRaSnrFloor(int spreadingFactor) {
+    // Demodulation floor from the SX1276 datasheet: -7.5 dB at SF7, 2.5 dB lower per step
+    return -7.5f - 2.5f * (spreadingFactor - 7);
+}
+
+int getLastPacketRssi() {
+    return lastPacketRssi;
+}
+
+float getLastPacketSnr() {
+    return lastPacketSnr;
+}
+
+unsigned long getLastPacketMillis() {
+    return lastPacketMillis;
+}
+
+String getLoRaStatsJSON() {
+    static const char* classNames[LORA_TX_CLASSES] = {"gong", "schedule", "status", "bulk"};
+    
+    DynamicJsonDocument doc(2048);
+    doc["sf"] = loraSpreadingFactor;
+    doc["tx_power"] = loraTxPower;
+    doc["transmitting"] = loraTransmitting;
+    doc["queue_depth"] = loraTxQueueDepth;
+    doc["queue_capacity"] = LORA_TX_QUEUE_SIZE;
+    addLoRaZonesJSON(doc.as<JsonObject>(), loraZones);
+    
+    JsonObject dutyCycle = doc.createNestedObject("duty_cycle");
+    dutyCycle["used_ms"] = getLoRaDutyCycleUsedUs() / 1000;
+    dutyCycle["budget_ms"] = getLoRaDutyCycleBudgetUs() / 1000;
+    dutyCycle["window_s"] = LORA_DUTY_CYCLE_WINDOW / 1000;
+    dutyCycle["deferrals"] = loraChannelStats.dutyCycleDeferrals;
+    
+    JsonObject lbt = doc.createNestedObject("lbt");
+    lbt["cad_checks"] = loraChannelStats.cadChecks;
+    lbt["cad_busy"] = loraChannelStats.cadBusy;
+    lbt["forced"] = loraChannelStats.lbtForced;
+    lbt["backoff_ms"] = (uint32_t)loraChannelStats.backoffMs;
+    lbt["rx_corrupt"] = loraChannelStats.rxCorrupt;
+    lbt["rx_filtered"] = loraChannelStats.rxFiltered;
+    
+    addFrameAuthJSON(doc.createNestedObject("auth"));
+    addLoRaCaptureJSON(doc.createNestedObject("capture"));
+    
+    JsonObject classes = doc.createNestedObject("classes");
+    for (uint8_t i = 0; i < LORA_TX_CLASSES; i++) {
+        const LoRaTxClassStats& stats = loraTxStats[i];
+        JsonObject entry = classes.createNestedObject(classNames[i]);
+        entry["queued"] = stats.queued;
+        entry["sent"] = stats.sent;
+        entry["dropped"] = stats.dropped;
+        entry["timeouts"] = stats.timeouts;
+        entry["max_depth"] = stats.maxDepth;
+        entry["avg_wait_ms"] = stats.sent ? (uint32_t)(stats.waitMs / stats.sent) : 0;
+        entry["max_wait_ms"] = stats.maxWaitMs;
+        entry["airtime_ms"] = (uint32_t)(stats.airtimeUs / 1000);
+    }
+    
+    String result;
+    serializeJson(doc, result);
+    return result;
 }
@@ -0,0 +1,986 @@
+#include "loraota.h"
+#include "lorahandler.h"
+#include "frameauth.h"
+#include "mp3handler.h"
+#include "gongsynth.h"
+#include "logger.h"
+#include <SPIFFS.h>
+#include <Update.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include "rom/miniz.h"
+#include "mbedtls/sha256.h"
+
+// A slave in the master's table
+struct OtaNode {
+    uint16_t id;
+    uint8_t state;
+    uint16_t received;
+    uint8_t silentPolls;    // Announces since the last reply
+    bool answered;          // Replied to the current announce
+};
+
+LoRaOtaStats otaStats = {};
+
+// Session, as announced (both roles)
+uint8_t otaSession = 0;
+uint16_t otaBlockCount = 0;
+uint32_t otaPackageSize = 0;
+uint32_t otaImageSize = 0;
+uint8_t otaFlags = 0;
+uint8_t otaBaseDigest[OTA_ANNOUNCE_DIGEST_BYTES];
+uint8_t otaTargetDigest[OTA_ANNOUNCE_DIGEST_BYTES];
+unsigned long otaStartedAt = 0;
+
+// Master state
+bool otaMasterActive = false;
+File otaPackage;
+uint8_t otaSendMask[OTA_MAX_BLOCKS / 8];    // Blocks to send in the current pass
+uint16_t otaSendCursor = 0;
+unsigned long otaCollectUntil = 0;          // Replies to the last announce are due until then
+uint8_t otaCommitsLeft = 0;
+OtaNode otaNodes[OTA_MAX_NODES];
+uint8_t otaNodeCount = 0;
+
+// Slave state
+uint8_t otaState = OTA_STATE_IDLE;
+unsigned long otaLastFrameAt = 0;
+uint8_t otaReceived[OTA_MAX_BLOCKS / 8];
+uint16_t otaReceivedCount = 0;
+uint16_t otaSpillSlot[OTA_MAX_BLOCKS];      // Record in the spill file + 1; 0 = not spilled
+uint16_t otaSpillCount = 0;
+bool otaSpillFull = false;
+bool otaReplyPending = false;
+bool otaReplyCovered = false;               // Another slave already asked for our missing blocks
+unsigned long otaReplyAt = 0;
+bool otaRebootPending = false;
+unsigned long otaRebootAt = 0;
+
+// Decoder: package blocks in order -> inflate -> delta ops -> OTA partition
+uint16_t otaFeedBlock = 0;                  // Next block the decoder takes
+uint8_t otaInput[OTA_BLOCK_SIZE];
+size_t otaInputLength = 0;
+size_t otaInputPos = 0;
+uint32_t otaPackagePos = 0;                 // Package bytes consumed
+uint8_t otaHeader[OTA_HEADER_BYTES];
+tinfl_decompressor* otaInflator = nullptr;
+uint8_t* otaWindow = nullptr;               // Inflate dictionary, doubles as the output buffer
+size_t otaWindowPos = 0;
+size_t otaWindowAvail = 0;
+tinfl_status otaInflateStatus = TINFL_STATUS_NEEDS_MORE_INPUT;
+uint8_t otaOpHeader[9];
+uint8_t otaOpHeaderLength = 0;
+uint8_t otaOp = 0;
+uint32_t otaOpOffset = 0;
+uint32_t otaOpRemaining = 0;
+uint32_t otaWritten = 0;
+mbedtls_sha256_context otaSha;
+
+// Running image, hashed once per boot
+const esp_partition_t* otaRunning = nullptr;
+uint8_t otaRunningDigest[OTA_DIGEST_BYTES];
+bool otaRunningDigestKnown = false;
+
+const char* getOtaStateName(uint8_t state) {
+    static const char* names[] = {"idle", "receiving", "verified", "failed", "current", "wrong_base", "refused", "lost"};
+    return state < sizeof(names) / sizeof(names[0]) ? names[state] : "unknown";
+}
+
+uint16_t readOtaU16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+uint32_t readOtaU32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+void writeOtaU16(uint8_t* p, uint16_t value) {
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+}
+
+void writeOtaU32(uint8_t* p, uint32_t value) {
+    for (uint8_t i = 0; i < 4; i++) {
+        p[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+bool testOtaBit(const uint8_t* bitmap, uint16_t index) {
+    return bitmap[index >> 3] & (1 << (index & 7));
+}
+
+void setOtaBit(uint8_t* bitmap, uint16_t index) {
+    bitmap[index >> 3] |= 1 << (index & 7);
+}
+
+void clearOtaBit(uint8_t* bitmap, uint16_t index) {
+    bitmap[index >> 3] &= ~(1 << (index & 7));
+}
+
+size_t getOtaBlockLength(uint16_t index) {
+    return index + 1 < otaBlockCount ? OTA_BLOCK_SIZE : otaPackageSize - (uint32_t)index * OTA_BLOCK_SIZE;
+}
+
+uint32_t getOtaFrameAirtimeUs(size_t payloadLength, bool wake) {
+    // "4:" header, payload, trailer; wake frames carry the long preamble
+    int preamble = LORA_PREAMBLE_LENGTH;
+    if (wake && isLoRaMaster() && getLoRaWakePeriod() > 0) {
+        preamble = getLoRaWakePreamble(getLoRaSpreadingFactor(), getLoRaWakePeriod());
+    }
+    return calculateLoRaAirtimeUs(2 + payloadLength + getFrameAuthOverhead(), getLoRaSpreadingFactor(),
+                                  LORA_BANDWIDTH, LORA_CODING_RATE, preamble);
+}
+
+bool sendOtaFrame(const uint8_t* payload, size_t length, bool wake) {
+    if (!sendLoRaBinary(payload, length, MSG_TYPE_OTA, wake)) {
+        return false;
+    }
+    otaStats.txAirtimeUs += getOtaFrameAirtimeUs(length, wake);
+    return true;
+}
+
+const uint8_t* getOtaRunningDigest() {
+    // Hashing the running image takes a while; once per boot is enough
+    if (!otaRunningDigestKnown) {
+        otaRunning = esp_ota_get_running_partition();
+        otaRunningDigestKnown = otaRunning && esp_partition_get_sha256(otaRunning, otaRunningDigest) == ESP_OK;
+    }
+    return otaRunningDigestKnown ? otaRunningDigest : nullptr;
+}
+
+void setupLoRaOta() {
+    otaSession = random(1, 256);
+    
+    // Blocks parked by a transfer the last reboot cut short
+    if (SPIFFS.exists(OTA_SPILL_FILE)) {
+        SPIFFS.remove(OTA_SPILL_FILE);
+    }
+    
+    LOG_INFO(LOG_MODULE_OTA, "LoRa OTA initialized");
+}
+
+// Master side
+
+void resetOtaStats() {
+    uint32_t sessions = otaStats.sessions;
+    otaStats = {};
+    otaStats.sessions = sessions + 1;
+}
+
+void stopOtaDistribution() {
+    otaMasterActive = false;
+    otaCollectUntil = 0;
+    otaCommitsLeft = 0;
+    if (otaPackage) {
+        otaPackage.close();
+    }
+}
+
+bool startLoRaOta() {
+    if (!isLoRaMaster()) {
+        LOG_WARN(LOG_MODULE_OTA, "OTA: only the master distributes firmware");
+        return false;
+    }
+    if (otaMasterActive) {
+        LOG_WARN(LOG_MODULE_OTA, "OTA: a distribution is already running");
+        return false;
+    }
+    
+    otaPackage = SPIFFS.open(OTA_PACKAGE_FILE, "r");
+    uint8_t header[OTA_HEADER_BYTES];
+    if (!otaPackage || otaPackage.read(header, sizeof(header)) != sizeof(header) ||
+        memcmp(header, "GOTA", 4) != 0 || header[4] != OTA_PACKAGE_VERSION) {
+        LOG_WARN(LOG_MODULE_OTA, "OTA: no valid package in " OTA_PACKAGE_FILE);
+        stopOtaDistribution();
+        return false;
+    }
+    uint32_t packageSize = otaPackage.size();
+    uint32_t blocks = (packageSize + OTA_BLOCK_SIZE - 1) / OTA_BLOCK_SIZE;
+    if (blocks > OTA_MAX_BLOCKS) {
+        LOG_ERROR(LOG_MODULE_OTA, "OTA: package too large (%lu bytes)", (unsigned long)packageSize);
+        stopOtaDistribution();
+        return false;
+    }
+    
+    resetOtaStats();
+    otaSession = otaSession % 255 + 1;
+    otaBlockCount = blocks;
+    otaPackageSize = packageSize;
+    otaImageSize = readOtaU32(header + OTA_HEADER_IMAGE_SIZE);
+    otaFlags = header[5];
+    memcpy(otaBaseDigest, header + OTA_HEADER_BASE_DIGEST, OTA_ANNOUNCE_DIGEST_BYTES);
+    memcpy(otaTargetDigest, header + OTA_HEADER_TARGET_DIGEST, OTA_ANNOUNCE_DIGEST_BYTES);
+    otaStats.packageBytes = packageSize;
+    otaStats.blocks = blocks;
+    
+    // The first pass sends every block
+    memset(otaSendMask, 0, sizeof(otaSendMask));
+    for (uint16_t i = 0; i < otaBlockCount; i++) {
+        setOtaBit(otaSendMask, i);
+    }
+    otaSendCursor = 0;
+    otaNodeCount = 0;
+    otaCollectUntil = 0;
+    otaCommitsLeft = 0;
+    otaStartedAt = millis();
+    otaMasterActive = true;
+    
+    LOG_INFO(LOG_MODULE_OTA, "OTA session %02X: %lu-byte %s package, %u blocks", otaSession, (unsigned long)packageSize,
+             (otaFlags & OTA_FLAG_DELTA) ? "delta" : "full", otaBlockCount);
+    return true;
+}
+
+void cancelLoRaOta() {
+    if (otaMasterActive) {
+        stopOtaDistribution();
+        LOG_WARN(LOG_MODULE_OTA, "OTA session %02X cancelled", otaSession);
+    }
+}
+
+uint32_t getOtaCollectWindowMs() {
+    // Announce on air, every slave's jitter, and room for the last N frame
+    return getOtaFrameAirtimeUs(OTA_ANNOUNCE_BYTES, true) / 1000 + OTA_REPLY_JITTER +
+           2 * getOtaFrameAirtimeUs(OTA_REPLY_HEADER_BYTES + 2 + OTA_NACK_BLOCKS / 8, false) / 1000;
+}
+
+bool sendOtaAnnounce() {
+    uint8_t frame[OTA_ANNOUNCE_BYTES];
+    frame[0] = OTA_OP_ANNOUNCE;
+    frame[1] = otaSession;
+    writeOtaU16(frame + 2, otaBlockCount);
+    writeOtaU32(frame + 4, otaPackageSize);
+    writeOtaU32(frame + 8, otaImageSize);
+    frame[12] = otaFlags;
+    memcpy(frame + 13, otaBaseDigest, OTA_ANNOUNCE_DIGEST_BYTES);
+    memcpy(frame + 13 + OTA_ANNOUNCE_DIGEST_BYTES, otaTargetDigest, OTA_ANNOUNCE_DIGEST_BYTES);
+    
+    // Announces wake battery slaves; blocks only reach the ones that stayed up for them
+    if (!sendOtaFrame(frame, sizeof(frame), true)) {
+        return false;
+    }
+    otaStats.passes++;
+    for (uint8_t i = 0; i < otaNodeCount; i++) {
+        otaNodes[i].answered = false;
+    }
+    otaCollectUntil = millis() + getOtaCollectWindowMs();
+    return true;
+}
+
+bool sendOtaBlock(uint16_t index) {
+    uint8_t frame[4 + OTA_BLOCK_SIZE];
+    frame[0] = OTA_OP_BLOCK;
+    frame[1] = otaSession;
+    writeOtaU16(frame + 2, index);
+    
+    size_t length = getOtaBlockLength(index);
+    if (!otaPackage.seek((uint32_t)index * OTA_BLOCK_SIZE) || otaPackage.read(frame + 4, length) != length) {
+        LOG_ERROR(LOG_MODULE_OTA, "OTA: package read failed");
+        stopOtaDistribution();
+        return false;
+    }
+    if (!sendOtaFrame(frame, 4 + length, false)) {
+        return false;
+    }
+    
+    otaStats.blocksSent++;
+    if (otaStats.passes > 1) {
+        otaStats.blocksResent++;
+    }
+    return true;
+}
+
+int findNextOtaSendBlock() {
+    for (uint16_t i = otaSendCursor; i < otaBlockCount; i++) {
+        if (testOtaBit(otaSendMask, i)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+OtaNode* findOtaNode(uint16_t id) {
+    for (uint8_t i = 0; i < otaNodeCount; i++) {
+        if (otaNodes[i].id == id) {
+            return &otaNodes[i];
+        }
+    }
+    if (otaNodeCount == OTA_MAX_NODES) {
+        return nullptr;
+    }
+    
+    OtaNode& node = otaNodes[otaNodeCount++];
+    node = {};
+    node.id = id;
+    return &node;
+}
+
+void finishOtaDistribution() {
+    otaCollectUntil = 0;
+    
+    uint8_t verified = 0;
+    for (uint8_t i = 0; i < otaNodeCount; i++) {
+        if (otaNodes[i].state == OTA_STATE_VERIFIED) {
+            verified++;
+        }
+    }
+    otaStats.nodesUpdated = verified;
+    otaStats.durationMs = millis() - otaStartedAt;
+    
+    uint32_t airtimeMs = (otaStats.txAirtimeUs + otaStats.rxAirtimeUs) / 1000;
+    LOG_INFO(LOG_MODULE_OTA,
+             "OTA session %02X: %u of %u nodes verified after %u passes, %lu ms airtime (%lu ms per node)", otaSession,
+             verified, otaNodeCount, otaStats.passes, (unsigned long)airtimeMs,
+             (unsigned long)(verified ? airtimeMs / verified : 0));
+    
+    otaCommitsLeft = verified ? OTA_COMMIT_REPEATS : 0;
+    if (!otaCommitsLeft) {
+        stopOtaDistribution();
+    }
+}
+
+void finishOtaPoll() {
+    otaCollectUntil = 0;
+    
+    bool receiving = false;
+    for (uint8_t i = 0; i < otaNodeCount; i++) {
+        OtaNode& node = otaNodes[i];
+        if (node.state != OTA_STATE_RECEIVING) continue;
+        if (!node.answered && ++node.silentPolls >= OTA_MAX_SILENT_POLLS) {
+            node.state = OTA_STATE_LOST;
+            LOG_WARN(LOG_MODULE_OTA, "OTA: node %04X stopped answering", node.id);
+        } else {
+            receiving = true;
+        }
+    }
+    
+    // Done when nobody still needs blocks, or when the slow ones had their chances
+    if (!receiving || otaStats.passes >= OTA_MAX_PASSES) {
+        finishOtaDistribution();
+        return;
+    }
+    otaSendCursor = 0;
+}
+
+void handleOtaReply(const uint8_t* data, size_t length) {
+    if (!otaMasterActive || length < OTA_REPLY_HEADER_BYTES || data[1] != otaSession) {
+        return;
+    }
+    otaStats.rxAirtimeUs += getOtaFrameAirtimeUs(length, false);
+    
+    OtaNode* node = findOtaNode(readOtaU16(data + 2));
+    if (!node) {
+        return;
+    }
+    node->answered = true;
+    node->silentPolls = 0;
+    node->received = readOtaU16(data + 4);
+    
+    if (data[0] == OTA_OP_STATE && length > OTA_REPLY_HEADER_BYTES) {
+        node->state = data[OTA_REPLY_HEADER_BYTES];
+    } else if (data[0] == OTA_OP_MISSING && length > OTA_REPLY_HEADER_BYTES + 2) {
+        // Whatever anyone misses goes out once for everyone in the next pass
+        node->state = OTA_STATE_RECEIVING;
+        uint16_t first = readOtaU16(data + OTA_REPLY_HEADER_BYTES);
+        const uint8_t* bitmap = data + OTA_REPLY_HEADER_BYTES + 2;
+        uint32_t bits = (length - OTA_REPLY_HEADER_BYTES - 2) * 8;
+        for (uint32_t i = 0; i < bits && first + i < otaBlockCount; i++) {
+            if (testOtaBit(bitmap, i)) {
+                setOtaBit(otaSendMask, first + i);
+            }
+        }
+    }
+}
+
+void loopMasterOta() {
+    // One frame at a time, and only behind everything else the node has to say
+    if (!otaMasterActive || getLoRaTxQueueDepth() > 0) {
+        return;
+    }
+    
+    if (otaCommitsLeft > 0) {
+        uint8_t frame[2] = {OTA_OP_COMMIT, otaSession};
+        if (sendOtaFrame(frame, sizeof(frame), true) && --otaCommitsLeft == 0) {
+            LOG_INFO(LOG_MODULE_OTA, "OTA session %02X committed", otaSession);
+            stopOtaDistribution();
+        }
+        return;
+    }
+    
+    if (otaCollectUntil) {
+        if ((long)(millis() - otaCollectUntil) >= 0) {
+            finishOtaPoll();
+        }
+        return;
+    }
+    
+    // The first announce opens the session; after that, each pass's blocks and then the announce polling for the next
+    int block = otaStats.passes > 0 ? findNextOtaSendBlock() : -1;
+    if (block < 0) {
+        sendOtaAnnounce();
+        return;
+    }
+    if (sendOtaBlock(block)) {
+        clearOtaBit(otaSendMask, block);
+        otaSendCursor = block + 1;
+    }
+}
+
+// Slave side
+
+void endOtaDecoder(bool abortUpdate) {
+    if (otaInflator) {
+        mbedtls_sha256_free(&otaSha);
+    }
+    free(otaInflator);
+    free(otaWindow);
+    otaInflator = nullptr;
+    otaWindow = nullptr;
+    
+    if (abortUpdate && Update.isRunning()) {
+        Update.abort();
+    }
+    if (otaSpillCount > 0 || otaSpillFull) {
+        SPIFFS.remove(OTA_SPILL_FILE);
+    }
+    otaSpillCount = 0;
+    otaSpillFull = false;
+}
+
+void failOta(uint8_t state, const char* reason) {
+    LOG_ERROR(LOG_MODULE_OTA, "OTA session %02X failed: %s", otaSession, reason);
+    otaState = state;
+    endOtaDecoder(true);
+}
+
+uint8_t checkOtaEligibility() {
+    if (!isFrameAuthEnabled()) {
+        LOG_WARN(LOG_MODULE_OTA, "OTA refused: frame authentication is off");
+        return OTA_STATE_REFUSED;
+    }
+    if (otaBlockCount == 0 || otaBlockCount > OTA_MAX_BLOCKS ||
+        otaPackageSize > (uint32_t)otaBlockCount * OTA_BLOCK_SIZE ||
+        otaPackageSize <= (uint32_t)(otaBlockCount - 1) * OTA_BLOCK_SIZE) {
+        LOG_WARN(LOG_MODULE_OTA, "OTA refused: bad package size");
+        return OTA_STATE_REFUSED;
+    }
+    
+    const uint8_t* running = getOtaRunningDigest();
+    if (running && memcmp(running, otaTargetDigest, OTA_ANNOUNCE_DIGEST_BYTES) == 0) {
+        return OTA_STATE_CURRENT;
+    }
+    if ((otaFlags & OTA_FLAG_DELTA) && (!running || memcmp(running, otaBaseDigest, OTA_ANNOUNCE_DIGEST_BYTES) != 0)) {
+        return OTA_STATE_WRONG_BASE;
+    }
+    return OTA_STATE_RECEIVING;
+}
+
+void beginOtaSession(const uint8_t* announce) {
+    // A new session replaces whatever the last one left behind, verified image included
+    endOtaDecoder(true);
+    otaRebootPending = false;
+    
+    otaSession = announce[1];
+    otaBlockCount = readOtaU16(announce + 2);
+    otaPackageSize = readOtaU32(announce + 4);
+    otaImageSize = readOtaU32(announce + 8);
+    otaFlags = announce[12];
+    memcpy(otaBaseDigest, announce + 13, OTA_ANNOUNCE_DIGEST_BYTES);
+    memcpy(otaTargetDigest, announce + 13 + OTA_ANNOUNCE_DIGEST_BYTES, OTA_ANNOUNCE_DIGEST_BYTES);
+    
+    resetOtaStats();
+    otaStats.packageBytes = otaPackageSize;
+    otaStats.blocks = otaBlockCount;
+    memset(otaReceived, 0, sizeof(otaReceived));
+    memset(otaSpillSlot, 0, sizeof(otaSpillSlot));
+    otaReceivedCount = 0;
+    otaFeedBlock = 0;
+    otaInputLength = 0;
+    otaInputPos = 0;
+    otaPackagePos = 0;
+    otaWindowPos = 0;
+    otaWindowAvail = 0;
+    otaInflateStatus = TINFL_STATUS_NEEDS_MORE_INPUT;
+    otaOpHeaderLength = 0;
+    otaOpRemaining = 0;
+    otaWritten = 0;
+    otaStartedAt = millis();
+    
+    otaState = checkOtaEligibility();
+    if (otaState != OTA_STATE_RECEIVING) {
+        LOG_INFO(LOG_MODULE_OTA, "OTA session %02X: %s", otaSession, getOtaStateName(otaState));
+        return;
+    }
+    
+    otaInflator = (tinfl_decompressor*)malloc(sizeof(tinfl_decompressor));
+    otaWindow = (uint8_t*)malloc(TINFL_LZ_DICT_SIZE);
+    if (!otaInflator || !otaWindow) {
+        failOta(OTA_STATE_FAILED, "out of memory");
+        return;
+    }
+    tinfl_init(otaInflator);
+    mbedtls_sha256_init(&otaSha);
+    mbedtls_sha256_starts(&otaSha, 0);
+    
+    if (!Update.begin(otaImageSize)) {
+        failOta(OTA_STATE_FAILED, Update.errorString());
+        return;
+    }
+    
+    LOG_INFO(LOG_MODULE_OTA, "OTA session %02X: receiving %lu-byte %s package, %u blocks", otaSession,
+             (unsigned long)otaPackageSize, (otaFlags & OTA_FLAG_DELTA) ? "delta" : "full", otaBlockCount);
+}
+
+void handleOtaAnnounce(const uint8_t* data, size_t length) {
+    if (length < OTA_ANNOUNCE_BYTES) {
+        return;
+    }
+    if (data[1] != otaSession || otaState == OTA_STATE_IDLE) {
+        beginOtaSession(data);
+    }
+    otaLastFrameAt = millis();
+    
+    // Every announce is also a poll; jitter spreads the replies out
+    otaReplyPending = true;
+    otaReplyCovered = false;
+    otaReplyAt = millis() + random(1, OTA_REPLY_JITTER);
+}
+
+bool spillOtaBlock(uint16_t index, const uint8_t* data, size_t length) {
+    // Fixed-size records, so a block's slot gives its offset
+    if (otaSpillFull) {
+        return false;
+    }
+    uint8_t record[OTA_BLOCK_SIZE] = {0};
+    memcpy(record, data, length);
+    
+    File file = SPIFFS.open(OTA_SPILL_FILE, "a");
+    bool written = file && file.write(record, sizeof(record)) == sizeof(record);
+    if (file) {
+        file.close();
+    }
+    if (!written) {
+        // A short record would shift every later one; stop parking blocks for this session
+        LOG_ERROR(LOG_MODULE_OTA, "OTA: SPIFFS full, out-of-order blocks are dropped");
+        otaSpillFull = true;
+        return false;
+    }
+    
+    otaSpillSlot[index] = ++otaSpillCount;
+    otaStats.blocksSpilled++;
+    return true;
+}
+
+void handleOtaBlock(const uint8_t* data, size_t length) {
+    if (length < 5 || data[1] != otaSession || otaState != OTA_STATE_RECEIVING) {
+        return;
+    }
+    uint16_t index = readOtaU16(data + 2);
+    if (index >= otaBlockCount || length - 4 != getOtaBlockLength(index)) {
+        return;
+    }
+    otaLastFrameAt = millis();
+    
+    if (testOtaBit(otaReceived, index)) {
+        otaStats.blocksDuplicate++;
+        return;
+    }
+    
+    // The block the decoder waits for goes straight in; the rest wait in SPIFFS
+    if (index == otaFeedBlock && otaInputPos >= otaInputLength) {
+        memcpy(otaInput, data + 4, length - 4);
+        otaInputLength = length - 4;
+        otaInputPos = 0;
+        otaFeedBlock++;
+    } else if (!spillOtaBlock(index, data + 4, length - 4)) {
+        return;     // Asked for again after the pass
+    }
+    setOtaBit(otaReceived, index);
+    otaReceivedCount++;
+}
+
+bool loadOtaBlock() {
+    if (otaFeedBlock >= otaBlockCount || !testOtaBit(otaReceived, otaFeedBlock)) {
+        return false;
+    }
+    
+    uint16_t slot = otaSpillSlot[otaFeedBlock];
+    size_t length = getOtaBlockLength(otaFeedBlock);
+    bool loaded = false;
+    if (slot > 0) {
+        File file = SPIFFS.open(OTA_SPILL_FILE, "r");
+        loaded = file && file.seek((uint32_t)(slot - 1) * OTA_BLOCK_SIZE) && file.read(otaInput, length) == length;
+        if (file) {
+            file.close();
+        }
+    }
+    if (!loaded) {
+        // Lost from flash: forget it, so the next reply asks for it again
+        clearOtaBit(otaReceived, otaFeedBlock);
+        otaReceivedCount--;
+        otaSpillSlot[otaFeedBlock] = 0;
+        return false;
+    }
+    
+    otaInputLength = length;
+    otaInputPos = 0;
+    otaFeedBlock++;
+    return true;
+}
+
+void checkOtaHeader() {
+    if (memcmp(otaHeader, "GOTA", 4) != 0 || otaHeader[4] != OTA_PACKAGE_VERSION || otaHeader[5] != otaFlags ||
+        readOtaU32(otaHeader + OTA_HEADER_IMAGE_SIZE) != otaImageSize ||
+        memcmp(otaHeader + OTA_HEADER_TARGET_DIGEST, otaTargetDigest, OTA_ANNOUNCE_DIGEST_BYTES) != 0 ||
+        memcmp(otaHeader + OTA_HEADER_BASE_DIGEST, otaBaseDigest, OTA_ANNOUNCE_DIGEST_BYTES) != 0) {
+        failOta(OTA_STATE_FAILED, "package header does not match the announce");
+        return;
+    }
+    
+    // The announce only carries a prefix; a delta needs the whole base digest to match
+    if ((otaFlags & OTA_FLAG_DELTA) &&
+        memcmp(getOtaRunningDigest(), otaHeader + OTA_HEADER_BASE_DIGEST, OTA_DIGEST_BYTES) != 0) {
+        failOta(OTA_STATE_WRONG_BASE, "delta built against another image");
+    }
+}
+
+void inflateOtaInput() {
+    // The package header comes first, uncompressed
+    if (otaPackagePos < OTA_HEADER_BYTES) {
+        size_t count = min(otaInputLength - otaInputPos, (size_t)(OTA_HEADER_BYTES - otaPackagePos));
+        memcpy(otaHeader + otaPackagePos, otaInput + otaInputPos, count);
+        otaInputPos += count;
+        otaPackagePos += count;
+        if (otaPackagePos == OTA_HEADER_BYTES) {
+            checkOtaHeader();
+        }
+        return;
+    }
+    if (otaInflateStatus == TINFL_STATUS_DONE) {
+        failOta(OTA_STATE_FAILED, "data after the end of the package");
+        return;
+    }
+    
+    size_t inBytes = otaInputLength - otaInputPos;
+    size_t outBytes = TINFL_LZ_DICT_SIZE - otaWindowPos;
+    int flags = TINFL_FLAG_PARSE_ZLIB_HEADER;
+    if (otaFeedBlock < otaBlockCount) {
+        flags |= TINFL_FLAG_HAS_MORE_INPUT;
+    }
+    otaInflateStatus = tinfl_decompress(otaInflator, otaInput + otaInputPos, &inBytes, otaWindow,
+                                        otaWindow + otaWindowPos, &outBytes, flags);
+    otaInputPos += inBytes;
+    otaPackagePos += inBytes;
+    otaWindowAvail = outBytes;
+    if (otaInflateStatus < TINFL_STATUS_DONE) {
+        failOta(OTA_STATE_FAILED, "corrupt package");
+    }
+}
+
+bool writeOtaImage(const uint8_t* data, size_t length) {
+    if (Update.write((uint8_t*)data, length) != length) {
+        failOta(OTA_STATE_FAILED, Update.errorString());
+        return false;
+    }
+    mbedtls_sha256_update(&otaSha, data, length);
+    otaWritten += length;
+    return true;
+}
+
+size_t copyOtaImage(size_t budget) {
+    uint8_t buffer[256];
+    size_t count = min(min((size_t)otaOpRemaining, budget), sizeof(buffer));
+    if (esp_partition_read(otaRunning, otaOpOffset, buffer, count) != ESP_OK) {
+        failOta(OTA_STATE_FAILED, "running image read failed");
+        return 0;
+    }
+    if (!writeOtaImage(buffer, count)) {
+        return 0;
+    }
+    otaOpOffset += count;
+    otaOpRemaining -= count;
+    return count;
+}
+
+size_t parseOtaOp(const uint8_t* data, size_t available) {
+    size_t used = 0;
+    while (used < available) {
+        otaOpHeader[otaOpHeaderLength++] = data[used++];
+        uint8_t needed = otaOpHeader[0] == OTA_DELTA_COPY ? 9 : otaOpHeader[0] == OTA_DELTA_LITERAL ? 5 : 0;
+        if (needed == 0) {
+            failOta(OTA_STATE_FAILED, "bad delta op");
+            return used;
+        }
+        if (otaOpHeaderLength < needed) continue;
+        
+        otaOpHeaderLength = 0;
+        otaOp = otaOpHeader[0];
+        if (otaOp == OTA_DELTA_COPY) {
+            otaOpOffset = readOtaU32(otaOpHeader + 1);
+            otaOpRemaining = readOtaU32(otaOpHeader + 5);
+            if (!otaRunning || otaOpRemaining > otaRunning->size || otaOpOffset > otaRunning->size - otaOpRemaining) {
+                failOta(OTA_STATE_FAILED, "copy outside the running image");
+                return used;
+            }
+        } else {
+            otaOpRemaining = readOtaU32(otaOpHeader + 1);
+        }
+        if (otaOpRemaining > otaImageSize - otaWritten) {
+            failOta(OTA_STATE_FAILED, "delta op runs past the image");
+        }
+        break;
+    }
+    return used;
+}
+
+void finishOtaImage() {
+    uint8_t digest[OTA_DIGEST_BYTES];
+    mbedtls_sha256_finish(&otaSha, digest);
+    endOtaDecoder(false);
+    otaStats.durationMs = millis() - otaStartedAt;
+    
+    if (memcmp(digest, otaHeader + OTA_HEADER_IMAGE_SHA, OTA_DIGEST_BYTES) != 0) {
+        failOta(OTA_STATE_FAILED, "image SHA-256 mismatch");
+        return;
+    }
+    otaState = OTA_STATE_VERIFIED;
+    LOG_INFO(LOG_MODULE_OTA, "OTA session %02X: image verified (%lu bytes in %lu ms), waiting for the commit",
+             otaSession, (unsigned long)otaWritten, (unsigned long)otaStats.durationMs);
+    
+    // Tell the master now rather than at its next announce
+    otaReplyPending = true;
+    otaReplyCovered = false;
+    otaReplyAt = millis() + random(1, OTA_REPLY_JITTER);
+}
+
+void stepOtaDecoder() {
+    // Bounded work per loop keeps gongs and the radio on time during a transfer
+    size_t budget = OTA_DECODE_BUDGET;
+    while (otaState == OTA_STATE_RECEIVING && otaWritten < otaImageSize) {
+        if (otaOpRemaining > 0 && otaOp == OTA_DELTA_COPY) {
+            size_t copied = budget > 0 ? copyOtaImage(budget) : 0;
+            if (copied == 0) return;
+            budget -= copied;
+            continue;
+        }
+        
+        if (otaWindowAvail > 0) {
+            const uint8_t* data = otaWindow + otaWindowPos;
+            size_t used;
+            if (otaOpRemaining > 0) {
+                if (budget == 0) return;
+                used = min(min(otaWindowAvail, (size_t)otaOpRemaining), budget);
+                if (!writeOtaImage(data, used)) return;
+                otaOpRemaining -= used;
+                budget -= used;
+            } else {
+                used = parseOtaOp(data, otaWindowAvail);
+                if (otaState != OTA_STATE_RECEIVING) return;
+            }
+            otaWindowPos = (otaWindowPos + used) & (TINFL_LZ_DICT_SIZE - 1);
+            otaWindowAvail -= used;
+            continue;
+        }
+        
+        if (otaInputPos < otaInputLength || otaInflateStatus == TINFL_STATUS_HAS_MORE_OUTPUT) {
+            inflateOtaInput();
+            continue;
+        }
+        if (otaFeedBlock >= otaBlockCount) {
+            failOta(OTA_STATE_FAILED, "package ends before the image");
+            return;
+        }
+        if (!loadOtaBlock()) {
+            return;     // Waiting for the next block
+        }
+    }
+    
+    if (otaState == OTA_STATE_RECEIVING) {
+        finishOtaImage();
+    }
+}
+
+void handleOtaCommit(const uint8_t* data, size_t length) {
+    if (length < 2 || data[1] != otaSession || otaState != OTA_STATE_VERIFIED || otaRebootPending) {
+        return;
+    }
+    // Staggered, so the whole network does not drop off at once
+    otaRebootPending = true;
+    otaRebootAt = millis() + random(1, OTA_REBOOT_JITTER);
+}
+
+void handleOverheardMissing(const uint8_t* data, size_t length) {
+    // Another slave's N frame covering all we miss makes ours redundant
+    if (!otaReplyPending || otaState != OTA_STATE_RECEIVING || length <= OTA_REPLY_HEADER_BYTES + 2 ||
+        data[1] != otaSession) {
+        return;
+    }
+    uint16_t first = readOtaU16(data + OTA_REPLY_HEADER_BYTES);
+    const uint8_t* bitmap = data + OTA_REPLY_HEADER_BYTES + 2;
+    uint32_t end = min((uint32_t)otaBlockCount, first + (uint32_t)(length - OTA_REPLY_HEADER_BYTES - 2) * 8);
+    
+    for (uint32_t i = 0; i < end; i++) {
+        if (!testOtaBit(otaReceived, i) && (i < first || !testOtaBit(bitmap, i - first))) {
+            return;
+        }
+    }
+    otaReplyCovered = true;
+}
+
+void sendOtaReply() {
+    otaReplyPending = false;
+    
+    uint8_t frame[OTA_REPLY_HEADER_BYTES + 2 + OTA_NACK_BLOCKS / 8];
+    frame[1] = otaSession;
+    writeOtaU16(frame + 2, getLoRaNodeId());
+    writeOtaU16(frame + 4, otaReceivedCount);
+    
+    // Missing blocks from the first gap on, unless another slave asked for them already
+    int first = -1;
+    if (otaState == OTA_STATE_RECEIVING && !otaReplyCovered) {
+        for (uint16_t i = 0; i < otaBlockCount; i++) {
+            if (!testOtaBit(otaReceived, i)) {
+                first = i;
+                break;
+            }
+        }
+    }
+    
+    if (first < 0) {
+        frame[0] = OTA_OP_STATE;
+        frame[OTA_REPLY_HEADER_BYTES] = otaState;
+        sendOtaFrame(frame, OTA_REPLY_HEADER_BYTES + 1, false);
+        return;
+    }
+    
+    uint16_t bits = min(otaBlockCount - first, OTA_NACK_BLOCKS);
+    uint8_t* bitmap = frame + OTA_REPLY_HEADER_BYTES + 2;
+    memset(bitmap, 0, (bits + 7) / 8);
+    for (uint16_t i = 0; i < bits; i++) {
+        if (!testOtaBit(otaReceived, first + i)) {
+            setOtaBit(bitmap, i);
+        }
+    }
+    frame[0] = OTA_OP_MISSING;
+    writeOtaU16(frame + OTA_REPLY_HEADER_BYTES, first);
+    sendOtaFrame(frame, OTA_REPLY_HEADER_BYTES + 2 + (bits + 7) / 8, false);
+}
+
+void rebootIntoOtaImage() {
+    otaRebootPending = false;
+    if (!Update.end()) {
+        LOG_ERROR(LOG_MODULE_OTA, "OTA image rejected: %s", Update.errorString());
+        otaState = OTA_STATE_FAILED;
+        return;
+    }
+    LOG_INFO(LOG_MODULE_OTA, "OTA: rebooting into the new firmware");
+    flushLog();
+    delay(100);
+    ESP.restart();
+}
+
+void loopSlaveOta() {
+    if (otaState == OTA_STATE_RECEIVING) {
+        stepOtaDecoder();
+    }
+    
+    if ((otaState == OTA_STATE_RECEIVING || otaState == OTA_STATE_VERIFIED) &&
+        millis() - otaLastFrameAt > OTA_SESSION_TIMEOUT) {
+        failOta(OTA_STATE_FAILED, "master went quiet");
+        otaRebootPending = false;
+    }
+    
+    if (otaReplyPending && (long)(millis() - otaReplyAt) >= 0) {
+        sendOtaReply();
+    }
+    
+    // Never reboot in the middle of a gong
+    if (otaRebootPending && (long)(millis() - otaRebootAt) >= 0 && !isPlaying() && !isGongSynthPlaying()) {
+        rebootIntoOtaImage();
+    }
+}
+
+void loopLoRaOta() {
+    if (isLoRaMaster()) {
+        loopMasterOta();
+    } else {
+        loopSlaveOta();
+    }
+}
+
+void handleLoRaOtaFrame(const uint8_t* data, size_t length) {
+    if (length < 2) {
+        return;
+    }
+    
+    if (isLoRaMaster()) {
+        if (data[0] == OTA_OP_STATE || data[0] == OTA_OP_MISSING) {
+            handleOtaReply(data, length);
+        }
+        return;
+    }
+    
+    switch (data[0]) {
+        case OTA_OP_ANNOUNCE:
+            handleOtaAnnounce(data, length);
+            break;
+        case OTA_OP_BLOCK:
+            handleOtaBlock(data, length);
+            break;
+        case OTA_OP_COMMIT:
+            handleOtaCommit(data, length);
+            break;
+        case OTA_OP_MISSING:
+            handleOverheardMissing(data, length);
+            break;
+    }
+}
+
+bool isLoRaOtaActive() {
+    // Battery slaves stay awake for the blocks, which carry no wake preamble
+    return isLoRaMaster() ? otaMasterActive : otaState == OTA_STATE_RECEIVING;
+}
+
+const LoRaOtaStats& getLoRaOtaStats() {
+    return otaStats;
+}
+
+String getLoRaOtaJSON() {
+    DynamicJsonDocument doc(6144);
+    doc["active"] = isLoRaOtaActive();
+    doc["session"] = otaSession;
+    doc["sessions"] = otaStats.sessions;
+    doc["package_bytes"] = otaStats.packageBytes;
+    doc["image_bytes"] = otaImageSize;
+    doc["delta"] = (otaFlags & OTA_FLAG_DELTA) != 0;
+    doc["blocks"] = otaStats.blocks;
+    doc["tx_airtime_ms"] = (uint32_t)(otaStats.txAirtimeUs / 1000);
+    doc["duration_ms"] = otaMasterActive ? millis() - otaStartedAt : otaStats.durationMs;
+    
+    if (isLoRaMaster()) {
+        uint32_t airtimeMs = (otaStats.txAirtimeUs + otaStats.rxAirtimeUs) / 1000;
+        doc["passes"] = otaStats.passes;
+        doc["blocks_sent"] = otaStats.blocksSent;
+        doc["blocks_resent"] = otaStats.blocksResent;
+        doc["rx_airtime_ms"] = (uint32_t)(otaStats.rxAirtimeUs / 1000);
+        doc["nodes_updated"] = otaStats.nodesUpdated;
+        doc["airtime_per_node_ms"] = otaStats.nodesUpdated ? airtimeMs / otaStats.nodesUpdated : 0;
+        
+        JsonArray nodes = doc.createNestedArray("nodes");
+        for (uint8_t i = 0; i < otaNodeCount; i++) {
+            JsonObject node = nodes.createNestedObject();
+            node["id"] = String(otaNodes[i].id, HEX);
+            node["state"] = getOtaStateName(otaNodes[i].state);
+            node["received"] = otaNodes[i].received;
+        }
+    } else {
+        doc["state"] = getOtaStateName(otaState);
+        doc["received"] = otaReceivedCount;
+        doc["blocks_spilled"] = otaStats.blocksSpilled;
+        doc["blocks_duplicate"] = otaStats.blocksDuplicate;
+        doc["written"] = otaWritten;
+    }
+    
+    String json;
+    serializeJson(doc, json);
+    return json;
+}
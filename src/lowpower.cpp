@@ -0,0 +1,147 @@
+#include "lowpower.h"
+#include "lorahandler.h"
+#include "mp3handler.h"
+#include "gongsynth.h"
+#include "loraota.h"
+#include "logger.h"
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+
+// Awake for a frame announced by a detected preamble
+unsigned long lplListenStart = 0;
+unsigned long lplListenUntil = 0;
+unsigned long lplLastSampleMicros = 0;
+unsigned long lplLastAccountedMicros = 0;
+
+// Counters
+uint32_t lplSamples = 0;
+uint32_t lplDetections = 0;
+uint32_t lplFalseWakes = 0;        // Preamble detected, no frame followed
+uint32_t lplMaxRxDelayMs = 0;      // Detection to frame received
+uint64_t lplSleepUs = 0;
+uint64_t lplAwakeUs = 0;
+
+uint32_t getCadDurationUs(int spreadingFactor) {
+    // A CAD takes about two symbols
+    return (uint32_t)((2000000ULL << spreadingFactor) / (uint64_t)LORA_BANDWIDTH);
+}
+
+float getModeledCurrentMa(uint32_t wakePeriod, int spreadingFactor) {
+    // Idle channel: sleep floor plus one CAD sample per period
+    uint32_t cadUs = getCadDurationUs(spreadingFactor);
+    float sampleCharge = LPL_ESP_ACTIVE_MA * (LPL_WAKE_OVERHEAD_US + cadUs) + LPL_RADIO_RX_MA * cadUs;
+    return LPL_ESP_SLEEP_MA + sampleCharge / (wakePeriod * 1000.0f);
+}
+
+uint32_t getWorstWakeLatencyMs(uint32_t wakePeriod, int spreadingFactor) {
+    // The frame ends at the same time wherever the sample hit its preamble
+    uint32_t airtimeUs = calculateLoRaAirtimeUs(LPL_GONG_FRAME_BYTES, spreadingFactor, LORA_BANDWIDTH, LORA_CODING_RATE,
+                                                getLoRaWakePreamble(spreadingFactor, wakePeriod));
+    return (airtimeUs + LPL_WAKE_OVERHEAD_US + 999) / 1000;
+}
+
+void setupLowPower() {
+    if (!isLoRaLowPower()) {
+        return;
+    }
+    
+    setCpuFrequencyMhz(LPL_CPU_FREQ_MHZ);
+    
+    // DIO0 signals CAD done and RX done
+    gpio_wakeup_enable((gpio_num_t)LORA_DIO0_PIN, GPIO_INTR_HIGH_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+    
+    lplLastSampleMicros = micros();
+    lplLastAccountedMicros = micros();
+    
+    LOG_INFO(LOG_MODULE_POWER, "Low-power listening: %lu ms wake period, worst-case gong latency %lu ms",
+             (unsigned long)getLoRaWakePeriod(),
+             (unsigned long)getWorstWakeLatencyMs(getLoRaWakePeriod(), getLoRaSpreadingFactor()));
+}
+
+void lightSleepFor(uint32_t sleepUs) {
+    unsigned long start = micros();
+    esp_sleep_enable_timer_wakeup(sleepUs);
+    esp_light_sleep_start();
+    lplSleepUs += micros() - start;
+}
+
+void loopLowPower() {
+    if (!isLoRaLowPower()) {
+        return;
+    }
+    
+    if (lplListenUntil) {
+        if (getLastPacketMillis() != 0 && (long)(getLastPacketMillis() - lplListenStart) >= 0) {
+            lplMaxRxDelayMs = max(lplMaxRxDelayMs, (uint32_t)(getLastPacketMillis() - lplListenStart));
+            lplListenUntil = 0;
+        } else if ((long)(millis() - lplListenUntil) >= 0) {
+            lplFalseWakes++;
+            lplListenUntil = 0;
+        } else {
+            return;
+        }
+    }
+    
+    // Stay up while anything is queued, on air or playing, and through firmware transfers
+    if (!isLoRaIdle() || isPlaying() || isGongSynthPlaying() || isLoRaOtaActive()) {
+        return;
+    }
+    
+    lplAwakeUs += micros() - lplLastAccountedMicros;
+    
+    // Sleep out the rest of the period, radio off
+    uint32_t periodUs = getLoRaWakePeriod() * 1000;
+    uint32_t elapsedUs = micros() - lplLastSampleMicros;
+    sleepLoRa();
+    Serial.flush();
+    if (elapsedUs < periodUs) {
+        lightSleepFor(periodUs - elapsedUs);
+    }
+    
+    // Sample; CAD done on DIO0 or the timeout wakes us
+    lplLastSampleMicros = micros();
+    lplSamples++;
+    startLoRaChannelSample();
+    lightSleepFor(LORA_CAD_TIMEOUT * 1000UL);
+    
+    if (finishLoRaChannelSample()) {
+        // Preamble of at most one period, then the longest frame
+        lplDetections++;
+        lplListenStart = millis();
+        lplListenUntil = millis() + getLoRaWakePeriod() + calculateLoRaAirtimeUs(LORA_MAX_PACKET, getLoRaSpreadingFactor()) / 1000;
+    }
+    
+    lplLastAccountedMicros = micros();
+}
+
+void addLowPowerJSON(JsonObject obj) {
+    obj["low_power"] = isLoRaLowPower();
+    obj["wake_period_ms"] = getLoRaWakePeriod();
+    if (!isLoRaLowPower()) {
+        return;
+    }
+    
+    int spreadingFactor = getLoRaSpreadingFactor();
+    uint64_t totalUs = lplSleepUs + lplAwakeUs;
+    float chargeUsMa = lplSleepUs * LPL_ESP_SLEEP_MA + lplAwakeUs * (LPL_ESP_ACTIVE_MA + LPL_RADIO_RX_MA) +
+                       (float)lplSamples * getCadDurationUs(spreadingFactor) * LPL_RADIO_RX_MA;
+    
+    JsonObject lpl = obj.createNestedObject("lpl");
+    lpl["samples"] = lplSamples;
+    lpl["detections"] = lplDetections;
+    lpl["false_wakes"] = lplFalseWakes;
+    lpl["max_rx_delay_ms"] = lplMaxRxDelayMs;
+    lpl["sleep_ratio"] = totalUs ? (float)lplSleepUs / totalUs : 0;
+    lpl["avg_current_ma"] = totalUs ? chargeUsMa / totalUs : 0;
+    
+    // Idle-channel model for other periods at the current SF
+    static const uint32_t periods[] = {250, 500, 1000, 2000, 4000};
+    JsonArray model = lpl.createNestedArray("model");
+    for (uint32_t period : periods) {
+        JsonObject entry = model.createNestedObject();
+        entry["wake_period_ms"] = period;
+        entry["avg_current_ma"] = getModeledCurrentMa(period, spreadingFactor);
+        entry["worst_latency_ms"] = getWorstWakeLatencyMs(period, spreadingFactor);
+    }
+}
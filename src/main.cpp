@@ -1,55 +1,39 @@
 #include <Arduino.h>
 #include <SPIFFS.h>
 #include "webhandler.h"
-#include "lorahandler.h"
-#include "mp3handler.h"
-#include "schedule.h"
-
-// Global state
-unsigned long lastScheduleCheck = 0;
-const unsigned long SCHEDULE_CHECK_INTERVAL = 1000; // Check every second
+#include "lowpower.h"
+#include "tasks.h"
+#include "boot.h"
+#include "logger.h"
 
 void setup() {
+    // Room for the log to be printed without waiting on the UART
+    Serial.setTxBufferSize(LOG_SERIAL_TX_BUFFER);
     Serial.begin(115200);
     Serial.println("\n=== ESP32 Gong/Ring System ===");
     
-    // Initialize SPIFFS first
-    if (!SPIFFS.begin(true)) {
-        Serial.println("SPIFFS initialization failed!");
-        return;
-    }
-    
-    // Initialize all modules
-    setupWiFi();
-    setupWebServer();
-    setupLoRa();
-    setupMP3();
-    setupSchedule();
-    
-    // Set up callbacks
-    onGongTrigger = playGong;
+    // Storage, configuration and every module, in stages (boot.h); a missing peripheral leaves the node degraded
+    bootSystem();
     
-    Serial.println("System initialization complete!");
+    LOG_INFO(LOG_MODULE_MAIN, "System initialization complete!");
+    flushLog();
 }
 
 void loop() {
-    // Handle web server
-    loopWebServer();
-    
-    // Handle LoRa communication
-    loopLoRa();
-    
-    // Handle MP3 module
-    loopMP3();
-    
-    // Check schedule periodically
-    if (millis() - lastScheduleCheck >= SCHEDULE_CHECK_INTERVAL) {
-        checkSchedule();
-        lastScheduleCheck = millis();
+    // Everything runs in its own task; the loop task has nothing left to do
+    if (areTasksRunning()) {
+        vTaskDelete(NULL);
     }
     
-    // Small delay to prevent watchdog issues
-    delay(10);
+    // Battery slaves: one pass of each task's work in turn
+    runRadioPass();
+    runAudioPass();
+    runSchedulerPass();
+    loopLog();
+    
+    // Battery slaves sleep between channel samples
+    loopLowPower();
+    delay(1);
 }
 
 // Additional utility functions
@@ -1,111 +1,913 @@
 #include "mp3handler.h"
+#include "configstore.h"
+#include "logger.h"
 #include <Arduino.h>
+#include <ArduinoJson.h>
 #include <HardwareSerial.h>
+#include <SPIFFS.h>
 
-// Use Hardware Serial 2 for MP3 communication
+// Use Hardware Serial 2 for MP3 communication, or SoftwareSerial where it is not available
+#ifdef USE_SOFTWARE_SERIAL
+#include <SoftwareSerial.h>
+SoftwareSerial MP3Serial(MP3_RX_PIN, MP3_TX_PIN);
+#else
 HardwareSerial MP3Serial(2);
+#endif
+
+// When the last gong was played (0 = never)
+unsigned long lastGongMillis = 0;
 
-// MP3 command packet structure
-struct MP3Command {
-    uint8_t start;
-    uint8_t version;
-    uint8_t length;
+// Queued command
+struct MP3QueuedCommand {
     uint8_t command;
-    uint8_t data;
-    uint8_t checksum;
+    uint16_t param;
+};
+
+MP3QueuedCommand mp3Queue[MP3_QUEUE_SIZE];
+uint8_t mp3QueueHead = 0;
+uint8_t mp3QueueDepth = 0;
+
+// Command at the queue head, once sent
+bool mp3CommandInFlight = false;
+bool mp3ResendPending = false;  // The module asked for it again
+unsigned long mp3ResendDelay = 0;
+uint8_t mp3Attempts = 0;
+unsigned long mp3SentAt = 0;
+unsigned long mp3LastFrameAt = 0;
+
+// Response being assembled byte by byte
+uint8_t mp3RxFrame[MP3_FRAME_BYTES];
+uint8_t mp3RxLength = 0;
+
+MP3Status mp3Status = {};
+MP3DriverStats mp3Stats = {};
+
+// BUSY edges, set by the interrupt handler and taken by loopMP3()
+volatile bool mp3BusyFell = false;
+volatile bool mp3BusyRose = false;
+volatile unsigned long mp3BusyFellMicros = 0;
+volatile unsigned long mp3BusyRoseMicros = 0;
+
+MP3Playback mp3Playback = {};
+MP3PlaybackStats mp3PlaybackStats = {};
+void (*onMP3Playback)(uint8_t state, uint16_t track) = nullptr;
+void (*onMP3Message)(uint8_t command, uint16_t param) = nullptr;
+
+// "mp3" section of gong.conf
+struct MP3Settings {
+    uint8_t leadIns;
+    struct {
+        uint16_t track;
+        uint16_t ms;
+    } leadIn[MP3_CALIBRATED_TRACKS];
 };
 
+// Start latency per track, saved now and then
+MP3TrackCalibration mp3Calibration[MP3_CALIBRATED_TRACKS];
+uint8_t mp3CalibrationCount = 0;
+bool mp3CalibrationDirty = false;
+unsigned long mp3CalibrationSavedAt = 0;
+
+// Volume ramp or fade-out in progress
+MP3VolumeRamp mp3Ramp = {};
+unsigned long mp3RampSteppedAt = 0;
+
+// Amplifier enable, when fitted
+bool mp3AmpOn = false;
+unsigned long mp3AmpLastActive = 0;
+
+// Module supply, when switched; commands wait while it boots
+bool mp3PowerOn = true;
+bool mp3PowerReady = true;
+unsigned long mp3PowerOnAt = 0;
+unsigned long mp3PowerLastActive = 0;
+
+const char* const mp3StateNames[MP3_STATES] = {"idle", "starting", "playing", "finished", "failed"};
+
+void IRAM_ATTR onMP3Busy() {
+    // BUSY is low while a track plays
+    if (digitalRead(MP3_BUSY_PIN) == LOW) {
+        mp3BusyFellMicros = micros();
+        mp3BusyFell = true;
+    } else {
+        mp3BusyRoseMicros = micros();
+        mp3BusyRose = true;
+    }
+}
+
+MP3TrackCalibration* findMP3Calibration(uint16_t track, bool create) {
+    for (uint8_t i = 0; i < mp3CalibrationCount; i++) {
+        if (mp3Calibration[i].track == track) {
+            return &mp3Calibration[i];
+        }
+    }
+    if (!create) {
+        return nullptr;
+    }
+    
+    // A full table gives up the track measured least
+    MP3TrackCalibration* entry = &mp3Calibration[mp3CalibrationCount];
+    if (mp3CalibrationCount < MP3_CALIBRATED_TRACKS) {
+        mp3CalibrationCount++;
+    } else {
+        entry = &mp3Calibration[0];
+        for (uint8_t i = 1; i < mp3CalibrationCount; i++) {
+            if (mp3Calibration[i].samples < entry->samples) {
+                entry = &mp3Calibration[i];
+            }
+        }
+    }
+    *entry = {};
+    entry->track = track;
+    return entry;
+}
+
+const char* parseMP3Settings(JsonVariantConst json, void* settings) {
+    MP3Settings& mp3 = *(MP3Settings*)settings;
+    mp3.leadIns = 0;
+    for (JsonPairConst item : json["lead_in"].as<JsonObjectConst>()) {
+        int track = atoi(item.key().c_str());
+        int leadInMs = item.value() | -1;
+        if (track < 1 || track > MP3_MAX_TRACK) {
+            return "lead_in track is 1-3000";
+        }
+        if (leadInMs < 0 || leadInMs > MP3_MAX_LEAD_IN) {
+            return "lead_in is 0-2000 ms";
+        }
+        if (mp3.leadIns == MP3_CALIBRATED_TRACKS) {
+            return "lead_in for 16 tracks at most";
+        }
+        mp3.leadIn[mp3.leadIns].track = track;
+        mp3.leadIn[mp3.leadIns].ms = leadInMs;
+        mp3.leadIns++;
+    }
+    return nullptr;
+}
+
+void loadMP3LeadIns() {
+    // Again on every change to the "mp3" section; the measured latencies stay
+    MP3Settings settings;
+    loadConfigSection(CONFIG_SECTION_MP3, &settings, sizeof(settings), parseMP3Settings);
+    for (uint8_t i = 0; i < mp3CalibrationCount; i++) {
+        mp3Calibration[i].leadInMs = 0;
+    }
+    for (uint8_t i = 0; i < settings.leadIns; i++) {
+        setMP3LeadIn(settings.leadIn[i].track, settings.leadIn[i].ms);
+    }
+}
+
+void loadMP3Config() {
+    // Lead-ins from gong.conf, then the start latencies measured before
+    loadMP3LeadIns();
+    if (!SPIFFS.exists(MP3_CALIBRATION_FILE)) {
+        return;
+    }
+    File file = SPIFFS.open(MP3_CALIBRATION_FILE, "r");
+    if (!file) {
+        return;
+    }
+    DynamicJsonDocument doc(2048);
+    DeserializationError error = deserializeJson(doc, file);
+    file.close();
+    
+    if (error) {
+        LOG_ERROR(LOG_MODULE_MP3, "Failed to parse MP3 calibration file");
+        return;
+    }
+    
+    for (JsonObjectConst item : doc.as<JsonArrayConst>()) {
+        uint16_t track = item["track"] | 0;
+        if (track < 1 || track > MP3_MAX_TRACK) {
+            continue;
+        }
+        MP3TrackCalibration* entry = findMP3Calibration(track, true);
+        entry->latencyUs = item["latency_us"] | 0;
+        entry->samples = item["samples"] | 0;
+    }
+}
+
+void saveMP3Calibration() {
+    File file = SPIFFS.open(MP3_CALIBRATION_FILE, "w");
+    if (!file) {
+        LOG_ERROR(LOG_MODULE_MP3, "Failed to open MP3 calibration file for writing");
+        return;
+    }
+    
+    DynamicJsonDocument doc(2048);
+    JsonArray array = doc.to<JsonArray>();
+    for (uint8_t i = 0; i < mp3CalibrationCount; i++) {
+        if (mp3Calibration[i].samples == 0) {
+            continue;
+        }
+        JsonObject item = array.createNestedObject();
+        item["track"] = mp3Calibration[i].track;
+        item["latency_us"] = mp3Calibration[i].latencyUs;
+        item["samples"] = mp3Calibration[i].samples;
+    }
+    
+    serializeJson(doc, file);
+    file.close();
+    mp3CalibrationDirty = false;
+    mp3CalibrationSavedAt = max(millis(), 1UL);
+}
+
+void recordMP3Latency(uint16_t track, uint32_t latencyUs) {
+    MP3TrackCalibration* entry = findMP3Calibration(track, true);
+    if (entry->samples == 0) {
+        entry->latencyUs = latencyUs;
+    } else {
+        entry->latencyUs += ((float)latencyUs - entry->latencyUs) * MP3_LATENCY_EWMA_WEIGHT;
+    }
+    entry->samples++;
+    mp3CalibrationDirty = true;
+}
+
 void setupMP3() {
-    // Initialize Hardware Serial 2 for MP3 communication
+    loadMP3Config();
+
+#ifdef USE_SOFTWARE_SERIAL
+    MP3Serial.begin(9600);
+#else
     MP3Serial.begin(9600, SERIAL_8N1, MP3_RX_PIN, MP3_TX_PIN);
-    
+#endif
+
     // Configure BUSY pin as input with pull-up
     pinMode(MP3_BUSY_PIN, INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(MP3_BUSY_PIN), onMP3Busy, CHANGE);
+    if (MP3_AMP_PIN >= 0) {
+        pinMode(MP3_AMP_PIN, OUTPUT);
+        digitalWrite(MP3_AMP_PIN, LOW);
+    }
+    if (MP3_POWER_PIN >= 0) {
+        pinMode(MP3_POWER_PIN, OUTPUT);
+        mp3PowerOn = false;
+        wakeMP3Module();
+    }
     
-    // Set initial volume (0-30)
+    // Set initial volume (0-30); the commands go out from loopMP3()
     setVolume(20);
+    queryMP3TrackCount();
+    
+    LOG_INFO(LOG_MODULE_MP3, "MP3 module initialized");
+}
+
+uint16_t getMP3Checksum(const uint8_t* frame) {
+    uint16_t sum = 0;
+    for (uint8_t i = 1; i < 7; i++) {
+        sum += frame[i];
+    }
+    return -sum;
+}
+
+void buildMP3Frame(uint8_t* frame, uint8_t command, uint16_t param, bool feedback) {
+    frame[0] = MP3_FRAME_START;
+    frame[1] = MP3_FRAME_VERSION;
+    frame[2] = MP3_FRAME_LENGTH;
+    frame[3] = command;
+    frame[4] = feedback ? 1 : 0;
+    frame[5] = param >> 8;
+    frame[6] = param & 0xFF;
+    uint16_t checksum = getMP3Checksum(frame);
+    frame[7] = checksum >> 8;
+    frame[8] = checksum & 0xFF;
+    frame[9] = MP3_FRAME_END;
+}
+
+bool isMP3Query(uint8_t command) {
+    // Queries are answered with a frame of the same command instead of an ACK
+    return command >= 0x3C && command <= 0x4F;
+}
+
+bool queueMP3Command(uint8_t command, uint16_t param) {
+    wakeMP3Module();
+    if (mp3QueueDepth >= MP3_QUEUE_SIZE) {
+        mp3Stats.queueFull++;
+        LOG_WARN(LOG_MODULE_MP3, "MP3 queue full, command 0x%02X dropped", command);
+        return false;
+    }
+    
+    MP3QueuedCommand& entry = mp3Queue[(mp3QueueHead + mp3QueueDepth) % MP3_QUEUE_SIZE];
+    entry.command = command;
+    entry.param = param;
+    mp3QueueDepth++;
+    return true;
+}
+
+void sendMP3Frame() {
+    const MP3QueuedCommand& entry = mp3Queue[mp3QueueHead];
+    uint8_t frame[MP3_FRAME_BYTES];
+    buildMP3Frame(frame, entry.command, entry.param, !isMP3Query(entry.command));
+    MP3Serial.write(frame, MP3_FRAME_BYTES);
+    
+    mp3CommandInFlight = true;
+    mp3ResendPending = false;
+    mp3Attempts++;
+    mp3SentAt = millis();
+    mp3LastFrameAt = mp3SentAt;
+    mp3Stats.framesSent++;
+    
+    // Latency is measured from the frame the module acted on, so the latest one
+    if (entry.command == MP3_CMD_PLAY_TRACK && entry.param == mp3Playback.track &&
+        mp3Playback.state == MP3_STATE_STARTING) {
+        mp3Playback.commandMicros = max(micros(), 1UL);
+    }
+    
+    LOG_DEBUG(LOG_MODULE_MP3, "MP3 Command sent: 0x%02X, Data: 0x%04X%s", entry.command, entry.param,
+              mp3Attempts > 1 ? " (retry)" : "");
+}
+
+void setMP3PlaybackState(uint8_t state) {
+    mp3Playback.state = state;
+    mp3Playback.stateMillis[state] = millis();
+    LOG_DEBUG(LOG_MODULE_MP3, "MP3 playback %s (track %u)", mp3StateNames[state], mp3Playback.track);
+    if (onMP3Playback) {
+        onMP3Playback(state, mp3Playback.track);
+    }
+}
+
+void failMP3Playback() {
+    mp3PlaybackStats.failed++;
+    mp3Playback.strikesLeft = 0;
+    setMP3PlaybackState(MP3_STATE_FAILED);
+}
+
+void finishMP3Playback(unsigned long endMicros) {
+    mp3Playback.endMicros = endMicros;
+    mp3Playback.lastTrack = mp3Playback.track;
+    mp3Playback.lastDurationMs = mp3Playback.edgeStart ? (endMicros - mp3Playback.startMicros) / 1000 : 0;
+    mp3PlaybackStats.finished++;
+    setMP3PlaybackState(MP3_STATE_FINISHED);
+    
+    // The next strike goes out right away instead of waiting for a poll
+    if (mp3Playback.strikesLeft > 0) {
+        mp3Playback.strikesLeft--;
+        playTrack(MP3_GONG_TRACK);
+        lastGongMillis = millis();
+    }
+}
+
+void finishMP3Command(bool ok) {
+    // A play command the module rejected or never answered will not start
+    const MP3QueuedCommand& entry = mp3Queue[mp3QueueHead];
+    if (!ok && entry.command == MP3_CMD_PLAY_TRACK && entry.param == mp3Playback.track &&
+        mp3Playback.state == MP3_STATE_STARTING) {
+        failMP3Playback();
+    }
+    mp3CommandInFlight = false;
+    mp3ResendPending = false;
+    mp3Attempts = 0;
+    mp3QueueHead = (mp3QueueHead + 1) % MP3_QUEUE_SIZE;
+    mp3QueueDepth--;
+}
+
+void completeMP3Command() {
+    uint32_t replyMs = millis() - mp3SentAt;
+    mp3Stats.commands++;
+    mp3Stats.maxReplyMs = max(mp3Stats.maxReplyMs, replyMs);
+    finishMP3Command(true);
+}
+
+void handleMP3Error(uint8_t code) {
+    mp3Status.lastError = code;
+    LOG_ERROR(LOG_MODULE_MP3, "MP3 module error 0x%02X", code);
+    if (!mp3CommandInFlight) {
+        return;
+    }
+    
+    // Transient errors get the command resent; the others would fail again
+    if ((code == MP3_ERROR_BUSY || code == MP3_ERROR_SERIAL || code == MP3_ERROR_CHECKSUM) &&
+        mp3Attempts <= MP3_MAX_RETRIES) {
+        mp3ResendPending = true;
+        mp3ResendDelay = code == MP3_ERROR_BUSY ? MP3_BUSY_RETRY_DELAY : MP3_COMMAND_GAP;
+        return;
+    }
+    mp3Stats.failed++;
+    finishMP3Command(false);
+}
+
+void handleMP3Frame(const uint8_t* frame) {
+    uint8_t command = frame[3];
+    uint16_t param = (frame[5] << 8) | frame[6];
+    mp3Stats.framesReceived++;
+    mp3Status.online = true;
+    
+    bool answersQuery = mp3CommandInFlight && isMP3Query(command) && mp3Queue[mp3QueueHead].command == command;
+    switch (command) {
+        case MP3_MSG_ACK:
+            if (mp3CommandInFlight && !isMP3Query(mp3Queue[mp3QueueHead].command)) {
+                completeMP3Command();
+            }
+            break;
+        case MP3_MSG_ERROR:
+            handleMP3Error(param);
+            break;
+        case MP3_MSG_TRACK_FINISHED:
+            // Only ends a playback that started; the module sends this twice,
+            // and the repeat must not end the strike that followed
+            mp3Status.lastTrackFinished = param;
+            if (mp3Playback.state == MP3_STATE_PLAYING && param == mp3Playback.track) {
+                finishMP3Playback(micros());
+            }
+            break;
+        case MP3_MSG_ONLINE:
+            // Power-up or reset: the volume and card contents may have changed
+            if (!mp3PowerReady) {
+                mp3PowerReady = true;
+                mp3Stats.maxBootMs = max(mp3Stats.maxBootMs, (uint32_t)(millis() - mp3PowerOnAt));
+            }
+            LOG_INFO(LOG_MODULE_MP3, "MP3 module online");
+            queryMP3Volume();
+            queryMP3TrackCount();
+            break;
+        case MP3_MSG_CARD_INSERTED:
+            queryMP3TrackCount();
+            break;
+        case MP3_MSG_CARD_REMOVED:
+            mp3Status.trackCount = 0;
+            break;
+        case MP3_CMD_QUERY_STATUS:
+            mp3Status.playbackStatus = param;
+            break;
+        case MP3_CMD_QUERY_VOLUME:
+            mp3Status.volume = param;
+            break;
+        case MP3_CMD_QUERY_TRACKS:
+            mp3Status.trackCount = param;
+            break;
+    }
+    if (answersQuery) {
+        completeMP3Command();
+    }
+    if (onMP3Message) {
+        onMP3Message(command, param);
+    }
+}
+
+bool isValidMP3Frame(const uint8_t* frame) {
+    uint16_t checksum = (frame[7] << 8) | frame[8];
+    return frame[1] == MP3_FRAME_VERSION && frame[2] == MP3_FRAME_LENGTH && frame[9] == MP3_FRAME_END &&
+           checksum == getMP3Checksum(frame);
+}
+
+void parseMP3Byte(uint8_t b) {
+    if (mp3RxLength == 0 && b != MP3_FRAME_START) {
+        return;
+    }
+    mp3RxFrame[mp3RxLength++] = b;
+    if (mp3RxLength < MP3_FRAME_BYTES) {
+        return;
+    }
     
-    Serial.println("MP3 module initialized");
+    mp3RxLength = 0;
+    if (isValidMP3Frame(mp3RxFrame)) {
+        handleMP3Frame(mp3RxFrame);
+        return;
+    }
+    
+    // Resynchronize on the next start byte inside the rejected frame
+    mp3Stats.badFrames++;
+    uint8_t rest[MP3_FRAME_BYTES - 1];
+    memcpy(rest, mp3RxFrame + 1, sizeof(rest));
+    for (uint8_t i = 0; i < sizeof(rest); i++) {
+        if (rest[i] == MP3_FRAME_START) {
+            for (uint8_t j = i; j < sizeof(rest); j++) {
+                parseMP3Byte(rest[j]);
+            }
+            break;
+        }
+    }
 }
 
-void sendMP3Command(uint8_t command, uint8_t data = 0) {
-    MP3Command cmd;
-    cmd.start = 0x7E;
-    cmd.version = 0xFF;
-    cmd.length = 0x06;
-    cmd.command = command;
-    cmd.data = data;
-    cmd.checksum = 0xFF - (cmd.version + cmd.length + cmd.command + cmd.data);
+bool sendMP3Volume(uint8_t volume) {
+    volume = min(volume, (uint8_t)MP3_MAX_VOLUME);
     
-    MP3Serial.write((uint8_t*)&cmd, sizeof(cmd));
+    // A volume frame still waiting at the tail of the queue is brought up to
+    // date; one in flight, or one with other commands queued behind it, is not
+    if (mp3QueueDepth > 0) {
+        uint8_t tail = (mp3QueueHead + mp3QueueDepth - 1) % MP3_QUEUE_SIZE;
+        bool inFlight = mp3QueueDepth == 1 && mp3CommandInFlight;
+        if (mp3Queue[tail].command == MP3_CMD_SET_VOL && !inFlight) {
+            mp3Queue[tail].param = volume;
+            mp3Status.volume = volume;
+            mp3Stats.volumeCoalesced++;
+            return true;
+        }
+    }
     
-    Serial.printf("MP3 Command sent: 0x%02X, Data: 0x%02X\n", command, data);
+    if (!queueMP3Command(MP3_CMD_SET_VOL, volume)) {
+        return false;
+    }
+    mp3Status.volume = volume;
+    return true;
 }
 
 void playGong() {
-    // Play track 1 (assuming gong sound is stored as first track)
-    playTrack(1);
+    playGongStrikes(1);
+}
+
+void playGongStrikes(uint8_t strikes) {
+    // The gong sound is stored as the first track; further strikes follow
+    // the moment the previous one ends
+    mp3Playback.strikesLeft = constrain(strikes, 1, MP3_MAX_STRIKES) - 1;
+    playTrack(MP3_GONG_TRACK);
+    lastGongMillis = millis();
 }
 
-void playTrack(uint8_t trackNumber) {
-    if (trackNumber < 1 || trackNumber > 3000) {
-        Serial.println("Invalid track number");
+void playTrack(uint16_t trackNumber) {
+    if (trackNumber < 1 || trackNumber > MP3_MAX_TRACK) {
+        LOG_WARN(LOG_MODULE_MP3, "Invalid track number");
         return;
     }
     
-    sendMP3Command(MP3_CMD_PLAY_TRACK, trackNumber);
+    // A new play ends a fade-out, at the volume it would have come back to
+    if (mp3Ramp.active && mp3Ramp.stopAtEnd) {
+        mp3Ramp.active = false;
+        sendMP3Volume(mp3Ramp.restoreVolume);
+    }
+    
+    uint8_t strikesLeft = mp3Playback.strikesLeft;
+    if (!queueMP3Command(MP3_CMD_PLAY_TRACK, trackNumber)) {
+        failMP3Playback();
+        return;
+    }
+    wakeMP3Amplifier();
+    mp3Playback.track = trackNumber;
+    mp3Playback.strikesLeft = strikesLeft;
+    mp3Playback.commandMicros = 0;
+    mp3Playback.startMicros = 0;
+    mp3Playback.endMicros = 0;
+    mp3Playback.edgeStart = false;
+    setMP3PlaybackState(MP3_STATE_STARTING);
 }
 
 void setVolume(uint8_t volume) {
-    if (volume > 30) {
-        volume = 30;
+    // Replaces a ramp in progress; a fade-out still stops the playback
+    if (mp3Ramp.active && mp3Ramp.stopAtEnd) {
+        mp3Ramp.restoreVolume = min(volume, (uint8_t)MP3_MAX_VOLUME);
+        return;
+    }
+    mp3Ramp.active = false;
+    if (sendMP3Volume(volume)) {
+        LOG_DEBUG(LOG_MODULE_MP3, "MP3 volume set to: %d", mp3Status.volume);
+    }
+}
+
+void rampVolume(uint8_t volume, uint32_t durationMs) {
+    volume = min(volume, (uint8_t)MP3_MAX_VOLUME);
+    if (durationMs == 0 || volume == mp3Status.volume) {
+        setVolume(volume);
+        return;
+    }
+    mp3Ramp.active = true;
+    mp3Ramp.from = mp3Status.volume;
+    mp3Ramp.to = volume;
+    mp3Ramp.startMillis = millis();
+    mp3Ramp.durationMs = durationMs;
+    mp3Ramp.stopAtEnd = false;
+    mp3RampSteppedAt = 0;
+    LOG_INFO(LOG_MODULE_MP3, "MP3 volume ramp %d -> %d over %u ms", mp3Ramp.from, volume, durationMs);
+}
+
+void fadeOutPlayback(uint32_t durationMs, int16_t restoreVolume) {
+    if (!isPlaying()) {
+        return;
+    }
+    uint8_t restore = restoreVolume >= 0 ? restoreVolume : (mp3Ramp.active ? mp3Ramp.to : mp3Status.volume);
+    mp3Ramp.active = true;
+    mp3Ramp.from = mp3Status.volume;
+    mp3Ramp.to = 0;
+    mp3Ramp.startMillis = millis();
+    mp3Ramp.durationMs = durationMs;
+    mp3Ramp.stopAtEnd = true;
+    mp3Ramp.restoreVolume = min(restore, (uint8_t)MP3_MAX_VOLUME);
+    mp3RampSteppedAt = 0;
+    LOG_INFO(LOG_MODULE_MP3, "MP3 fade-out over %u ms", durationMs);
+}
+
+void finishMP3Ramp() {
+    // Fade-out done, or the track ended first: stop, then the volume back
+    // for the next play
+    mp3Ramp.active = false;
+    if (mp3Ramp.stopAtEnd) {
+        if (isPlaying()) {
+            stopPlayback();
+        }
+        sendMP3Volume(mp3Ramp.restoreVolume);
+        return;
+    }
+    sendMP3Volume(mp3Ramp.to);
+}
+
+void updateMP3Ramp() {
+    if (!mp3Ramp.active) {
+        return;
+    }
+    unsigned long elapsed = millis() - mp3Ramp.startMillis;
+    if (elapsed >= mp3Ramp.durationMs || (mp3Ramp.stopAtEnd && !isPlaying())) {
+        finishMP3Ramp();
+        return;
+    }
+    if (mp3RampSteppedAt != 0 && millis() - mp3RampSteppedAt < MP3_RAMP_STEP_INTERVAL) {
+        return;
     }
     
-    sendMP3Command(MP3_CMD_SET_VOL, volume);
-    Serial.printf("MP3 volume set to: %d\n", volume);
+    int16_t span = (int16_t)mp3Ramp.to - mp3Ramp.from;
+    uint8_t level = mp3Ramp.from + span * (int32_t)elapsed / (int32_t)mp3Ramp.durationMs;
+    if (level != mp3Status.volume) {
+        sendMP3Volume(level);
+        mp3RampSteppedAt = max(millis(), 1UL);
+    }
+}
+
+bool isVolumeRamping() {
+    return mp3Ramp.active;
+}
+
+const MP3VolumeRamp& getMP3VolumeRamp() {
+    return mp3Ramp;
 }
 
 void stopPlayback() {
-    sendMP3Command(MP3_CMD_STOP);
-    Serial.println("MP3 playback stopped");
+    mp3Playback.strikesLeft = 0;
+    if (mp3Playback.state == MP3_STATE_STARTING || mp3Playback.state == MP3_STATE_PLAYING) {
+        setMP3PlaybackState(MP3_STATE_IDLE);
+    }
+    queueMP3Command(MP3_CMD_STOP);
+    LOG_INFO(LOG_MODULE_MP3, "MP3 playback stopped");
+}
+
+bool queryMP3Status() {
+    return queueMP3Command(MP3_CMD_QUERY_STATUS);
+}
+
+bool queryMP3Volume() {
+    return queueMP3Command(MP3_CMD_QUERY_VOLUME);
+}
+
+bool queryMP3TrackCount() {
+    return queueMP3Command(MP3_CMD_QUERY_TRACKS);
+}
+
+bool isMP3Idle() {
+    return mp3QueueDepth == 0;
 }
 
 bool isPlaying() {
-    // BUSY pin is LOW when playing, HIGH when stopped
-    return !digitalRead(MP3_BUSY_PIN);
+    // From the play command on, so a gong about to sound counts as playing
+    return mp3Playback.state == MP3_STATE_STARTING || mp3Playback.state == MP3_STATE_PLAYING;
 }
 
-void loopMP3() {
-    // Handle any incoming MP3 responses if needed
-    if (MP3Serial.available()) {
-        String response = MP3Serial.readString();
-        Serial.printf("MP3 Response: %s\n", response.c_str());
+unsigned long getLastGongMillis() {
+    return lastGongMillis;
+}
+
+const MP3Status& getMP3Status() {
+    return mp3Status;
+}
+
+const MP3DriverStats& getMP3DriverStats() {
+    return mp3Stats;
+}
+
+const MP3Playback& getMP3Playback() {
+    return mp3Playback;
+}
+
+const MP3PlaybackStats& getMP3PlaybackStats() {
+    return mp3PlaybackStats;
+}
+
+const MP3TrackCalibration* getMP3Calibration(uint16_t track) {
+    return findMP3Calibration(track, false);
+}
+
+uint32_t getMP3PreRoll(uint16_t track) {
+    // How long before the audible strike its play frame has to go out
+    const MP3TrackCalibration* entry = findMP3Calibration(track, false);
+    if (!entry) {
+        return MP3_DEFAULT_START_LATENCY;
     }
+    uint32_t latencyMs = entry->samples > 0 ? (entry->latencyUs + 500) / 1000 : MP3_DEFAULT_START_LATENCY;
+    return latencyMs + entry->leadInMs;
 }
 
-// Alternative implementation using SoftwareSerial if Hardware Serial 2 is not available
-#ifdef USE_SOFTWARE_SERIAL
-#include <SoftwareSerial.h>
-SoftwareSerial MP3SerialSoft(MP3_RX_PIN, MP3_TX_PIN);
+void setMP3LeadIn(uint16_t track, uint16_t leadInMs) {
+    if (track < 1 || track > MP3_MAX_TRACK) {
+        return;
+    }
+    findMP3Calibration(track, true)->leadInMs = leadInMs;
+}
 
-void setupMP3Soft() {
-    MP3SerialSoft.begin(9600);
-    pinMode(MP3_BUSY_PIN, INPUT_PULLUP);
-    setVolume(20);
-    Serial.println("MP3 module initialized (Software Serial)");
+void wakeMP3Amplifier() {
+    mp3AmpLastActive = millis();
+    if (MP3_AMP_PIN < 0 || mp3AmpOn) {
+        return;
+    }
+    digitalWrite(MP3_AMP_PIN, HIGH);
+    mp3AmpOn = true;
+}
+
+bool isMP3AmplifierOn() {
+    return mp3AmpOn;
+}
+
+void wakeMP3Module() {
+    mp3PowerLastActive = millis();
+    if (MP3_POWER_PIN < 0 || mp3PowerOn) {
+        return;
+    }
+    digitalWrite(MP3_POWER_PIN, HIGH);
+    mp3PowerOn = true;
+    mp3PowerReady = false;
+    mp3PowerOnAt = millis();
+    mp3Stats.powerUps++;
+    LOG_DEBUG(LOG_MODULE_MP3, "MP3 module powered up");
+    
+    // It boots at its default volume; the one set last goes out first
+    if (mp3Status.volume > 0) {
+        queueMP3Command(MP3_CMD_SET_VOL, mp3Status.volume);
+    }
+}
+
+void sleepMP3Module() {
+    digitalWrite(MP3_POWER_PIN, LOW);
+    mp3PowerOn = false;
+    mp3PowerReady = false;
+    mp3RxLength = 0;
+    LOG_DEBUG(LOG_MODULE_MP3, "MP3 module powered down");
+}
+
+bool isMP3ModuleOn() {
+    return mp3PowerOn;
 }
 
-void sendMP3CommandSoft(uint8_t command, uint8_t data = 0) {
-    MP3Command cmd;
-    cmd.start = 0x7E;
-    cmd.version = 0xFF;
-    cmd.length = 0x06;
-    cmd.command = command;
-    cmd.data = data;
-    cmd.checksum = 0xFF - (cmd.version + cmd.length + cmd.command + cmd.data);
+bool isMP3ModuleReady() {
+    return mp3PowerOn && mp3PowerReady;
+}
+
+String getMP3StatusJSON() {
+    DynamicJsonDocument doc(3072);
+    doc["online"] = mp3Status.online;
+    doc["playing"] = isPlaying();
+    doc["volume"] = mp3Status.volume;
+    doc["tracks"] = mp3Status.trackCount;
+    doc["status"] = mp3Status.playbackStatus;
+    doc["last_track_finished"] = mp3Status.lastTrackFinished;
+    doc["last_error"] = mp3Status.lastError;
+    doc["queue_depth"] = mp3QueueDepth;
+    
+    JsonObject stats = doc.createNestedObject("driver");
+    stats["commands"] = mp3Stats.commands;
+    stats["frames_sent"] = mp3Stats.framesSent;
+    stats["retries"] = mp3Stats.retries;
+    stats["timeouts"] = mp3Stats.timeouts;
+    stats["failed"] = mp3Stats.failed;
+    stats["queue_full"] = mp3Stats.queueFull;
+    stats["volume_coalesced"] = mp3Stats.volumeCoalesced;
+    stats["frames_received"] = mp3Stats.framesReceived;
+    stats["bad_frames"] = mp3Stats.badFrames;
+    stats["max_reply_ms"] = mp3Stats.maxReplyMs;
+    
+    JsonObject playback = doc.createNestedObject("playback");
+    playback["state"] = mp3StateNames[mp3Playback.state];
+    playback["track"] = mp3Playback.track;
+    playback["strikes_left"] = mp3Playback.strikesLeft;
+    playback["since_ms"] = millis() - mp3Playback.stateMillis[mp3Playback.state];
+    if (mp3Playback.endMicros && mp3Playback.startMicros) {
+        playback["duration_ms"] = (mp3Playback.endMicros - mp3Playback.startMicros) / 1000;
+    }
+    playback["started"] = mp3PlaybackStats.started;
+    playback["finished"] = mp3PlaybackStats.finished;
+    playback["failed"] = mp3PlaybackStats.failed;
+    playback["latency_ms"] = mp3PlaybackStats.lastLatencyUs / 1000.0;
+    playback["max_latency_ms"] = mp3PlaybackStats.maxLatencyUs / 1000.0;
+    if (mp3PlaybackStats.latencySamples > 0) {
+        playback["avg_latency_ms"] = mp3PlaybackStats.latencyUs / 1000.0 / mp3PlaybackStats.latencySamples;
+    }
+    doc["amplifier"] = mp3AmpOn;
+    doc["module_power"] = mp3PowerOn;
+    doc["module_ready"] = mp3PowerReady;
+    stats["power_ups"] = mp3Stats.powerUps;
+    stats["max_boot_ms"] = mp3Stats.maxBootMs;
+    if (mp3Ramp.active) {
+        JsonObject ramp = doc.createNestedObject("ramp");
+        ramp["from"] = mp3Ramp.from;
+        ramp["to"] = mp3Ramp.to;
+        ramp["remaining_ms"] = mp3Ramp.durationMs - min((uint32_t)(millis() - mp3Ramp.startMillis), mp3Ramp.durationMs);
+        ramp["fade_out"] = mp3Ramp.stopAtEnd;
+    }
     
-    MP3SerialSoft.write((uint8_t*)&cmd, sizeof(cmd));
+    JsonArray calibration = doc.createNestedArray("calibration");
+    for (uint8_t i = 0; i < mp3CalibrationCount; i++) {
+        JsonObject item = calibration.createNestedObject();
+        item["track"] = mp3Calibration[i].track;
+        item["latency_ms"] = mp3Calibration[i].latencyUs / 1000.0;
+        item["lead_in_ms"] = mp3Calibration[i].leadInMs;
+        item["samples"] = mp3Calibration[i].samples;
+        item["pre_roll_ms"] = getMP3PreRoll(mp3Calibration[i].track);
+    }
     
-    Serial.printf("MP3 Command sent (Soft): 0x%02X, Data: 0x%02X\n", command, data);
+    String result;
+    serializeJson(doc, result);
+    return result;
+}
+
+void updateMP3Playback() {
+    // BUSY edges from the interrupt handler
+    noInterrupts();
+    bool fell = mp3BusyFell;
+    bool rose = mp3BusyRose;
+    unsigned long fellMicros = mp3BusyFellMicros;
+    unsigned long roseMicros = mp3BusyRoseMicros;
+    mp3BusyFell = false;
+    mp3BusyRose = false;
+    interrupts();
+    
+    // A fall only counts once the play frame is out, not for the track before
+    if (fell && mp3Playback.state == MP3_STATE_STARTING && mp3Playback.commandMicros &&
+        (long)(fellMicros - mp3Playback.commandMicros) >= 0) {
+        uint32_t latencyUs = fellMicros - mp3Playback.commandMicros;
+        mp3Playback.startMicros = fellMicros;
+        mp3PlaybackStats.started++;
+        mp3PlaybackStats.latencySamples++;
+        mp3PlaybackStats.latencyUs += latencyUs;
+        mp3PlaybackStats.lastLatencyUs = latencyUs;
+        mp3PlaybackStats.maxLatencyUs = max(mp3PlaybackStats.maxLatencyUs, latencyUs);
+        recordMP3Latency(mp3Playback.track, latencyUs);
+        mp3Playback.edgeStart = true;
+        setMP3PlaybackState(MP3_STATE_PLAYING);
+    }
+    if (rose && mp3Playback.state == MP3_STATE_PLAYING && (long)(roseMicros - mp3Playback.startMicros) > 0) {
+        finishMP3Playback(roseMicros);
+    }
+    
+    // No edge in time: a play that replaced a running track may keep BUSY
+    // low throughout, anything else never started
+    if (mp3Playback.state == MP3_STATE_STARTING && mp3Playback.commandMicros &&
+        micros() - mp3Playback.commandMicros > MP3_START_TIMEOUT * 1000UL) {
+        if (digitalRead(MP3_BUSY_PIN) == LOW) {
+            mp3Playback.startMicros = micros();
+            mp3PlaybackStats.started++;
+            setMP3PlaybackState(MP3_STATE_PLAYING);
+        } else {
+            LOG_WARN(LOG_MODULE_MP3, "MP3 track %u did not start", mp3Playback.track);
+            failMP3Playback();
+        }
+    }
+    
+    // A module that never says it is online takes commands after the boot time
+    if (mp3PowerOn && !mp3PowerReady && millis() - mp3PowerOnAt >= MP3_POWER_BOOT_MS) {
+        mp3PowerReady = true;
+    }
+    
+    // Amplifier and module off after a quiet spell; calibration written between strikes
+    if (isPlaying()) {
+        mp3AmpLastActive = millis();
+        mp3PowerLastActive = millis();
+    } else {
+        if (mp3AmpOn && millis() - mp3AmpLastActive >= MP3_AMP_IDLE_OFF) {
+            digitalWrite(MP3_AMP_PIN, LOW);
+            mp3AmpOn = false;
+        }
+        if (MP3_POWER_PIN >= 0 && mp3PowerOn && mp3QueueDepth == 0 && !mp3Ramp.active &&
+            millis() - mp3PowerLastActive >= MP3_POWER_IDLE_OFF) {
+            sleepMP3Module();
+        }
+        if (mp3CalibrationDirty &&
+            (mp3CalibrationSavedAt == 0 || millis() - mp3CalibrationSavedAt >= MP3_CALIBRATION_SAVE_INTERVAL)) {
+            saveMP3Calibration();
+        }
+    }
+}
+
+void loopMP3() {
+    // Take whatever bytes have arrived; never waits for the rest of a frame
+    while (MP3Serial.available()) {
+        parseMP3Byte(MP3Serial.read());
+    }
+    updateMP3Playback();
+    updateMP3Ramp();
+    
+    // Resend the command in flight, or give up on it
+    if (mp3CommandInFlight) {
+        bool resend = mp3ResendPending && millis() - mp3LastFrameAt >= mp3ResendDelay;
+        bool expired = !mp3ResendPending && millis() - mp3SentAt >= MP3_ACK_TIMEOUT;
+        if (!expired && !resend) {
+            return;
+        }
+        if (mp3Attempts > MP3_MAX_RETRIES) {
+            LOG_WARN(LOG_MODULE_MP3, "MP3 command 0x%02X got no answer", mp3Queue[mp3QueueHead].command);
+            mp3Stats.timeouts++;
+            finishMP3Command(false);
+        } else {
+            mp3Stats.retries++;
+            sendMP3Frame();
+            return;
+        }
+    }
+    
+    // Next command once the module has had its gap, and has booted
+    if (mp3QueueDepth > 0 && mp3PowerReady && millis() - mp3LastFrameAt >= MP3_COMMAND_GAP) {
+        sendMP3Frame();
+    }
 }
-#endif
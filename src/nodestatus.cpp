@@ -0,0 +1,283 @@
+#include "nodestatus.h"
+#include "lorahandler.h"
+#include "mp3handler.h"
+#include "schedule.h"
+#include "linkadapt.h"
+#include "lowpower.h"
+#include "logger.h"
+
+// Node table (master only)
+NodeInfo nodeTable[MAX_NODES];
+uint8_t nodeCount = 0;
+
+// Own heartbeat state
+uint16_t heartbeatSeq = 0;
+unsigned long nextHeartbeatAt = 0;
+uint32_t heartbeatPeriod = HEARTBEAT_BASE_PERIOD;
+uint32_t heartbeatsSent = 0;
+uint64_t heartbeatAirtimeUs = 0;
+
+// Link to the master as seen by this node
+int masterRssi = 0;
+float masterSnr = 0;
+unsigned long masterLastHeard = 0;
+
+void setupNodeStatus() {
+    nodeCount = 0;
+    
+    if (BATTERY_ADC_PIN >= 0) {
+        pinMode(BATTERY_ADC_PIN, INPUT);
+    }
+    
+    // Spread the first heartbeats of nodes that boot together
+    nextHeartbeatAt = millis() + random(HEARTBEAT_BASE_PERIOD);
+    
+    LOG_INFO(LOG_MODULE_NODES, "Node status initialized");
+}
+
+uint16_t readBatteryMillivolts() {
+    if (BATTERY_ADC_PIN < 0) {
+        return 0;
+    }
+    return analogReadMilliVolts(BATTERY_ADC_PIN) * BATTERY_DIVIDER_RATIO;
+}
+
+uint32_t getHeartbeatPeriod() {
+    return heartbeatPeriod;
+}
+
+void requestHeartbeat(unsigned long maxDelay) {
+    // Jittered so nodes answering the same event do not collide
+    unsigned long dueAt = millis() + random(maxDelay);
+    if ((long)(nextHeartbeatAt - dueAt) > 0) {
+        nextHeartbeatAt = dueAt;
+    }
+}
+
+void noteMasterFrame() {
+    // Slaves track their link to the master to pace their own heartbeats
+    masterRssi = getLastPacketRssi();
+    masterSnr = getLastPacketSnr();
+    masterLastHeard = millis();
+}
+
+unsigned long getMasterLastHeard() {
+    return masterLastHeard;
+}
+
+uint8_t getNodeCount() {
+    return nodeCount;
+}
+
+const NodeInfo* getNode(uint8_t index) {
+    return index < nodeCount ? &nodeTable[index] : nullptr;
+}
+
+bool isNodeAlive(const NodeInfo& node) {
+    return millis() - node.lastSeen < node.period * HEARTBEAT_MISSED_LIMIT;
+}
+
+void updateHeartbeatPeriod() {
+    // Strong links need fewer heartbeats to be tracked reliably
+    bool masterKnown = masterLastHeard != 0 && millis() - masterLastHeard < HEARTBEAT_MASTER_TIMEOUT;
+    if (isLoRaMaster() || !masterKnown) {
+        heartbeatPeriod = HEARTBEAT_BASE_PERIOD;
+        return;
+    }
+    
+    float margin = masterSnr - getLoRaSnrFloor(getLoRaSpreadingFactor());
+    if (margin >= HEARTBEAT_STRONG_MARGIN) {
+        heartbeatPeriod = HEARTBEAT_MAX_PERIOD;
+    } else if (margin >= HEARTBEAT_GOOD_MARGIN) {
+        heartbeatPeriod = HEARTBEAT_BASE_PERIOD * 2;
+    } else {
+        heartbeatPeriod = HEARTBEAT_BASE_PERIOD;
+    }
+}
+
+void sendHeartbeat() {
+    uint8_t flags = 0;
+    if (isLoRaMaster()) flags |= HEARTBEAT_FLAG_MASTER;
+    if (isTimeSynced()) flags |= HEARTBEAT_FLAG_TIME_SYNCED;
+    if (isLoRaLowPower()) flags |= HEARTBEAT_FLAG_LOW_POWER;
+    
+    unsigned long lastGong = getLastGongMillis();
+    long lastGongAge = lastGong ? (long)((millis() - lastGong) / 1000) : -1;
+    
+    char frame[128];
+    snprintf(frame, sizeof(frame), "%c%04X,%X,%u,%lu,%lu,%u,%ld,%d,%d,%lu,%d,%d,%ld,%ld",
+            STATUS_OP_HEARTBEAT, getLoRaNodeId(), flags, ++heartbeatSeq,
+            millis() / 1000, getCurrentEpoch(), readBatteryMillivolts(), lastGongAge,
+            masterRssi, (int)(masterSnr * 4), (unsigned long)(heartbeatPeriod / 1000),
+            getLoRaSpreadingFactor(), getLoRaTxPower(),
+            (long)getLinkEnergySavedMj(), (long)getLinkAirtimeSavedMs());
+    
+    // Heartbeats are for the master only; no long preamble to wake sleeping slaves
+    sendLoRaMessageAt(frame, MSG_TYPE_STATUS, 0, 0, false);
+    
+    heartbeatsSent++;
+    // sendLoRaMessage prefixes "3:"
+    heartbeatAirtimeUs += getLoRaAirtimeUs(strlen(frame) + 2);
+}
+
+void loopNodeStatus() {
+    if ((long)(millis() - nextHeartbeatAt) >= 0) {
+        updateHeartbeatPeriod();
+        sendHeartbeat();
+        // +-10% jitter keeps nodes from locking onto the same slot
+        nextHeartbeatAt = millis() + heartbeatPeriod - heartbeatPeriod / 10 + random(heartbeatPeriod / 5);
+    }
+}
+
+NodeInfo* findOrAddNode(uint16_t id) {
+    for (uint8_t i = 0; i < nodeCount; i++) {
+        if (nodeTable[i].id == id) {
+            return &nodeTable[i];
+        }
+    }
+    
+    uint8_t slot = nodeCount;
+    if (nodeCount < MAX_NODES) {
+        nodeCount++;
+    } else {
+        // Table full: reuse the entry silent for the longest time
+        slot = 0;
+        for (uint8_t i = 1; i < nodeCount; i++) {
+            if (millis() - nodeTable[i].lastSeen > millis() - nodeTable[slot].lastSeen) {
+                slot = i;
+            }
+        }
+        LOG_WARN(LOG_MODULE_NODES, "Node table full, evicting node %04X", nodeTable[slot].id);
+    }
+    
+    NodeInfo& node = nodeTable[slot];
+    memset(&node, 0, sizeof(node));
+    node.id = id;
+    return &node;
+}
+
+void handleNodeStatusMessage(const String& content) {
+    if (content.length() >= 2 && content[0] == STATUS_OP_ADR) {
+        handleLinkAdaptMessage(content.c_str() + 1);
+        return;
+    }
+    
+    if (content.length() < 2 || content[0] != STATUS_OP_HEARTBEAT) {
+        LOG_WARN(LOG_MODULE_NODES, "Unknown status message");
+        return;
+    }
+    
+    unsigned int id = 0, flags = 0, seq = 0, battery = 0;
+    unsigned long uptime = 0, epoch = 0, period = 0;
+    long lastGongAge = -1, energySaved = 0, airtimeSaved = 0;
+    int rssi = 0, snrQuarter = 0, spreadingFactor = 0, txPower = 0;
+    
+    int fields = sscanf(content.c_str() + 1, "%x,%x,%u,%lu,%lu,%u,%ld,%d,%d,%lu,%d,%d,%ld,%ld",
+                        &id, &flags, &seq, &uptime, &epoch, &battery, &lastGongAge,
+                        &rssi, &snrQuarter, &period, &spreadingFactor, &txPower,
+                        &energySaved, &airtimeSaved);
+    if (fields != 14) {
+        LOG_WARN(LOG_MODULE_NODES, "Invalid heartbeat");
+        return;
+    }
+    
+    if (flags & HEARTBEAT_FLAG_MASTER) {
+        noteMasterFrame();
+        return;
+    }
+    
+    if (!isLoRaMaster()) {
+        return;
+    }
+    
+    NodeInfo* node = findOrAddNode(id);
+    int rxRssi = getLastPacketRssi();
+    float rxSnr = getLastPacketSnr();
+    
+    if (node->heartbeats == 0) {
+        node->rssiAverage = rxRssi;
+        node->snrAverage = rxSnr;
+        node->snrMin = rxSnr;
+    } else {
+        // A reboot restarts the sequence; only count forward gaps
+        uint16_t gap = seq - node->lastSeq;
+        if (seq > node->lastSeq && gap > 1) {
+            node->missed += gap - 1;
+        }
+        node->rssiAverage += LINK_EWMA_WEIGHT * (rxRssi - node->rssiAverage);
+        node->snrAverage += LINK_EWMA_WEIGHT * (rxSnr - node->snrAverage);
+        node->snrMin = min(node->snrMin, rxSnr);
+    }
+    
+    node->flags = flags;
+    node->lastSeq = seq;
+    node->uptime = uptime;
+    node->batteryMv = battery;
+    node->lastGongAge = lastGongAge;
+    node->period = period * 1000;
+    node->lastSeen = millis();
+    node->heartbeats++;
+    node->rssi = rxRssi;
+    node->snr = rxSnr;
+    node->reportedRssi = rssi;
+    node->reportedSnr = snrQuarter / 4.0f;
+    node->spreadingFactor = spreadingFactor;
+    node->txPower = txPower;
+    node->energySavedMj = energySaved;
+    node->airtimeSavedMs = airtimeSaved;
+    
+    bool bothSynced = (flags & HEARTBEAT_FLAG_TIME_SYNCED) && isTimeSynced();
+    node->clockOffset = bothSynced ? (int32_t)(epoch - getCurrentEpoch()) : 0;
+}
+
+String getNodeTableJSON() {
+    DynamicJsonDocument doc(1024 + nodeCount * 448);
+    
+    JsonObject self = doc.createNestedObject("self");
+    self["id"] = String(getLoRaNodeId(), HEX);
+    self["role"] = isLoRaMaster() ? "master" : "slave";
+    self["heartbeat_period_s"] = heartbeatPeriod / 1000;
+    self["heartbeats_sent"] = heartbeatsSent;
+    self["heartbeat_airtime_ms"] = (uint32_t)(heartbeatAirtimeUs / 1000);
+    self["master_rssi"] = masterRssi;
+    self["master_snr"] = masterSnr;
+    addLinkAdaptJSON(self);
+    addLowPowerJSON(self);
+    
+    JsonArray nodes = doc.createNestedArray("nodes");
+    for (uint8_t i = 0; i < nodeCount; i++) {
+        const NodeInfo& node = nodeTable[i];
+        unsigned long silentMs = millis() - node.lastSeen;
+        
+        JsonObject entry = nodes.createNestedObject();
+        entry["id"] = String(node.id, HEX);
+        entry["alive"] = isNodeAlive(node);
+        entry["last_seen_s"] = silentMs / 1000;
+        entry["uptime_s"] = node.uptime;
+        entry["time_synced"] = (node.flags & HEARTBEAT_FLAG_TIME_SYNCED) != 0;
+        entry["low_power"] = (node.flags & HEARTBEAT_FLAG_LOW_POWER) != 0;
+        entry["clock_offset_s"] = node.clockOffset;
+        entry["battery_mv"] = node.batteryMv;
+        entry["last_gong_s"] = node.lastGongAge;
+        entry["period_s"] = node.period / 1000;
+        entry["heartbeats"] = node.heartbeats;
+        entry["missed"] = node.missed;
+        entry["delivery_ratio"] = (float)node.heartbeats / (node.heartbeats + node.missed);
+        entry["rssi"] = node.rssi;
+        entry["snr"] = node.snr;
+        entry["rssi_avg"] = node.rssiAverage;
+        entry["snr_avg"] = node.snrAverage;
+        entry["snr_min"] = node.snrMin;
+        entry["snr_margin"] = node.snrAverage - getLoRaSnrFloor(getLoRaSpreadingFactor());
+        entry["reported_rssi"] = node.reportedRssi;
+        entry["reported_snr"] = node.reportedSnr;
+        entry["sf"] = node.spreadingFactor;
+        entry["tx_power"] = node.txPower;
+        entry["energy_saved_mj"] = node.energySavedMj;
+        entry["airtime_saved_ms"] = node.airtimeSavedMs;
+    }
+    
+    String result;
+    serializeJson(doc, result);
+    return result;
+}
@@ -0,0 +1,336 @@
+#include "powermanager.h"
+#include "tasks.h"
+#include "eventbus.h"
+#include "schedule.h"
+#include "mp3handler.h"
+#include "gongprogram.h"
+#include "gongsynth.h"
+#include "lorahandler.h"
+#include "loraota.h"
+#include "profiler.h"
+#include "configstore.h"
+#include "logger.h"
+#include <ArduinoJson.h>
+#include <atomic>
+
+#if defined(CONFIG_PM_ENABLE) && defined(CONFIG_FREERTOS_USE_TICKLESS_IDLE)
+#include <esp_pm.h>
+#define POWER_LIGHT_SLEEP 1
+#else
+#define POWER_LIGHT_SLEEP 0
+#endif
+
+static_assert(POWER_GONG_LEAD_MS > MP3_POWER_BOOT_MS + MP3_AMP_WAKE_MS, "the MP3 module boots before the gong");
+
+// "power" section of gong.conf
+struct PowerSettings {
+    bool enabled;
+    uint32_t idleMhz;
+    uint32_t batteryMah;
+};
+
+// Clock, task periods and modem sleep; gongs are prepared for regardless
+bool powerEnabled = true;
+uint32_t powerIdleMhz = POWER_IDLE_MHZ;
+uint32_t powerBatteryMah = 0;
+int8_t powerSubscriber = -1;
+
+// Full speed and WiFi awake until these millis(), pushed on from any task
+std::atomic<uint32_t> powerActiveUntil(0);
+std::atomic<uint32_t> powerUiUntil(0);
+std::atomic<bool> powerIdle(false);
+unsigned long powerActiveSince = 0;
+unsigned long powerAccountedAt = 0;
+
+// WiFi modem sleep as asked for, and as it is: an access point never sleeps
+bool powerWiFiWanted = false;
+bool powerWiFiApplied = false;
+bool powerWiFiSleeping = false;
+
+// Scheduled gong being prepared for
+bool powerGongPending = false;
+bool powerGongWoken = false;                // MP3 module wake posted
+unsigned long powerGongFireAt = 0;
+
+PowerStats powerStats = {};
+
+#if POWER_LIGHT_SLEEP
+esp_pm_lock_handle_t powerLock = nullptr;
+#endif
+
+const char* const powerTimeNames[POWER_TIMES] = {
+    "cpu_active", "cpu_idle", "wifi_awake", "wifi_sleep", "mp3_on", "amp_on"
+};
+
+const float powerTimeMa[POWER_TIMES] = {
+    POWER_CPU_ACTIVE_MA, POWER_CPU_IDLE_MA, POWER_WIFI_AWAKE_MA, POWER_WIFI_SLEEP_MA, POWER_MP3_MA, POWER_AMP_MA
+};
+
+bool isPowerHeld(const std::atomic<uint32_t>& until, unsigned long now) {
+    return (int32_t)(until.load() - (uint32_t)now) > 0;
+}
+
+const char* parsePowerSettings(JsonVariantConst json, void* settings) {
+    PowerSettings& power = *(PowerSettings*)settings;
+    power.enabled = json["enabled"] | true;
+    power.idleMhz = json["idle_mhz"] | POWER_IDLE_MHZ;
+    power.batteryMah = json["battery_mah"] | 0;
+    if (power.idleMhz != 80 && power.idleMhz != 160 && power.idleMhz != POWER_ACTIVE_MHZ) {
+        return "idle_mhz is 80, 160 or 240";
+    }
+    return nullptr;
+}
+
+void loadPowerConfig() {
+    // Again on every change to the "power" section; the next idle period runs on the new settings
+    PowerSettings settings;
+    loadConfigSection(CONFIG_SECTION_POWER, &settings, sizeof(settings), parsePowerSettings);
+    powerEnabled = settings.enabled;
+    powerIdleMhz = settings.idleMhz;
+    powerBatteryMah = settings.batteryMah;
+    holdPowerActive();
+    
+    // Switched off: WiFi stays awake from now on
+    if (!powerEnabled && powerWiFiSleeping) {
+        powerWiFiSleeping = setWiFiSleep(false);
+    }
+    powerWiFiApplied = false;
+}
+
+void onPowerEvent(const Event& event) {
+    // A gong from LoRa or the web runs at full speed; a new WiFi mode gets its sleep setting again
+    if (event.type == EVENT_GONG_REQUESTED) {
+        holdPowerActive();
+    } else if (event.type == EVENT_CONFIG_CHANGED) {
+        if (event.param == CONFIG_SECTION_POWER) {
+            loadPowerConfig();
+#if POWER_LIGHT_SLEEP
+            if (powerLock) {
+                esp_pm_config_esp32_t config = {};
+                config.max_freq_mhz = POWER_ACTIVE_MHZ;
+                config.min_freq_mhz = powerIdleMhz;
+                config.light_sleep_enable = true;
+                esp_pm_configure(&config);
+            }
+#endif
+        }
+    } else {
+        powerWiFiApplied = false;
+    }
+}
+
+void setupPowerManager() {
+    powerActiveSince = millis();
+    powerAccountedAt = millis();
+    powerStats.minGongLeadMs = UINT32_MAX;
+    holdPowerActive();
+    
+    // Low-power listening owns the clock on battery slaves
+    if (isLoRaLowPower()) {
+        powerEnabled = false;
+        return;
+    }
+    loadPowerConfig();
+    powerSubscriber = subscribeEvents("power", EVENT_MASK(EVENT_GONG_REQUESTED) | EVENT_MASK(EVENT_WIFI_STATE) |
+                                      EVENT_MASK(EVENT_CONFIG_CHANGED), onPowerEvent);
+
+#if POWER_LIGHT_SLEEP
+    esp_pm_config_esp32_t config = {};
+    config.max_freq_mhz = POWER_ACTIVE_MHZ;
+    config.min_freq_mhz = powerIdleMhz;
+    config.light_sleep_enable = true;
+    if (powerEnabled && (esp_pm_configure(&config) != ESP_OK ||
+                         esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "power", &powerLock) != ESP_OK)) {
+        LOG_WARN(LOG_MODULE_POWER, "Automatic light sleep not available, setting the clock instead");
+        powerLock = nullptr;
+    }
+    if (powerLock) {
+        esp_pm_lock_acquire(powerLock);
+    }
+#endif
+
+    LOG_INFO(LOG_MODULE_POWER, "Power manager %s: %lu MHz when idle, %s", powerEnabled ? "on" : "off",
+             (unsigned long)powerIdleMhz, POWER_LIGHT_SLEEP ? "light sleep between wake-ups" : "no light sleep");
+}
+
+void setPowerClock(bool active) {
+#if POWER_LIGHT_SLEEP
+    if (powerLock) {
+        if (active) {
+            esp_pm_lock_acquire(powerLock);
+        } else {
+            esp_pm_lock_release(powerLock);
+        }
+        return;
+    }
+#endif
+    setCpuFrequencyMhz(active ? POWER_ACTIVE_MHZ : powerIdleMhz);
+    setProfileCpuMhz(getCpuFrequencyMhz());
+}
+
+void accountPower(unsigned long now) {
+    uint32_t elapsed = now - powerAccountedAt;
+    powerAccountedAt = now;
+    powerStats.timeMs[powerIdle ? POWER_TIME_CPU_IDLE : POWER_TIME_CPU_ACTIVE] += elapsed;
+    powerStats.timeMs[powerWiFiSleeping ? POWER_TIME_WIFI_SLEEP : POWER_TIME_WIFI_AWAKE] += elapsed;
+    if (isMP3ModuleOn()) {
+        powerStats.timeMs[POWER_TIME_MP3_ON] += elapsed;
+    }
+    if (isMP3AmplifierOn()) {
+        powerStats.timeMs[POWER_TIME_AMP_ON] += elapsed;
+    }
+}
+
+void finishPowerGong() {
+    // The play command has gone out: was everything up in time?
+    powerGongPending = false;
+    powerStats.gongs++;
+    bool mp3Ready = MP3_POWER_PIN < 0 || isMP3ModuleReady() || isGongSynthEnabled();
+    if (powerIdle || !mp3Ready) {
+        powerStats.gongsUnready++;
+        LOG_WARN(LOG_MODULE_POWER, "Scheduled gong fired with the %s", powerIdle ? "clock low" : "MP3 module booting");
+    }
+    uint32_t leadMs = powerIdle ? 0 : powerGongFireAt - powerActiveSince;
+    powerStats.minGongLeadMs = min(powerStats.minGongLeadMs, leadMs);
+}
+
+void preparePowerGong(unsigned long now) {
+    // Tracked every pass, as the plan moves with clock corrections
+    long fireIn = getScheduleFireInMs();
+    if (fireIn >= 0 && fireIn <= POWER_GONG_LEAD_MS) {
+        if (!powerGongPending) {
+            powerGongPending = true;
+            powerGongWoken = false;
+            if (powerIdle) {
+                powerStats.gongWakes++;
+            }
+        }
+        powerGongFireAt = now + fireIn;
+    }
+    if (!powerGongPending) {
+        return;
+    }
+    
+    holdPowerActive();
+    if (!powerGongWoken) {
+        powerGongWoken = postAudioRequest(AUDIO_REQUEST_MP3_WAKE);
+    }
+    if ((long)(now - powerGongFireAt) >= 0) {
+        finishPowerGong();
+    }
+}
+
+void loopPowerManager() {
+    if (isLoRaLowPower()) {
+        return;
+    }
+    unsigned long now = millis();
+    accountPower(now);
+    dispatchEvents(powerSubscriber);
+    
+    // Anything under way keeps the node at full speed; a node without a radio has no LoRa traffic
+    if (isPlaying() || !isMP3Idle() || isVolumeRamping() || isGongSynthPlaying() || isGongProgramRunning() ||
+        (isLoRaReady() && !isLoRaIdle()) || isLoRaOtaActive()) {
+        holdPowerActive();
+    }
+    preparePowerGong(now);
+    
+    bool active = !powerEnabled || isPowerHeld(powerActiveUntil, now);
+    if (active && powerIdle) {
+        setPowerClock(true);
+        powerIdle = false;
+        powerActiveSince = now;
+        powerStats.wakes++;
+        LOG_DEBUG(LOG_MODULE_POWER, "Full speed");
+    } else if (!active && !powerIdle) {
+        setPowerClock(false);
+        powerIdle = true;
+        LOG_DEBUG(LOG_MODULE_POWER, "Idle at %lu MHz", (unsigned long)powerIdleMhz);
+    }
+    
+    // WiFi sleeps between beacons unless the web interface is in use
+    bool wifiSleep = powerEnabled && !isPowerHeld(powerUiUntil, now);
+    if (powerEnabled && (wifiSleep != powerWiFiWanted || !powerWiFiApplied)) {
+        powerWiFiWanted = wifiSleep;
+        powerWiFiApplied = true;
+        powerWiFiSleeping = setWiFiSleep(wifiSleep);
+    }
+}
+
+void holdPowerActive() {
+    powerActiveUntil = millis() + POWER_ACTIVE_HOLD_MS;
+}
+
+void holdPowerUi() {
+    holdPowerActive();
+    powerUiUntil = millis() + POWER_UI_HOLD_MS;
+}
+
+bool isPowerIdle() {
+    return powerIdle;
+}
+
+uint32_t getPowerTaskPeriodMs(uint8_t task) {
+    // Short again as soon as anything asks for full speed, before the clock follows
+    if (powerIdle && !isPowerHeld(powerActiveUntil, millis())) {
+        return POWER_IDLE_TASK_PERIOD_MS;
+    }
+    return task == TASK_WEB ? TASK_WEB_PERIOD_MS : TASK_PERIOD_MS;
+}
+
+float getPowerAverageMa() {
+    uint64_t totalMs = powerStats.timeMs[POWER_TIME_CPU_ACTIVE] + powerStats.timeMs[POWER_TIME_CPU_IDLE];
+    if (totalMs == 0) {
+        return 0;
+    }
+    float chargeMsMa = 0;
+    for (uint8_t i = 0; i < POWER_TIMES; i++) {
+        chargeMsMa += powerStats.timeMs[i] * powerTimeMa[i];
+    }
+    return chargeMsMa / totalMs;
+}
+
+const PowerStats& getPowerStats() {
+    return powerStats;
+}
+
+String getPowerJSON() {
+    DynamicJsonDocument doc(1536);
+    doc["enabled"] = powerEnabled;
+    doc["idle"] = (bool)powerIdle;
+    doc["cpu_mhz"] = getCpuFrequencyMhz();
+    doc["idle_mhz"] = powerIdleMhz;
+    doc["light_sleep"] = POWER_LIGHT_SLEEP == 1;
+    doc["wifi_sleep"] = powerWiFiSleeping;
+    doc["mp3_module"] = isMP3ModuleOn();
+    doc["amplifier"] = isMP3AmplifierOn();
+    long fireIn = getScheduleFireInMs();
+    if (fireIn >= 0) {
+        doc["next_gong_ms"] = fireIn;
+    }
+    
+    JsonObject times = doc.createNestedObject("time_ms");
+    for (uint8_t i = 0; i < POWER_TIMES; i++) {
+        times[powerTimeNames[i]] = powerStats.timeMs[i];
+    }
+    doc["wakes"] = powerStats.wakes;
+    doc["gong_wakes"] = powerStats.gongWakes;
+    doc["gongs"] = powerStats.gongs;
+    doc["gongs_unready"] = powerStats.gongsUnready;
+    if (powerStats.gongs > 0) {
+        doc["min_gong_lead_ms"] = powerStats.minGongLeadMs;
+    }
+    
+    // Against the node as it ran before: full speed, with WiFi and the MP3 module always on
+    float averageMa = getPowerAverageMa();
+    doc["avg_current_ma"] = averageMa;
+    doc["always_on_ma"] = POWER_CPU_ACTIVE_MA + POWER_WIFI_AWAKE_MA + POWER_MP3_MA;
+    if (powerBatteryMah > 0 && averageMa > 0) {
+        doc["battery_mah"] = powerBatteryMah;
+        doc["battery_hours"] = powerBatteryMah / averageMa;
+    }
+    
+    String result;
+    serializeJson(doc, result);
+    return result;
+}
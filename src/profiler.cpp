@@ -0,0 +1,323 @@
+#include "profiler.h"
+#include "tasks.h"
+#include "logger.h"
+#include <ArduinoJson.h>
+
+#define PROFILE_SUB_BITS 2
+
+static_assert((1 << PROFILE_SUB_BITS) == PROFILE_SUB_BUCKETS, "PROFILE_SUB_BUCKETS is 2 to the PROFILE_SUB_BITS");
+static_assert(PROFILE_TASKS == SYSTEM_TASKS, "one pass profile per task");
+
+// A pass being run, and the sections it has run so far
+struct ProfilePass {
+    bool active;
+    uint32_t startCycles;
+    ProfileTrace trace;
+};
+
+ProfileStats profileSections[PROFILE_SECTIONS];
+ProfileStats profilePassStats[PROFILE_TASKS];
+ProfilePass profilePasses[PROFILE_TASKS];
+ProfileTrace profileWorstTraces[PROFILE_TASKS];
+bool profileSlowPending[PROFILE_TASKS];     // A slow new worst pass, to be logged by loopProfiler()
+uint32_t profileCpuMhz = 240;
+uint32_t profileCycleScale = 256;          // Cycles now to cycles at profileCpuMhz, in 1/256
+uint32_t profileProbeCycles = 0;
+unsigned long profileLastReport = 0;
+
+const char* const profileSectionNames[PROFILE_SECTIONS] = {
+    "radio_requests", "lora", "sync", "nodes", "adr", "ota", "audio_requests", "mp3", "catalog", "synth", "program",
+    "schedule_check", "schedule", "web", "http", "log", "power"
+};
+
+const uint8_t profileSectionTasks[PROFILE_SECTIONS] = {
+    TASK_RADIO, TASK_RADIO, TASK_RADIO, TASK_RADIO, TASK_RADIO, TASK_RADIO,
+    TASK_AUDIO, TASK_AUDIO, TASK_AUDIO, TASK_AUDIO, TASK_AUDIO,
+    TASK_SCHEDULER, TASK_SCHEDULER,
+    TASK_WEB, TASK_WEB, TASK_WEB,
+    TASK_SCHEDULER
+};
+
+void setupProfiler() {
+    profileCpuMhz = getCpuFrequencyMhz();
+    
+    // What one probe costs: reading the counter and counting the section
+    uint32_t batchCycles = UINT32_MAX;
+    for (uint8_t batch = 0; batch < PROFILE_CALIBRATION_BATCHES; batch++) {
+        uint32_t start = getProfileCycles();
+        for (uint16_t i = 0; i < PROFILE_CALIBRATION_PROBES; i++) {
+            PROFILE(PROFILE_LOG, (void)0);
+        }
+        batchCycles = min(batchCycles, getProfileCycles() - start);
+    }
+    profileProbeCycles = batchCycles / PROFILE_CALIBRATION_PROBES;
+    resetProfiler();
+    
+    LOG_INFO(LOG_MODULE_PROFILE, "Profiler initialized: %u MHz, %u cycles per probe", profileCpuMhz,
+             profileProbeCycles);
+}
+
+void setProfileCpuMhz(uint32_t mhz) {
+    profileCycleScale = (profileCpuMhz << 8) / max(mhz, 1u);
+}
+
+uint32_t scaleProfileCycles(uint32_t cycles) {
+    if (profileCycleScale == 256) {
+        return cycles;
+    }
+    return (uint32_t)min((uint64_t)cycles * profileCycleScale >> 8, (uint64_t)UINT32_MAX);
+}
+
+void resetProfiler() {
+    // Tasks keep running meanwhile; a pass being counted may land half in the old counters
+    memset(profileSections, 0, sizeof(profileSections));
+    memset(profilePassStats, 0, sizeof(profilePassStats));
+    memset(profileWorstTraces, 0, sizeof(profileWorstTraces));
+    memset(profileSlowPending, 0, sizeof(profileSlowPending));
+    profileLastReport = millis();
+}
+
+uint16_t getProfileBucket(uint32_t cycles) {
+    if (cycles < (1UL << PROFILE_FIRST_OCTAVE)) {
+        return 0;
+    }
+    uint8_t octave = 31 - __builtin_clz(cycles);
+    uint8_t sub = (cycles >> (octave - PROFILE_SUB_BITS)) & (PROFILE_SUB_BUCKETS - 1);
+    return 1 + (octave - PROFILE_FIRST_OCTAVE) * PROFILE_SUB_BUCKETS + sub;
+}
+
+uint32_t getProfileBucketLimit(uint16_t bucket) {
+    // The largest cycle count the bucket holds
+    if (bucket == 0) {
+        return (1UL << PROFILE_FIRST_OCTAVE) - 1;
+    }
+    uint8_t octave = PROFILE_FIRST_OCTAVE + (bucket - 1) / PROFILE_SUB_BUCKETS;
+    uint64_t step = 1ULL << (octave - PROFILE_SUB_BITS);
+    uint64_t lower = (PROFILE_SUB_BUCKETS + (bucket - 1) % PROFILE_SUB_BUCKETS) * step;
+    return (uint32_t)min(lower + step - 1, (uint64_t)UINT32_MAX);
+}
+
+void countProfile(ProfileStats& stats, uint32_t cycles, const char* label) {
+    stats.count++;
+    stats.totalCycles += cycles;
+    if (cycles > stats.maxCycles) {
+        stats.maxCycles = cycles;
+        stats.maxLabel = label;
+    }
+    stats.buckets[getProfileBucket(cycles)]++;
+}
+
+void beginProfilePass(uint8_t task) {
+    ProfilePass& pass = profilePasses[task];
+    pass.trace.entries = 0;
+    pass.trace.overflowed = false;
+    pass.active = true;
+    pass.startCycles = getProfileCycles();
+}
+
+void endProfilePass(uint8_t task) {
+    ProfilePass& pass = profilePasses[task];
+    uint32_t cycles = scaleProfileCycles(getProfileCycles() - pass.startCycles);
+    pass.active = false;
+    countProfile(profilePassStats[task], cycles, nullptr);
+    
+    // The slowest pass so far keeps its trace
+    if (cycles > profileWorstTraces[task].passCycles) {
+        pass.trace.passCycles = cycles;
+        pass.trace.timeMs = millis();
+        profileWorstTraces[task] = pass.trace;
+        if (cycles >= PROFILE_SLOW_PASS_US * profileCpuMhz) {
+            profileSlowPending[task] = true;
+        }
+    }
+}
+
+void endProfileSection(uint8_t section, uint32_t startCycles, const char* label) {
+    uint32_t cycles = scaleProfileCycles(getProfileCycles() - startCycles);
+    countProfile(profileSections[section], cycles, label);
+    
+    ProfilePass& pass = profilePasses[profileSectionTasks[section]];
+    if (!pass.active) {
+        return;
+    }
+    if (pass.trace.entries == PROFILE_TRACE_ENTRIES) {
+        pass.trace.overflowed = true;
+        return;
+    }
+    ProfileTraceEntry& entry = pass.trace.entry[pass.trace.entries++];
+    entry.section = section;
+    entry.offsetCycles = scaleProfileCycles(startCycles - pass.startCycles);
+    entry.cycles = cycles;
+}
+
+uint32_t getProfilePercentile(const ProfileStats& stats, uint16_t perMille) {
+    // The upper bound of the bucket holding it, but never above the maximum seen
+    if (stats.count == 0) {
+        return 0;
+    }
+    uint32_t rank = ((uint64_t)stats.count * perMille + 999) / 1000;
+    uint32_t seen = 0;
+    for (uint16_t i = 0; i < PROFILE_BUCKETS; i++) {
+        seen += stats.buckets[i];
+        if (seen >= rank) {
+            return min(getProfileBucketLimit(i), stats.maxCycles);
+        }
+    }
+    return stats.maxCycles;
+}
+
+uint32_t getProfileOverheadPerMille(uint8_t task) {
+    // Probes in the task's passes at their calibrated cost, against the time the passes took
+    const ProfileStats& passes = profilePassStats[task];
+    if (passes.totalCycles == 0) {
+        return 0;
+    }
+    uint64_t probes = passes.count;
+    for (uint8_t i = 0; i < PROFILE_SECTIONS; i++) {
+        if (profileSectionTasks[i] == task) {
+            probes += profileSections[i].count;
+        }
+    }
+    return (uint32_t)(probes * profileProbeCycles * 1000 / passes.totalCycles);
+}
+
+uint32_t toProfileUs(uint32_t cycles) {
+    return cycles / profileCpuMhz;
+}
+
+void logProfileSummary() {
+    for (uint8_t i = 0; i < PROFILE_TASKS; i++) {
+        const ProfileStats& stats = profilePassStats[i];
+        if (stats.count == 0) {
+            continue;
+        }
+        uint32_t overhead = getProfileOverheadPerMille(i);
+        LOG_INFO(LOG_MODULE_PROFILE, "%s: %lu passes, p50 %lu us, p99 %lu us, max %lu us, profiler %lu.%lu%%",
+                 getSystemTaskName(i), (unsigned long)stats.count,
+                 (unsigned long)toProfileUs(getProfilePercentile(stats, 500)),
+                 (unsigned long)toProfileUs(getProfilePercentile(stats, 990)),
+                 (unsigned long)toProfileUs(stats.maxCycles), (unsigned long)(overhead / 10),
+                 (unsigned long)(overhead % 10));
+    }
+    for (uint8_t i = 0; i < PROFILE_SECTIONS; i++) {
+        const ProfileStats& stats = profileSections[i];
+        if (stats.count == 0) {
+            continue;
+        }
+        LOG_DEBUG(LOG_MODULE_PROFILE, "  %s: %lu calls, p50 %lu us, p99 %lu us, max %lu us", profileSectionNames[i],
+                  (unsigned long)stats.count, (unsigned long)toProfileUs(getProfilePercentile(stats, 500)),
+                  (unsigned long)toProfileUs(getProfilePercentile(stats, 990)),
+                  (unsigned long)toProfileUs(stats.maxCycles));
+    }
+}
+
+void loopProfiler() {
+    // Slow passes are logged here, on the web task, not by the task that ran them
+    for (uint8_t i = 0; i < PROFILE_TASKS; i++) {
+        if (!profileSlowPending[i]) {
+            continue;
+        }
+        profileSlowPending[i] = false;
+        const ProfileTrace& trace = profileWorstTraces[i];
+        const ProfileTraceEntry* longest = nullptr;
+        for (uint8_t j = 0; j < trace.entries; j++) {
+            if (!longest || trace.entry[j].cycles > longest->cycles) {
+                longest = &trace.entry[j];
+            }
+        }
+        LOG_WARN(LOG_MODULE_PROFILE, "Slow %s pass: %lu us, longest section %s (%lu us)", getSystemTaskName(i),
+                 (unsigned long)toProfileUs(trace.passCycles), longest ? profileSectionNames[longest->section] : "none",
+                 (unsigned long)(longest ? toProfileUs(longest->cycles) : 0));
+    }
+    
+    if (millis() - profileLastReport >= PROFILE_REPORT_INTERVAL) {
+        profileLastReport = millis();
+        logProfileSummary();
+    }
+}
+
+uint32_t getProfileProbeCycles() {
+    return profileProbeCycles;
+}
+
+const ProfileStats& getProfileSectionStats(uint8_t section) {
+    return profileSections[section];
+}
+
+const ProfileStats& getProfilePassStats(uint8_t task) {
+    return profilePassStats[task];
+}
+
+const ProfileTrace& getProfileWorstTrace(uint8_t task) {
+    return profileWorstTraces[task];
+}
+
+const char* getProfileSectionName(uint8_t section) {
+    return section < PROFILE_SECTIONS ? profileSectionNames[section] : "unknown";
+}
+
+void addProfileStatsJSON(JsonObject obj, const ProfileStats& stats, bool histograms) {
+    obj["avg_us"] = stats.count ? (float)stats.totalCycles / stats.count / profileCpuMhz : 0;
+    obj["p50_us"] = (float)getProfilePercentile(stats, 500) / profileCpuMhz;
+    obj["p99_us"] = (float)getProfilePercentile(stats, 990) / profileCpuMhz;
+    obj["max_us"] = (float)stats.maxCycles / profileCpuMhz;
+    if (stats.maxLabel) {
+        obj["slowest"] = stats.maxLabel;
+    }
+    if (!histograms) {
+        return;
+    }
+    
+    // [upper bound in us, count] for every bucket in use
+    JsonArray histogram = obj.createNestedArray("histogram");
+    for (uint16_t i = 0; i < PROFILE_BUCKETS; i++) {
+        if (stats.buckets[i]) {
+            JsonArray bucket = histogram.createNestedArray();
+            bucket.add((float)getProfileBucketLimit(i) / profileCpuMhz);
+            bucket.add(stats.buckets[i]);
+        }
+    }
+}
+
+String getProfileJSON(bool histograms) {
+    DynamicJsonDocument doc(histograms ? 24576 : 8192);
+    doc["cpu_mhz"] = profileCpuMhz;
+    doc["probe_cycles"] = profileProbeCycles;
+    
+    JsonArray tasks = doc.createNestedArray("tasks");
+    for (uint8_t i = 0; i < PROFILE_TASKS; i++) {
+        const ProfileStats& stats = profilePassStats[i];
+        JsonObject task = tasks.createNestedObject();
+        task["name"] = getSystemTaskName(i);
+        task["passes"] = stats.count;
+        addProfileStatsJSON(task, stats, histograms);
+        task["profiler_percent"] = getProfileOverheadPerMille(i) / 10.0;
+        
+        const ProfileTrace& trace = profileWorstTraces[i];
+        JsonObject worst = task.createNestedObject("worst");
+        worst["time_ms"] = trace.timeMs;
+        worst["pass_us"] = (float)trace.passCycles / profileCpuMhz;
+        worst["overflowed"] = trace.overflowed;
+        JsonArray sections = worst.createNestedArray("sections");
+        for (uint8_t j = 0; j < trace.entries; j++) {
+            JsonObject section = sections.createNestedObject();
+            section["name"] = profileSectionNames[trace.entry[j].section];
+            section["start_us"] = (float)trace.entry[j].offsetCycles / profileCpuMhz;
+            section["us"] = (float)trace.entry[j].cycles / profileCpuMhz;
+        }
+    }
+    
+    JsonArray sections = doc.createNestedArray("sections");
+    for (uint8_t i = 0; i < PROFILE_SECTIONS; i++) {
+        const ProfileStats& stats = profileSections[i];
+        JsonObject section = sections.createNestedObject();
+        section["name"] = profileSectionNames[i];
+        section["task"] = getSystemTaskName(profileSectionTasks[i]);
+        section["calls"] = stats.count;
+        addProfileStatsJSON(section, stats, histograms);
+    }
+    
+    String result;
+    serializeJson(doc, result);
+    return result;
+}
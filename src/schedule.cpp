@@ -1,76 +1,426 @@
 #include "schedule.h"
+#include "lorahandler.h"
+#include "mp3handler.h"
+#include "gongprogram.h"
+#include "gongsynth.h"
+#include "tasks.h"
+#include "eventbus.h"
+#include "configstore.h"
+#include "logger.h"
 #include <SPIFFS.h>
 #include <Arduino.h>
 #include <NTPClient.h>
 #include <WiFiUdp.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 
-#define MAX_SCHEDULE_ENTRIES 20
 #define SCHEDULE_FILE "/schedule.json"
-#define GONG_CONFIG_FILE "/gong.conf"
 
 ScheduleEntry scheduleEntries[MAX_SCHEDULE_ENTRIES];
 uint8_t scheduleCount = 0;
 uint32_t nextScheduleId = 1;
+uint32_t scheduleVersionHash = 0;
+
+// The entry table is changed from the web and radio tasks and planned from
+// by the scheduler task. The scheduler never waits for it: a change is
+// published as an event and planned once the lock is free, and the planned
+// entry is copied, so the strike itself needs no lock.
+SemaphoreHandle_t scheduleMutex = nullptr;
+int8_t scheduleSubscriber = -1;
+bool scheduleChanged = false;               // Replan waiting for the lock
+
+static_assert(SCHEDULE_ALL_ZONES == LORA_ZONE_ALL, "schedule zones are LoRa zone masks");
 
 WiFiUDP ntpUDP;
 NTPClient timeClient(ntpUDP, "pool.ntp.org");
 
-// External callback for gong trigger
-extern void (*onGongTrigger)();
+// Next schedule instant: planned every second by checkSchedule(), its play
+// command issued early by the pre-roll from loopSchedule()
+uint32_t scheduleNextId = 0;                // 0 = nothing planned
+ScheduleEntry scheduleNextEntry;
+unsigned long scheduleNextInstant = 0;      // Epoch seconds
+unsigned long scheduleLastInstant = 0;      // Last instant rung
+unsigned long scheduleFireAt = 0;           // millis() of the play command
+unsigned long scheduleWakeAt = 0;           // millis() to wake the amplifier
+bool scheduleWoken = false;
+uint32_t schedulePreRoll = 0;
+unsigned long scheduleEpochSeen = 0;
+unsigned long scheduleEpochTickMillis = 0;
 
-void setupSchedule() {
-    if (!SPIFFS.begin(true)) {
-        Serial.println("SPIFFS initialization failed");
+// Volume for the planned entry, set when the amplifier wakes; put back
+// once the entry has finished sounding
+int16_t scheduleRestoreVolume = -1;         // -1 = left unchanged
+uint8_t scheduleEntryVolume = 0;
+uint16_t schedulePreparedFadeIn = 0;
+bool scheduleFadePending = false;           // Fade-in waiting for the instant
+unsigned long scheduleFadeAt = 0;
+uint16_t scheduleFadeIn = 0;
+
+// "volume_profile" section of gong.conf
+struct VolumeProfileSettings {
+    uint8_t count;
+    VolumeProfilePoint points[MAX_VOLUME_PROFILE_POINTS];
+};
+
+// "default_schedules" section of gong.conf
+struct DefaultScheduleEntry {
+    uint8_t hour;
+    uint8_t minute;
+    bool enabled;
+    uint8_t volume;
+    uint16_t fadeIn;
+    uint32_t zones;
+    char description[SCHEDULE_DESCRIPTION_LENGTH];
+    char program[GONG_PROGRAM_NAME_LENGTH];
+};
+
+struct DefaultScheduleSettings {
+    uint8_t count;
+    DefaultScheduleEntry entries[MAX_SCHEDULE_ENTRIES];
+};
+
+VolumeProfilePoint volumeProfile[MAX_VOLUME_PROFILE_POINTS];
+uint8_t volumeProfileCount = 0;
+int16_t volumeProfileApplied = -1;          // Profile volume last set, -1 = none yet
+
+void updateScheduleVersion();
+void planNextSchedule();
+void replanSchedule();
+void updateScheduleVolume();
+
+void onScheduleChanged(const Event& event) {
+    // A new volume profile is followed from the next minute on
+    if (event.type == EVENT_CONFIG_CHANGED) {
+        if (event.param == CONFIG_SECTION_VOLUME_PROFILE) {
+            loadVolumeProfile();
+        }
         return;
     }
+    replanSchedule();
+}
+
+void setupSchedule() {
+    if (!scheduleMutex) {
+        scheduleMutex = xSemaphoreCreateRecursiveMutex();
+    }
+    scheduleSubscriber = subscribeEvents("schedule", EVENT_MASK(EVENT_SCHEDULE_CHANGED) |
+                                         EVENT_MASK(EVENT_CONFIG_CHANGED), onScheduleChanged);
     
+    // SPIFFS is mounted by the boot storage stage; defaults from gong.conf if no schedules exist
     loadScheduleFromSPIFFS();
-    
-    // If no schedules exist, load defaults from gong.conf
-    if (scheduleCount == 0) {
-        loadDefaultSchedules();
-    }
+    loadDefaultSchedules();
+    loadVolumeProfile();
     
     // Initialize NTP client
     timeClient.begin();
     timeClient.setTimeOffset(0); // Will be set based on timezone
     timeClient.setUpdateInterval(60000); // Update every minute
     
-    Serial.println("Schedule module initialized");
+    LOG_INFO(LOG_MODULE_SCHEDULE, "Schedule module initialized");
 }
 
 void checkSchedule() {
-    timeClient.update();
+    if (timeClient.update()) {
+        publishEvent(EVENT_TIME_SYNCED, EVENT_SOURCE_SCHEDULE, 0, timeClient.getEpochTime());
+    }
     
     if (!timeClient.isTimeSet()) {
         return; // Wait for NTP sync
     }
     
-    // Get current time from NTP
-    unsigned long epochTime = timeClient.getEpochTime();
-    struct tm *ptm = gmtime((time_t *)&epochTime);
+    replanSchedule();
+    updateScheduleVolume();
+}
+
+void lockSchedule() {
+    xSemaphoreTakeRecursive(scheduleMutex, portMAX_DELAY);
+}
+
+void unlockSchedule() {
+    xSemaphoreGiveRecursive(scheduleMutex);
+}
+
+void replanSchedule() {
+    // While a change is being saved the plan stays as it is; it is made
+    // again on the next pass
+    if (xSemaphoreTakeRecursive(scheduleMutex, 0) != pdTRUE) {
+        scheduleChanged = true;
+        return;
+    }
+    scheduleChanged = false;
+    planNextSchedule();
+    unlockSchedule();
+}
+
+uint16_t getMinuteOfDay(unsigned long epoch) {
+    return epoch % 86400 / 60;
+}
+
+const char* parseVolumeProfileSettings(JsonVariantConst json, void* settings) {
+    VolumeProfileSettings& profile = *(VolumeProfileSettings*)settings;
+    JsonArrayConst points = json.as<JsonArrayConst>();
+    profile.count = 0;
+    if (points.size() > MAX_VOLUME_PROFILE_POINTS) {
+        return "8 points at most";
+    }
+    for (JsonObjectConst item : points) {
+        int hour = item["hour"] | 0;
+        int minute = item["minute"] | 0;
+        int volume = item["volume"] | 0;
+        if (hour < 0 || hour > 23 || minute < 0 || minute > 59 || volume < 0 || volume > MP3_MAX_VOLUME) {
+            return "points are hour 0-23, minute 0-59 and volume 0-30";
+        }
+        VolumeProfilePoint& point = profile.points[profile.count++];
+        point.hour = hour;
+        point.minute = minute;
+        point.volume = volume;
+    }
+    return nullptr;
+}
+
+void loadVolumeProfile() {
+    // Again on every change to the "volume_profile" section
+    VolumeProfileSettings settings;
+    loadConfigSection(CONFIG_SECTION_VOLUME_PROFILE, &settings, sizeof(settings), parseVolumeProfileSettings);
+    setVolumeProfile(settings.points, settings.count);
+    if (volumeProfileCount > 0) {
+        LOG_INFO(LOG_MODULE_SCHEDULE, "Loaded volume profile with %d points", volumeProfileCount);
+    }
+}
+
+bool setVolumeProfile(const VolumeProfilePoint* points, uint8_t count) {
+    if (count > MAX_VOLUME_PROFILE_POINTS) {
+        return false;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        if (points[i].hour > 23 || points[i].minute > 59 || points[i].volume > MP3_MAX_VOLUME) {
+            return false;
+        }
+    }
+    
+    // Kept in time-of-day order
+    volumeProfileCount = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        uint16_t minute = points[i].hour * 60 + points[i].minute;
+        uint8_t j = volumeProfileCount++;
+        while (j > 0 && volumeProfile[j - 1].hour * 60 + volumeProfile[j - 1].minute > minute) {
+            volumeProfile[j] = volumeProfile[j - 1];
+            j--;
+        }
+        volumeProfile[j] = points[i];
+    }
+    volumeProfileApplied = -1;
+    return true;
+}
+
+int16_t getProfileVolume(uint16_t minuteOfDay) {
+    if (volumeProfileCount == 0) {
+        return -1;
+    }
+    
+    // The points either side, around midnight where needed
+    uint8_t next = 0;
+    while (next < volumeProfileCount &&
+           volumeProfile[next].hour * 60 + volumeProfile[next].minute <= minuteOfDay) {
+        next++;
+    }
+    const VolumeProfilePoint& after = volumeProfile[next % volumeProfileCount];
+    const VolumeProfilePoint& before = volumeProfile[(next + volumeProfileCount - 1) % volumeProfileCount];
+    int16_t beforeMinute = before.hour * 60 + before.minute;
+    int16_t span = (after.hour * 60 + after.minute - beforeMinute + 1440) % 1440;
+    if (span == 0) {
+        return before.volume;
+    }
+    int16_t into = (minuteOfDay - beforeMinute + 1440) % 1440;
+    int16_t change = (int16_t)after.volume - before.volume;
+    return before.volume + (change * into + (change >= 0 ? span / 2 : -span / 2)) / span;
+}
+
+int16_t getScheduleEntryVolume(const ScheduleEntry& entry, unsigned long instant) {
+    if (entry.volume != SCHEDULE_VOLUME_PROFILE) {
+        return entry.volume;
+    }
+    return getProfileVolume(getMinuteOfDay(instant));
+}
+
+void prepareScheduleVolume(const ScheduleEntry& entry) {
+    // The entry's volume, or the profile's at its instant, set with the
+    // amplifier; a fade-in starts from silence and ramps up at the instant
+    int16_t volume = getScheduleEntryVolume(entry, scheduleNextInstant);
+    scheduleEntryVolume = volume >= 0 ? volume : getMP3Status().volume;
+    schedulePreparedFadeIn = entry.program.length() == 0 ? entry.fadeIn : 0;
+    uint8_t start = schedulePreparedFadeIn > 0 ? 0 : scheduleEntryVolume;
+    if (start == getMP3Status().volume) {
+        return;
+    }
+    if (scheduleRestoreVolume < 0) {
+        scheduleRestoreVolume = getMP3Status().volume;
+    }
+    postAudioRequest(AUDIO_REQUEST_VOLUME, start);
+}
+
+void updateScheduleVolume() {
+    // Only between gongs: not while one rings, is about to, or is fading
+    if (scheduleWoken || scheduleFadePending || isPlaying() || isGongProgramRunning() || isVolumeRamping()) {
+        return;
+    }
+    if (scheduleRestoreVolume >= 0) {
+        postAudioRequest(AUDIO_REQUEST_VOLUME, scheduleRestoreVolume);
+        scheduleRestoreVolume = -1;
+    }
+    
+    // The profile is followed as it changes; a volume set by hand stays
+    // until the curve moves on
+    int16_t volume = getProfileVolume(getMinuteOfDay(getCurrentEpoch()));
+    if (volume >= 0 && volume != volumeProfileApplied) {
+        volumeProfileApplied = volume;
+        if (volume != getMP3Status().volume) {
+            postAudioRequest(AUDIO_REQUEST_VOLUME, volume);
+        }
+    }
+}
+
+String getVolumeProfileJSON() {
+    DynamicJsonDocument doc(1024);
+    doc["volume"] = getMP3Status().volume;
+    doc["ramping"] = isVolumeRamping();
+    if (volumeProfileCount > 0 && timeClient.isTimeSet()) {
+        doc["profile_volume"] = getProfileVolume(getMinuteOfDay(getCurrentEpoch()));
+    }
+    
+    JsonArray profile = doc.createNestedArray("profile");
+    for (uint8_t i = 0; i < volumeProfileCount; i++) {
+        JsonObject point = profile.createNestedObject();
+        point["hour"] = volumeProfile[i].hour;
+        point["minute"] = volumeProfile[i].minute;
+        point["volume"] = volumeProfile[i].volume;
+    }
+    
+    String result;
+    serializeJson(doc, result);
+    return result;
+}
+
+uint64_t getCurrentEpochMillis() {
+    // NTPClient counts whole seconds; the millisecond phase comes from when
+    // loopSchedule() last saw the second change
+    unsigned long epoch = timeClient.getEpochTime();
+    if (epoch != scheduleEpochSeen) {
+        scheduleEpochSeen = epoch;
+        scheduleEpochTickMillis = millis();
+    }
+    return epoch * 1000ULL + min(millis() - scheduleEpochTickMillis, 999UL);
+}
+
+uint32_t getSchedulePreRoll(const ScheduleEntry& entry) {
+    // A single gong from the synthesizer only waits for the next DMA buffer
+    if (entry.program.length() == 0 && isGongSynthEnabled()) {
+        return GONG_SYNTH_PRE_ROLL;
+    }
+    uint16_t track = entry.program.length() > 0 ? getGongProgramFirstTrack(entry.program) : MP3_GONG_TRACK;
+    return getMP3PreRoll(track);
+}
+
+void planNextSchedule() {
+    // Earliest enabled entry for this node's zones, up to a minute late
+    // (as when the minute was polled), never the instant already rung
+    uint64_t nowMillis = getCurrentEpochMillis();
+    unsigned long now = nowMillis / 1000;
+    unsigned long dayStart = now - now % 86400;
+    const ScheduleEntry* next = nullptr;
+    unsigned long nextInstant = 0;
     
     for (uint8_t i = 0; i < scheduleCount; i++) {
-        if (scheduleEntries[i].enabled && 
-            scheduleEntries[i].hour == ptm->tm_hour && 
-            scheduleEntries[i].minute == ptm->tm_min) {
-            
-            Serial.printf("Schedule triggered: %02d:%02d - %s\n", 
-                        scheduleEntries[i].hour, 
-                        scheduleEntries[i].minute, 
-                        scheduleEntries[i].description.c_str());
-            
-            triggerGong();
+        const ScheduleEntry& entry = scheduleEntries[i];
+        if (!entry.enabled || !(entry.zones & getLoRaZones())) {
+            continue;
         }
+        unsigned long instant = dayStart + entry.hour * 3600UL + entry.minute * 60UL;
+        if (instant + 60 <= now || instant <= scheduleLastInstant) {
+            instant += 86400;
+        }
+        if (!next || instant < nextInstant) {
+            next = &entry;
+            nextInstant = instant;
+        }
+    }
+    
+    if (!next) {
+        scheduleNextId = 0;
+        return;
+    }
+    if (next->id != scheduleNextId || nextInstant != scheduleNextInstant) {
+        scheduleWoken = false;
+        schedulePreparedFadeIn = 0;
     }
+    
+    // Replanned every second, so clock corrections and new calibration apply
+    scheduleNextId = next->id;
+    if (scheduleNextEntry.id != next->id || getScheduleEntryHash(scheduleNextEntry) != getScheduleEntryHash(*next)) {
+        scheduleNextEntry = *next;
+    }
+    scheduleNextInstant = nextInstant;
+    schedulePreRoll = getSchedulePreRoll(*next);
+    long untilMs = (long)((int64_t)nextInstant * 1000 - (int64_t)nowMillis);
+    scheduleFireAt = millis() + untilMs - schedulePreRoll;
+    scheduleWakeAt = scheduleFireAt - MP3_AMP_WAKE_MS;
 }
 
-bool addScheduleEntry(uint8_t hour, uint8_t minute, const String& description) {
-    if (scheduleCount >= MAX_SCHEDULE_ENTRIES) {
+void loopSchedule() {
+    if (!timeClient.isTimeSet()) {
+        return;
+    }
+    getCurrentEpochMillis();
+    
+    // Fade-in from the moment the strike is heard
+    if (scheduleFadePending && (long)(millis() - scheduleFadeAt) >= 0) {
+        scheduleFadePending = false;
+        postAudioRequest(AUDIO_REQUEST_VOLUME, scheduleEntryVolume, scheduleFadeIn);
+    }
+    dispatchEvents(scheduleSubscriber);
+    if (scheduleChanged) {
+        replanSchedule();
+    }
+    if (scheduleNextId == 0) {
+        return;
+    }
+    
+    // Amplifier up and the volume set before the play command
+    const ScheduleEntry* entry = &scheduleNextEntry;
+    if (!scheduleWoken && (long)(millis() - scheduleWakeAt) >= 0) {
+        scheduleWoken = true;
+        postAudioRequest(AUDIO_REQUEST_AMP_WAKE);
+        prepareScheduleVolume(*entry);
+        if (entry->program.length() > 0) {
+            postAudioRequest(AUDIO_REQUEST_PREPARE, 0, 0, entry->program);
+        }
+    }
+    if ((long)(millis() - scheduleFireAt) < 0) {
+        return;
+    }
+    
+    scheduleLastInstant = scheduleNextInstant;
+    scheduleNextId = 0;
+    if (schedulePreparedFadeIn > 0) {
+        scheduleFadePending = true;
+        scheduleFadeAt = millis() + schedulePreRoll;
+        scheduleFadeIn = schedulePreparedFadeIn;
+    }
+    LOG_INFO(LOG_MODULE_SCHEDULE, "Schedule triggered: %02d:%02d - %s (%u ms pre-roll)", entry->hour, entry->minute,
+             entry->description.c_str(), schedulePreRoll);
+    triggerScheduleEntry(*entry);
+    replanSchedule();
+}
+
+bool addScheduleEntry(uint8_t hour, uint8_t minute, const String& description, uint32_t zones,
+                      const String& program, uint8_t volume, uint16_t fadeIn) {
+    if (hour > 23 || minute > 59 || volume > MP3_MAX_VOLUME || fadeIn > SCHEDULE_MAX_FADE_IN) {
         return false;
     }
     
-    if (hour > 23 || minute > 59) {
+    lockSchedule();
+    if (scheduleCount >= MAX_SCHEDULE_ENTRIES) {
+        unlockSchedule();
         return false;
     }
     
@@ -80,17 +430,23 @@ bool addScheduleEntry(uint8_t hour, uint8_t minute, const String& description) {
     entry.description = description;
     entry.enabled = true;
     entry.id = nextScheduleId++;
+    entry.zones = zones;
+    entry.program = program;
+    entry.volume = volume;
+    entry.fadeIn = fadeIn;
     
     scheduleCount++;
     saveScheduleToSPIFFS();
     
-    Serial.printf("Added schedule: %02d:%02d - %s (ID: %u)\n", 
-                 hour, minute, description.c_str(), entry.id);
+    LOG_INFO(LOG_MODULE_SCHEDULE, "Added schedule: %02d:%02d - %s (ID: %u)",
+             hour, minute, description.c_str(), entry.id);
+    unlockSchedule();
     
     return true;
 }
 
 bool deleteScheduleEntry(uint32_t id) {
+    lockSchedule();
     for (uint8_t i = 0; i < scheduleCount; i++) {
         if (scheduleEntries[i].id == id) {
             // Shift remaining entries
@@ -100,31 +456,41 @@ bool deleteScheduleEntry(uint32_t id) {
             scheduleCount--;
             saveScheduleToSPIFFS();
             
-            Serial.printf("Deleted schedule ID: %u\n", id);
+            LOG_INFO(LOG_MODULE_SCHEDULE, "Deleted schedule ID: %u", id);
+            unlockSchedule();
             return true;
         }
     }
+    unlockSchedule();
     return false;
 }
 
-bool editScheduleEntry(uint32_t id, uint8_t hour, uint8_t minute, const String& description, bool enabled) {
-    if (hour > 23 || minute > 59) {
+bool editScheduleEntry(uint32_t id, uint8_t hour, uint8_t minute, const String& description, bool enabled,
+                       uint32_t zones, const String& program, uint8_t volume, uint16_t fadeIn) {
+    if (hour > 23 || minute > 59 || volume > MP3_MAX_VOLUME || fadeIn > SCHEDULE_MAX_FADE_IN) {
         return false;
     }
     
+    lockSchedule();
     for (uint8_t i = 0; i < scheduleCount; i++) {
         if (scheduleEntries[i].id == id) {
             scheduleEntries[i].hour = hour;
             scheduleEntries[i].minute = minute;
             scheduleEntries[i].description = description;
             scheduleEntries[i].enabled = enabled;
+            scheduleEntries[i].zones = zones;
+            scheduleEntries[i].program = program;
+            scheduleEntries[i].volume = volume;
+            scheduleEntries[i].fadeIn = fadeIn;
             saveScheduleToSPIFFS();
             
-            Serial.printf("Edited schedule ID: %u to %02d:%02d - %s (enabled: %s)\n", 
-                        id, hour, minute, description.c_str(), enabled ? "true" : "false");
+            LOG_INFO(LOG_MODULE_SCHEDULE, "Edited schedule ID: %u to %02d:%02d - %s (enabled: %s)",
+                     id, hour, minute, description.c_str(), enabled ? "true" : "false");
+            unlockSchedule();
             return true;
         }
     }
+    unlockSchedule();
     return false;
 }
 
@@ -132,6 +498,7 @@ String getScheduleJSON() {
     DynamicJsonDocument doc(2048);
     JsonArray array = doc.to<JsonArray>();
     
+    lockSchedule();
     for (uint8_t i = 0; i < scheduleCount; i++) {
         JsonObject entry = array.createNestedObject();
         entry["id"] = scheduleEntries[i].id;
@@ -139,7 +506,18 @@ String getScheduleJSON() {
         entry["minute"] = scheduleEntries[i].minute;
         entry["enabled"] = scheduleEntries[i].enabled;
         entry["description"] = scheduleEntries[i].description;
+        addLoRaZonesJSON(entry, scheduleEntries[i].zones);
+        if (scheduleEntries[i].program.length() > 0) {
+            entry["program"] = scheduleEntries[i].program;
+        }
+        if (scheduleEntries[i].volume != SCHEDULE_VOLUME_PROFILE) {
+            entry["volume"] = scheduleEntries[i].volume;
+        }
+        if (scheduleEntries[i].fadeIn > 0) {
+            entry["fade_in"] = scheduleEntries[i].fadeIn;
+        }
     }
+    unlockSchedule();
     
     String result;
     serializeJson(doc, result);
@@ -148,13 +526,13 @@ String getScheduleJSON() {
 
 void loadScheduleFromSPIFFS() {
     if (!SPIFFS.exists(SCHEDULE_FILE)) {
-        Serial.println("No schedule file found, starting with empty schedule");
+        LOG_INFO(LOG_MODULE_SCHEDULE, "No schedule file found, starting with empty schedule");
         return;
     }
     
     File file = SPIFFS.open(SCHEDULE_FILE, "r");
     if (!file) {
-        Serial.println("Failed to open schedule file for reading");
+        LOG_ERROR(LOG_MODULE_SCHEDULE, "Failed to open schedule file for reading");
         return;
     }
     
@@ -163,7 +541,7 @@ void loadScheduleFromSPIFFS() {
     file.close();
     
     if (error) {
-        Serial.println("Failed to parse schedule file");
+        LOG_ERROR(LOG_MODULE_SCHEDULE, "Failed to parse schedule file");
         return;
     }
     
@@ -179,6 +557,10 @@ void loadScheduleFromSPIFFS() {
         sched.minute = entry["minute"] | 0;
         sched.enabled = entry["enabled"] | true;
         sched.description = entry["description"] | "";
+        sched.zones = parseLoRaZones(entry["zones"]);
+        sched.program = entry["program"] | "";
+        sched.volume = min(entry["volume"] | 0, MP3_MAX_VOLUME);
+        sched.fadeIn = min(entry["fade_in"] | 0, SCHEDULE_MAX_FADE_IN);
         
         if (sched.id >= nextScheduleId) {
             nextScheduleId = sched.id + 1;
@@ -187,63 +569,86 @@ void loadScheduleFromSPIFFS() {
         scheduleCount++;
     }
     
-    Serial.printf("Loaded %d schedule entries\n", scheduleCount);
+    updateScheduleVersion();
+    LOG_INFO(LOG_MODULE_SCHEDULE, "Loaded %d schedule entries", scheduleCount);
 }
 
-void loadDefaultSchedules() {
-    if (!SPIFFS.exists(GONG_CONFIG_FILE)) {
-        Serial.println("No gong.conf file found for default schedules");
-        return;
+const char* parseDefaultScheduleSettings(JsonVariantConst json, void* settings) {
+    DefaultScheduleSettings& defaults = *(DefaultScheduleSettings*)settings;
+    JsonArrayConst entries = json.as<JsonArrayConst>();
+    defaults.count = 0;
+    if (entries.size() > MAX_SCHEDULE_ENTRIES) {
+        return "20 entries at most";
     }
-    
-    File file = SPIFFS.open(GONG_CONFIG_FILE, "r");
-    if (!file) {
-        Serial.println("Failed to open gong.conf file for reading");
+    for (JsonObjectConst item : entries) {
+        DefaultScheduleEntry& entry = defaults.entries[defaults.count++];
+        int hour = item["hour"] | 0;
+        int minute = item["minute"] | 0;
+        const char* description = item["description"] | "";
+        const char* program = item["program"] | "";
+        if (hour < 0 || hour > 23 || minute < 0 || minute > 59) {
+            return "entries are hour 0-23 and minute 0-59";
+        }
+        if (strlen(description) >= SCHEDULE_DESCRIPTION_LENGTH || strlen(program) >= GONG_PROGRAM_NAME_LENGTH) {
+            return "description too long, or program name";
+        }
+        entry.hour = hour;
+        entry.minute = minute;
+        entry.enabled = item["enabled"] | true;
+        entry.zones = parseLoRaZones(item["zones"]);
+        entry.volume = min(item["volume"] | 0, MP3_MAX_VOLUME);
+        entry.fadeIn = min(item["fade_in"] | 0, SCHEDULE_MAX_FADE_IN);
+        strlcpy(entry.description, description, sizeof(entry.description));
+        strlcpy(entry.program, program, sizeof(entry.program));
+    }
+    return nullptr;
+}
+
+void loadDefaultSchedules() {
+    // Loaded, and so checked, at every boot; used only while there are no schedules
+    DefaultScheduleSettings settings;
+    loadConfigSection(CONFIG_SECTION_DEFAULT_SCHEDULES, &settings, sizeof(settings), parseDefaultScheduleSettings);
+    if (scheduleCount > 0) {
         return;
     }
-    
-    DynamicJsonDocument doc(2048);
-    DeserializationError error = deserializeJson(doc, file);
-    file.close();
-    
-    if (error) {
-        Serial.println("Failed to parse gong.conf file");
+    if (settings.count == 0) {
+        LOG_INFO(LOG_MODULE_SCHEDULE, "No default schedules in gong.conf");
         return;
     }
     
-    if (doc.containsKey("default_schedules")) {
-        JsonArray array = doc["default_schedules"];
-        
-        for (JsonObject entry : array) {
-            if (scheduleCount >= MAX_SCHEDULE_ENTRIES) break;
-            
-            ScheduleEntry& sched = scheduleEntries[scheduleCount];
-            sched.id = nextScheduleId++;
-            sched.hour = entry["hour"] | 0;
-            sched.minute = entry["minute"] | 0;
-            sched.enabled = entry["enabled"] | true;
-            sched.description = entry["description"] | "";
-            
-            scheduleCount++;
-        }
-        
-        Serial.printf("Loaded %d default schedule entries from gong.conf\n", scheduleCount);
+    for (uint8_t i = 0; i < settings.count; i++) {
+        const DefaultScheduleEntry& entry = settings.entries[i];
+        ScheduleEntry& sched = scheduleEntries[scheduleCount];
+        sched.id = nextScheduleId++;
+        sched.hour = entry.hour;
+        sched.minute = entry.minute;
+        sched.enabled = entry.enabled;
+        sched.description = entry.description;
+        sched.zones = entry.zones;
+        sched.program = entry.program;
+        sched.volume = entry.volume;
+        sched.fadeIn = entry.fadeIn;
         
-        // Save the default schedules to the schedule file
-        saveScheduleToSPIFFS();
+        scheduleCount++;
     }
+    
+    LOG_INFO(LOG_MODULE_SCHEDULE, "Loaded %d default schedule entries from gong.conf", scheduleCount);
+    
+    // Save the default schedules to the schedule file
+    saveScheduleToSPIFFS();
 }
 
 void saveScheduleToSPIFFS() {
     File file = SPIFFS.open(SCHEDULE_FILE, "w");
     if (!file) {
-        Serial.println("Failed to open schedule file for writing");
+        LOG_ERROR(LOG_MODULE_SCHEDULE, "Failed to open schedule file for writing");
         return;
     }
     
     DynamicJsonDocument doc(2048);
     JsonArray array = doc.to<JsonArray>();
     
+    lockSchedule();
     for (uint8_t i = 0; i < scheduleCount; i++) {
         JsonObject entry = array.createNestedObject();
         entry["id"] = scheduleEntries[i].id;
@@ -251,16 +656,190 @@ void saveScheduleToSPIFFS() {
         entry["minute"] = scheduleEntries[i].minute;
         entry["enabled"] = scheduleEntries[i].enabled;
         entry["description"] = scheduleEntries[i].description;
+        addLoRaZonesJSON(entry, scheduleEntries[i].zones);
+        if (scheduleEntries[i].program.length() > 0) {
+            entry["program"] = scheduleEntries[i].program;
+        }
+        if (scheduleEntries[i].volume != SCHEDULE_VOLUME_PROFILE) {
+            entry["volume"] = scheduleEntries[i].volume;
+        }
+        if (scheduleEntries[i].fadeIn > 0) {
+            entry["fade_in"] = scheduleEntries[i].fadeIn;
+        }
     }
     
     serializeJson(doc, file);
     file.close();
     
-    Serial.println("Schedule saved to SPIFFS");
+    updateScheduleVersion();
+    unlockSchedule();
+    LOG_INFO(LOG_MODULE_SCHEDULE, "Schedule saved to SPIFFS");
 }
 
 void triggerGong() {
-    if (onGongTrigger) {
-        onGongTrigger();
+    publishEvent(EVENT_GONG_REQUESTED, EVENT_SOURCE_SCHEDULE);
+}
+
+void triggerScheduleEntry(const ScheduleEntry& entry) {
+    // A program that is missing on this node still rings a single gong
+    int8_t program = entry.program.length() > 0 ? findGongProgramIndex(entry.program) : -1;
+    if (entry.program.length() > 0 && program < 0) {
+        LOG_WARN(LOG_MODULE_SCHEDULE, "Unknown gong program: %s", entry.program.c_str());
     }
+    publishEvent(EVENT_GONG_REQUESTED, EVENT_SOURCE_SCHEDULE, program + 1);
+}
+
+bool isTimeSynced() {
+    return timeClient.isTimeSet();
+}
+
+long getScheduleFireInMs() {
+    // Until the planned entry's play command; -1 while nothing is planned
+    if (scheduleNextId == 0 || !timeClient.isTimeSet()) {
+        return -1;
+    }
+    return max((long)(scheduleFireAt - millis()), 0L);
+}
+
+unsigned long getCurrentEpoch() {
+    return timeClient.isTimeSet() ? timeClient.getEpochTime() : 0;
+}
+
+uint8_t getScheduleCount() {
+    return scheduleCount;
+}
+
+const ScheduleEntry* getScheduleEntry(uint8_t index) {
+    if (index >= scheduleCount) {
+        return nullptr;
+    }
+    return &scheduleEntries[index];
+}
+
+const ScheduleEntry* findScheduleEntry(uint32_t id) {
+    for (uint8_t i = 0; i < scheduleCount; i++) {
+        if (scheduleEntries[i].id == id) {
+            return &scheduleEntries[i];
+        }
+    }
+    return nullptr;
+}
+
+uint32_t fnv1a(uint32_t hash, const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+uint32_t getScheduleEntryHash(const ScheduleEntry& entry) {
+    uint8_t fields[7] = {
+        (uint8_t)entry.id, (uint8_t)(entry.id >> 8), (uint8_t)(entry.id >> 16), (uint8_t)(entry.id >> 24),
+        entry.hour, entry.minute, (uint8_t)entry.enabled
+    };
+    
+    uint32_t hash = fnv1a(2166136261UL, fields, sizeof(fields));
+    hash = fnv1a(hash, (const uint8_t*)entry.description.c_str(), entry.description.length());
+    
+    // Entries for every zone hash as they did before zones existed
+    if (entry.zones != SCHEDULE_ALL_ZONES) {
+        uint8_t zones[4] = {
+            (uint8_t)entry.zones, (uint8_t)(entry.zones >> 8), (uint8_t)(entry.zones >> 16), (uint8_t)(entry.zones >> 24)
+        };
+        hash = fnv1a(hash, zones, sizeof(zones));
+    }
+    if (entry.program.length() > 0) {
+        hash = fnv1a(hash, (const uint8_t*)entry.program.c_str(), entry.program.length());
+    }
+    if (entry.volume != SCHEDULE_VOLUME_PROFILE || entry.fadeIn > 0) {
+        uint8_t sound[3] = {entry.volume, (uint8_t)entry.fadeIn, (uint8_t)(entry.fadeIn >> 8)};
+        hash = fnv1a(hash, sound, sizeof(sound));
+    }
+    return hash;
+}
+
+uint32_t getScheduleVersionHash() {
+    return scheduleVersionHash;
+}
+
+void updateScheduleVersion() {
+    // XOR of entry hashes is order-independent, so nodes that received
+    // the same entries in a different order still agree on the version
+    uint32_t version = scheduleCount * 0x9E3779B1UL;
+    for (uint8_t i = 0; i < scheduleCount; i++) {
+        version ^= getScheduleEntryHash(scheduleEntries[i]);
+    }
+    scheduleVersionHash = version;
+    publishEvent(EVENT_SCHEDULE_CHANGED, EVENT_SOURCE_NONE, scheduleCount, version);
+}
+
+uint8_t upsertScheduleEntries(const ScheduleEntry* entries, uint8_t count) {
+    uint8_t applied = 0;
+    
+    lockSchedule();
+    for (uint8_t i = 0; i < count; i++) {
+        const ScheduleEntry& incoming = entries[i];
+        if (incoming.id == 0 || incoming.hour > 23 || incoming.minute > 59 || incoming.volume > MP3_MAX_VOLUME ||
+            incoming.fadeIn > SCHEDULE_MAX_FADE_IN) {
+            continue;
+        }
+        
+        ScheduleEntry* entry = (ScheduleEntry*)findScheduleEntry(incoming.id);
+        if (!entry) {
+            if (scheduleCount >= MAX_SCHEDULE_ENTRIES) {
+                continue;
+            }
+            entry = &scheduleEntries[scheduleCount++];
+        }
+        
+        *entry = incoming;
+        if (incoming.id >= nextScheduleId) {
+            nextScheduleId = incoming.id + 1;
+        }
+        applied++;
+    }
+    
+    if (applied > 0) {
+        saveScheduleToSPIFFS();
+        LOG_INFO(LOG_MODULE_SCHEDULE, "Upserted %d schedule entries", applied);
+    }
+    unlockSchedule();
+    
+    return applied;
+}
+
+uint8_t pruneScheduleEntries(const uint32_t* keepIds, uint8_t keepCount) {
+    uint8_t removed = 0;
+    uint8_t i = 0;
+    
+    lockSchedule();
+    while (i < scheduleCount) {
+        bool keep = false;
+        for (uint8_t k = 0; k < keepCount; k++) {
+            if (keepIds[k] == scheduleEntries[i].id) {
+                keep = true;
+                break;
+            }
+        }
+        
+        if (keep) {
+            i++;
+            continue;
+        }
+        
+        for (uint8_t j = i; j < scheduleCount - 1; j++) {
+            scheduleEntries[j] = scheduleEntries[j + 1];
+        }
+        scheduleCount--;
+        removed++;
+    }
+    
+    if (removed > 0) {
+        saveScheduleToSPIFFS();
+        LOG_INFO(LOG_MODULE_SCHEDULE, "Pruned %d schedule entries", removed);
+    }
+    unlockSchedule();
+    
+    return removed;
 }
@@ -0,0 +1,674 @@
+#include "schedulesync.h"
+#include "schedule.h"
+#include "lorahandler.h"
+#include "nodestatus.h"
+#include "logger.h"
+
+// Sync counters
+SyncStats syncStats;
+
+// Master state
+uint32_t syncAnnouncedVersion = 0;
+unsigned long syncLastAdvert = 0;
+unsigned long syncAdvertDueAt = 0;
+unsigned long syncDigestDueAt = 0;
+unsigned long syncPatchDueAt = 0;
+unsigned long syncResendDueAt = 0;
+uint32_t syncDigestIds[MAX_SCHEDULE_ENTRIES];
+uint16_t syncDigestHashes[MAX_SCHEDULE_ENTRIES];
+uint8_t syncDigestCount = 0;
+uint32_t syncDigestVersion = 0;
+uint8_t syncDigestSent = 0;       // Entries of the digest already sent
+bool syncDigestSending = false;
+uint32_t syncRequestedMask = 0;   // Digest indices requested by slaves
+String syncPatch;
+uint8_t syncPatchXfer = 0;
+uint8_t syncPatchFragments = 0;
+uint16_t syncSendMask = 0;        // Fragments still to transmit
+uint16_t syncResendMask = 0;      // Fragments NACKed during the collect window
+unsigned long syncRoundStart = 0;
+unsigned long syncLastActivity = 0;
+uint32_t syncRoundAirtimeUs = 0;
+
+// Slave state
+char syncPendingOp = 0;
+unsigned long syncPendingAt = 0;
+uint32_t syncPendingMask = 0;
+uint32_t syncTargetVersion = 0;
+uint32_t syncRxDigestVersion = 0;
+uint8_t syncRxDigestCount = 0;
+uint32_t syncRxDigestMask = 0;    // Digest indices received so far
+uint32_t syncRxDigestIds[MAX_SCHEDULE_ENTRIES];
+uint16_t syncRxDigestHashes[MAX_SCHEDULE_ENTRIES];
+char syncRxBuffer[SYNC_FRAGMENT_SIZE * SYNC_MAX_FRAGMENTS + 1];
+uint8_t syncRxXfer = 0;
+uint8_t syncRxTotal = 0;          // 0 = no transfer in progress
+uint16_t syncRxReceived = 0;
+size_t syncRxLength = 0;
+unsigned long syncRxLastFragment = 0;
+uint8_t syncRxNacks = 0;
+
+static_assert(MAX_SCHEDULE_ENTRIES <= 32, "digest masks are 32 bits wide");
+static_assert(SYNC_MAX_FRAGMENTS <= 16, "fragment masks are 16 bits wide");
+
+bool syncDue(unsigned long dueAt) {
+    return dueAt != 0 && (long)(millis() - dueAt) >= 0;
+}
+
+uint16_t syncEntryHash16(const ScheduleEntry& entry) {
+    uint32_t hash = getScheduleEntryHash(entry);
+    return (uint16_t)(hash ^ (hash >> 16));
+}
+
+uint16_t syncFragmentMask(uint8_t total) {
+    return (uint16_t)((1UL << total) - 1);
+}
+
+void setupScheduleSync() {
+    memset(&syncStats, 0, sizeof(syncStats));
+    randomSeed(getLoRaNodeId());
+    
+    LOG_INFO(LOG_MODULE_SYNC, "Schedule sync initialized");
+}
+
+void sendSyncFrame(const String& content) {
+    sendLoRaMessage(content, MSG_TYPE_SCHEDULE);
+    
+    // sendLoRaMessage prefixes "2:"
+    size_t frameLength = content.length() + 2;
+    uint32_t airtimeUs = getLoRaAirtimeUs(frameLength);
+    
+    syncStats.framesSent++;
+    syncStats.bytesSent += frameLength;
+    syncStats.txAirtimeUs += airtimeUs;
+    
+    if (syncRoundStart) {
+        syncRoundAirtimeUs += airtimeUs;
+    }
+    syncLastActivity = millis();
+}
+
+// ---- Master side ----
+
+void startSyncRound() {
+    if (!syncRoundStart) {
+        syncRoundStart = millis();
+        syncRoundAirtimeUs = 0;
+    }
+    syncLastActivity = millis();
+}
+
+void sendVersionAdvert() {
+    char frame[16];
+    snprintf(frame, sizeof(frame), "%c%08lX", SYNC_OP_VERSION, (unsigned long)getScheduleVersionHash());
+    sendSyncFrame(frame);
+    syncLastAdvert = millis();
+}
+
+void takeDigest() {
+    lockSchedule();
+    syncDigestCount = getScheduleCount();
+    syncDigestVersion = getScheduleVersionHash();
+    syncRequestedMask = 0; // Requests against an older digest no longer apply
+    
+    for (uint8_t i = 0; i < syncDigestCount; i++) {
+        const ScheduleEntry* entry = getScheduleEntry(i);
+        syncDigestIds[i] = entry->id;
+        syncDigestHashes[i] = syncEntryHash16(*entry);
+    }
+    unlockSchedule();
+    
+    syncDigestSent = 0;
+    syncDigestSending = true;
+}
+
+void sendDigestPart() {
+    // As many entries as fit, so a full schedule with long ids still goes out
+    String items;
+    uint8_t start = syncDigestSent;
+    while (syncDigestSent < syncDigestCount) {
+        char item[20];
+        int length = snprintf(item, sizeof(item), "%s%lu:%04X", syncDigestSent > start ? "," : "",
+                              (unsigned long)syncDigestIds[syncDigestSent], syncDigestHashes[syncDigestSent]);
+        if (items.length() + length > SYNC_DIGEST_SIZE) {
+            break;
+        }
+        items += item;
+        syncDigestSent++;
+    }
+    
+    // A digest that fits one frame keeps the short header
+    char header[32];
+    if (start == 0 && syncDigestSent >= syncDigestCount) {
+        snprintf(header, sizeof(header), "%c%08lX;", SYNC_OP_DIGEST, (unsigned long)syncDigestVersion);
+    } else {
+        snprintf(header, sizeof(header), "%c%08lX,%u,%u;", SYNC_OP_DIGEST, (unsigned long)syncDigestVersion,
+                 start, syncDigestCount);
+    }
+    
+    String frame = header;
+    frame += items;
+    sendSyncFrame(frame);
+    if (syncDigestSent >= syncDigestCount) {
+        syncDigestSending = false;
+        syncLastAdvert = millis();
+    }
+}
+
+void buildPatch(uint32_t mask) {
+    const size_t capacity = SYNC_FRAGMENT_SIZE * SYNC_MAX_FRAGMENTS;
+    
+    DynamicJsonDocument doc(4096);
+    char version[9];
+    snprintf(version, sizeof(version), "%08lX", (unsigned long)syncDigestVersion);
+    doc["v"] = version;
+    JsonArray set = doc.createNestedArray("s");
+    
+    lockSchedule();
+    for (uint8_t i = 0; i < syncDigestCount; i++) {
+        if (!(mask & (1UL << i))) {
+            continue;
+        }
+        
+        const ScheduleEntry* entry = findScheduleEntry(syncDigestIds[i]);
+        if (!entry) {
+            continue;
+        }
+        
+        JsonArray item = set.createNestedArray();
+        item.add(entry->id);
+        item.add(entry->hour);
+        item.add(entry->minute);
+        item.add(entry->enabled ? 1 : 0);
+        item.add(entry->description);
+        // Trailing fields only when set; the ones before them are then sent too
+        bool sound = entry->volume != SCHEDULE_VOLUME_PROFILE || entry->fadeIn > 0;
+        if (entry->zones != SCHEDULE_ALL_ZONES || entry->program.length() > 0 || sound) {
+            item.add(entry->zones);
+        }
+        if (entry->program.length() > 0 || sound) {
+            item.add(entry->program);
+        }
+        if (sound) {
+            item.add(entry->volume);
+            item.add(entry->fadeIn);
+        }
+        
+        // Whatever does not fit is requested again after the next advert
+        if (measureJson(doc) > capacity) {
+            set.remove(set.size() - 1);
+            break;
+        }
+    }
+    unlockSchedule();
+    
+    String patch;
+    serializeJson(doc, patch);
+    
+    // The same patch again keeps its number, so slaves keep the fragments they already have
+    if (patch != syncPatch) {
+        syncPatch = patch;
+        syncPatchXfer++;
+    }
+    syncPatchFragments = (syncPatch.length() + SYNC_FRAGMENT_SIZE - 1) / SYNC_FRAGMENT_SIZE;
+    syncSendMask = syncFragmentMask(syncPatchFragments);
+    syncResendMask = 0;
+    
+    LOG_INFO(LOG_MODULE_SYNC, "Schedule patch %02X: %d entries, %d bytes, %d fragments",
+             syncPatchXfer, (int)set.size(), syncPatch.length(), syncPatchFragments);
+}
+
+void sendPatchFragment(uint8_t seq) {
+    char header[16];
+    snprintf(header, sizeof(header), "%c%02X,%d,%d;", SYNC_OP_PATCH, syncPatchXfer, seq, syncPatchFragments);
+    
+    String frame = header;
+    size_t start = seq * SYNC_FRAGMENT_SIZE;
+    frame += syncPatch.substring(start, min(start + SYNC_FRAGMENT_SIZE, (size_t)syncPatch.length()));
+    
+    sendSyncFrame(frame);
+}
+
+void handleMasterSyncMessage(char op, const char* body) {
+    unsigned long node = 0, version = 0, mask = 0;
+    
+    switch (op) {
+        case SYNC_OP_QUERY:
+            if (sscanf(body, "%lx,%lx", &node, &version) != 2) return;
+            startSyncRound();
+            if (!syncDigestDueAt) {
+                syncDigestDueAt = millis() + SYNC_COLLECT_WINDOW;
+            }
+            break;
+        
+        case SYNC_OP_REQUEST:
+            if (sscanf(body, "%lx,%lx,%lx", &node, &version, &mask) != 3) return;
+            startSyncRound();
+            if (version != syncDigestVersion || version != getScheduleVersionHash()) {
+                // Slave worked from a stale digest
+                if (!syncDigestDueAt) {
+                    syncDigestDueAt = millis() + SYNC_COLLECT_WINDOW;
+                }
+                return;
+            }
+            syncRequestedMask |= mask;
+            if (!syncPatchDueAt) {
+                syncPatchDueAt = millis() + SYNC_COLLECT_WINDOW;
+            }
+            break;
+        
+        case SYNC_OP_NACK: {
+            unsigned long xfer = 0;
+            if (sscanf(body, "%lx,%lx,%lx", &node, &xfer, &mask) != 3) return;
+            startSyncRound();
+            if (xfer != syncPatchXfer) {
+                return;
+            }
+            syncResendMask |= mask & syncFragmentMask(syncPatchFragments);
+            if (!syncResendDueAt) {
+                syncResendDueAt = millis() + SYNC_COLLECT_WINDOW;
+            }
+            break;
+        }
+        
+        default:
+            break;
+    }
+}
+
+void loopMasterSync() {
+    uint32_t version = getScheduleVersionHash();
+    if (version != syncAnnouncedVersion) {
+        // Local edit: push the digest straight away
+        syncAnnouncedVersion = version;
+        startSyncRound();
+        syncDigestDueAt = millis();
+        syncPatchDueAt = 0;
+        syncSendMask = 0;
+        syncDigestSending = false;
+    }
+    
+    // One frame per call so the web server and scheduler keep running;
+    // fragments wait while the radio queue backs up so gongs are not delayed
+    if (syncDigestSending) {
+        sendDigestPart();
+        return;
+    }
+    if (syncSendMask) {
+        if (getLoRaTxQueueDepth() >= SYNC_TX_BACKLOG) {
+            return;
+        }
+        
+        uint8_t seq = 0;
+        while (!(syncSendMask & (1U << seq))) {
+            seq++;
+        }
+        sendPatchFragment(seq);
+        syncSendMask &= ~(1U << seq);
+        
+        if (!syncSendMask) {
+            syncAdvertDueAt = millis() + SYNC_SETTLE_DELAY;
+        }
+        return;
+    }
+    
+    if (syncDue(syncDigestDueAt)) {
+        syncDigestDueAt = 0;
+        takeDigest();
+        sendDigestPart();
+        return;
+    }
+    
+    if (syncDue(syncResendDueAt)) {
+        syncResendDueAt = 0;
+        syncSendMask = syncResendMask;
+        syncResendMask = 0;
+        for (uint16_t m = syncSendMask; m; m &= m - 1) {
+            syncStats.fragmentsResent++;
+        }
+        return;
+    }
+    
+    if (syncDue(syncPatchDueAt)) {
+        syncPatchDueAt = 0;
+        buildPatch(syncRequestedMask);
+        syncRequestedMask = 0;
+        return;
+    }
+    
+    if (syncDue(syncAdvertDueAt) || millis() - syncLastAdvert >= SYNC_ADVERT_INTERVAL) {
+        syncAdvertDueAt = 0;
+        sendVersionAdvert();
+        return;
+    }
+    
+    bool idle = !syncDigestSending && !syncDigestDueAt && !syncPatchDueAt && !syncResendDueAt && !syncAdvertDueAt;
+    if (syncRoundStart && idle && millis() - syncLastActivity >= SYNC_QUIET_PERIOD) {
+        syncStats.lastConvergenceMs = syncLastActivity - syncRoundStart;
+        syncStats.lastConvergenceAirtimeMs = syncRoundAirtimeUs / 1000;
+        syncRoundStart = 0;
+        
+        LOG_INFO(LOG_MODULE_SYNC, "Schedule sync converged in %u ms, %u ms airtime",
+                 syncStats.lastConvergenceMs, syncStats.lastConvergenceAirtimeMs);
+    }
+}
+
+// ---- Slave side ----
+
+void schedulePendingReply(char op, uint32_t mask) {
+    syncPendingOp = op;
+    syncPendingMask = mask;
+    syncPendingAt = millis() + random(1, SYNC_REPLY_JITTER);
+}
+
+void suppressPendingReply(char op) {
+    if (syncPendingOp == op) {
+        syncPendingOp = 0;
+        syncStats.repliesSuppressed++;
+    }
+}
+
+void applyReceivedPatch() {
+    syncRxBuffer[syncRxLength] = '\0';
+    syncRxTotal = 0;
+    
+    DynamicJsonDocument doc(4096);
+    DeserializationError error = deserializeJson(doc, syncRxBuffer, syncRxLength);
+    
+    if (error) {
+        LOG_ERROR(LOG_MODULE_SYNC, "Failed to parse schedule patch");
+        return;
+    }
+    
+    ScheduleEntry entries[MAX_SCHEDULE_ENTRIES];
+    uint8_t count = 0;
+    
+    for (JsonArray item : doc["s"].as<JsonArray>()) {
+        if (count >= MAX_SCHEDULE_ENTRIES) break;
+        
+        ScheduleEntry& entry = entries[count++];
+        entry.id = item[0] | 0;
+        entry.hour = item[1] | 0;
+        entry.minute = item[2] | 0;
+        entry.enabled = (item[3] | 1) != 0;
+        entry.description = item[4] | "";
+        entry.zones = item[5] | SCHEDULE_ALL_ZONES;
+        entry.program = item[6] | "";
+        entry.volume = item[7] | SCHEDULE_VOLUME_PROFILE;
+        entry.fadeIn = item[8] | 0;
+    }
+    
+    upsertScheduleEntries(entries, count);
+    syncStats.patchesApplied++;
+    
+    if (getScheduleVersionHash() == syncTargetVersion) {
+        syncPendingOp = 0;
+        LOG_INFO(LOG_MODULE_SYNC, "Schedule synced to version %08lX", (unsigned long)syncTargetVersion);
+    }
+}
+
+void handleDigest(const char* body) {
+    char* cursor = nullptr;
+    uint32_t version = strtoul(body, &cursor, 16);
+    
+    // "<version>;" is a whole digest in one frame, "<version>,<start>,<count>;" one part of it
+    unsigned long start = 0;
+    unsigned long count = MAX_SCHEDULE_ENTRIES;
+    bool whole = *cursor == ';';
+    if (!whole) {
+        if (*cursor != ',') return;
+        start = strtoul(cursor + 1, &cursor, 10);
+        if (*cursor != ',') return;
+        count = strtoul(cursor + 1, &cursor, 10);
+        if (*cursor != ';' || count > MAX_SCHEDULE_ENTRIES || start > count) return;
+    }
+    
+    uint32_t ids[MAX_SCHEDULE_ENTRIES];
+    uint16_t hashes[MAX_SCHEDULE_ENTRIES];
+    uint8_t end = start;
+    
+    while (*cursor && end < count) {
+        cursor++; // ';' or ','
+        if (!*cursor) break;
+        ids[end] = strtoul(cursor, &cursor, 10);
+        if (*cursor != ':') return;
+        hashes[end] = strtoul(cursor + 1, &cursor, 16);
+        end++;
+    }
+    if (whole) {
+        count = end;
+    }
+    
+    syncTargetVersion = version;
+    
+    // Parts of another digest start it over; the slave acts once it has every entry
+    if (version != syncRxDigestVersion || count != syncRxDigestCount) {
+        syncRxDigestVersion = version;
+        syncRxDigestCount = count;
+        syncRxDigestMask = 0;
+    }
+    for (uint8_t i = start; i < end; i++) {
+        syncRxDigestIds[i] = ids[i];
+        syncRxDigestHashes[i] = hashes[i];
+        syncRxDigestMask |= 1UL << i;
+    }
+    if (syncRxDigestMask != (uint32_t)((1ULL << count) - 1)) {
+        return;
+    }
+    
+    // Entries the master no longer has can go right away
+    pruneScheduleEntries(syncRxDigestIds, count);
+    
+    if (getScheduleVersionHash() == version) {
+        syncPendingOp = 0;
+        return;
+    }
+    
+    uint32_t need = 0;
+    lockSchedule();
+    for (uint8_t i = 0; i < count; i++) {
+        const ScheduleEntry* entry = findScheduleEntry(syncRxDigestIds[i]);
+        if (!entry || syncEntryHash16(*entry) != syncRxDigestHashes[i]) {
+            need |= 1UL << i;
+        }
+    }
+    unlockSchedule();
+    
+    if (!need) {
+        // 16-bit hashes collided; fall back to a full transfer
+        need = (uint32_t)((1ULL << count) - 1);
+    }
+    
+    schedulePendingReply(SYNC_OP_REQUEST, need);
+}
+
+void handlePatchFragment(const char* body) {
+    unsigned int xfer = 0, seq = 0, total = 0;
+    const char* chunk = strchr(body, ';');
+    if (!chunk || sscanf(body, "%x,%u,%u", &xfer, &seq, &total) != 3) return;
+    if (total == 0 || total > SYNC_MAX_FRAGMENTS || seq >= total) return;
+    
+    chunk++;
+    size_t length = strlen(chunk);
+    if (length > SYNC_FRAGMENT_SIZE) return;
+    
+    // Patches for slaves still behind; NACKing them once in sync would keep the round going
+    if (getScheduleVersionHash() == syncTargetVersion) {
+        syncRxTotal = 0;
+        return;
+    }
+    
+    if (!syncRxTotal || xfer != syncRxXfer) {
+        syncRxXfer = xfer;
+        syncRxTotal = total;
+        syncRxReceived = 0;
+        syncRxLength = 0;
+        syncRxNacks = 0;
+    }
+    
+    // The master is answering someone; the settle advert catches anything left over
+    suppressPendingReply(SYNC_OP_REQUEST);
+    
+    memcpy(syncRxBuffer + seq * SYNC_FRAGMENT_SIZE, chunk, length);
+    if (seq == total - 1) {
+        syncRxLength = seq * SYNC_FRAGMENT_SIZE + length;
+    }
+    syncRxReceived |= 1U << seq;
+    syncRxLastFragment = millis();
+    
+    if (syncRxReceived == syncFragmentMask(syncRxTotal)) {
+        if (syncPendingOp == SYNC_OP_NACK) {
+            syncPendingOp = 0;
+        }
+        applyReceivedPatch();
+    }
+}
+
+void handleSlaveSyncMessage(char op, const char* body) {
+    unsigned long node = 0, version = 0, mask = 0, xfer = 0;
+    
+    // Only the master sends these; low-power slaves may hear nothing else from it
+    if (op == SYNC_OP_VERSION || op == SYNC_OP_DIGEST || op == SYNC_OP_PATCH) {
+        noteMasterFrame();
+    }
+    
+    switch (op) {
+        case SYNC_OP_VERSION:
+            syncTargetVersion = strtoul(body, nullptr, 16);
+            if (syncTargetVersion == getScheduleVersionHash()) {
+                syncPendingOp = 0;
+            } else if (!syncPendingOp) {
+                schedulePendingReply(SYNC_OP_QUERY, 0);
+            }
+            break;
+        
+        case SYNC_OP_DIGEST:
+            handleDigest(body);
+            break;
+        
+        case SYNC_OP_PATCH:
+            handlePatchFragment(body);
+            break;
+        
+        // Overheard replies from other slaves: stay quiet if they cover ours
+        case SYNC_OP_QUERY:
+            suppressPendingReply(SYNC_OP_QUERY);
+            break;
+        
+        case SYNC_OP_REQUEST:
+            if (sscanf(body, "%lx,%lx,%lx", &node, &version, &mask) == 3 &&
+                version == syncTargetVersion && (mask & syncPendingMask) == syncPendingMask) {
+                suppressPendingReply(SYNC_OP_REQUEST);
+            }
+            break;
+        
+        case SYNC_OP_NACK:
+            if (sscanf(body, "%lx,%lx,%lx", &node, &xfer, &mask) == 3 &&
+                xfer == syncRxXfer && (mask & syncPendingMask) == syncPendingMask) {
+                suppressPendingReply(SYNC_OP_NACK);
+            }
+            break;
+        
+        default:
+            break;
+    }
+}
+
+void sendPendingReply() {
+    char frame[32];
+    uint16_t node = getLoRaNodeId();
+    
+    switch (syncPendingOp) {
+        case SYNC_OP_QUERY:
+            snprintf(frame, sizeof(frame), "%c%04X,%08lX", SYNC_OP_QUERY, node,
+                    (unsigned long)getScheduleVersionHash());
+            break;
+        case SYNC_OP_REQUEST:
+            snprintf(frame, sizeof(frame), "%c%04X,%08lX,%lX", SYNC_OP_REQUEST, node,
+                    (unsigned long)syncTargetVersion, (unsigned long)syncPendingMask);
+            break;
+        case SYNC_OP_NACK:
+            snprintf(frame, sizeof(frame), "%c%04X,%02X,%lX", SYNC_OP_NACK, node,
+                    syncRxXfer, (unsigned long)syncPendingMask);
+            break;
+        default:
+            return;
+    }
+    
+    syncPendingOp = 0;
+    sendSyncFrame(frame);
+}
+
+void loopSlaveSync() {
+    uint16_t complete = syncFragmentMask(syncRxTotal);
+    if (syncRxTotal && syncRxReceived != complete &&
+        millis() - syncRxLastFragment >= SYNC_REASSEMBLY_TIMEOUT) {
+        syncRxLastFragment = millis();
+        
+        if (getScheduleVersionHash() == syncTargetVersion) {
+            // Caught up meanwhile; the rest of the patch is not needed
+            syncRxTotal = 0;
+        } else if (syncRxNacks++ >= SYNC_MAX_NACKS) {
+            LOG_WARN(LOG_MODULE_SYNC, "Schedule patch %02X abandoned", syncRxXfer);
+            syncRxTotal = 0;
+        } else {
+            schedulePendingReply(SYNC_OP_NACK, complete & ~syncRxReceived);
+        }
+    }
+    
+    if (syncPendingOp && syncDue(syncPendingAt)) {
+        sendPendingReply();
+    }
+}
+
+void loopScheduleSync() {
+    if (isLoRaMaster()) {
+        loopMasterSync();
+    } else {
+        loopSlaveSync();
+    }
+}
+
+void handleScheduleSyncMessage(const String& content) {
+    if (content.length() < 2) {
+        LOG_WARN(LOG_MODULE_SYNC, "Invalid schedule sync message");
+        return;
+    }
+    
+    syncStats.framesReceived++;
+    if (syncRoundStart) {
+        syncRoundAirtimeUs += getLoRaAirtimeUs(content.length() + 2);
+    }
+    
+    if (isLoRaMaster()) {
+        handleMasterSyncMessage(content[0], content.c_str() + 1);
+    } else {
+        handleSlaveSyncMessage(content[0], content.c_str() + 1);
+    }
+}
+
+const SyncStats& getScheduleSyncStats() {
+    return syncStats;
+}
+
+String getScheduleSyncJSON() {
+    DynamicJsonDocument doc(512);
+    char version[9];
+    snprintf(version, sizeof(version), "%08lX", (unsigned long)getScheduleVersionHash());
+    
+    doc["role"] = isLoRaMaster() ? "master" : "slave";
+    doc["version"] = version;
+    doc["frames_sent"] = syncStats.framesSent;
+    doc["frames_received"] = syncStats.framesReceived;
+    doc["bytes_sent"] = syncStats.bytesSent;
+    doc["tx_airtime_ms"] = (uint32_t)(syncStats.txAirtimeUs / 1000);
+    doc["patches_applied"] = syncStats.patchesApplied;
+    doc["fragments_resent"] = syncStats.fragmentsResent;
+    doc["replies_suppressed"] = syncStats.repliesSuppressed;
+    doc["last_convergence_ms"] = syncStats.lastConvergenceMs;
+    doc["last_convergence_airtime_ms"] = syncStats.lastConvergenceAirtimeMs;
+    
+    String result;
+    serializeJson(doc, result);
+    return result;
+}
@@ -0,0 +1,476 @@
+#include "tasks.h"
+#include "eventbus.h"
+#include "webhandler.h"
+#include "lorahandler.h"
+#include "loracapture.h"
+#include "loraota.h"
+#include "mp3handler.h"
+#include "gongprogram.h"
+#include "trackcatalog.h"
+#include "gongsynth.h"
+#include "schedule.h"
+#include "schedulesync.h"
+#include "nodestatus.h"
+#include "linkadapt.h"
+#include "logger.h"
+#include "profiler.h"
+#include "powermanager.h"
+#include "configstore.h"
+#include "boot.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/event_groups.h>
+#include <esp_task_wdt.h>
+
+struct SystemTask {
+    const char* name;
+    uint8_t core;
+    uint8_t priority;
+    uint32_t stackSize;
+    TaskHandle_t handle;
+};
+
+SystemTask systemTasks[SYSTEM_TASKS] = {
+    {"radio", TASK_RADIO_CORE, TASK_RADIO_PRIORITY, TASK_RADIO_STACK, nullptr},
+    {"audio", TASK_AUDIO_CORE, TASK_AUDIO_PRIORITY, TASK_AUDIO_STACK, nullptr},
+    {"scheduler", TASK_SCHEDULER_CORE, TASK_SCHEDULER_PRIORITY, TASK_SCHEDULER_STACK, nullptr},
+    {"web", TASK_WEB_CORE, TASK_WEB_PRIORITY, TASK_WEB_STACK, nullptr},
+};
+SystemTaskStats systemTaskStats[SYSTEM_TASKS] = {};
+bool tasksRunning = false;
+
+// Boot handshake: a bit per task once its boot stages are done, and the release from setup()
+EventGroupHandle_t bootEvents = nullptr;
+#define TASK_BOOTED_BITS ((1 << SYSTEM_TASKS) - 1)
+#define TASK_RELEASE_BIT (1 << SYSTEM_TASKS)
+
+QueueHandle_t audioQueue = nullptr;
+QueueHandle_t radioQueue = nullptr;
+TaskQueueStats audioQueueStats = {};
+TaskQueueStats radioQueueStats = {};
+int8_t audioSubscriber = -1;
+int8_t radioConfigSubscriber = -1;
+int8_t webSubscriber = -1;
+
+unsigned long lastScheduleCheck = 0;
+
+void onAudioEvent(const Event& event);
+void onRadioConfigChanged(const Event& event);
+void onWebConfigChanged(const Event& event);
+void wakeAudioTask(bool fromIsr);
+
+void setupTasks() {
+    // Queues and subscriptions first, so modules can post from their setup
+    audioQueue = xQueueCreate(TASK_AUDIO_QUEUE_LENGTH, sizeof(TaskRequest));
+    radioQueue = xQueueCreate(TASK_RADIO_QUEUE_LENGTH, sizeof(TaskRequest));
+    audioSubscriber = subscribeEvents("audio", EVENT_MASK(EVENT_GONG_REQUESTED) | EVENT_MASK(EVENT_CONFIG_CHANGED),
+                                      onAudioEvent, 0, wakeAudioTask);
+    
+    // Received frames wake the radio task straight from the DIO0 interrupt (lorahandler.cpp); configuration
+    // changes, from the web task, come as events
+    radioConfigSubscriber = subscribeEvents("radio", EVENT_MASK(EVENT_CONFIG_CHANGED), onRadioConfigChanged, 0,
+                                            wakeRadioTask);
+    webSubscriber = subscribeEvents("web", EVENT_MASK(EVENT_CONFIG_CHANGED), onWebConfigChanged);
+}
+
+bool areTasksRunning() {
+    return tasksRunning;
+}
+
+void IRAM_ATTR wakeSystemTask(uint8_t task, bool fromIsr) {
+    TaskHandle_t handle = systemTasks[task].handle;
+    if (!handle) {
+        return;
+    }
+    if (fromIsr) {
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(handle, &woken);
+        portYIELD_FROM_ISR(woken);
+    } else {
+        xTaskNotifyGive(handle);
+    }
+}
+
+void IRAM_ATTR wakeAudioTask(bool fromIsr) {
+    wakeSystemTask(TASK_AUDIO, fromIsr);
+}
+
+void IRAM_ATTR wakeRadioTask(bool fromIsr) {
+    wakeSystemTask(TASK_RADIO, fromIsr);
+}
+
+bool postRequest(QueueHandle_t queue, TaskQueueStats& stats, uint8_t type, uint16_t param, uint32_t value,
+                 const String& name) {
+    TaskRequest request = {};
+    request.type = type;
+    request.param = param;
+    request.value = value;
+    request.postedUs = micros();
+    strlcpy(request.name, name.c_str(), sizeof(request.name));
+    
+    // Never blocks: a full queue means the owner is stuck, and waiting on
+    // it would only stall the caller too
+    if (!queue || xQueueSend(queue, &request, 0) != pdTRUE) {
+        stats.dropped++;
+        return false;
+    }
+    stats.posted++;
+    stats.maxDepth = max(stats.maxDepth, (uint32_t)uxQueueMessagesWaiting(queue));
+    return true;
+}
+
+bool postAudioRequest(uint8_t type, uint16_t param, uint32_t value, const String& name) {
+    if (!postRequest(audioQueue, audioQueueStats, type, param, value, name)) {
+        return false;
+    }
+    holdPowerActive();
+    wakeAudioTask(false);
+    return true;
+}
+
+bool postRadioRequest(uint8_t type, uint16_t param, uint32_t value) {
+    if (!postRequest(radioQueue, radioQueueStats, type, param, value, "")) {
+        return false;
+    }
+    holdPowerActive();
+    wakeRadioTask(false);
+    return true;
+}
+
+void onGongRequested(const Event& event) {
+    // Events are taken in order: a program index published before a change to the programs is used before
+    // they are loaded again. A program that cannot start rings a single gong, as a program unknown here does.
+    bool started = false;
+    if (event.param > 0) {
+        const GongProgram* program = getGongProgram(event.param - 1);
+        started = program && startGongProgram(program->name);
+    }
+    if (!started) {
+        if (isGongSynthEnabled()) {
+            playGongSynth();
+        } else {
+            playGong();
+        }
+    }
+    publishEvent(EVENT_GONG_FIRED, event.source, event.param, micros() - event.timeUs);
+}
+
+void onAudioEvent(const Event& event) {
+    if (event.type == EVENT_GONG_REQUESTED) {
+        onGongRequested(event);
+        return;
+    }
+    
+    // Sections of the modules this task owns, loaded again here
+    switch (event.param) {
+        case CONFIG_SECTION_MP3:
+            loadMP3LeadIns();
+            break;
+        case CONFIG_SECTION_SYNTH:
+            loadGongSynthConfig();
+            break;
+        case CONFIG_SECTION_PROGRAMS:
+            loadGongPrograms();
+            break;
+    }
+}
+
+void onRadioConfigChanged(const Event& event) {
+    if (event.param == CONFIG_SECTION_LORA) {
+        loadLoRaConfig();
+    }
+}
+
+void onWebConfigChanged(const Event& event) {
+    switch (event.param) {
+        case CONFIG_SECTION_WIFI:
+            applyWiFiConfig();
+            break;
+        case CONFIG_SECTION_LOG:
+            loadLogLevels();
+            break;
+    }
+}
+
+void countRequestLatency(TaskQueueStats& stats, const TaskRequest& request) {
+    uint32_t latency = micros() - request.postedUs;
+    stats.handled++;
+    stats.latencyUs += latency;
+    stats.maxLatencyUs = max(stats.maxLatencyUs, latency);
+}
+
+void handleAudioRequest(const TaskRequest& request) {
+    switch (request.type) {
+        case AUDIO_REQUEST_STRIKES:
+            playGongStrikes(request.param);
+            break;
+        case AUDIO_REQUEST_TRACK:
+            playTrack(request.param);
+            break;
+        case AUDIO_REQUEST_PREPARE:
+            prepareGongProgram(request.name);
+            break;
+        case AUDIO_REQUEST_STOP:
+            if (request.value > 0) {
+                fadeOutGongProgram(request.value);
+            } else {
+                stopGongProgram();
+                stopPlayback();
+            }
+            stopGongSynth();
+            break;
+        case AUDIO_REQUEST_VOLUME:
+            rampVolume(request.param, request.value);
+            break;
+        case AUDIO_REQUEST_AMP_WAKE:
+            wakeMP3Amplifier();
+            break;
+        case AUDIO_REQUEST_RESCAN:
+            rescanTrackCatalog();
+            break;
+        case AUDIO_REQUEST_MP3_WAKE:
+            wakeMP3Module();
+            break;
+    }
+    countRequestLatency(audioQueueStats, request);
+}
+
+void handleRadioRequest(const TaskRequest& request) {
+    switch (request.type) {
+        case RADIO_REQUEST_GONG:
+            sendGongLoRa(request.value);
+            break;
+        case RADIO_REQUEST_OTA_START:
+            if (!startLoRaOta()) {
+                LOG_WARN(LOG_MODULE_TASKS, "Firmware distribution not started: no valid package, or not the master");
+            }
+            break;
+        case RADIO_REQUEST_OTA_CANCEL:
+            cancelLoRaOta();
+            break;
+        case RADIO_REQUEST_CAPTURE:
+            setLoRaCaptureEnabled(request.param != 0);
+            break;
+        case RADIO_REQUEST_CAPTURE_CLEAR:
+            clearLoRaCapture();
+            break;
+    }
+    countRequestLatency(radioQueueStats, request);
+}
+
+void processAudioRequests() {
+    TaskRequest request;
+    while (audioQueue && xQueueReceive(audioQueue, &request, 0) == pdTRUE) {
+        handleAudioRequest(request);
+    }
+}
+
+void processRadioRequests() {
+    TaskRequest request;
+    while (radioQueue && xQueueReceive(radioQueue, &request, 0) == pdTRUE) {
+        handleRadioRequest(request);
+    }
+}
+
+void runRadioPass() {
+    // DIO0 only wakes the task; loopLoRa() reads the radio's flags and the frame
+    PROFILE(PROFILE_RADIO_REQUESTS, processRadioRequests(); dispatchEvents(radioConfigSubscriber));
+    PROFILE(PROFILE_LORA, loopLoRa());
+    
+    // Push/pull schedule changes over LoRa
+    PROFILE(PROFILE_SYNC, loopScheduleSync());
+    
+    // Periodic heartbeat and node table upkeep
+    PROFILE(PROFILE_NODES, loopNodeStatus());
+    
+    // Adapt spreading factor and TX power to link quality
+    PROFILE(PROFILE_ADR, loopLinkAdapt());
+    
+    // Firmware distribution: one block per pass on the master, bounded decoding on slaves
+    PROFILE(PROFILE_OTA, loopLoRaOta());
+}
+
+void runAudioPass() {
+    PROFILE(PROFILE_AUDIO_REQUESTS, processAudioRequests(); dispatchEvents(audioSubscriber));
+    PROFILE(PROFILE_MP3, loopMP3());
+    
+    // Scan a new card; learn track lengths as they play
+    PROFILE(PROFILE_CATALOG, loopTrackCatalog());
+    
+    // Keep the synthesizer's DMA ring filled while a gong rings
+    PROFILE(PROFILE_SYNTH, loopGongSynth());
+    
+    // Next strike of a running gong program
+    PROFILE(PROFILE_PROGRAM, loopGongProgram());
+}
+
+void runSchedulerPass() {
+    // Plan the next schedule instant periodically; fire it, ahead by the pre-roll, on time
+    if (millis() - lastScheduleCheck >= SCHEDULE_CHECK_INTERVAL) {
+        PROFILE(PROFILE_SCHEDULE_CHECK, checkSchedule());
+        lastScheduleCheck = millis();
+    }
+    PROFILE(PROFILE_SCHEDULE, loopSchedule());
+    PROFILE(PROFILE_POWER, loopPowerManager());
+    loopBoot();
+}
+
+void finishTaskPass(uint8_t task, unsigned long startUs) {
+    endProfilePass(task);
+    SystemTaskStats& stats = systemTaskStats[task];
+    uint32_t passUs = micros() - startUs;
+    stats.passes++;
+    stats.busyUs += passUs;
+    stats.maxPassUs = max(stats.maxPassUs, passUs);
+    esp_task_wdt_reset();
+}
+
+void bootSystemTask(uint8_t task) {
+    // Stages owned by this task run here, side by side with the other tasks'
+    for (uint8_t stage = 0; stage < BOOT_STAGES; stage++) {
+        if (getBootStageTask(stage) == task) {
+            runBootStage(stage);
+        }
+    }
+    xEventGroupSetBits(bootEvents, 1 << task);
+    
+    // No loop until setup() is done with the boot, and no watchdog until the loop
+    xEventGroupWaitBits(bootEvents, TASK_RELEASE_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+    esp_task_wdt_add(NULL);
+}
+
+void radioTask(void*) {
+    bootSystemTask(TASK_RADIO);
+    for (;;) {
+        // Woken at once by a request or an event, otherwise every tick, or less often while idle
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(getPowerTaskPeriodMs(TASK_RADIO)));
+        unsigned long startUs = micros();
+        beginProfilePass(TASK_RADIO);
+        runRadioPass();
+        finishTaskPass(TASK_RADIO, startUs);
+    }
+}
+
+void audioTask(void*) {
+    bootSystemTask(TASK_AUDIO);
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(getPowerTaskPeriodMs(TASK_AUDIO)));
+        unsigned long startUs = micros();
+        beginProfilePass(TASK_AUDIO);
+        runAudioPass();
+        finishTaskPass(TASK_AUDIO, startUs);
+    }
+}
+
+void schedulerTask(void*) {
+    bootSystemTask(TASK_SCHEDULER);
+    for (;;) {
+        unsigned long startUs = micros();
+        beginProfilePass(TASK_SCHEDULER);
+        runSchedulerPass();
+        finishTaskPass(TASK_SCHEDULER, startUs);
+        vTaskDelay(pdMS_TO_TICKS(getPowerTaskPeriodMs(TASK_SCHEDULER)));
+    }
+}
+
+void webTask(void*) {
+    bootSystemTask(TASK_WEB);
+    for (;;) {
+        unsigned long startUs = micros();
+        beginProfilePass(TASK_WEB);
+        PROFILE(PROFILE_WEB, loopWebServer(); dispatchEvents(webSubscriber));
+        // Lowest priority, so log lines are formatted and printed when nothing else needs the CPU
+        PROFILE(PROFILE_LOG, loopLog());
+        loopProfiler();
+        finishTaskPass(TASK_WEB, startUs);
+        vTaskDelay(pdMS_TO_TICKS(getPowerTaskPeriodMs(TASK_WEB)));
+    }
+}
+
+void startTasks() {
+    // Already running when the Arduino core set it up; then only the timeout is kept
+    esp_task_wdt_init(TASK_WATCHDOG_TIMEOUT, true);
+    bootEvents = xEventGroupCreate();
+    
+    void (*entries[SYSTEM_TASKS])(void*) = {radioTask, audioTask, schedulerTask, webTask};
+    for (uint8_t i = 0; i < SYSTEM_TASKS; i++) {
+        SystemTask& task = systemTasks[i];
+        if (xTaskCreatePinnedToCore(entries[i], task.name, task.stackSize, nullptr, task.priority, &task.handle,
+                                    task.core) != pdPASS) {
+            LOG_ERROR(LOG_MODULE_TASKS, "Failed to start the %s task", task.name);
+            continue;
+        }
+        LOG_INFO(LOG_MODULE_TASKS, "Task %s: core %d, priority %d", task.name, task.core, task.priority);
+    }
+    tasksRunning = true;
+}
+
+bool waitForTaskBoot(uint32_t timeoutMs) {
+    EventBits_t bits = xEventGroupWaitBits(bootEvents, TASK_BOOTED_BITS, pdFALSE, pdTRUE, pdMS_TO_TICKS(timeoutMs));
+    return (bits & TASK_BOOTED_BITS) == TASK_BOOTED_BITS;
+}
+
+void releaseTasks() {
+    xEventGroupSetBits(bootEvents, TASK_RELEASE_BIT);
+}
+
+const char* getSystemTaskName(uint8_t task) {
+    return task < SYSTEM_TASKS ? systemTasks[task].name : "unknown";
+}
+
+const SystemTaskStats& getSystemTaskStats(uint8_t task) {
+    // The high-water mark is only read when asked for
+    SystemTaskStats& stats = systemTaskStats[task];
+    if (systemTasks[task].handle) {
+        stats.stackFree = uxTaskGetStackHighWaterMark(systemTasks[task].handle);
+    }
+    return stats;
+}
+
+const TaskQueueStats& getAudioQueueStats() {
+    return audioQueueStats;
+}
+
+const TaskQueueStats& getRadioQueueStats() {
+    return radioQueueStats;
+}
+
+void addQueueJSON(JsonObject obj, const TaskQueueStats& stats, QueueHandle_t queue, uint8_t length) {
+    obj["length"] = length;
+    obj["waiting"] = queue ? uxQueueMessagesWaiting(queue) : 0;
+    obj["max_depth"] = stats.maxDepth;
+    obj["posted"] = stats.posted;
+    obj["dropped"] = stats.dropped;
+    obj["handled"] = stats.handled;
+    obj["avg_latency_us"] = stats.handled ? (uint32_t)(stats.latencyUs / stats.handled) : 0;
+    obj["max_latency_us"] = stats.maxLatencyUs;
+}
+
+String getTasksJSON() {
+    DynamicJsonDocument doc(2048);
+    doc["running"] = tasksRunning;
+    doc["uptime_ms"] = millis();
+    
+    JsonArray tasks = doc.createNestedArray("tasks");
+    for (uint8_t i = 0; i < SYSTEM_TASKS; i++) {
+        const SystemTaskStats& stats = getSystemTaskStats(i);
+        JsonObject task = tasks.createNestedObject();
+        task["name"] = systemTasks[i].name;
+        task["core"] = systemTasks[i].core;
+        task["priority"] = systemTasks[i].priority;
+        task["stack"] = systemTasks[i].stackSize;
+        task["stack_free"] = stats.stackFree;
+        task["passes"] = stats.passes;
+        task["max_pass_us"] = stats.maxPassUs;
+        task["busy_us"] = stats.busyUs;
+    }
+    
+    JsonObject queues = doc.createNestedObject("queues");
+    addQueueJSON(queues.createNestedObject("audio"), audioQueueStats, audioQueue, TASK_AUDIO_QUEUE_LENGTH);
+    addQueueJSON(queues.createNestedObject("radio"), radioQueueStats, radioQueue, TASK_RADIO_QUEUE_LENGTH);
+    
+    String result;
+    serializeJson(doc, result);
+    return result;
+}
@@ -0,0 +1,354 @@
+#include "trackcatalog.h"
+#include "logger.h"
+#include "mp3handler.h"
+#include <ArduinoJson.h>
+#include <SPIFFS.h>
+
+// Index file: this header, then the track count of each folder and the
+// length of each /mp3 track, all uint16_t
+struct TrackCatalogHeader {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t folderCount;
+    uint16_t totalTracks;
+    uint16_t mp3Tracks;
+    uint16_t durationCount;
+    uint32_t checksum;          // FNV-1a of the header (checksum 0) and everything after it
+};
+
+TrackCatalog trackCatalog = {};
+TrackCatalogStats trackCatalogStats = {};
+
+// Scan in progress, one query at a time
+uint8_t catalogQuery = 0;               // Command waiting for its reply, 0 = none
+uint8_t catalogQueryFolder = 0;
+bool catalogQueryQueued = false;        // False while the driver's queue was full
+unsigned long catalogQuerySince = 0;
+unsigned long catalogScanStartedAt = 0;
+uint16_t catalogScanTotal = 0;
+uint8_t catalogScanFolders = 0;
+uint16_t catalogScanFolderTracks[TRACK_CATALOG_MAX_FOLDERS];
+bool catalogCardChanged = false;        // The next track count starts a scan, whatever it is
+
+// Lengths learned since the last write
+uint32_t catalogFinishedSeen = 0;
+bool catalogDirty = false;
+unsigned long catalogSavedAt = 0;
+
+const char* const trackCatalogStateNames[TRACK_CATALOG_STATES] = {"unknown", "cached", "scanning", "valid",
+                                                                   "no_card"};
+
+uint32_t hashTrackCatalog(uint32_t hash, const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+uint32_t getTrackCatalogChecksum(const TrackCatalogHeader& header, const uint16_t* folderTracks,
+                                 const uint16_t* durations) {
+    TrackCatalogHeader fields = header;
+    fields.checksum = 0;
+    uint32_t hash = hashTrackCatalog(2166136261UL, (const uint8_t*)&fields, sizeof(fields));
+    hash = hashTrackCatalog(hash, (const uint8_t*)folderTracks, header.folderCount * sizeof(uint16_t));
+    return hashTrackCatalog(hash, (const uint8_t*)durations, header.durationCount * sizeof(uint16_t));
+}
+
+void setTrackCatalogState(uint8_t state) {
+    trackCatalog.state = state;
+    LOG_INFO(LOG_MODULE_CATALOG, "Track catalog %s", trackCatalogStateNames[state]);
+}
+
+void loadTrackCatalog() {
+    // A few hundred bytes, checked by size and checksum instead of asking the card
+    unsigned long start = micros();
+    if (!SPIFFS.exists(TRACK_CATALOG_FILE)) {
+        return;
+    }
+    File file = SPIFFS.open(TRACK_CATALOG_FILE, "r");
+    if (!file) {
+        return;
+    }
+    
+    TrackCatalogHeader header;
+    TrackCatalog loaded = {};
+    bool ok = file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) && header.magic == TRACK_CATALOG_MAGIC &&
+              header.version == TRACK_CATALOG_VERSION && header.folderCount <= TRACK_CATALOG_MAX_FOLDERS &&
+              header.durationCount <= TRACK_CATALOG_MAX_TRACKS && header.durationCount <= header.mp3Tracks &&
+              file.size() == sizeof(header) + (header.folderCount + header.durationCount) * sizeof(uint16_t);
+    if (ok) {
+        size_t folderBytes = header.folderCount * sizeof(uint16_t);
+        size_t durationBytes = header.durationCount * sizeof(uint16_t);
+        ok = file.read((uint8_t*)loaded.folderTracks, folderBytes) == folderBytes &&
+             file.read((uint8_t*)loaded.durations, durationBytes) == durationBytes &&
+             getTrackCatalogChecksum(header, loaded.folderTracks, loaded.durations) == header.checksum;
+    }
+    file.close();
+    
+    if (!ok) {
+        trackCatalogStats.rejected++;
+        LOG_WARN(LOG_MODULE_CATALOG, "Track catalog index invalid, the card will be scanned");
+        return;
+    }
+    loaded.totalTracks = header.totalTracks;
+    loaded.folderCount = header.folderCount;
+    loaded.mp3Tracks = header.mp3Tracks;
+    trackCatalog = loaded;
+    setTrackCatalogState(TRACK_CATALOG_CACHED);
+    trackCatalogStats.loadUs = micros() - start;
+}
+
+void saveTrackCatalog() {
+    File file = SPIFFS.open(TRACK_CATALOG_FILE, "w");
+    if (!file) {
+        LOG_ERROR(LOG_MODULE_CATALOG, "Failed to open track catalog for writing");
+        return;
+    }
+    
+    TrackCatalogHeader header;
+    header.magic = TRACK_CATALOG_MAGIC;
+    header.version = TRACK_CATALOG_VERSION;
+    header.folderCount = trackCatalog.folderCount;
+    header.totalTracks = trackCatalog.totalTracks;
+    header.mp3Tracks = trackCatalog.mp3Tracks;
+    header.durationCount = min(trackCatalog.mp3Tracks, (uint16_t)TRACK_CATALOG_MAX_TRACKS);
+    header.checksum = getTrackCatalogChecksum(header, trackCatalog.folderTracks, trackCatalog.durations);
+    
+    file.write((const uint8_t*)&header, sizeof(header));
+    file.write((const uint8_t*)trackCatalog.folderTracks, header.folderCount * sizeof(uint16_t));
+    file.write((const uint8_t*)trackCatalog.durations, header.durationCount * sizeof(uint16_t));
+    file.close();
+    trackCatalogStats.saves++;
+    catalogDirty = false;
+    catalogSavedAt = max(millis(), 1UL);
+}
+
+void sendTrackCatalogQuery(uint8_t command, uint8_t folder) {
+    catalogQuery = command;
+    catalogQueryFolder = folder;
+    catalogQuerySince = millis();
+    catalogQueryQueued = queueMP3Command(command, folder);
+    if (catalogQueryQueued) {
+        trackCatalogStats.queries++;
+    }
+}
+
+void startTrackCatalogScan(uint16_t totalTracks) {
+    catalogCardChanged = false;
+    catalogScanTotal = totalTracks;
+    catalogScanFolders = 0;
+    memset(catalogScanFolderTracks, 0, sizeof(catalogScanFolderTracks));
+    catalogScanStartedAt = millis();
+    trackCatalogStats.scans++;
+    setTrackCatalogState(TRACK_CATALOG_SCANNING);
+    sendTrackCatalogQuery(MP3_CMD_QUERY_FOLDERS, 0);
+}
+
+void finishTrackCatalogScan() {
+    // Tracks in no numbered folder are the ones in /mp3
+    uint32_t inFolders = 0;
+    for (uint8_t i = 0; i < catalogScanFolders; i++) {
+        inFolders += catalogScanFolderTracks[i];
+    }
+    uint16_t mp3Tracks = catalogScanTotal > inFolders ? catalogScanTotal - inFolders : 0;
+    
+    // Lengths learned before still hold for the same layout
+    bool sameLayout = catalogScanTotal == trackCatalog.totalTracks && mp3Tracks == trackCatalog.mp3Tracks &&
+                      catalogScanFolders == trackCatalog.folderCount &&
+                      memcmp(catalogScanFolderTracks, trackCatalog.folderTracks, sizeof(catalogScanFolderTracks)) == 0;
+    if (!sameLayout) {
+        memset(trackCatalog.durations, 0, sizeof(trackCatalog.durations));
+    }
+    trackCatalog.totalTracks = catalogScanTotal;
+    trackCatalog.folderCount = catalogScanFolders;
+    memcpy(trackCatalog.folderTracks, catalogScanFolderTracks, sizeof(catalogScanFolderTracks));
+    trackCatalog.mp3Tracks = mp3Tracks;
+    catalogQuery = 0;
+    trackCatalogStats.lastScanMs = millis() - catalogScanStartedAt;
+    setTrackCatalogState(TRACK_CATALOG_VALID);
+    LOG_INFO(LOG_MODULE_CATALOG, "Track catalog: %u files, %u in /mp3, %u folders (%u ms)", trackCatalog.totalTracks,
+             mp3Tracks, catalogScanFolders, trackCatalogStats.lastScanMs);
+    saveTrackCatalog();
+}
+
+void takeTrackCatalogReply(uint16_t param) {
+    if (catalogQuery == MP3_CMD_QUERY_FOLDERS) {
+        catalogScanFolders = min(param, (uint16_t)TRACK_CATALOG_MAX_FOLDERS);
+        catalogQueryFolder = 0;
+    } else {
+        catalogScanFolderTracks[catalogQueryFolder - 1] = param;
+    }
+    
+    // Folders are numbered from 01; one the module does not know counts as empty
+    if (catalogQueryFolder < catalogScanFolders) {
+        sendTrackCatalogQuery(MP3_CMD_QUERY_FOLDER_TRACKS, catalogQueryFolder + 1);
+        return;
+    }
+    finishTrackCatalogScan();
+}
+
+void checkTrackCount(uint16_t count) {
+    if (trackCatalog.state == TRACK_CATALOG_SCANNING) {
+        return;
+    }
+    if (count == 0) {
+        setTrackCatalogState(TRACK_CATALOG_NO_CARD);
+        return;
+    }
+    
+    // The same count as the index: the card is taken to be the same
+    bool known = trackCatalog.state == TRACK_CATALOG_CACHED || trackCatalog.state == TRACK_CATALOG_VALID;
+    if (!catalogCardChanged && known && count == trackCatalog.totalTracks) {
+        if (trackCatalog.state == TRACK_CATALOG_CACHED) {
+            setTrackCatalogState(TRACK_CATALOG_VALID);
+        }
+        return;
+    }
+    startTrackCatalogScan(count);
+}
+
+void onTrackCatalogMessage(uint8_t command, uint16_t param) {
+    switch (command) {
+        case MP3_MSG_CARD_REMOVED:
+            catalogQuery = 0;
+            setTrackCatalogState(TRACK_CATALOG_NO_CARD);
+            break;
+        case MP3_MSG_CARD_INSERTED:
+            // Another card may hold as many files as the last one; the
+            // driver asks for the track count, and that starts a scan
+            catalogCardChanged = true;
+            break;
+        case MP3_CMD_QUERY_TRACKS:
+            checkTrackCount(param);
+            break;
+        case MP3_CMD_QUERY_FOLDERS:
+        case MP3_CMD_QUERY_FOLDER_TRACKS:
+            if (trackCatalog.state == TRACK_CATALOG_SCANNING && catalogQueryQueued && command == catalogQuery) {
+                takeTrackCatalogReply(param);
+            }
+            break;
+    }
+}
+
+void recordTrackDuration(uint16_t track, uint32_t durationMs) {
+    bool known = trackCatalog.state == TRACK_CATALOG_CACHED || trackCatalog.state == TRACK_CATALOG_VALID;
+    uint16_t count = min(trackCatalog.mp3Tracks, (uint16_t)TRACK_CATALOG_MAX_TRACKS);
+    if (!known || durationMs == 0 || track < 1 || track > count) {
+        return;
+    }
+    
+    // BUSY is read to a loop iteration; a unit either way is the same length
+    uint32_t rounded = (durationMs + TRACK_CATALOG_DURATION_UNIT / 2) / TRACK_CATALOG_DURATION_UNIT;
+    uint16_t units = min(rounded, (uint32_t)0xFFFF);
+    uint16_t& stored = trackCatalog.durations[track - 1];
+    if (stored != 0 && abs((int32_t)units - stored) <= 1) {
+        return;
+    }
+    stored = units;
+    trackCatalogStats.lengthsLearned++;
+    catalogDirty = true;
+}
+
+void setupTrackCatalog() {
+    trackCatalog = {};
+    loadTrackCatalog();
+    onMP3Message = onTrackCatalogMessage;
+    catalogFinishedSeen = getMP3PlaybackStats().finished;
+    if (trackCatalog.state == TRACK_CATALOG_CACHED) {
+        LOG_INFO(LOG_MODULE_CATALOG, "Track catalog loaded: %u tracks in /mp3 (%u us)", trackCatalog.mp3Tracks,
+                 trackCatalogStats.loadUs);
+    }
+}
+
+void loopTrackCatalog() {
+    // Scan query lost, refused or never queued: move on without it
+    if (trackCatalog.state == TRACK_CATALOG_SCANNING && catalogQuery != 0) {
+        if (!catalogQueryQueued) {
+            sendTrackCatalogQuery(catalogQuery, catalogQueryFolder);
+        } else if (millis() - catalogQuerySince >= TRACK_CATALOG_QUERY_TIMEOUT) {
+            trackCatalogStats.queryTimeouts++;
+            takeTrackCatalogReply(0);
+        }
+    }
+    
+    // Length of every track that played to its end
+    const MP3PlaybackStats& playback = getMP3PlaybackStats();
+    if (playback.finished != catalogFinishedSeen) {
+        catalogFinishedSeen = playback.finished;
+        recordTrackDuration(getMP3Playback().lastTrack, getMP3Playback().lastDurationMs);
+    }
+    
+    // Learned lengths written between strikes, now and then
+    if (catalogDirty && !isPlaying() &&
+        (catalogSavedAt == 0 || millis() - catalogSavedAt >= TRACK_CATALOG_SAVE_INTERVAL)) {
+        saveTrackCatalog();
+    }
+}
+
+void rescanTrackCatalog() {
+    if (trackCatalog.state == TRACK_CATALOG_SCANNING) {
+        return;
+    }
+    catalogCardChanged = true;
+    queryMP3TrackCount();
+}
+
+bool isTrackAvailable(uint16_t track) {
+    // Only a catalog that is known can rule a track out
+    if (track < 1 || track > MP3_MAX_TRACK) {
+        return false;
+    }
+    if (trackCatalog.state == TRACK_CATALOG_CACHED || trackCatalog.state == TRACK_CATALOG_VALID) {
+        return track <= trackCatalog.mp3Tracks;
+    }
+    return true;
+}
+
+uint32_t getTrackDuration(uint16_t track) {
+    if (track < 1 || track > TRACK_CATALOG_MAX_TRACKS || track > trackCatalog.mp3Tracks) {
+        return 0;
+    }
+    return trackCatalog.durations[track - 1] * TRACK_CATALOG_DURATION_UNIT;
+}
+
+const TrackCatalog& getTrackCatalog() {
+    return trackCatalog;
+}
+
+const TrackCatalogStats& getTrackCatalogStats() {
+    return trackCatalogStats;
+}
+
+String getTrackCatalogJSON() {
+    DynamicJsonDocument doc(6144);
+    doc["state"] = trackCatalogStateNames[trackCatalog.state];
+    doc["files"] = trackCatalog.totalTracks;
+    doc["tracks"] = trackCatalog.mp3Tracks;
+    
+    JsonArray folders = doc.createNestedArray("folders");
+    for (uint8_t i = 0; i < trackCatalog.folderCount; i++) {
+        folders.add(trackCatalog.folderTracks[i]);
+    }
+    
+    // Lengths of /mp3 tracks 1, 2, ...; 0 until the track has played to its end
+    JsonArray lengths = doc.createNestedArray("length_ms");
+    uint16_t count = min(trackCatalog.mp3Tracks, (uint16_t)TRACK_CATALOG_MAX_TRACKS);
+    for (uint16_t i = 0; i < count; i++) {
+        lengths.add(trackCatalog.durations[i] * TRACK_CATALOG_DURATION_UNIT);
+    }
+    
+    JsonObject stats = doc.createNestedObject("stats");
+    stats["load_us"] = trackCatalogStats.loadUs;
+    stats["scans"] = trackCatalogStats.scans;
+    stats["queries"] = trackCatalogStats.queries;
+    stats["query_timeouts"] = trackCatalogStats.queryTimeouts;
+    stats["last_scan_ms"] = trackCatalogStats.lastScanMs;
+    stats["lengths_learned"] = trackCatalogStats.lengthsLearned;
+    stats["saves"] = trackCatalogStats.saves;
+    stats["rejected"] = trackCatalogStats.rejected;
+    
+    String result;
+    serializeJson(doc, result);
+    return result;
+}
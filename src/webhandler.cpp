@@ -1,6 +1,18 @@
 #include "webhandler.h"
+#include "lorahandler.h"
+#include "loraota.h"
+#include "loracapture.h"
+#include "mp3handler.h"
+#include "tasks.h"
+#include "eventbus.h"
+#include "logger.h"
+#include "profiler.h"
+#include "powermanager.h"
+#include "configstore.h"
+#include "boot.h"
 #include <WiFi.h>
 #include <ArduinoJson.h>
+#include <StreamString.h>
 
 // WiFi credentials
 const char* ap_ssid = "GonggonG";
@@ -10,43 +22,89 @@ const char* ap_password = "vipassana";
 WiFiConfig wifiConfig;
 bool apMode = false;
 unsigned long wifiStartTime = 0;
+int8_t wifiStatePublished = -1;
+
+// Firmware package upload in progress
+File otaUploadFile;
+bool otaUploadRejected = false;
 
 // Web server instance
 WebServer server(WEB_SERVER_PORT);
 
 void setupWiFi() {
-    // Load WiFi configuration from SPIFFS
+    // Load WiFi configuration from gong.conf
     if (loadWiFiConfig() && wifiConfig.configured) {
         WiFi.mode(WIFI_STA);
         WiFi.begin(wifiConfig.ssid, wifiConfig.password);
         wifiStartTime = millis();
         
-        Serial.println("Connecting to WiFi...");
-        Serial.printf("SSID: %s\n", wifiConfig.ssid);
+        LOG_INFO(LOG_MODULE_WEB, "Connecting to WiFi...");
+        LOG_INFO(LOG_MODULE_WEB, "SSID: %s", wifiConfig.ssid);
     } else {
-        Serial.println("No WiFi configuration found, starting AP mode");
+        LOG_INFO(LOG_MODULE_WEB, "No WiFi configuration found, starting AP mode");
         setupAPMode();
     }
 }
 
+// REST handlers are timed as the http profile section, labelled with their
+// route, and keep the node at full speed with WiFi awake for the UI
+void onRoute(const char* uri, HTTPMethod method, void (*handler)()) {
+    server.on(uri, method, [uri, handler]() {
+        holdPowerUi();
+        uint32_t start = getProfileCycles();
+        handler();
+        endProfileSection(PROFILE_HTTP, start, uri);
+    });
+}
+
 void setupWebServer() {
     // Set up API endpoints
-    server.on("/", HTTP_GET, handleRoot);
-    server.on("/schedule", HTTP_GET, handleSchedule);
-    server.on("/schedule", HTTP_POST, handleAddSchedule);
-    server.on("/schedule", HTTP_PUT, handleEditSchedule);
-    server.on("/schedule", HTTP_DELETE, handleDeleteSchedule);
+    onRoute("/", HTTP_GET, handleRoot);
+    onRoute("/schedule", HTTP_GET, handleSchedule);
+    onRoute("/schedule", HTTP_POST, handleAddSchedule);
+    onRoute("/schedule", HTTP_PUT, handleEditSchedule);
+    onRoute("/schedule", HTTP_DELETE, handleDeleteSchedule);
     
     // Add specific ID-based routes for better REST API support
-    server.on("/schedule/", HTTP_PUT, handleEditScheduleById);
-    server.on("/schedule/", HTTP_DELETE, handleDeleteScheduleById);
+    onRoute("/schedule/", HTTP_PUT, handleEditScheduleById);
+    onRoute("/schedule/", HTTP_DELETE, handleDeleteScheduleById);
     
-    server.on("/play", HTTP_POST, handlePlay);
-    server.on("/play-lora", HTTP_POST, handlePlayLoRa);
-    server.on("/wifi-config", HTTP_GET, handleWiFiConfig);
-    server.on("/wifi-save", HTTP_POST, handleWiFiSave);
-    server.on("/wifi-reset", HTTP_POST, handleWiFiReset);
-    server.on("/wifi-status", HTTP_GET, handleWiFiStatus);
+    onRoute("/play", HTTP_POST, handlePlay);
+    onRoute("/play-lora", HTTP_POST, handlePlayLoRa);
+    onRoute("/stop", HTTP_POST, handleStop);
+    onRoute("/volume", HTTP_GET, handleVolume);
+    onRoute("/volume", HTTP_POST, handleSetVolume);
+    onRoute("/wifi-config", HTTP_GET, handleWiFiConfig);
+    onRoute("/wifi-save", HTTP_POST, handleWiFiSave);
+    onRoute("/wifi-reset", HTTP_POST, handleWiFiReset);
+    onRoute("/wifi-status", HTTP_GET, handleWiFiStatus);
+    onRoute("/sync", HTTP_GET, handleSyncStatus);
+    onRoute("/nodes", HTTP_GET, handleNodes);
+    onRoute("/lora-stats", HTTP_GET, handleLoRaStats);
+    // Uploads call their handler once per chunk, so they are not timed as one call
+    server.on("/ota-upload", HTTP_POST, handleOtaUploadDone, handleOtaUpload);
+    onRoute("/ota-start", HTTP_POST, handleOtaStart);
+    onRoute("/ota-cancel", HTTP_POST, handleOtaCancel);
+    onRoute("/ota", HTTP_GET, handleOtaStatus);
+    onRoute("/lora-capture", HTTP_GET, handleLoRaCapture);
+    onRoute("/lora-capture", HTTP_POST, handleLoRaCaptureControl);
+    onRoute("/mp3", HTTP_GET, handleMP3Status);
+    onRoute("/programs", HTTP_GET, handleGongPrograms);
+    onRoute("/synth", HTTP_GET, handleGongSynth);
+    onRoute("/tracks", HTTP_GET, handleTracks);
+    onRoute("/tracks", HTTP_POST, handleTracksRescan);
+    onRoute("/tasks", HTTP_GET, handleTasks);
+    onRoute("/events", HTTP_GET, handleEvents);
+    onRoute("/log", HTTP_GET, handleLog);
+    onRoute("/log-config", HTTP_GET, handleLogConfig);
+    onRoute("/log-config", HTTP_POST, handleLogConfigSave);
+    onRoute("/profile", HTTP_GET, handleProfile);
+    onRoute("/profile", HTTP_POST, handleProfileReset);
+    onRoute("/power", HTTP_GET, handlePower);
+    onRoute("/boot", HTTP_GET, handleBoot);
+    onRoute("/health", HTTP_GET, handleHealth);
+    onRoute("/config", HTTP_GET, handleConfig);
+    onRoute("/config", HTTP_POST, handleConfigSave);
     
     // Handle not found
     server.onNotFound(handleNotFound);
@@ -56,10 +114,21 @@ void setupWebServer() {
     
     // Start server
     server.begin();
-    Serial.println("Web server started");
+    LOG_INFO(LOG_MODULE_WEB, "Web server started");
+}
+
+void publishWiFiState() {
+    int8_t state = apMode ? EVENT_WIFI_AP
+                 : WiFi.status() == WL_CONNECTED ? EVENT_WIFI_CONNECTED : EVENT_WIFI_CONNECTING;
+    if (state != wifiStatePublished) {
+        wifiStatePublished = state;
+        publishEvent(EVENT_WIFI_STATE, EVENT_SOURCE_WEB, state);
+    }
 }
 
 void loopWebServer() {
+    publishWiFiState();
+    
     // Check WiFi connection status
     if (!apMode) {
         if (WiFi.status() == WL_CONNECTED) {
@@ -67,7 +136,7 @@ void loopWebServer() {
             server.handleClient();
         } else if (millis() - wifiStartTime > WIFI_TIMEOUT) {
             // WiFi connection failed, switch to AP mode
-            Serial.println("WiFi connection failed, switching to AP mode");
+            LOG_ERROR(LOG_MODULE_WEB, "WiFi connection failed, switching to AP mode");
             setupAPMode();
         }
     } else {
@@ -82,10 +151,10 @@ void setupAPMode() {
     
     if (result) {
         apMode = true;
-        Serial.printf("AP started: %s\n", ap_ssid);
-        Serial.printf("AP IP: %s\n", WiFi.softAPIP().toString().c_str());
+        LOG_INFO(LOG_MODULE_WEB, "AP started: %s", ap_ssid);
+        LOG_INFO(LOG_MODULE_WEB, "AP IP: %s", WiFi.softAPIP().toString().c_str());
     } else {
-        Serial.println("AP start failed!");
+        LOG_ERROR(LOG_MODULE_WEB, "AP start failed!");
     }
 }
 
@@ -108,6 +177,13 @@ void handleSchedule() {
     }
 }
 
+bool hasScheduleTracks(const String& program) {
+    if (program.length() > 0) {
+        return hasGongProgramTracks(program);
+    }
+    return isGongSynthEnabled() || isTrackAvailable(MP3_GONG_TRACK);
+}
+
 void handleAddSchedule() {
     if (server.method() == HTTP_POST) {
         String body = server.arg("plain");
@@ -123,8 +199,17 @@ void handleAddSchedule() {
         uint8_t hour = doc["hour"] | 0;
         uint8_t minute = doc["minute"] | 0;
         String description = doc["description"] | "";
+        uint32_t zones = parseLoRaZones(doc["zones"]);
+        String program = doc["program"] | "";
+        uint8_t volume = doc["volume"] | 0;
+        uint16_t fadeIn = doc["fade_in"] | 0;        
+        // Only tracks the card has: the program's, or the gong's
+        if (!hasScheduleTracks(program)) {
+            server.send(400, "application/json", "{\"success\":false,\"message\":\"Track not on the card\"}");
+            return;
+        }
         
-        if (addScheduleEntry(hour, minute, description)) {
+        if (addScheduleEntry(hour, minute, description, zones, program, volume, fadeIn)) {
             server.send(200, "application/json", "{\"success\":true,\"message\":\"Schedule added\"}");
         } else {
             server.send(400, "application/json", "{\"success\":false,\"message\":\"Failed to add schedule\"}");
@@ -149,8 +234,17 @@ void handleEditSchedule() {
         uint8_t minute = doc["minute"] | 0;
         String description = doc["description"] | "";
         bool enabled = doc["enabled"] | true;
+        uint32_t zones = parseLoRaZones(doc["zones"]);
+        String program = doc["program"] | "";
+        uint8_t volume = doc["volume"] | 0;
+        uint16_t fadeIn = doc["fade_in"] | 0;        
+        // Only tracks the card has: the program's, or the gong's
+        if (!hasScheduleTracks(program)) {
+            server.send(400, "application/json", "{\"success\":false,\"message\":\"Track not on the card\"}");
+            return;
+        }
         
-        if (editScheduleEntry(id, hour, minute, description, enabled)) {
+        if (editScheduleEntry(id, hour, minute, description, enabled, zones, program, volume, fadeIn)) {
             server.send(200, "application/json", "{\"success\":true,\"message\":\"Schedule updated\"}");
         } else {
             server.send(400, "application/json", "{\"success\":false,\"message\":\"Failed to update schedule\"}");
@@ -185,8 +279,17 @@ void handleEditScheduleById() {
         uint8_t minute = doc["minute"] | 0;
         String description = doc["description"] | "";
         bool enabled = doc["enabled"] | true;
+        uint32_t zones = parseLoRaZones(doc["zones"]);
+        String program = doc["program"] | "";
+        uint8_t volume = doc["volume"] | 0;
+        uint16_t fadeIn = doc["fade_in"] | 0;        
+        // Only tracks the card has: the program's, or the gong's
+        if (!hasScheduleTracks(program)) {
+            server.send(400, "application/json", "{\"success\":false,\"message\":\"Track not on the card\"}");
+            return;
+        }
         
-        if (editScheduleEntry(id, hour, minute, description, enabled)) {
+        if (editScheduleEntry(id, hour, minute, description, enabled, zones, program, volume, fadeIn)) {
             server.send(200, "application/json", "{\"success\":true,\"message\":\"Schedule updated\"}");
         } else {
             server.send(400, "application/json", "{\"success\":false,\"message\":\"Failed to update schedule\"}");
@@ -230,14 +333,120 @@ void handleDeleteScheduleById() {
 
 void handlePlay() {
     if (server.method() == HTTP_POST) {
-        playGong();
+        // Optional ?program=name runs a gong program instead
+        if (server.hasArg("program")) {
+            int8_t program = findGongProgramIndex(server.arg("program"));
+            if (program < 0) {
+                server.send(400, "application/json", "{\"success\":false,\"message\":\"Unknown program\"}");
+            } else if (!publishEvent(EVENT_GONG_REQUESTED, EVENT_SOURCE_WEB, program + 1)) {
+                server.send(503, "application/json", "{\"success\":false,\"message\":\"Audio queue full\"}");
+            } else {
+                server.send(200, "application/json", "{\"success\":true,\"message\":\"Gong program started\"}");
+            }
+            return;
+        }
+        
+        // Optional ?track=n plays that track from /mp3, if the card has it
+        if (server.hasArg("track")) {
+            int track = server.arg("track").toInt();
+            if (!isTrackAvailable(track)) {
+                server.send(400, "application/json", "{\"success\":false,\"message\":\"Track not on the card\"}");
+                return;
+            }
+            if (!postAudioRequest(AUDIO_REQUEST_TRACK, track)) {
+                server.send(503, "application/json", "{\"success\":false,\"message\":\"Audio queue full\"}");
+                return;
+            }
+            server.send(200, "application/json", "{\"success\":true,\"message\":\"Track played locally\"}");
+            return;
+        }
+        
+        // Optional ?strikes=3 rings the gong that many times back to back
+        int strikes = server.hasArg("strikes") ? server.arg("strikes").toInt() : 1;
+        if (strikes < 1 || strikes > MP3_MAX_STRIKES) {
+            server.send(400, "application/json", "{\"success\":false,\"message\":\"Invalid strikes\"}");
+            return;
+        }
+        // A single strike goes to the synthesizer when it is enabled
+        bool posted = strikes == 1 ? publishEvent(EVENT_GONG_REQUESTED, EVENT_SOURCE_WEB) :
+                                     postAudioRequest(AUDIO_REQUEST_STRIKES, strikes);
+        if (!posted) {
+            server.send(503, "application/json", "{\"success\":false,\"message\":\"Audio queue full\"}");
+            return;
+        }
         server.send(200, "application/json", "{\"success\":true,\"message\":\"Gong played locally\"}");
     }
 }
 
+void handleStop() {
+    if (server.method() == HTTP_POST) {
+        // Optional ?fade=2000 fades the gong out over that many ms instead of cutting it
+        uint32_t fade = server.hasArg("fade") ? server.arg("fade").toInt() : 0;
+        if (!postAudioRequest(AUDIO_REQUEST_STOP, 0, fade)) {
+            server.send(503, "application/json", "{\"success\":false,\"message\":\"Audio queue full\"}");
+            return;
+        }
+        server.send(200, "application/json", "{\"success\":true,\"message\":\"Playback stopped\"}");
+    }
+}
+
+void handleVolume() {
+    if (server.method() == HTTP_GET) {
+        server.send(200, "application/json", getVolumeProfileJSON());
+    }
+}
+
+void handleSetVolume() {
+    if (server.method() == HTTP_POST) {
+        // ?level=0-30, optionally ramped over ?fade=ms
+        int level = server.hasArg("level") ? server.arg("level").toInt() : -1;
+        if (level < 0 || level > MP3_MAX_VOLUME) {
+            server.send(400, "application/json", "{\"success\":false,\"message\":\"Invalid level\"}");
+            return;
+        }
+        uint32_t fade = server.hasArg("fade") ? server.arg("fade").toInt() : 0;
+        if (!postAudioRequest(AUDIO_REQUEST_VOLUME, level, fade)) {
+            server.send(503, "application/json", "{\"success\":false,\"message\":\"Audio queue full\"}");
+            return;
+        }
+        server.send(200, "application/json", "{\"success\":true,\"message\":\"Volume set\"}");
+    }
+}
+
 void handlePlayLoRa() {
     if (server.method() == HTTP_POST) {
-        sendGongLoRa();
+        if (!isLoRaReady()) {
+            server.send(503, "application/json", "{\"success\":false,\"message\":\"LoRa radio not available\"}");
+            return;
+        }
+        
+        // Optional ?zones=1,3 rings only those zones
+        uint32_t zones = LORA_ZONE_ALL;
+        if (server.hasArg("zones")) {
+            zones = 0;
+            String list = server.arg("zones");
+            int start = 0;
+            while (start < (int)list.length()) {
+                int end = list.indexOf(',', start);
+                if (end < 0) {
+                    end = list.length();
+                }
+                int zone = list.substring(start, end).toInt();
+                if (zone >= 1 && zone <= LORA_MAX_ZONES) {
+                    zones |= 1UL << (zone - 1);
+                }
+                start = end + 1;
+            }
+            if (zones == 0) {
+                server.send(400, "application/json", "{\"success\":false,\"message\":\"Invalid zones\"}");
+                return;
+            }
+        }
+        
+        if (!postRadioRequest(RADIO_REQUEST_GONG, 0, zones)) {
+            server.send(503, "application/json", "{\"success\":false,\"message\":\"Radio queue full\"}");
+            return;
+        }
         server.send(200, "application/json", "{\"success\":true,\"message\":\"Gong sent via LoRa\"}");
     }
 }
@@ -278,11 +487,7 @@ void handleWiFiSave() {
         }
         
         if (saveWiFiConfig(ssid, password)) {
-            server.send(200, "application/json", "{\"success\":true,\"message\":\"WiFi configuration saved. Device will restart to connect.\"}");
-            
-            // Restart after a short delay to apply new WiFi settings
-            delay(1000);
-            ESP.restart();
+            server.send(200, "application/json", "{\"success\":true,\"message\":\"WiFi configuration saved, connecting.\"}");
         } else {
             server.send(500, "application/json", "{\"success\":false,\"message\":\"Failed to save WiFi configuration\"}");
         }
@@ -291,12 +496,11 @@ void handleWiFiSave() {
 
 void handleWiFiReset() {
     if (server.method() == HTTP_POST) {
-        resetWiFiConfig();
-        server.send(200, "application/json", "{\"success\":true,\"message\":\"WiFi configuration reset. Device will restart.\"}");
-        
-        // Restart after a short delay
-        delay(1000);
-        ESP.restart();
+        if (!resetWiFiConfig()) {
+            server.send(500, "application/json", "{\"success\":false,\"message\":\"Failed to reset WiFi configuration\"}");
+            return;
+        }
+        server.send(200, "application/json", "{\"success\":true,\"message\":\"WiFi configuration reset, starting the access point.\"}");
     }
 }
 
@@ -317,6 +521,262 @@ void handleWiFiStatus() {
     }
 }
 
+void handleSyncStatus() {
+    if (server.method() == HTTP_GET) {
+        server.send(200, "application/json", getScheduleSyncJSON());
+    }
+}
+
+void handleNodes() {
+    if (server.method() == HTTP_GET) {
+        server.send(200, "application/json", getNodeTableJSON());
+    }
+}
+
+void handleLoRaStats() {
+    if (server.method() == HTTP_GET) {
+        server.send(200, "application/json", getLoRaStatsJSON());
+    }
+}
+
+void handleOtaUpload() {
+    // Package from tools/otapack.py, streamed to SPIFFS; kept while a distribution reads it
+    HTTPUpload& upload = server.upload();
+    if (upload.status == UPLOAD_FILE_START) {
+        otaUploadRejected = isLoRaOtaActive();
+        if (!otaUploadRejected) {
+            otaUploadFile = SPIFFS.open(OTA_PACKAGE_FILE, "w");
+        }
+    } else if (upload.status == UPLOAD_FILE_WRITE) {
+        if (otaUploadFile && otaUploadFile.write(upload.buf, upload.currentSize) != upload.currentSize) {
+            otaUploadRejected = true;
+        }
+    } else if (otaUploadFile) {
+        otaUploadFile.close();
+    }
+}
+
+void handleOtaUploadDone() {
+    if (server.method() == HTTP_POST) {
+        if (otaUploadRejected) {
+            server.send(409, "application/json", "{\"success\":false,\"message\":\"Distribution running or SPIFFS full\"}");
+        } else {
+            server.send(200, "application/json", "{\"success\":true,\"message\":\"Firmware package stored\"}");
+        }
+    }
+}
+
+void handleOtaStart() {
+    if (server.method() == HTTP_POST) {
+        // Started by the radio task; GET /ota shows whether the package was accepted
+        if (postRadioRequest(RADIO_REQUEST_OTA_START)) {
+            server.send(200, "application/json", "{\"success\":true,\"message\":\"Firmware distribution requested\"}");
+        } else {
+            server.send(503, "application/json", "{\"success\":false,\"message\":\"Radio queue full\"}");
+        }
+    }
+}
+
+void handleOtaCancel() {
+    if (server.method() == HTTP_POST) {
+        if (!postRadioRequest(RADIO_REQUEST_OTA_CANCEL)) {
+            server.send(503, "application/json", "{\"success\":false,\"message\":\"Radio queue full\"}");
+            return;
+        }
+        server.send(200, "application/json", "{\"success\":true,\"message\":\"Firmware distribution cancelled\"}");
+    }
+}
+
+void handleOtaStatus() {
+    if (server.method() == HTTP_GET) {
+        server.send(200, "application/json", getLoRaOtaJSON());
+    }
+}
+
+void handleLoRaCapture() {
+    if (server.method() == HTTP_GET) {
+        // One copy of the ring, streamed block by block: the radio task keeps capturing meanwhile, and
+        // the length sent up front must match the body
+        LoRaCaptureSnapshot snapshot;
+        if (!takeLoRaCaptureSnapshot(snapshot)) {
+            server.send(503, "application/json", "{\"success\":false,\"message\":\"Out of memory\"}");
+            return;
+        }
+        server.sendHeader("Content-Disposition", "attachment; filename=\"lora.pcapng\"");
+        server.setContentLength(getLoRaCaptureSize(snapshot));
+        server.send(200, "application/x-pcapng", "");
+        WiFiClient client = server.client();
+        exportLoRaCapture(snapshot, client, getCurrentEpoch());
+        releaseLoRaCaptureSnapshot(snapshot);
+    }
+}
+
+void handleLoRaCaptureControl() {
+    if (server.method() == HTTP_POST) {
+        DynamicJsonDocument doc(128);
+        if (deserializeJson(doc, server.arg("plain"))) {
+            server.send(400, "text/plain", "Invalid JSON");
+            return;
+        }
+        
+        bool posted = true;
+        if (doc["clear"] | false) {
+            posted = postRadioRequest(RADIO_REQUEST_CAPTURE_CLEAR);
+        }
+        if (doc.containsKey("enabled")) {
+            posted = postRadioRequest(RADIO_REQUEST_CAPTURE, doc["enabled"].as<bool>() ? 1 : 0) && posted;
+        }
+        if (!posted) {
+            server.send(503, "application/json", "{\"success\":false,\"message\":\"Radio queue full\"}");
+            return;
+        }
+        server.send(200, "application/json", "{\"success\":true,\"message\":\"Capture updated\"}");
+    }
+}
+
+void handleMP3Status() {
+    if (server.method() == HTTP_GET) {
+        server.send(200, "application/json", getMP3StatusJSON());
+    }
+}
+
+void handleGongPrograms() {
+    if (server.method() == HTTP_GET) {
+        server.send(200, "application/json", getGongProgramsJSON());
+    }
+}
+
+void handleGongSynth() {
+    if (server.method() == HTTP_GET) {
+        server.send(200, "application/json", getGongSynthJSON());
+    }
+}
+
+void handleTracks() {
+    if (server.method() == HTTP_GET) {
+        server.send(200, "application/json", getTrackCatalogJSON());
+    }
+}
+
+void handleTracksRescan() {
+    if (server.method() == HTTP_POST) {
+        // The track count query starts the scan; GET /tracks shows its progress
+        if (!postAudioRequest(AUDIO_REQUEST_RESCAN)) {
+            server.send(503, "application/json", "{\"success\":false,\"message\":\"Audio queue full\"}");
+            return;
+        }
+        server.send(200, "application/json", "{\"success\":true,\"message\":\"Track scan started\"}");
+    }
+}
+
+void handleTasks() {
+    if (server.method() == HTTP_GET) {
+        server.send(200, "application/json", getTasksJSON());
+    }
+}
+
+void handleEvents() {
+    if (server.method() == HTTP_GET) {
+        server.send(200, "application/json", getEventBusJSON());
+    }
+}
+
+void handleLog() {
+    if (server.method() == HTTP_GET) {
+        // ?previous=1: the records kept from before the last reset
+        StreamString text;
+        exportLog(text, server.arg("previous") == "1");
+        server.send(200, "text/plain", text);
+    }
+}
+
+void handleLogConfig() {
+    if (server.method() == HTTP_GET) {
+        server.send(200, "application/json", getLogConfigJSON());
+    }
+}
+
+void handleLogConfigSave() {
+    if (server.method() == HTTP_POST) {
+        DynamicJsonDocument doc(1024);
+        if (deserializeJson(doc, server.arg("plain"))) {
+            server.send(400, "text/plain", "Invalid JSON");
+            return;
+        }
+        
+        // {"<module>": "<level>", ...}; until the next boot or change to the "log" section, gong.conf is not changed
+        for (JsonPair item : doc.as<JsonObject>()) {
+            if (!setLogLevel(item.key().c_str(), item.value().as<const char*>())) {
+                server.send(400, "application/json", "{\"success\":false,\"message\":\"Unknown module or level\"}");
+                return;
+            }
+        }
+        server.send(200, "application/json", "{\"success\":true,\"message\":\"Log levels updated\"}");
+    }
+}
+
+void handleProfile() {
+    if (server.method() == HTTP_GET) {
+        // ?histograms=1 adds every section's buckets
+        server.send(200, "application/json", getProfileJSON(server.arg("histograms") == "1"));
+    }
+}
+
+void handleProfileReset() {
+    if (server.method() == HTTP_POST) {
+        resetProfiler();
+        server.send(200, "application/json", "{\"success\":true,\"message\":\"Profile reset\"}");
+    }
+}
+
+void handlePower() {
+    if (server.method() == HTTP_GET) {
+        server.send(200, "application/json", getPowerJSON());
+    }
+}
+
+void handleBoot() {
+    if (server.method() == HTTP_GET) {
+        server.send(200, "application/json", getBootJSON());
+    }
+}
+
+void handleHealth() {
+    if (server.method() == HTTP_GET) {
+        // For monitoring: a degraded node answers, but not with 200
+        server.send(isBootDegraded() ? 503 : 200, "application/json", getHealthJSON());
+    }
+}
+
+void handleConfig() {
+    if (server.method() == HTTP_GET) {
+        server.send(200, "application/json", getConfigJSON());
+    }
+}
+
+void handleConfigSave() {
+    if (server.method() == HTTP_POST) {
+        DynamicJsonDocument doc(CONFIG_DOC_SIZE);
+        if (deserializeJson(doc, server.arg("plain")) || !doc.is<JsonObject>()) {
+            server.send(400, "text/plain", "Invalid JSON");
+            return;
+        }
+        
+        // {"<section>": <as in gong.conf>, ...}; each module takes its section on its own task
+        String error;
+        if (!setConfig(doc.as<JsonObjectConst>(), error)) {
+            DynamicJsonDocument reply(256);
+            reply["success"] = false;
+            reply["message"] = error;
+            String result;
+            serializeJson(reply, result);
+            server.send(400, "application/json", result);
+            return;
+        }
+        server.send(200, "application/json", "{\"success\":true,\"message\":\"Configuration applied\"}");
+    }
+}
+
 void handleNotFound() {
     server.send(404, "text/plain", "Not found");
 }
@@ -325,6 +785,22 @@ bool isWiFiConnected() {
     return WiFi.status() == WL_CONNECTED;
 }
 
+bool isWiFiAPMode() {
+    return apMode;
+}
+
+bool isWiFiConfigured() {
+    return wifiConfig.configured;
+}
+
+bool setWiFiSleep(bool sleep) {
+    // Only a station can sleep between beacons; an access point keeps its receiver on
+    if (apMode || WiFi.getMode() != WIFI_STA) {
+        return false;
+    }
+    return WiFi.setSleep(sleep ? WIFI_PS_MAX_MODEM : WIFI_PS_NONE) && sleep;
+}
+
 String getWiFiStatus() {
     if (apMode) {
         return "AP Mode: " + String(ap_ssid);
@@ -336,91 +812,62 @@ String getWiFiStatus() {
 }
 
 // WiFi configuration functions
-bool loadWiFiConfig() {
-    // First try to load from gong.conf
-    if (SPIFFS.exists("/gong.conf")) {
-        File file = SPIFFS.open("/gong.conf", "r");
-        if (file) {
-            DynamicJsonDocument doc(1024);
-            DeserializationError error = deserializeJson(doc, file);
-            file.close();
-            
-            if (!error && doc.containsKey("wifi")) {
-                JsonObject wifi = doc["wifi"];
-                strlcpy(wifiConfig.ssid, wifi["ssid"] | "", sizeof(wifiConfig.ssid));
-                strlcpy(wifiConfig.password, wifi["password"] | "", sizeof(wifiConfig.password));
-                wifiConfig.configured = wifi["configured"] | false;
-                
-                Serial.printf("WiFi config loaded from gong.conf: SSID=%s, configured=%s\n", 
-                             wifiConfig.ssid, wifiConfig.configured ? "true" : "false");
-                return true;
-            }
-        }
+const char* parseWiFiSettings(JsonVariantConst json, void* settings) {
+    WiFiConfig& wifi = *(WiFiConfig*)settings;
+    const char* ssid = json["ssid"] | "";
+    const char* password = json["password"] | "";
+    wifi.configured = json["configured"] | false;
+    if (strlen(ssid) >= sizeof(wifi.ssid) || strlen(password) >= sizeof(wifi.password)) {
+        return "ssid is 31 characters at most, password 63";
     }
-    
-    // Fallback to wifi.conf
-    if (SPIFFS.exists(WIFI_CONFIG_FILE)) {
-        File file = SPIFFS.open(WIFI_CONFIG_FILE, "r");
-        if (!file) {
-            Serial.println("Failed to open WiFi config file");
-            return false;
-        }
-        
-        DynamicJsonDocument doc(512);
-        DeserializationError error = deserializeJson(doc, file);
-        file.close();
-        
-        if (error) {
-            Serial.println("Failed to parse WiFi config file");
-            return false;
-        }
-        
-        strlcpy(wifiConfig.ssid, doc["ssid"] | "", sizeof(wifiConfig.ssid));
-        strlcpy(wifiConfig.password, doc["password"] | "", sizeof(wifiConfig.password));
-        wifiConfig.configured = doc["configured"] | false;
-        
-        Serial.printf("WiFi config loaded from wifi.conf: SSID=%s, configured=%s\n", 
-                     wifiConfig.ssid, wifiConfig.configured ? "true" : "false");
-        
-        return true;
+    if (wifi.configured && ssid[0] == '\0') {
+        return "configured without an ssid";
     }
-    
-    Serial.println("No WiFi config file found");
-    return false;
+    strlcpy(wifi.ssid, ssid, sizeof(wifi.ssid));
+    strlcpy(wifi.password, password, sizeof(wifi.password));
+    return nullptr;
+}
+
+bool loadWiFiConfig() {
+    // The "wifi" section of gong.conf, or wifi.conf where an earlier firmware left one
+    bool valid = loadConfigSection(CONFIG_SECTION_WIFI, &wifiConfig, sizeof(wifiConfig), parseWiFiSettings);
+    LOG_INFO(LOG_MODULE_WEB, "WiFi config: SSID=%s, configured=%s", wifiConfig.ssid,
+             wifiConfig.configured ? "true" : "false");
+    return valid;
+}
+
+void applyWiFiConfig() {
+    // After a change to the "wifi" section: the new network is joined, or the access point started
+    apMode = false;
+    WiFi.disconnect();
+    setupWiFi();
 }
 
 bool saveWiFiConfig(const String& ssid, const String& password) {
-    File file = SPIFFS.open(WIFI_CONFIG_FILE, "w");
-    if (!file) {
-        Serial.println("Failed to open WiFi config file for writing");
-        return false;
-    }
-    
+    // Into gong.conf; the web task then joins the network, see applyWiFiConfig()
     DynamicJsonDocument doc(512);
-    doc["ssid"] = ssid;
-    doc["password"] = password;
-    doc["configured"] = true;
-    
-    serializeJson(doc, file);
-    file.close();
-    
-    // Update local config
-    strlcpy(wifiConfig.ssid, ssid.c_str(), sizeof(wifiConfig.ssid));
-    strlcpy(wifiConfig.password, password.c_str(), sizeof(wifiConfig.password));
-    wifiConfig.configured = true;
+    doc["wifi"]["ssid"] = ssid;
+    doc["wifi"]["password"] = password;
+    doc["wifi"]["configured"] = true;
     
-    Serial.printf("WiFi config saved: SSID=%s\n", ssid.c_str());
+    String error;
+    if (!setConfig(doc.as<JsonObjectConst>(), error)) {
+        LOG_ERROR(LOG_MODULE_WEB, "WiFi config not saved: %s", error.c_str());
+        return false;
+    }
+    LOG_INFO(LOG_MODULE_WEB, "WiFi config saved: SSID=%s", ssid.c_str());
     return true;
 }
 
-void resetWiFiConfig() {
-    if (SPIFFS.exists(WIFI_CONFIG_FILE)) {
-        SPIFFS.remove(WIFI_CONFIG_FILE);
-    }
-    
-    wifiConfig.configured = false;
-    wifiConfig.ssid[0] = '\0';
-    wifiConfig.password[0] = '\0';
+bool resetWiFiConfig() {
+    DynamicJsonDocument doc(64);
+    doc.createNestedObject("wifi");
     
-    Serial.println("WiFi configuration reset");
+    String error;
+    if (!setConfig(doc.as<JsonObjectConst>(), error)) {
+        LOG_ERROR(LOG_MODULE_WEB, "WiFi config not reset: %s", error.c_str());
+        return false;
+    }
+    LOG_INFO(LOG_MODULE_WEB, "WiFi configuration reset");
+    return true;
 }
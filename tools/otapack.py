@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""Build a firmware package for LoRa distribution (see include/loraota.h).
+
+With --base, the package is a delta against the image the slaves run now:
+runs of the new image found anywhere in the old one become copy ops, the
+rest literals. Without it, the whole image goes out as literals. Either way
+the ops are zlib-compressed.
+
+    tools/otapack.py .pio/build/esp32dev/firmware.bin --base old-firmware.bin -o ota.pkg
+
+Upload the result with POST /ota-upload, then start with POST /ota-start.
+"""
+import argparse
+import hashlib
+import struct
+import sys
+import zlib
+
+MAGIC = b"GOTA"
+VERSION = 1
+FLAG_DELTA = 0x01
+BLOCK_SIZE = 200        # OTA_BLOCK_SIZE
+MAX_BLOCKS = 4096       # OTA_MAX_BLOCKS
+MATCH_SIZE = 32         # Base image indexed in chunks this long; shorter matches stay literal
+
+
+def app_digest(image):
+    """What esp_partition_get_sha256() reports for an app image."""
+    # Images built with a hash appended (header byte 23) report that hash
+    if len(image) > 64 and image[0] == 0xE9 and image[23] == 1:
+        return image[-32:]
+    return hashlib.sha256(image).digest()
+
+
+def delta_ops(new, base):
+    index = {}
+    for offset in range(0, len(base) - MATCH_SIZE + 1, MATCH_SIZE):
+        index.setdefault(base[offset:offset + MATCH_SIZE], offset)
+
+    ops = bytearray()
+    literal_start = 0
+    copied = 0
+
+    def flush_literal(end):
+        if end > literal_start:
+            ops.extend(b"L" + struct.pack("<I", end - literal_start) + new[literal_start:end])
+
+    position = 0
+    while position + MATCH_SIZE <= len(new):
+        offset = index.get(new[position:position + MATCH_SIZE])
+        if offset is None:
+            position += 1
+            continue
+
+        # Grow the match both ways
+        start = position
+        while start > literal_start and offset > 0 and new[start - 1] == base[offset - 1]:
+            start -= 1
+            offset -= 1
+        end = position + MATCH_SIZE
+        base_end = offset + (end - start)
+        while end < len(new) and base_end < len(base) and new[end] == base[base_end]:
+            end += 1
+            base_end += 1
+
+        flush_literal(start)
+        ops.extend(b"C" + struct.pack("<II", offset, end - start))
+        copied += end - start
+        literal_start = position = end
+
+    flush_literal(len(new))
+    return bytes(ops), copied
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build a LoRa firmware package")
+    parser.add_argument("image", help="new firmware image")
+    parser.add_argument("--base", help="image the slaves run now; builds a delta against it")
+    parser.add_argument("-o", "--output", default="ota.pkg")
+    args = parser.parse_args()
+
+    with open(args.image, "rb") as f:
+        new = f.read()
+    flags = 0
+    base_digest = bytes(32)
+    if args.base:
+        with open(args.base, "rb") as f:
+            base = f.read()
+        ops, copied = delta_ops(new, base)
+        flags |= FLAG_DELTA
+        base_digest = app_digest(base)
+    else:
+        ops = b"L" + struct.pack("<I", len(new)) + new
+        copied = 0
+
+    header = struct.pack("<4sBBHI", MAGIC, VERSION, flags, 0, len(new))
+    header += hashlib.sha256(new).digest() + app_digest(new) + base_digest
+    package = header + zlib.compress(ops, 9)
+
+    blocks = (len(package) + BLOCK_SIZE - 1) // BLOCK_SIZE
+    if blocks > MAX_BLOCKS:
+        sys.exit("package too large: %d blocks, at most %d" % (blocks, MAX_BLOCKS))
+    with open(args.output, "wb") as f:
+        f.write(package)
+
+    print("%s: %d-byte image, %d bytes copied from the base" % (args.image, len(new), copied))
+    print("%s: %d bytes, %d blocks (%.1f%% of the image)" % (args.output, len(package), blocks,
+                                                           100.0 * len(package) / len(new)))
+
+
+if __name__ == "__main__":
+    main()